@@ -25,6 +25,8 @@ static char *ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_set_shm_hugepages(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static char *ngx_load_module(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 #if (NGX_HAVE_DLOPEN)
 static void ngx_unload_module(void *data);
@@ -110,6 +112,20 @@ static ngx_command_t  ngx_core_commands[] = {
       0,
       NULL },
 
+    { ngx_string("reuseport_steering"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_core_conf_t, reuseport_steering),
+      NULL },
+
+    { ngx_string("worker_numa"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_core_conf_t, worker_numa),
+      NULL },
+
     { ngx_string("worker_rlimit_nofile"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_num_slot,
@@ -131,6 +147,27 @@ static ngx_command_t  ngx_core_commands[] = {
       offsetof(ngx_core_conf_t, shutdown_timeout),
       NULL },
 
+    { ngx_string("worker_slab_cache"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_core_conf_t, slab_cache),
+      NULL },
+
+    { ngx_string("worker_pool_cache"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      0,
+      offsetof(ngx_core_conf_t, pool_cache),
+      NULL },
+
+    { ngx_string("shm_hugepages"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_1MORE,
+      ngx_set_shm_hugepages,
+      0,
+      0,
+      NULL },
+
     { ngx_string("working_directory"),
       NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_str_slot,
@@ -1023,16 +1060,23 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
      *     ccf->cpu_affinity_auto = 0;
      *     ccf->cpu_affinity_n = 0;
      *     ccf->cpu_affinity = NULL;
+     *     ccf->numa = NULL;
+     *     ccf->worker_stats = 0;
      */
 
     ccf->daemon = NGX_CONF_UNSET;
     ccf->master = NGX_CONF_UNSET;
     ccf->privileged_agent = NGX_CONF_UNSET;
+    ccf->reuseport_steering = NGX_CONF_UNSET;
+    ccf->worker_numa = NGX_CONF_UNSET;
     ccf->timer_resolution = NGX_CONF_UNSET_MSEC;
     ccf->shutdown_timeout = NGX_CONF_UNSET_MSEC;
 
     ccf->worker_processes = NGX_CONF_UNSET;
     ccf->debug_points = NGX_CONF_UNSET;
+    ccf->slab_cache = NGX_CONF_UNSET;
+    ccf->pool_cache = NGX_CONF_UNSET_SIZE;
+    ccf->hugepages = NGX_CONF_UNSET_UINT;
 
     ccf->rlimit_nofile = NGX_CONF_UNSET;
     ccf->rlimit_core = NGX_CONF_UNSET;
@@ -1046,6 +1090,13 @@ ngx_core_module_create_conf(ngx_cycle_t *cycle)
         return NULL;
     }
 
+    if (ngx_array_init(&ccf->hugepages_zones, cycle->pool, 1,
+                       sizeof(ngx_core_hugepages_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
     return ccf;
 }
 
@@ -1063,6 +1114,49 @@ ngx_core_module_init_conf(ngx_cycle_t *cycle, void *conf)
 
     ngx_conf_init_value(ccf->worker_processes, 1);
     ngx_conf_init_value(ccf->debug_points, 0);
+    ngx_conf_init_value(ccf->slab_cache, 0);
+    ngx_conf_init_size_value(ccf->pool_cache, 0);
+    ngx_conf_init_uint_value(ccf->hugepages, NGX_SHM_HUGEPAGES_OFF);
+    ngx_conf_init_value(ccf->reuseport_steering, 0);
+    ngx_conf_init_value(ccf->worker_numa, 0);
+
+#if (NGX_HAVE_NUMA)
+
+    if (ccf->worker_numa
+        && ngx_numa_init(cycle->pool, cycle->log, &ccf->numa) != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
+
+#else
+
+    if (ccf->worker_numa) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"worker_numa\" is not supported "
+                      "on this platform, ignored");
+    }
+
+#endif
+
+#if (NGX_HAVE_REUSEPORT_CBPF && NGX_HAVE_CPU_AFFINITY)
+
+    if (ccf->reuseport_steering && ccf->cpu_affinity == NULL) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"reuseport_steering\" requires "
+                      "\"worker_cpu_affinity\", ignored");
+        ccf->reuseport_steering = 0;
+    }
+
+#else
+
+    if (ccf->reuseport_steering) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "\"reuseport_steering\" is not supported "
+                      "on this platform, ignored");
+        ccf->reuseport_steering = 0;
+    }
+
+#endif
 
 #if (NGX_HAVE_CPU_AFFINITY)
 
@@ -1413,6 +1507,13 @@ ngx_set_cpu_affinity(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
 ngx_cpuset_t *
 ngx_get_cpu_affinity(ngx_uint_t n)
+{
+    return ngx_get_cycle_cpu_affinity((ngx_cycle_t *) ngx_cycle, n);
+}
+
+
+ngx_cpuset_t *
+ngx_get_cycle_cpu_affinity(ngx_cycle_t *cycle, ngx_uint_t n)
 {
 #if (NGX_HAVE_CPU_AFFINITY)
     ngx_uint_t        i, j;
@@ -1421,10 +1522,20 @@ ngx_get_cpu_affinity(ngx_uint_t n)
 
     static ngx_cpuset_t  result;
 
-    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
-                                           ngx_core_module);
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
 
     if (ccf->cpu_affinity == NULL) {
+
+#if (NGX_HAVE_NUMA)
+
+        /* without explicit masks, workers are spread over NUMA nodes */
+
+        if (ccf->numa) {
+            return &ccf->numa->cpus[n % ccf->numa->nnodes];
+        }
+
+#endif
+
         return NULL;
     }
 
@@ -1494,6 +1605,61 @@ ngx_set_worker_processes(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_set_shm_hugepages(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_core_conf_t  *ccf = conf;
+
+    ngx_str_t             *value;
+    ngx_uint_t             i, hugepages;
+    ngx_core_hugepages_t  *hp;
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "on") == 0) {
+        hugepages = NGX_SHM_HUGEPAGES_ON;
+
+    } else if (ngx_strcmp(value[1].data, "auto") == 0) {
+        hugepages = NGX_SHM_HUGEPAGES_AUTO;
+
+    } else if (ngx_strcmp(value[1].data, "off") == 0) {
+        hugepages = NGX_SHM_HUGEPAGES_OFF;
+
+    } else {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid value \"%V\" in \"%V\" directive, "
+                           "it must be \"on\", \"off\" or \"auto\"",
+                           &value[1], &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    /* "shm_hugepages mode;" sets the default for all zones */
+
+    if (cf->args->nelts == 2) {
+
+        if (ccf->hugepages != NGX_CONF_UNSET_UINT) {
+            return "is duplicate";
+        }
+
+        ccf->hugepages = hugepages;
+
+        return NGX_CONF_OK;
+    }
+
+    for (i = 2; i < cf->args->nelts; i++) {
+        hp = ngx_array_push(&ccf->hugepages_zones);
+        if (hp == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        hp->name = value[i];
+        hp->hugepages = hugepages;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static char *
 ngx_load_module(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
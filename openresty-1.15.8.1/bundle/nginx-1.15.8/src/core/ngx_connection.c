@@ -95,6 +95,14 @@ ngx_create_listening(ngx_conf_t *cf, struct sockaddr *sockaddr,
 }
 
 
+#if (NGX_HAVE_REUSEPORT_CBPF && NGX_HAVE_CPU_AFFINITY)
+static ngx_int_t ngx_create_reuseport_steering(ngx_cycle_t *cycle,
+    struct sock_fprog *fprog);
+static ngx_uint_t ngx_reuseport_ordered(ngx_cycle_t *cycle,
+    ngx_listening_t *ls);
+#endif
+
+
 ngx_int_t
 ngx_clone_listening(ngx_cycle_t *cycle, ngx_listening_t *ls)
 {
@@ -720,6 +728,15 @@ ngx_configure_listening_sockets(ngx_cycle_t *cycle)
     struct accept_filter_arg   af;
 #endif
 
+#if (NGX_HAVE_REUSEPORT_CBPF && NGX_HAVE_CPU_AFFINITY)
+    ngx_uint_t                 ordered;
+    struct sock_fprog          steering;
+
+    if (ngx_create_reuseport_steering(cycle, &steering) != NGX_OK) {
+        steering.filter = NULL;
+    }
+#endif
+
     ls = cycle->listening.elts;
     for (i = 0; i < cycle->listening.nelts; i++) {
 
@@ -861,6 +878,46 @@ ngx_configure_listening_sockets(ngx_cycle_t *cycle)
             }
         }
 
+#if (NGX_HAVE_REUSEPORT_CBPF && NGX_HAVE_CPU_AFFINITY)
+
+        /* the program is shared by the whole group, set it once */
+
+        if (ls[i].reuseport && ls[i].worker == 0) {
+
+            ordered = ngx_reuseport_ordered(cycle, &ls[i]);
+
+            if (steering.filter && ordered) {
+                if (setsockopt(ls[i].fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                               &steering, sizeof(struct sock_fprog))
+                    == -1)
+                {
+                    ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                                  "setsockopt(SO_ATTACH_REUSEPORT_CBPF) "
+                                  "%V failed, ignored", &ls[i].addr_text);
+                }
+
+#ifdef SO_DETACH_REUSEPORT_BPF
+
+            } else if (ls[i].previous || ls[i].inherited
+                       || ls[i].reuseport_unordered)
+            {
+                value = 0;
+
+                if (setsockopt(ls[i].fd, SOL_SOCKET, SO_DETACH_REUSEPORT_BPF,
+                               (const void *) &value, sizeof(int))
+                    == -1
+                    && ngx_socket_errno != NGX_ENOENT)
+                {
+                    ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                                  "setsockopt(SO_DETACH_REUSEPORT_BPF) "
+                                  "%V failed, ignored", &ls[i].addr_text);
+                }
+#endif
+            }
+        }
+
+#endif
+
         /*
          * setting deferred mode should be last operation on socket,
          * because code may prematurely continue cycle on failure
@@ -1013,10 +1070,216 @@ ngx_configure_listening_sockets(ngx_cycle_t *cycle)
 #endif
     }
 
+#if (NGX_HAVE_REUSEPORT_CBPF && NGX_HAVE_CPU_AFFINITY)
+
+    if (steering.filter) {
+        ngx_free(steering.filter);
+    }
+
+#endif
+
     return;
 }
 
 
+#if (NGX_HAVE_REUSEPORT_CBPF && NGX_HAVE_CPU_AFFINITY)
+
+/*
+ * The program returns the index of the socket to pass a connection to
+ * within a reuseport group.  The sockets of a group join it in the order
+ * of workers, so the index of the worker bound to the CPU that handled
+ * the packet selects that worker's socket.  CPUs not bound to any worker
+ * get an index out of range, and the kernel uses its hash for them.
+ */
+
+static ngx_int_t
+ngx_create_reuseport_steering(ngx_cycle_t *cycle, struct sock_fprog *fprog)
+{
+    ngx_int_t            *map;
+    ngx_uint_t            cpu, n, w, identity;
+    ngx_cpuset_t         *mask;
+    ngx_core_conf_t      *ccf;
+    struct sock_filter   *code;
+
+    fprog->filter = NULL;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (!ccf->reuseport_steering) {
+        return NGX_OK;
+    }
+
+    map = ngx_alloc(CPU_SETSIZE * sizeof(ngx_int_t), cycle->log);
+    if (map == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        map[cpu] = -1;
+    }
+
+    for (w = 0; w < (ngx_uint_t) ccf->worker_processes; w++) {
+        mask = ngx_get_cycle_cpu_affinity(cycle, w);
+
+        if (mask == NULL) {
+            continue;
+        }
+
+        for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (map[cpu] == -1 && CPU_ISSET(cpu, mask)) {
+                map[cpu] = w;
+            }
+        }
+    }
+
+    /* 2 instructions per CPU, the load and the default return */
+
+    code = ngx_alloc((2 * CPU_SETSIZE + 2) * sizeof(struct sock_filter),
+                     cycle->log);
+    if (code == NULL) {
+        ngx_free(map);
+        return NGX_ERROR;
+    }
+
+    n = 0;
+    identity = 1;
+
+    code[n++] = (struct sock_filter)
+                    BPF_STMT(BPF_LD|BPF_W|BPF_ABS, SKF_AD_OFF + SKF_AD_CPU);
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+
+        if (map[cpu] == -1) {
+            continue;
+        }
+
+        if ((ngx_uint_t) map[cpu] != cpu) {
+            identity = 0;
+        }
+
+        code[n++] = (struct sock_filter)
+                        BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, cpu, 0, 1);
+        code[n++] = (struct sock_filter)
+                        BPF_STMT(BPF_RET|BPF_K, map[cpu]);
+    }
+
+    ngx_free(map);
+
+    if (n == 1) {
+        ngx_free(code);
+        return NGX_OK;
+    }
+
+    if (identity) {
+
+        /* CPU n runs worker n: the CPU number is the index itself */
+
+        n = 1;
+        code[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_A, 0);
+
+    } else {
+        code[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, 0xffffffff);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                   "reuseport steering program: %ui instructions%s",
+                   n, identity ? ", identity" : "");
+
+    fprog->len = n;
+    fprog->filter = code;
+
+    return NGX_OK;
+}
+
+
+/*
+ * The kernel keeps the sockets of a reuseport group in an array: a new
+ * socket is appended, and a closed one is replaced by the last one.
+ * When the number of workers shrinks, only the sockets beyond the new
+ * number are closed, so the remaining ones keep their indices.  But the
+ * sockets closed by the master stay in the group until the old workers
+ * exit, and the sockets of a group that grows meanwhile are appended
+ * after them: their indices no longer match the workers, for good.
+ * Such a group is left to the kernel hash until it is opened anew,
+ * that is, until a restart.  The sockets inherited on a binary upgrade
+ * are assumed to be in the order of workers.
+ */
+
+static ngx_uint_t
+ngx_reuseport_ordered(ngx_cycle_t *cycle, ngx_listening_t *ls)
+{
+    ngx_int_t         p;
+    ngx_uint_t        i, n, kept, opened, exiting;
+    ngx_core_conf_t  *ccf;
+    ngx_listening_t  *gls, *prev;
+
+    kept = 0;
+    opened = 0;
+
+    gls = cycle->listening.elts;
+    for (i = 0; i < cycle->listening.nelts; i++) {
+
+        if (!gls[i].reuseport
+            || gls[i].type != ls->type
+            || ngx_cmp_sockaddr(gls[i].sockaddr, gls[i].socklen,
+                                ls->sockaddr, ls->socklen, 1)
+               != NGX_OK)
+        {
+            continue;
+        }
+
+        if (gls[i].previous || gls[i].inherited) {
+            kept++;
+
+        } else {
+            opened++;
+        }
+    }
+
+    exiting = 0;
+
+    for (p = 0; p < ngx_last_process; p++) {
+        if (ngx_processes[p].pid != -1 && ngx_processes[p].exiting) {
+            exiting = 1;
+            break;
+        }
+    }
+
+    /* the sockets in the group before the new ones are appended */
+
+    prev = ls->previous;
+
+    if (prev && prev->reuseport) {
+        n = exiting ? prev->reuseport_held : prev->reuseport_socks;
+        ls->reuseport_unordered = prev->reuseport_unordered;
+
+    } else {
+        n = kept;
+    }
+
+    if (opened && n > kept && !ls->reuseport_unordered) {
+        ls->reuseport_unordered = 1;
+
+        ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                               ngx_core_module);
+
+        if (ccf->reuseport_steering) {
+            ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                          "the sockets of the old workers are still open, "
+                          "reuseport steering disabled for %V until restart",
+                          &ls->addr_text);
+        }
+    }
+
+    ls->reuseport_socks = kept + opened;
+    ls->reuseport_held = ngx_max(n, kept) + opened;
+
+    return !ls->reuseport_unordered;
+}
+
+#endif
+
+
 void
 ngx_close_listening_sockets(ngx_cycle_t *cycle)
 {
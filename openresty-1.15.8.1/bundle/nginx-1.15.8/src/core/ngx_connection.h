@@ -90,6 +90,13 @@ struct ngx_listening_s {
     int                 fastopen;
 #endif
 
+#if (NGX_HAVE_REUSEPORT_CBPF)
+    /* the reuseport group, kept in the socket of worker 0 */
+    ngx_uint_t          reuseport_socks;
+    ngx_uint_t          reuseport_held;
+    unsigned            reuseport_unordered:1;
+#endif
+
 };
 
 
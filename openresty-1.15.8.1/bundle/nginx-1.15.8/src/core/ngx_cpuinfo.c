@@ -9,6 +9,9 @@
 #include <ngx_core.h>
 
 
+ngx_uint_t  ngx_cpu_features;
+
+
 #if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
 
 
@@ -91,6 +94,10 @@ ngx_cpuinfo(void)
 
     ngx_cpuid(1, cpu);
 
+    if (cpu[3] & (1 << 20)) {
+        ngx_cpu_features |= NGX_CPU_SSE42;
+    }
+
     if (ngx_strcmp(vendor, "GenuineIntel") == 0) {
 
         switch ((cpu[0] & 0xf00) >> 8) {
@@ -102,10 +102,48 @@ uint32_t  ngx_crc32_table256[] = {
 uint32_t *ngx_crc32_table_short = ngx_crc32_table16;
 
 
+/*
+ * CRC32C, the Castagnoli polynomial, is computed by the crc32 instruction
+ * of SSE4.2 at up to 8 bytes per instruction; its table is only used
+ * on CPUs without it, and is built at startup
+ */
+
+static uint32_t ngx_crc32c_sw(uint32_t crc, u_char *p, size_t len);
+#if (NGX_HAVE_SSE42_CRC32)
+static uint32_t ngx_crc32c_sse42(uint32_t crc, u_char *p, size_t len);
+#endif
+
+
+static uint32_t  ngx_crc32c_table256[256];
+
+uint32_t (*ngx_crc32c_update)(uint32_t crc, u_char *p, size_t len)
+    = ngx_crc32c_sw;
+
+
 ngx_int_t
 ngx_crc32_table_init(void)
 {
-    void  *p;
+    void        *p;
+    uint32_t     c;
+    ngx_uint_t   i, k;
+
+    for (i = 0; i < 256; i++) {
+        c = i;
+
+        for (k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ 0x82f63b78 : c >> 1;
+        }
+
+        ngx_crc32c_table256[i] = c;
+    }
+
+    ngx_crc32c_update = ngx_crc32c_sw;
+
+#if (NGX_HAVE_SSE42_CRC32)
+    if (ngx_cpu_features & NGX_CPU_SSE42) {
+        ngx_crc32c_update = ngx_crc32c_sse42;
+    }
+#endif
 
     if (((uintptr_t) ngx_crc32_table_short
           & ~((uintptr_t) ngx_cacheline_size - 1))
@@ -127,3 +165,43 @@ ngx_crc32_table_init(void)
 
     return NGX_OK;
 }
+
+
+static uint32_t
+ngx_crc32c_sw(uint32_t crc, u_char *p, size_t len)
+{
+    while (len--) {
+        crc = ngx_crc32c_table256[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+
+#if (NGX_HAVE_SSE42_CRC32)
+
+__attribute__((target("sse4.2")))
+static uint32_t
+ngx_crc32c_sse42(uint32_t crc, u_char *p, size_t len)
+{
+    uint64_t  c, v;
+
+    c = crc;
+
+    while (len >= 8) {
+        ngx_memcpy(&v, p, 8);
+        c = __builtin_ia32_crc32di(c, v);
+        p += 8;
+        len -= 8;
+    }
+
+    crc = (uint32_t) c;
+
+    while (len--) {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    }
+
+    return crc;
+}
+
+#endif
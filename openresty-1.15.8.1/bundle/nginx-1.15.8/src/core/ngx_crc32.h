@@ -73,6 +73,21 @@ ngx_crc32_update(uint32_t *crc, u_char *p, size_t len)
     crc ^= 0xffffffff
 
 
+/*
+ * CRC32C uses a different polynomial, so it must not replace CRC32
+ * in anything stored or compared outside of a running binary
+ */
+
+extern uint32_t (*ngx_crc32c_update)(uint32_t crc, u_char *p, size_t len);
+
+
+static ngx_inline uint32_t
+ngx_crc32c(u_char *p, size_t len)
+{
+    return ngx_crc32c_update(0xffffffff, p, len) ^ 0xffffffff;
+}
+
+
 ngx_int_t ngx_crc32_table_init(void);
 
 
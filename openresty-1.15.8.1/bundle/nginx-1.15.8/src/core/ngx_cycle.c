@@ -13,9 +13,12 @@
 static void ngx_destroy_cycle_pools(ngx_conf_t *conf);
 static ngx_int_t ngx_init_zone_pool(ngx_cycle_t *cycle,
     ngx_shm_zone_t *shm_zone);
+static ngx_uint_t ngx_zone_hugepages(ngx_cycle_t *cycle, ngx_str_t *name);
+static ngx_uint_t ngx_zone_slab_cache(ngx_cycle_t *cycle, ngx_shm_zone_t *zn);
 static ngx_int_t ngx_test_lockfile(u_char *file, ngx_log_t *log);
 static void ngx_clean_old_cycles(ngx_event_t *ev);
 static void ngx_shutdown_timer_handler(ngx_event_t *ev);
+static ngx_msec_t ngx_cycle_phase_time(ngx_msec_t *start);
 
 
 volatile ngx_cycle_t  *ngx_cycle;
@@ -52,6 +55,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     ngx_listening_t     *ls, *nls;
     ngx_core_conf_t     *ccf, *old_ccf;
     ngx_core_module_t   *module;
+    ngx_msec_t           start, parse, init, files, shm, listen, modules;
     char                 hostname[NGX_MAXHOSTNAMELEN];
 
     ngx_timezone_update();
@@ -63,6 +67,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
 
     ngx_time_update();
 
+    start = ngx_current_msec;
+
 
     log = old_cycle->log;
 
@@ -278,6 +284,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         return NULL;
     }
 
+    parse = ngx_cycle_phase_time(&start);
+
     if (ngx_test_config && !ngx_quiet_mode) {
         ngx_log_stderr(0, "the configuration file %s syntax is ok",
                        cycle->conf_file.data);
@@ -306,6 +314,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         return cycle;
     }
 
+    init = ngx_cycle_phase_time(&start);
+
     ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
 
     if (ngx_test_config) {
@@ -401,6 +411,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     pool->log = &cycle->new_log;
 
 
+    files = ngx_cycle_phase_time(&start);
+
     /* create shared memory */
 
     part = &cycle->shared_memory.part;
@@ -457,6 +469,7 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
                 && !shm_zone[i].noreuse)
             {
                 shm_zone[i].shm.addr = oshm_zone[n].shm.addr;
+                shm_zone[i].shm.hugetlb = oshm_zone[n].shm.hugetlb;
 #if (NGX_WIN32)
                 shm_zone[i].shm.handle = oshm_zone[n].shm.handle;
 #endif
@@ -473,6 +486,13 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
             break;
         }
 
+        shm_zone[i].shm.hugepages = ngx_zone_hugepages(cycle,
+                                                       &shm_zone[i].shm.name);
+
+#if (NGX_HAVE_NUMA)
+        shm_zone[i].shm.interleave = ccf->numa ? ccf->numa->mask : 0;
+#endif
+
         if (ngx_shm_alloc(&shm_zone[i].shm) != NGX_OK) {
             goto failed;
         }
@@ -491,6 +511,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
     }
 
 
+    shm = ngx_cycle_phase_time(&start);
+
     /* handle the listening sockets */
 
     if (old_cycle->listening.nelts) {
@@ -613,6 +635,8 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         ngx_configure_listening_sockets(cycle);
     }
 
+    listen = ngx_cycle_phase_time(&start);
+
 
     /* commit the new cycle configuration */
 
@@ -627,6 +651,15 @@ ngx_init_cycle(ngx_cycle_t *old_cycle)
         exit(1);
     }
 
+    modules = ngx_cycle_phase_time(&start);
+
+    ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                  "configuration loaded in %Mms: parsing %Mms, "
+                  "init %Mms, files %Mms, shared memory %Mms, "
+                  "listening sockets %Mms, modules %Mms",
+                  parse + init + files + shm + listen + modules,
+                  parse, init, files, shm, listen, modules);
+
 
     /* close and delete stuff that lefts from an old cycle */
 
@@ -938,6 +971,20 @@ ngx_destroy_cycle_pools(ngx_conf_t *conf)
 }
 
 
+static ngx_msec_t
+ngx_cycle_phase_time(ngx_msec_t *start)
+{
+    ngx_msec_t  elapsed;
+
+    ngx_time_update();
+
+    elapsed = ngx_current_msec - *start;
+    *start = ngx_current_msec;
+
+    return elapsed;
+}
+
+
 static ngx_int_t
 ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
 {
@@ -949,6 +996,7 @@ ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
     if (zn->shm.exists) {
 
         if (sp == sp->addr) {
+            sp->cache_size = ngx_zone_slab_cache(cycle, zn);
             return NGX_OK;
         }
 
@@ -1000,10 +1048,65 @@ ngx_init_zone_pool(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
 
     ngx_slab_init(sp);
 
+    sp->cache_size = ngx_zone_slab_cache(cycle, zn);
+
     return NGX_OK;
 }
 
 
+static ngx_uint_t
+ngx_zone_slab_cache(ngx_cycle_t *cycle, ngx_shm_zone_t *zn)
+{
+    ngx_core_conf_t  *ccf;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (ccf->slab_cache <= 0) {
+        return 0;
+    }
+
+    /*
+     * a worker may keep about "worker_slab_cache" pages of chunks
+     * to itself, so the caches are not used in small zones where
+     * the chunks held by other workers could not be reclaimed
+     */
+
+    if (zn->shm.size / ngx_pagesize
+        < 8 * (size_t) ccf->slab_cache * ccf->worker_processes)
+    {
+        ngx_log_debug2(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                       "zone \"%V\" is too small for worker slab caches: %uz",
+                       &zn->shm.name, zn->shm.size);
+        return 0;
+    }
+
+    return ccf->slab_cache;
+}
+
+
+static ngx_uint_t
+ngx_zone_hugepages(ngx_cycle_t *cycle, ngx_str_t *name)
+{
+    ngx_uint_t             i;
+    ngx_core_conf_t       *ccf;
+    ngx_core_hugepages_t  *hp;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    hp = ccf->hugepages_zones.elts;
+
+    for (i = 0; i < ccf->hugepages_zones.nelts; i++) {
+        if (hp[i].name.len == name->len
+            && ngx_strncmp(hp[i].name.data, name->data, name->len) == 0)
+        {
+            return hp[i].hugepages;
+        }
+    }
+
+    return ccf->hugepages;
+}
+
+
 ngx_int_t
 ngx_create_pidfile(ngx_str_t *name, ngx_log_t *log)
 {
@@ -1159,6 +1262,10 @@ ngx_reopen_files(ngx_cycle_t *cycle, ngx_uid_t user)
     ngx_list_part_t  *part;
     ngx_open_file_t  *file;
 
+    /* the error log writer thread must not use the descriptors meanwhile */
+
+    ngx_log_async_suspend();
+
     part = &cycle->open_files.part;
     file = part->elts;
 
@@ -1271,6 +1378,8 @@ ngx_reopen_files(ngx_cycle_t *cycle, ngx_uid_t user)
         file[i].fd = fd;
     }
 
+    ngx_log_async_resume();
+
     (void) ngx_log_redirect_stderr(cycle);
 }
 
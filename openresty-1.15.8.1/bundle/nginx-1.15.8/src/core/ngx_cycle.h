@@ -96,6 +96,12 @@ struct ngx_cycle_s {
 };
 
 
+typedef struct {
+    ngx_str_t                 name;
+    ngx_uint_t                hugepages;
+} ngx_core_hugepages_t;
+
+
 typedef struct {
     ngx_flag_t                daemon;
     ngx_flag_t                master;
@@ -107,6 +113,15 @@ typedef struct {
     ngx_int_t                 worker_processes;
     ngx_int_t                 debug_points;
 
+    ngx_int_t                 slab_cache;
+    size_t                    pool_cache;
+
+    /* set by the modules that render the worker statistics */
+    ngx_uint_t                worker_stats;
+
+    ngx_uint_t                hugepages;
+    ngx_array_t               hugepages_zones;  /* ngx_core_hugepages_t */
+
     ngx_int_t                 rlimit_nofile;
     off_t                     rlimit_core;
 
@@ -116,6 +131,13 @@ typedef struct {
     ngx_uint_t                cpu_affinity_n;
     ngx_cpuset_t             *cpu_affinity;
 
+    ngx_flag_t                reuseport_steering;
+
+    ngx_flag_t                worker_numa;
+#if (NGX_HAVE_NUMA)
+    ngx_numa_t               *numa;
+#endif
+
     char                     *username;
     ngx_uid_t                 user;
     ngx_gid_t                 group;
@@ -144,6 +166,7 @@ void ngx_reopen_files(ngx_cycle_t *cycle, ngx_uid_t user);
 char **ngx_set_environment(ngx_cycle_t *cycle, ngx_uint_t *last);
 ngx_pid_t ngx_exec_new_binary(ngx_cycle_t *cycle, char *const *argv);
 ngx_cpuset_t *ngx_get_cpu_affinity(ngx_uint_t n);
+ngx_cpuset_t *ngx_get_cycle_cpu_affinity(ngx_cycle_t *cycle, ngx_uint_t n);
 ngx_shm_zone_t *ngx_shared_memory_add(ngx_conf_t *cf, ngx_str_t *name,
     size_t size, void *tag);
 void ngx_set_shutdown_timer(ngx_cycle_t *cycle);
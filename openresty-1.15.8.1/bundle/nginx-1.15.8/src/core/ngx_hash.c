@@ -606,6 +606,160 @@ ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
 }
 
 
+/*
+ * an exported hash is the number of buckets followed by the bucket
+ * offsets, 0 for empty buckets, and by the elements of the buckets
+ * in the bucket order, each bucket terminated by a NULL value;
+ * the offsets and the values are relative to the base of the file
+ */
+
+size_t
+ngx_hash_export_size(ngx_hash_t *hash)
+{
+    size_t           size;
+    ngx_uint_t       i;
+    ngx_hash_elt_t  *elt;
+
+    size = (hash->size + 1) * sizeof(void *);
+
+    for (i = 0; i < hash->size; i++) {
+        elt = hash->buckets[i];
+
+        if (elt == NULL) {
+            continue;
+        }
+
+        while (elt->value) {
+            elt = (ngx_hash_elt_t *) ngx_align_ptr(&elt->name[0] + elt->len,
+                                                   sizeof(void *));
+        }
+
+        size += (u_char *) elt - (u_char *) hash->buckets[i] + sizeof(void *);
+    }
+
+    return size;
+}
+
+
+u_char *
+ngx_hash_export(ngx_hash_t *hash, u_char *base, u_char *p,
+    ngx_hash_export_pt handler, void *data)
+{
+    size_t           len;
+    uintptr_t       *buckets;
+    ngx_uint_t       i;
+    ngx_hash_elt_t  *elt, *copy;
+
+    buckets = (uintptr_t *) p;
+    *buckets++ = hash->size;
+
+    p = (u_char *) (buckets + hash->size);
+
+    for (i = 0; i < hash->size; i++) {
+        elt = hash->buckets[i];
+
+        if (elt == NULL) {
+            buckets[i] = 0;
+            continue;
+        }
+
+        buckets[i] = p - base;
+
+        while (elt->value) {
+            len = sizeof(void *) + ngx_align(elt->len + 2, sizeof(void *));
+
+            ngx_memzero(p, len);
+
+            copy = (ngx_hash_elt_t *) p;
+            copy->value = (void *) handler(elt->value, data);
+            copy->len = elt->len;
+            ngx_memcpy(copy->name, elt->name, elt->len);
+
+            p += len;
+            elt = (ngx_hash_elt_t *) ((u_char *) elt + len);
+        }
+
+        *(uintptr_t *) p = 0;
+        p += sizeof(void *);
+    }
+
+    return p;
+}
+
+
+u_char *
+ngx_hash_import(ngx_hash_t *hash, u_char *base, u_char *p, u_char *last)
+{
+    size_t           len;
+    uintptr_t       *buckets, size;
+    ngx_uint_t       i;
+    ngx_hash_elt_t  *elt;
+
+    if ((size_t) (last - p) < sizeof(void *)) {
+        return NULL;
+    }
+
+    buckets = (uintptr_t *) p;
+    size = *buckets++;
+
+    if (size == 0
+        || size > (size_t) (last - (u_char *) buckets) / sizeof(void *))
+    {
+        return NULL;
+    }
+
+    p = (u_char *) (buckets + size);
+
+    for (i = 0; i < size; i++) {
+
+        if (buckets[i] == 0) {
+            continue;
+        }
+
+        if (buckets[i] != (uintptr_t) (p - base)) {
+            return NULL;
+        }
+
+        for ( ;; ) {
+            if ((size_t) (last - p) < sizeof(void *)) {
+                return NULL;
+            }
+
+            elt = (ngx_hash_elt_t *) p;
+
+            if (elt->value == NULL) {
+                break;
+            }
+
+            if ((size_t) (last - p) < sizeof(void *) + sizeof(u_short)) {
+                return NULL;
+            }
+
+            len = sizeof(void *) + ngx_align(elt->len + 2, sizeof(void *));
+
+            if ((size_t) (last - p) < len
+                || (uintptr_t) elt->value >= (uintptr_t) (last - base))
+            {
+                return NULL;
+            }
+
+            elt->value = base + (uintptr_t) elt->value;
+
+            p += len;
+        }
+
+        p += sizeof(void *);
+
+        buckets[i] = (uintptr_t) base + buckets[i];
+    }
+
+    hash->buckets = (ngx_hash_elt_t **) buckets;
+    hash->size = size;
+
+    return p;
+}
+
+
 ngx_uint_t
 ngx_hash_key(u_char *data, size_t len)
 {
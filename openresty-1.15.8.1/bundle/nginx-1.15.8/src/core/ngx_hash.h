@@ -40,6 +40,7 @@ typedef struct {
 
 
 typedef ngx_uint_t (*ngx_hash_key_pt) (u_char *data, size_t len);
+typedef uintptr_t (*ngx_hash_export_pt) (void *value, void *data);
 
 
 typedef struct {
@@ -108,6 +109,12 @@ ngx_int_t ngx_hash_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
 ngx_int_t ngx_hash_wildcard_init(ngx_hash_init_t *hinit, ngx_hash_key_t *names,
     ngx_uint_t nelts);
 
+size_t ngx_hash_export_size(ngx_hash_t *hash);
+u_char *ngx_hash_export(ngx_hash_t *hash, u_char *base, u_char *p,
+    ngx_hash_export_pt handler, void *data);
+u_char *ngx_hash_import(ngx_hash_t *hash, u_char *base, u_char *p,
+    u_char *last);
+
 #define ngx_hash(key, c)   ((ngx_uint_t) key * 31 + c)
 ngx_uint_t ngx_hash_key(u_char *data, size_t len);
 ngx_uint_t ngx_hash_key_lc(u_char *data, size_t len);
@@ -12,6 +12,75 @@
 static char *ngx_error_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_log_set_levels(ngx_conf_t *cf, ngx_log_t *log);
 static void ngx_log_insert(ngx_log_t *log, ngx_log_t *new_log);
+static void *ngx_log_create_conf(ngx_cycle_t *cycle);
+static char *ngx_log_init_conf(ngx_cycle_t *cycle, void *conf);
+static ngx_int_t ngx_log_init_process(ngx_cycle_t *cycle);
+static void ngx_log_exit_process(ngx_cycle_t *cycle);
+
+
+typedef struct {
+    size_t         async;
+} ngx_log_conf_t;
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t ngx_log_async_write(ngx_open_file_t *file, ngx_uint_t level,
+    u_char *buf, size_t len);
+static void *ngx_log_async_cycle(void *data);
+static ngx_int_t ngx_log_async_drain(void);
+static void ngx_log_async_notify(void);
+
+
+/*
+ * the formatted lines of the file logs are queued as records in a ring:
+ * the space is reserved by moving the head, so the worker, its signal
+ * handler and the thread pool threads never wait for each other, and
+ * the record becomes visible to the writer thread once its size is set;
+ * a record that does not fit before the end of the ring is preceded
+ * by a skip record with a NULL file, the written space is zeroed;
+ * a sleeping writer thread is woken up with a write() to a pipe,
+ * as no lock may be taken in the signal handler
+ */
+
+typedef struct {
+    ngx_open_file_t     *file;
+    uint32_t             len;
+    uint32_t             size;
+} ngx_log_async_record_t;
+
+#define NGX_LOG_ASYNC_ALIGN  16
+#define NGX_LOG_ASYNC_IOVS   64
+
+
+typedef struct {
+    u_char              *start;
+    size_t               size;
+
+    /* the bytes ever reserved and written */
+    ngx_atomic_t         head;
+    ngx_atomic_t         tail;
+
+    ngx_atomic_t         queued;
+    ngx_atomic_t         dropped;
+    ngx_atomic_t         blocked;
+
+    /* the writer thread waits for the records in read() */
+    ngx_atomic_t         sleeping;
+    ngx_atomic_t         exiting;
+    ngx_fd_t             notify[2];
+
+    /* is held while the records are written or the files are reopened */
+    ngx_thread_mutex_t   write_mutex;
+
+    pthread_t            tid;
+    ngx_uint_t           running;
+} ngx_log_async_t;
+
+
+static ngx_log_async_t  ngx_log_async;
+
+#endif
 
 
 #if (NGX_DEBUG)
@@ -40,14 +109,21 @@ static ngx_command_t  ngx_errlog_commands[] = {
       0,
       NULL },
 
+    { ngx_string("error_log_async"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      0,
+      offsetof(ngx_log_conf_t, async),
+      NULL },
+
       ngx_null_command
 };
 
 
 static ngx_core_module_t  ngx_errlog_module_ctx = {
     ngx_string("errlog"),
-    NULL,
-    NULL
+    ngx_log_create_conf,
+    ngx_log_init_conf
 };
 
 
@@ -58,10 +134,10 @@ ngx_module_t  ngx_errlog_module = {
     NGX_CORE_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_log_init_process,                  /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_log_exit_process,                  /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -192,16 +268,27 @@ ngx_log_error_core(ngx_uint_t level, ngx_log_t *log, ngx_err_t err,
             goto next;
         }
 
+        if (log->file->fd == ngx_stderr) {
+            wrote_stderr = 1;
+        }
+
+#if (NGX_THREADS)
+
+        if (ngx_log_async.running
+            && ngx_log_async_write(log->file, level, errstr, p - errstr)
+               == NGX_OK)
+        {
+            goto next;
+        }
+
+#endif
+
         n = ngx_write_fd(log->file->fd, errstr, p - errstr);
 
         if (n == -1 && ngx_errno == NGX_ENOSPC) {
             log->disk_full_time = ngx_time();
         }
 
-        if (log->file->fd == ngx_stderr) {
-            wrote_stderr = 1;
-        }
-
     next:
 
         log = log->next;
@@ -722,6 +809,457 @@ ngx_log_insert(ngx_log_t *log, ngx_log_t *new_log)
 }
 
 
+static void *
+ngx_log_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_log_conf_t  *lcf;
+
+    lcf = ngx_pcalloc(cycle->pool, sizeof(ngx_log_conf_t));
+    if (lcf == NULL) {
+        return NULL;
+    }
+
+    lcf->async = NGX_CONF_UNSET_SIZE;
+
+    return lcf;
+}
+
+
+static char *
+ngx_log_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_log_conf_t *lcf = conf;
+
+    ngx_conf_init_size_value(lcf->async, 0);
+
+    if (lcf->async == 0) {
+        return NGX_CONF_OK;
+    }
+
+#if (NGX_THREADS)
+
+    /* a few lines of the maximum length fit in the ring */
+
+    if (lcf->async < 4 * NGX_MAX_ERROR_STR) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "\"error_log_async\" size must be at least %uz",
+                      (size_t) 4 * NGX_MAX_ERROR_STR);
+        return NGX_CONF_ERROR;
+    }
+
+    lcf->async = ngx_align(lcf->async, NGX_LOG_ASYNC_ALIGN);
+
+    return NGX_CONF_OK;
+
+#else
+
+    ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                  "\"error_log_async\" requires threads support, "
+                  "use --with-threads");
+    return NGX_CONF_ERROR;
+
+#endif
+}
+
+
+static ngx_int_t
+ngx_log_init_process(ngx_cycle_t *cycle)
+{
+#if (NGX_THREADS)
+    int              err;
+    ngx_log_conf_t  *lcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    lcf = (ngx_log_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_errlog_module);
+
+    if (lcf->async == 0) {
+        return NGX_OK;
+    }
+
+    ngx_log_async.start = ngx_alloc(lcf->async, cycle->log);
+    if (ngx_log_async.start == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(ngx_log_async.start, lcf->async);
+
+    ngx_log_async.size = lcf->async;
+
+    if (pipe(ngx_log_async.notify) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno, "pipe() failed");
+        return NGX_ERROR;
+    }
+
+    /* the producers never block, the pending wakeups are enough */
+
+    if (ngx_nonblocking(ngx_log_async.notify[1]) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_socket_errno,
+                      ngx_nonblocking_n " failed");
+        return NGX_ERROR;
+    }
+
+    if (ngx_thread_mutex_create(&ngx_log_async.write_mutex, cycle->log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    err = pthread_create(&ngx_log_async.tid, NULL, ngx_log_async_cycle,
+                         cycle->log);
+    if (err) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, err,
+                      "pthread_create() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_async.running = 1;
+#endif
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_log_exit_process(ngx_cycle_t *cycle)
+{
+#if (NGX_THREADS)
+    int  err;
+
+    if (!ngx_log_async.running) {
+        return;
+    }
+
+    /* the thread writes out the queued records before it exits */
+
+    (void) ngx_atomic_cmp_set(&ngx_log_async.exiting, 0, 1);
+
+    ngx_log_async_notify();
+
+    err = pthread_join(ngx_log_async.tid, NULL);
+    if (err) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, err, "pthread_join() failed");
+        return;
+    }
+
+    ngx_log_async.running = 0;
+
+    (void) close(ngx_log_async.notify[0]);
+    (void) close(ngx_log_async.notify[1]);
+
+    if (ngx_log_async.dropped) {
+        ngx_log_error(NGX_LOG_WARN, cycle->log, 0,
+                      "%uA error log lines dropped, the async buffer was full",
+                      ngx_log_async.dropped);
+    }
+#endif
+}
+
+
+#if (NGX_THREADS)
+
+/*
+ * NGX_OK is returned if the line was queued or dropped,
+ * the emerg, alert and crit lines are written synchronously
+ * rather than dropped if the ring is full
+ */
+
+static ngx_int_t
+ngx_log_async_write(ngx_open_file_t *file, ngx_uint_t level, u_char *buf,
+    size_t len)
+{
+    size_t                   need, skip, pos;
+    ngx_atomic_uint_t        head;
+    ngx_log_async_record_t  *r;
+
+    need = ngx_align(sizeof(ngx_log_async_record_t) + len,
+                     NGX_LOG_ASYNC_ALIGN);
+
+    for ( ;; ) {
+        head = ngx_log_async.head;
+        pos = head % ngx_log_async.size;
+
+        skip = (ngx_log_async.size - pos < need) ? ngx_log_async.size - pos
+                                                 : 0;
+
+        if (head + skip + need - ngx_log_async.tail > ngx_log_async.size) {
+
+            if (level > NGX_LOG_CRIT) {
+                (void) ngx_atomic_fetch_add(&ngx_log_async.dropped, 1);
+                return NGX_OK;
+            }
+
+            (void) ngx_atomic_fetch_add(&ngx_log_async.blocked, 1);
+            return NGX_DECLINED;
+        }
+
+        if (ngx_atomic_cmp_set(&ngx_log_async.head, head, head + skip + need)) {
+            break;
+        }
+    }
+
+    if (skip) {
+        r = (ngx_log_async_record_t *) (ngx_log_async.start + pos);
+        r->file = NULL;
+        r->len = 0;
+
+        ngx_memory_barrier();
+
+        r->size = (uint32_t) skip;
+        pos = 0;
+    }
+
+    r = (ngx_log_async_record_t *) (ngx_log_async.start + pos);
+    r->file = file;
+    r->len = (uint32_t) len;
+
+    ngx_memcpy((u_char *) r + sizeof(ngx_log_async_record_t), buf, len);
+
+    ngx_memory_barrier();
+
+    r->size = (uint32_t) need;
+
+    (void) ngx_atomic_fetch_add(&ngx_log_async.queued, 1);
+
+    /* the atomic operation above orders the record before the check */
+
+    if (ngx_log_async.sleeping) {
+        ngx_log_async_notify();
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_log_async_notify(void)
+{
+    ngx_err_t  err;
+
+    /* write() is async-signal-safe, errno is kept for the signal handler */
+
+    err = ngx_errno;
+
+    (void) write(ngx_log_async.notify[1], "", 1);
+
+    ngx_set_errno(err);
+}
+
+
+static void *
+ngx_log_async_cycle(void *data)
+{
+    ngx_log_t *log = data;
+
+    int        err;
+    u_char     buf[64];
+    sigset_t   set;
+    ngx_int_t  rc;
+
+    sigfillset(&set);
+
+    sigdelset(&set, SIGILL);
+    sigdelset(&set, SIGFPE);
+    sigdelset(&set, SIGSEGV);
+    sigdelset(&set, SIGBUS);
+
+    err = pthread_sigmask(SIG_BLOCK, &set, NULL);
+    if (err) {
+        ngx_log_error(NGX_LOG_ALERT, log, err, "pthread_sigmask() failed");
+    }
+
+    for ( ;; ) {
+
+        while (ngx_log_async.head == ngx_log_async.tail) {
+
+            if (ngx_log_async.exiting) {
+                return NULL;
+            }
+
+            /*
+             * announce sleeping before the last look at the ring;
+             * a wakeup written meanwhile stays in the pipe
+             */
+
+            (void) ngx_atomic_cmp_set(&ngx_log_async.sleeping, 0, 1);
+
+            if (ngx_log_async.head == ngx_log_async.tail
+                && !ngx_log_async.exiting
+                && read(ngx_log_async.notify[0], buf, sizeof(buf)) == -1
+                && ngx_errno != NGX_EINTR)
+            {
+                ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                              "read() from the error log pipe failed");
+                ngx_log_async.sleeping = 0;
+                return NULL;
+            }
+
+            ngx_log_async.sleeping = 0;
+        }
+
+        (void) ngx_thread_mutex_lock(&ngx_log_async.write_mutex, log);
+
+        rc = ngx_log_async_drain();
+
+        (void) ngx_thread_mutex_unlock(&ngx_log_async.write_mutex, log);
+
+        if (rc == NGX_AGAIN) {
+            ngx_sched_yield();
+        }
+    }
+}
+
+
+/*
+ * the write_mutex is held by the caller, NGX_AGAIN is returned
+ * if a record is still being queued
+ */
+
+static ngx_int_t
+ngx_log_async_drain(void)
+{
+    size_t                   size;
+    ngx_uint_t               n;
+    ngx_atomic_uint_t        tail, next;
+    ngx_open_file_t         *file;
+    ngx_log_async_record_t  *r;
+    struct iovec             iovs[NGX_LOG_ASYNC_IOVS];
+
+    tail = ngx_log_async.tail;
+
+    while (tail != ngx_log_async.head) {
+
+        /* the consecutive lines of a file are written with a single writev() */
+
+        file = NULL;
+        n = 0;
+        next = tail;
+
+        while (next != ngx_log_async.head && n < NGX_LOG_ASYNC_IOVS) {
+            r = (ngx_log_async_record_t *)
+                    (ngx_log_async.start + next % ngx_log_async.size);
+
+            size = *(volatile uint32_t *) &r->size;
+
+            if (size == 0) {
+                break;
+            }
+
+            ngx_memory_barrier();
+
+            if (r->file) {
+                if (file && r->file != file) {
+                    break;
+                }
+
+                file = r->file;
+
+                iovs[n].iov_base = (u_char *) r
+                                   + sizeof(ngx_log_async_record_t);
+                iovs[n].iov_len = r->len;
+                n++;
+            }
+
+            next += size;
+        }
+
+        if (next == tail) {
+            return NGX_AGAIN;
+        }
+
+        if (n) {
+            (void) writev(file->fd, iovs, n);
+        }
+
+        /* the records never wrap, so the space is zeroed record by record */
+
+        while (tail != next) {
+            r = (ngx_log_async_record_t *)
+                    (ngx_log_async.start + tail % ngx_log_async.size);
+
+            size = r->size;
+
+            ngx_memzero(r, size);
+
+            tail += size;
+        }
+
+        /* the space is reused by the producers only after it was zeroed */
+
+        ngx_memory_barrier();
+
+        ngx_log_async.tail = tail;
+    }
+
+    return NGX_OK;
+}
+
+
+void
+ngx_log_async_suspend(void)
+{
+    if (!ngx_log_async.running) {
+        return;
+    }
+
+    /*
+     * the queued lines are written out and the writer thread is stopped
+     * until ngx_log_async_resume(), so the files may be reopened
+     */
+
+    (void) ngx_thread_mutex_lock(&ngx_log_async.write_mutex, ngx_cycle->log);
+
+    (void) ngx_log_async_drain();
+}
+
+
+void
+ngx_log_async_resume(void)
+{
+    if (!ngx_log_async.running) {
+        return;
+    }
+
+    (void) ngx_thread_mutex_unlock(&ngx_log_async.write_mutex,
+                                   ngx_cycle->log);
+}
+
+
+void
+ngx_log_async_stat(ngx_log_async_stat_t *stat)
+{
+    stat->queued = ngx_log_async.queued;
+    stat->dropped = ngx_log_async.dropped;
+    stat->blocked = ngx_log_async.blocked;
+}
+
+#else
+
+void
+ngx_log_async_suspend(void)
+{
+}
+
+
+void
+ngx_log_async_resume(void)
+{
+}
+
+
+void
+ngx_log_async_stat(ngx_log_async_stat_t *stat)
+{
+    ngx_memzero(stat, sizeof(ngx_log_async_stat_t));
+}
+
+#endif
+
+
 #if (NGX_DEBUG)
 
 static void
@@ -78,6 +78,13 @@ struct ngx_log_s {
 #endif
 
 
+typedef struct {
+    ngx_uint_t           queued;
+    ngx_uint_t           dropped;
+    ngx_uint_t           blocked;
+} ngx_log_async_stat_t;
+
+
 /*********************************/
 
 #if (NGX_HAVE_C99_VARIADIC_MACROS)
@@ -238,6 +245,9 @@ ngx_int_t ngx_log_open_default(ngx_cycle_t *cycle);
 ngx_int_t ngx_log_redirect_stderr(ngx_cycle_t *cycle);
 ngx_log_t *ngx_log_get_file_log(ngx_log_t *head);
 char *ngx_log_set_log(ngx_conf_t *cf, ngx_log_t **head);
+void ngx_log_async_suspend(void);
+void ngx_log_async_resume(void);
+void ngx_log_async_stat(ngx_log_async_stat_t *stat);
 
 
 /*
@@ -14,14 +14,40 @@ static ngx_inline void *ngx_palloc_small(ngx_pool_t *pool, size_t size,
     ngx_uint_t align);
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static void *ngx_pool_alloc(ngx_uint_t cached, size_t size, size_t alignment,
+    ngx_log_t *log);
+static void ngx_pool_free(ngx_uint_t cached, void *p, size_t size);
+
+
+#if (NGX_DEBUG_PALLOC)
+#define ngx_pool_cacheable(size)  0
+#else
+#define ngx_pool_cacheable(size)                                              \
+    (ngx_pool_cache_max && (size) <= NGX_POOL_CACHE_MAX)
+#endif
+
+
+/*
+ * the pool cache keeps the blocks freed by the pools of a worker process
+ * for the pools created later, a free list per power of two size class
+ * is linked through the first word of the blocks
+ */
+
+size_t                        ngx_pool_cache_max;
+
+static void                  *ngx_pool_cache[NGX_POOL_CACHE_CLASSES];
+static ngx_pool_cache_stat_t  ngx_pool_cache_stats;
 
 
 ngx_pool_t *
 ngx_create_pool(size_t size, ngx_log_t *log)
 {
+    ngx_uint_t   cached;
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    cached = ngx_pool_cacheable(size);
+
+    p = ngx_pool_alloc(cached, size, NGX_POOL_ALIGNMENT, log);
     if (p == NULL) {
         return NULL;
     }
@@ -39,6 +65,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
     p->large = NULL;
     p->cleanup = NULL;
     p->log = log;
+    p->cached = cached;
 
     ngx_core_probe_create_pool_done(p, size);
 
@@ -49,6 +76,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 void
 ngx_destroy_pool(ngx_pool_t *pool)
 {
+    ngx_uint_t           cached;
     ngx_pool_t          *p, *n;
     ngx_pool_large_t    *l;
     ngx_pool_cleanup_t  *c;
@@ -83,14 +111,16 @@ ngx_destroy_pool(ngx_pool_t *pool)
 
 #endif
 
+    cached = pool->cached;
+
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_free(cached, l->alloc, l->size);
         }
     }
 
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_pool_free(cached, p, p->d.end - (u_char *) p);
 
         if (n == NULL) {
             break;
@@ -107,7 +137,7 @@ ngx_reset_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_free(pool->cached, l->alloc, l->size);
         }
     }
 
@@ -186,7 +216,7 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     psize = (size_t) (pool->d.end - (u_char *) pool);
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    m = ngx_pool_alloc(pool->cached, psize, NGX_POOL_ALIGNMENT, pool->log);
     if (m == NULL) {
         return NULL;
     }
@@ -220,7 +250,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     ngx_uint_t         n;
     ngx_pool_large_t  *large;
 
-    p = ngx_alloc(size, pool->log);
+    p = ngx_pool_alloc(pool->cached, size, 0, pool->log);
     if (p == NULL) {
         return NULL;
     }
@@ -230,6 +260,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {
             large->alloc = p;
+            large->size = size;
             return p;
         }
 
@@ -240,11 +271,12 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
 
     large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
     if (large == NULL) {
-        ngx_free(p);
+        ngx_pool_free(pool->cached, p, size);
         return NULL;
     }
 
     large->alloc = p;
+    large->size = size;
     large->next = pool->large;
     pool->large = large;
 
@@ -258,18 +290,19 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
     void              *p;
     ngx_pool_large_t  *large;
 
-    p = ngx_memalign(alignment, size, pool->log);
+    p = ngx_pool_alloc(pool->cached, size, alignment, pool->log);
     if (p == NULL) {
         return NULL;
     }
 
     large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
     if (large == NULL) {
-        ngx_free(p);
+        ngx_pool_free(pool->cached, p, size);
         return NULL;
     }
 
     large->alloc = p;
+    large->size = size;
     large->next = pool->large;
     pool->large = large;
 
@@ -286,7 +319,7 @@ ngx_pfree(ngx_pool_t *pool, void *p)
         if (p == l->alloc) {
             ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
                            "free: %p", l->alloc);
-            ngx_free(l->alloc);
+            ngx_pool_free(pool->cached, l->alloc, l->size);
             l->alloc = NULL;
 
             return NGX_OK;
@@ -297,6 +330,117 @@ ngx_pfree(ngx_pool_t *pool, void *p)
 }
 
 
+/*
+ * the statistics are added to the ones already in "stat",
+ * so a caller may sum up several pools
+ */
+
+void
+ngx_pool_stat(ngx_pool_t *pool, ngx_pool_stat_t *stat)
+{
+    ngx_pool_t        *p;
+    ngx_pool_large_t  *l;
+
+    for (p = pool; p; p = p->d.next) {
+        stat->blocks++;
+        stat->size += p->d.end - (u_char *) p;
+        stat->used += p->d.last - (u_char *) p;
+    }
+
+    for (l = pool->large; l; l = l->next) {
+        if (l->alloc) {
+            stat->large++;
+            stat->large_size += l->size;
+        }
+    }
+}
+
+
+/*
+ * "alignment" of 0 is the malloc() one, the cached blocks are aligned
+ * to NGX_POOL_ALIGNMENT at least
+ */
+
+static void *
+ngx_pool_alloc(ngx_uint_t cached, size_t size, size_t alignment,
+    ngx_log_t *log)
+{
+    void        *p;
+    ngx_uint_t   n;
+
+    if (!cached || size > NGX_POOL_CACHE_MAX) {
+        if (alignment) {
+            return ngx_memalign(alignment, size, log);
+        }
+
+        return ngx_alloc(size, log);
+    }
+
+    for (n = 0; size > (size_t) 1 << (n + NGX_POOL_CACHE_MIN_SHIFT); n++) {
+        /* void */
+    }
+
+    size = (size_t) 1 << (n + NGX_POOL_CACHE_MIN_SHIFT);
+    alignment = ngx_max(alignment, NGX_POOL_ALIGNMENT);
+
+    p = ngx_pool_cache[n];
+
+    if (p && ((uintptr_t) p & (alignment - 1)) == 0) {
+        ngx_pool_cache[n] = *(void **) p;
+
+        ngx_pool_cache_stats.hits++;
+        ngx_pool_cache_stats.blocks--;
+        ngx_pool_cache_stats.size -= size;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, log, 0,
+                       "pool cache: %p:%uz", p, size);
+
+        return p;
+    }
+
+    ngx_pool_cache_stats.misses++;
+
+    return ngx_memalign(alignment, size, log);
+}
+
+
+static void
+ngx_pool_free(ngx_uint_t cached, void *p, size_t size)
+{
+    ngx_uint_t  n;
+
+    if (!cached || size > NGX_POOL_CACHE_MAX) {
+        ngx_free(p);
+        return;
+    }
+
+    for (n = 0; size > (size_t) 1 << (n + NGX_POOL_CACHE_MIN_SHIFT); n++) {
+        /* void */
+    }
+
+    size = (size_t) 1 << (n + NGX_POOL_CACHE_MIN_SHIFT);
+
+    if (ngx_pool_cache_stats.size + size > ngx_pool_cache_max) {
+        ngx_pool_cache_stats.full++;
+        ngx_free(p);
+        return;
+    }
+
+    *(void **) p = ngx_pool_cache[n];
+    ngx_pool_cache[n] = p;
+
+    ngx_pool_cache_stats.blocks++;
+    ngx_pool_cache_stats.size += size;
+}
+
+
+void
+ngx_pool_cache_stat(ngx_pool_cache_stat_t *stat)
+{
+    *stat = ngx_pool_cache_stats;
+}
+
+
 void *
 ngx_pcalloc(ngx_pool_t *pool, size_t size)
 {
@@ -26,6 +26,13 @@
     ngx_align((sizeof(ngx_pool_t) + 2 * sizeof(ngx_pool_large_t)),            \
               NGX_POOL_ALIGNMENT)
 
+/* blocks of 256 bytes to 64K are cached in power of two size classes */
+#define NGX_POOL_CACHE_MIN_SHIFT  8
+#define NGX_POOL_CACHE_MAX_SHIFT  16
+#define NGX_POOL_CACHE_MAX        (1 << NGX_POOL_CACHE_MAX_SHIFT)
+#define NGX_POOL_CACHE_CLASSES                                                \
+    (NGX_POOL_CACHE_MAX_SHIFT - NGX_POOL_CACHE_MIN_SHIFT + 1)
+
 
 typedef void (*ngx_pool_cleanup_pt)(void *data);
 
@@ -43,6 +50,7 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next;
     void                 *alloc;
+    size_t                size;
 };
 
 
@@ -62,9 +70,30 @@ struct ngx_pool_s {
     ngx_pool_large_t     *large;
     ngx_pool_cleanup_t   *cleanup;
     ngx_log_t            *log;
+
+    /* the blocks are taken from and returned to the pool cache */
+    unsigned              cached:1;
 };
 
 
+typedef struct {
+    ngx_uint_t            blocks;
+    size_t                size;
+    size_t                used;
+    ngx_uint_t            large;
+    size_t                large_size;
+} ngx_pool_stat_t;
+
+
+typedef struct {
+    ngx_uint_t            hits;
+    ngx_uint_t            misses;
+    ngx_uint_t            full;
+    ngx_uint_t            blocks;
+    size_t                size;
+} ngx_pool_cache_stat_t;
+
+
 typedef struct {
     ngx_fd_t              fd;
     u_char               *name;
@@ -81,6 +110,8 @@ void *ngx_pnalloc(ngx_pool_t *pool, size_t size);
 void *ngx_pcalloc(ngx_pool_t *pool, size_t size);
 void *ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment);
 ngx_int_t ngx_pfree(ngx_pool_t *pool, void *p);
+void ngx_pool_stat(ngx_pool_t *pool, ngx_pool_stat_t *stat);
+void ngx_pool_cache_stat(ngx_pool_cache_stat_t *stat);
 
 
 ngx_pool_cleanup_t *ngx_pool_cleanup_add(ngx_pool_t *p, size_t size);
@@ -89,4 +120,7 @@ void ngx_pool_cleanup_file(void *data);
 void ngx_pool_delete_file(void *data);
 
 
+extern size_t  ngx_pool_cache_max;
+
+
 #endif /* _NGX_PALLOC_H_INCLUDED_ */
@@ -9,7 +9,51 @@
 #include <ngx_core.h>
 
 
+#define NGX_RADIX_TRIE_LEAF      0x80000000
+#define NGX_RADIX_TRIE_STRIDE    6
+
+/* trees with more values get a larger direct table */
+#define NGX_RADIX_TRIE_VALUES    1024
+
+
+typedef struct {
+    ngx_array_t        nodes;     /* ngx_radix_trie_node_t */
+    ngx_array_t        leaves;    /* uintptr_t */
+} ngx_radix_trie_ctx_t;
+
+
 static ngx_radix_node_t *ngx_radix_alloc(ngx_radix_tree_t *tree);
+static ngx_uint_t ngx_radix_trie_values(ngx_radix_node_t *node,
+    ngx_uint_t max);
+static ngx_radix_node_t *ngx_radix_trie_walk(ngx_radix_node_t *node,
+    ngx_uint_t key, ngx_uint_t bits, uintptr_t *value);
+static ngx_int_t ngx_radix_trie_add_leaf(ngx_radix_trie_ctx_t *ctx,
+    uintptr_t value, ngx_uint_t reuse);
+static ngx_int_t ngx_radix_trie_build(ngx_radix_trie_ctx_t *ctx,
+    ngx_uint_t n, ngx_radix_node_t *node, uintptr_t value);
+static uintptr_t ngx_radix32trie_find(ngx_radix_trie_t *trie, uint32_t key);
+#if (NGX_HAVE_INET6)
+static uintptr_t ngx_radix128trie_find(ngx_radix_trie_t *trie, u_char *key);
+#endif
+
+
+#if (NGX_HAVE_GCC_POPCOUNT)
+
+#define ngx_radix_popcount(x)    (ngx_uint_t) __builtin_popcountll(x)
+
+#else
+
+static ngx_inline ngx_uint_t
+ngx_radix_popcount(uint64_t x)
+{
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+
+    return (ngx_uint_t) ((x * 0x0101010101010101ULL) >> 56);
+}
+
+#endif
 
 
 ngx_radix_tree_t *
@@ -27,6 +71,7 @@ ngx_radix_tree_create(ngx_pool_t *pool, ngx_int_t preallocate)
     tree->free = NULL;
     tree->start = NULL;
     tree->size = 0;
+    tree->trie = NULL;
 
     tree->root = ngx_radix_alloc(tree);
     if (tree->root == NULL) {
@@ -112,6 +157,10 @@ ngx_radix32tree_insert(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask,
     uint32_t           bit;
     ngx_radix_node_t  *node, *next;
 
+    /* a compiled trie does not follow changes */
+
+    tree->trie = NULL;
+
     bit = 0x80000000;
 
     node = tree->root;
@@ -176,6 +225,8 @@ ngx_radix32tree_delete(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask)
     uint32_t           bit;
     ngx_radix_node_t  *node;
 
+    tree->trie = NULL;
+
     bit = 0x80000000;
     node = tree->root;
 
@@ -240,6 +291,10 @@ ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key)
     uintptr_t          value;
     ngx_radix_node_t  *node;
 
+    if (tree->trie) {
+        return ngx_radix32trie_find(tree->trie, key);
+    }
+
     bit = 0x80000000;
     value = NGX_RADIX_NO_VALUE;
     node = tree->root;
@@ -273,6 +328,8 @@ ngx_radix128tree_insert(ngx_radix_tree_t *tree, u_char *key, u_char *mask,
     ngx_uint_t         i;
     ngx_radix_node_t  *node, *next;
 
+    tree->trie = NULL;
+
     i = 0;
     bit = 0x80;
 
@@ -355,6 +412,8 @@ ngx_radix128tree_delete(ngx_radix_tree_t *tree, u_char *key, u_char *mask)
     ngx_uint_t         i;
     ngx_radix_node_t  *node;
 
+    tree->trie = NULL;
+
     i = 0;
     bit = 0x80;
     node = tree->root;
@@ -429,6 +488,10 @@ ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key)
     ngx_uint_t         i;
     ngx_radix_node_t  *node;
 
+    if (tree->trie) {
+        return ngx_radix128trie_find(tree->trie, key);
+    }
+
     i = 0;
     bit = 0x80;
     value = NGX_RADIX_NO_VALUE;
@@ -460,6 +523,355 @@ ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key)
 #endif
 
 
+/*
+ * The trie is built in the manner of poptrie.  A node covers 6 bits of
+ * a key and has a bit per each of 64 possible chunks in two bitmaps.
+ * Chunks with a more specific prefix below have their bit set in
+ * "vector" and lead to children stored consecutively from "base1".
+ * Other chunks end with a leaf; leaves are stored from "base0", and
+ * a run of chunks with the same value shares one leaf, the start of
+ * a run being marked in "leafvec".  So a child or a leaf is found with
+ * a population count of the bits up to the chunk.
+ */
+
+ngx_int_t
+ngx_radix_tree_compile(ngx_radix_tree_t *tree, ngx_pool_t *temp_pool)
+{
+    size_t                  size;
+    uint32_t               *direct;
+    uintptr_t               value;
+    ngx_uint_t              i, n, bits;
+    ngx_radix_node_t       *child;
+    ngx_radix_trie_t       *trie;
+    ngx_radix_trie_ctx_t    ctx;
+
+    if (ngx_array_init(&ctx.nodes, temp_pool, 1024,
+                       sizeof(ngx_radix_trie_node_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_array_init(&ctx.leaves, temp_pool, 1024, sizeof(uintptr_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    bits = (ngx_radix_trie_values(tree->root, NGX_RADIX_TRIE_VALUES)
+            < NGX_RADIX_TRIE_VALUES) ? 8 : 16;
+
+    direct = ngx_alloc(sizeof(uint32_t) << bits, tree->pool->log);
+    if (direct == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < ((ngx_uint_t) 1 << bits); i++) {
+
+        value = tree->root->value;
+        child = ngx_radix_trie_walk(tree->root, i, bits, &value);
+
+        if (child && (child->left || child->right)) {
+            n = ctx.nodes.nelts;
+
+            if (ngx_array_push(&ctx.nodes) == NULL
+                || ngx_radix_trie_build(&ctx, n, child, value) != NGX_OK)
+            {
+                goto failed;
+            }
+
+            direct[i] = n;
+            continue;
+        }
+
+        if (ngx_radix_trie_add_leaf(&ctx, value, 1) != NGX_OK) {
+            goto failed;
+        }
+
+        direct[i] = NGX_RADIX_TRIE_LEAF | (ctx.leaves.nelts - 1);
+    }
+
+    if (ctx.nodes.nelts >= NGX_RADIX_TRIE_LEAF
+        || ctx.leaves.nelts >= NGX_RADIX_TRIE_LEAF)
+    {
+        goto failed;
+    }
+
+    size = sizeof(ngx_radix_trie_t)
+           + ctx.nodes.nelts * sizeof(ngx_radix_trie_node_t)
+           + ctx.leaves.nelts * sizeof(uintptr_t)
+           + (sizeof(uint32_t) << bits);
+
+    trie = ngx_palloc(tree->pool, size);
+    if (trie == NULL) {
+        goto failed;
+    }
+
+    trie->nodes = (ngx_radix_trie_node_t *) &trie[1];
+    trie->leaves = (uintptr_t *) &trie->nodes[ctx.nodes.nelts];
+    trie->direct = (uint32_t *) &trie->leaves[ctx.leaves.nelts];
+    trie->bits = bits;
+
+    ngx_memcpy(trie->nodes, ctx.nodes.elts,
+               ctx.nodes.nelts * sizeof(ngx_radix_trie_node_t));
+    ngx_memcpy(trie->leaves, ctx.leaves.elts,
+               ctx.leaves.nelts * sizeof(uintptr_t));
+    ngx_memcpy(trie->direct, direct, sizeof(uint32_t) << bits);
+
+    ngx_free(direct);
+
+    ngx_log_debug4(NGX_LOG_DEBUG_CORE, tree->pool->log, 0,
+                   "radix trie: %ui direct bits, %ui nodes, %ui leaves, "
+                   "%uz bytes", bits, ctx.nodes.nelts, ctx.leaves.nelts,
+                   size);
+
+    tree->trie = trie;
+
+    return NGX_OK;
+
+failed:
+
+    ngx_free(direct);
+
+    return NGX_ERROR;
+}
+
+
+static ngx_uint_t
+ngx_radix_trie_values(ngx_radix_node_t *node, ngx_uint_t max)
+{
+    ngx_uint_t  n;
+
+    n = 0;
+
+    while (node && n < max) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            n++;
+        }
+
+        n += ngx_radix_trie_values(node->left, max - n);
+        node = node->right;
+    }
+
+    return n;
+}
+
+
+static ngx_radix_node_t *
+ngx_radix_trie_walk(ngx_radix_node_t *node, ngx_uint_t key, ngx_uint_t bits,
+    uintptr_t *value)
+{
+    ngx_uint_t  bit;
+
+    for (bit = (ngx_uint_t) 1 << (bits - 1); bit; bit >>= 1) {
+
+        if (key & bit) {
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+
+        if (node == NULL) {
+            return NULL;
+        }
+
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            *value = node->value;
+        }
+    }
+
+    return node;
+}
+
+
+static ngx_int_t
+ngx_radix_trie_add_leaf(ngx_radix_trie_ctx_t *ctx, uintptr_t value,
+    ngx_uint_t reuse)
+{
+    uintptr_t  *leaf;
+
+    if (reuse && ctx->leaves.nelts) {
+        leaf = ctx->leaves.elts;
+
+        if (leaf[ctx->leaves.nelts - 1] == value) {
+            return NGX_OK;
+        }
+    }
+
+    leaf = ngx_array_push(&ctx->leaves);
+    if (leaf == NULL) {
+        return NGX_ERROR;
+    }
+
+    *leaf = value;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_radix_trie_build(ngx_radix_trie_ctx_t *ctx, ngx_uint_t n,
+    ngx_radix_node_t *node, uintptr_t value)
+{
+    uint64_t                vector, leafvec;
+    uintptr_t               last, values[1 << NGX_RADIX_TRIE_STRIDE];
+    ngx_uint_t              i, k, base0, base1, leaves;
+    ngx_radix_node_t       *children[1 << NGX_RADIX_TRIE_STRIDE];
+    ngx_radix_trie_node_t  *tn;
+
+    vector = 0;
+    leafvec = 0;
+    leaves = 0;
+    last = 0;
+
+    base0 = ctx->leaves.nelts;
+
+    for (i = 0; i < (1 << NGX_RADIX_TRIE_STRIDE); i++) {
+
+        values[i] = value;
+        children[i] = ngx_radix_trie_walk(node, i, NGX_RADIX_TRIE_STRIDE,
+                                          &values[i]);
+
+        if (children[i] && (children[i]->left || children[i]->right)) {
+            vector |= (uint64_t) 1 << i;
+            continue;
+        }
+
+        children[i] = NULL;
+
+        if (leaves && values[i] == last) {
+            continue;
+        }
+
+        if (ngx_radix_trie_add_leaf(ctx, values[i], 0) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        leafvec |= (uint64_t) 1 << i;
+        last = values[i];
+        leaves++;
+    }
+
+    base1 = ctx->nodes.nelts;
+
+    if (vector
+        && ngx_array_push_n(&ctx->nodes, ngx_radix_popcount(vector)) == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    tn = ctx->nodes.elts;
+
+    tn[n].vector = vector;
+    tn[n].leafvec = leafvec;
+    tn[n].base0 = base0;
+    tn[n].base1 = base1;
+
+    for (i = 0, k = base1; i < (1 << NGX_RADIX_TRIE_STRIDE); i++) {
+
+        if (children[i] == NULL) {
+            continue;
+        }
+
+        if (ngx_radix_trie_build(ctx, k++, children[i], values[i]) != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static uintptr_t
+ngx_radix32trie_find(ngx_radix_trie_t *trie, uint32_t key)
+{
+    uint32_t                e;
+    uint64_t                k, bit;
+    ngx_uint_t              off;
+    ngx_radix_trie_node_t  *node;
+
+    k = (uint64_t) key << 32;
+
+    e = trie->direct[k >> (64 - trie->bits)];
+    off = trie->bits;
+
+    while (!(e & NGX_RADIX_TRIE_LEAF)) {
+        node = &trie->nodes[e];
+
+        bit = (uint64_t) 1 << ((k << off) >> (64 - NGX_RADIX_TRIE_STRIDE));
+
+        if (!(node->vector & bit)) {
+            return trie->leaves[node->base0
+                                + ngx_radix_popcount(node->leafvec
+                                                     & ((bit << 1) - 1))
+                                - 1];
+        }
+
+        e = node->base1 + ngx_radix_popcount(node->vector & ((bit << 1) - 1))
+            - 1;
+        off += NGX_RADIX_TRIE_STRIDE;
+    }
+
+    return trie->leaves[e & ~NGX_RADIX_TRIE_LEAF];
+}
+
+
+#if (NGX_HAVE_INET6)
+
+static uintptr_t
+ngx_radix128trie_find(ngx_radix_trie_t *trie, u_char *key)
+{
+    uint32_t                e;
+    uint64_t                hi, lo, bit, chunk;
+    ngx_uint_t              i, off;
+    ngx_radix_trie_node_t  *node;
+
+    hi = 0;
+    lo = 0;
+
+    for (i = 0; i < 8; i++) {
+        hi = (hi << 8) | key[i];
+        lo = (lo << 8) | key[i + 8];
+    }
+
+    e = trie->direct[hi >> (64 - trie->bits)];
+    off = trie->bits;
+
+    while (!(e & NGX_RADIX_TRIE_LEAF)) {
+        node = &trie->nodes[e];
+
+        if (off + NGX_RADIX_TRIE_STRIDE <= 64) {
+            chunk = hi << off;
+
+        } else if (off >= 64) {
+            chunk = lo << (off - 64);
+
+        } else {
+            chunk = (hi << off) | (lo >> (64 - off));
+        }
+
+        bit = (uint64_t) 1 << (chunk >> (64 - NGX_RADIX_TRIE_STRIDE));
+
+        if (!(node->vector & bit)) {
+            return trie->leaves[node->base0
+                                + ngx_radix_popcount(node->leafvec
+                                                     & ((bit << 1) - 1))
+                                - 1];
+        }
+
+        e = node->base1 + ngx_radix_popcount(node->vector & ((bit << 1) - 1))
+            - 1;
+        off += NGX_RADIX_TRIE_STRIDE;
+    }
+
+    return trie->leaves[e & ~NGX_RADIX_TRIE_LEAF];
+}
+
+#endif
+
+
 static ngx_radix_node_t *
 ngx_radix_alloc(ngx_radix_tree_t *tree)
 {
@@ -25,17 +25,42 @@ struct ngx_radix_node_s {
 };
 
 
+/*
+ * a compiled, read-only form of a tree: a direct table indexed by
+ * the first bits of a key, followed by multibit nodes, each of them
+ * covering 6 bits with bitmaps of its children and leaves
+ */
+
+typedef struct {
+    uint64_t                vector;
+    uint64_t                leafvec;
+    uint32_t                base0;
+    uint32_t                base1;
+} ngx_radix_trie_node_t;
+
+
+typedef struct {
+    uint32_t               *direct;
+    ngx_radix_trie_node_t  *nodes;
+    uintptr_t              *leaves;
+    ngx_uint_t              bits;
+} ngx_radix_trie_t;
+
+
 typedef struct {
     ngx_radix_node_t  *root;
     ngx_pool_t        *pool;
     ngx_radix_node_t  *free;
     char              *start;
     size_t             size;
+    ngx_radix_trie_t  *trie;
 } ngx_radix_tree_t;
 
 
 ngx_radix_tree_t *ngx_radix_tree_create(ngx_pool_t *pool,
     ngx_int_t preallocate);
+ngx_int_t ngx_radix_tree_compile(ngx_radix_tree_t *tree,
+    ngx_pool_t *temp_pool);
 
 ngx_int_t ngx_radix32tree_insert(ngx_radix_tree_t *tree,
     uint32_t key, uint32_t mask, uintptr_t value);
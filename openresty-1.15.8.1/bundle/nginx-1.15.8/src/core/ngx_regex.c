@@ -14,6 +14,20 @@ typedef struct {
 } ngx_regex_conf_t;
 
 
+#define NGX_REGEX_SET_LITERAL_LEN  16
+#define NGX_REGEX_SET_RUNS         8
+#define NGX_REGEX_SET_NONE         0xffffffff
+#define NGX_REGEX_SET_BITS         (8 * sizeof(uintptr_t))
+
+
+static ngx_uint_t ngx_regex_set_runs(ngx_str_t *pattern, ngx_str_t *runs);
+static void ngx_regex_set_add_run(ngx_str_t *runs, ngx_uint_t *n, u_char *run,
+    size_t len);
+static int ngx_libc_cdecl ngx_regex_set_cmp_runs(const void *one,
+    const void *two);
+static u_char *ngx_regex_set_skip_class(u_char *p, u_char *last);
+static u_char *ngx_regex_set_skip_group(u_char *p, u_char *last);
+
 static void * ngx_libc_cdecl ngx_regex_malloc(size_t size);
 static void ngx_libc_cdecl ngx_regex_free(void *p);
 #if (NGX_HAVE_PCRE_JIT)
@@ -227,6 +241,682 @@ ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 }
 
 
+ngx_int_t
+ngx_regex_set_create(ngx_conf_t *cf, ngx_regex_set_t **set,
+    ngx_str_t *patterns, ngx_uint_t n)
+{
+    u_char            *buf, ch;
+    size_t             size, words;
+    uint32_t           state, child, *fail, *queue, *row, *frow;
+    ngx_uint_t         i, k, c, best, nstates, nliterals, nruns, head, tail;
+    ngx_uint_t        *nrun, *shared;
+    ngx_str_t         *runs, **sorted, *literals;
+    ngx_regex_set_t   *rs;
+
+    *set = NULL;
+
+    nruns = n * NGX_REGEX_SET_RUNS;
+
+    runs = ngx_palloc(cf->temp_pool, nruns * sizeof(ngx_str_t));
+    buf = ngx_pnalloc(cf->temp_pool, nruns * NGX_REGEX_SET_LITERAL_LEN);
+    nrun = ngx_palloc(cf->temp_pool, n * sizeof(ngx_uint_t));
+    sorted = ngx_palloc(cf->temp_pool, nruns * sizeof(ngx_str_t *));
+    shared = ngx_palloc(cf->temp_pool, nruns * sizeof(ngx_uint_t));
+    literals = ngx_palloc(cf->temp_pool, n * sizeof(ngx_str_t));
+
+    if (runs == NULL || buf == NULL || nrun == NULL || sorted == NULL
+        || shared == NULL || literals == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    k = 0;
+
+    for (i = 0; i < n; i++) {
+        for (c = 0; c < NGX_REGEX_SET_RUNS; c++) {
+            runs[i * NGX_REGEX_SET_RUNS + c].data =
+                            buf + (i * NGX_REGEX_SET_RUNS + c)
+                                  * NGX_REGEX_SET_LITERAL_LEN;
+        }
+
+        nrun[i] = ngx_regex_set_runs(&patterns[i],
+                                     &runs[i * NGX_REGEX_SET_RUNS]);
+
+        for (c = 0; c < nrun[i]; c++) {
+            sorted[k++] = &runs[i * NGX_REGEX_SET_RUNS + c];
+        }
+    }
+
+    /* the number of patterns sharing a run */
+
+    ngx_qsort(sorted, k, sizeof(ngx_str_t *), ngx_regex_set_cmp_runs);
+
+    for (i = 0; i < k; i = c) {
+        for (c = i + 1;
+             c < k && ngx_regex_set_cmp_runs(&sorted[i], &sorted[c]) == 0;
+             c++)
+        {
+            /* void */
+        }
+
+        for (best = i; best < c; best++) {
+            shared[sorted[best] - runs] = c - i;
+        }
+    }
+
+    rs = ngx_pcalloc(cf->pool, sizeof(ngx_regex_set_t));
+    if (rs == NULL) {
+        return NGX_ERROR;
+    }
+
+    rs->npatterns = n;
+
+    /* class 0 is for the bytes not in the literals */
+
+    rs->nclasses = 1;
+    nstates = 1;
+    nliterals = 0;
+
+    for (i = 0; i < n; i++) {
+
+        /* the least shared run, the longest of them, is looked up */
+
+        literals[i].len = 0;
+        best = 0;
+
+        for (c = 0; c < nrun[i]; c++) {
+            k = i * NGX_REGEX_SET_RUNS + c;
+
+            if (literals[i].len == 0
+                || shared[k] < shared[best]
+                || (shared[k] == shared[best] && runs[k].len > literals[i].len))
+            {
+                literals[i] = runs[k];
+                best = k;
+            }
+        }
+
+        if (literals[i].len == 0) {
+            continue;
+        }
+
+        nliterals++;
+        nstates += literals[i].len;
+
+        for (k = 0; k < literals[i].len; k++) {
+            ch = literals[i].data[k];
+
+            if (rs->classes[ch] == 0) {
+                rs->classes[ch] = (u_char) rs->nclasses++;
+            }
+        }
+    }
+
+    if (nliterals == 0) {
+        /* nothing to look up, the regexes are executed one by one */
+        return NGX_OK;
+    }
+
+    for (c = 'A'; c <= 'Z'; c++) {
+        rs->classes[c] = rs->classes[ngx_tolower(c)];
+    }
+
+    words = (n + NGX_REGEX_SET_BITS - 1) / NGX_REGEX_SET_BITS;
+    size = nstates * rs->nclasses * sizeof(uint32_t);
+
+    rs->next = ngx_pcalloc(cf->pool, size);
+    rs->output = ngx_palloc(cf->pool, nstates * sizeof(uint32_t));
+    rs->link = ngx_pcalloc(cf->pool, nstates * sizeof(uint32_t));
+    rs->same = ngx_palloc(cf->pool, n * sizeof(uint32_t));
+    rs->always = ngx_pcalloc(cf->pool, words * sizeof(uintptr_t));
+    rs->candidates = ngx_palloc(cf->pool, words * sizeof(uintptr_t));
+
+    fail = ngx_pcalloc(cf->temp_pool, nstates * sizeof(uint32_t));
+    queue = ngx_palloc(cf->temp_pool, nstates * sizeof(uint32_t));
+
+    if (rs->next == NULL || rs->output == NULL || rs->link == NULL
+        || rs->same == NULL || rs->always == NULL || rs->candidates == NULL
+        || fail == NULL || queue == NULL)
+    {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < nstates; i++) {
+        rs->output[i] = NGX_REGEX_SET_NONE;
+    }
+
+    /* the trie of the literals, 0 is the root and no transition */
+
+    nstates = 1;
+
+    for (i = n; i-- > 0; /* void */) {
+
+        if (literals[i].len == 0) {
+            rs->always[i / NGX_REGEX_SET_BITS]
+                                  |= (uintptr_t) 1 << (i % NGX_REGEX_SET_BITS);
+            continue;
+        }
+
+        state = 0;
+
+        for (k = 0; k < literals[i].len; k++) {
+            c = rs->classes[literals[i].data[k]];
+            child = rs->next[state * rs->nclasses + c];
+
+            if (child == 0) {
+                child = nstates++;
+                rs->next[state * rs->nclasses + c] = child;
+            }
+
+            state = child;
+        }
+
+        /* the patterns are inserted backwards to keep them in order */
+
+        rs->same[i] = rs->output[state];
+        rs->output[state] = i;
+    }
+
+    /* the failure transitions are resolved breadth-first */
+
+    head = 0;
+    tail = 0;
+
+    for (c = 0; c < rs->nclasses; c++) {
+        child = rs->next[c];
+
+        if (child) {
+            queue[tail++] = child;
+        }
+    }
+
+    while (head < tail) {
+        state = queue[head++];
+
+        row = &rs->next[state * rs->nclasses];
+        frow = &rs->next[fail[state] * rs->nclasses];
+
+        for (c = 0; c < rs->nclasses; c++) {
+            child = row[c];
+
+            if (child == 0) {
+                row[c] = frow[c];
+                continue;
+            }
+
+            fail[child] = frow[c];
+
+            rs->link[child] = (rs->output[fail[child]] != NGX_REGEX_SET_NONE)
+                              ? fail[child] : rs->link[fail[child]];
+
+            queue[tail++] = child;
+        }
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_CORE, cf->log, 0,
+                   "regex set: %ui patterns, %ui literals, %ui states, %uz",
+                   n, nliterals, nstates, size);
+
+    *set = rs;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_regex_set_create_array(ngx_conf_t *cf, ngx_regex_set_t **set,
+    ngx_array_t *a)
+{
+    ngx_str_t        *patterns;
+    ngx_uint_t        i;
+    ngx_regex_elt_t  *re;
+
+    *set = NULL;
+
+    if (a == NULL || a->nelts < 2) {
+        return NGX_OK;
+    }
+
+    patterns = ngx_palloc(cf->temp_pool, a->nelts * sizeof(ngx_str_t));
+    if (patterns == NULL) {
+        return NGX_ERROR;
+    }
+
+    re = a->elts;
+
+    for (i = 0; i < a->nelts; i++) {
+        patterns[i].data = re[i].name;
+        patterns[i].len = ngx_strlen(re[i].name);
+    }
+
+    return ngx_regex_set_create(cf, set, patterns, a->nelts);
+}
+
+
+ngx_uint_t
+ngx_regex_set_scan(ngx_regex_set_t *set, ngx_str_t *s)
+{
+    u_char    *p, *last;
+    uint32_t   state, st, i;
+
+    ngx_memcpy(set->candidates, set->always,
+               (set->npatterns + NGX_REGEX_SET_BITS - 1) / NGX_REGEX_SET_BITS
+               * sizeof(uintptr_t));
+
+    state = 0;
+
+    p = s->data;
+    last = p + s->len;
+
+    while (p < last) {
+        state = set->next[state * set->nclasses + set->classes[*p++]];
+
+        st = (set->output[state] != NGX_REGEX_SET_NONE) ? state
+                                                         : set->link[state];
+
+        for ( /* void */ ; st; st = set->link[st]) {
+
+            for (i = set->output[st];
+                 i != NGX_REGEX_SET_NONE;
+                 i = set->same[i])
+            {
+                set->candidates[i / NGX_REGEX_SET_BITS]
+                                  |= (uintptr_t) 1 << (i % NGX_REGEX_SET_BITS);
+            }
+        }
+    }
+
+    return ngx_regex_set_next(set, 0);
+}
+
+
+ngx_uint_t
+ngx_regex_set_next(ngx_regex_set_t *set, ngx_uint_t i)
+{
+    ngx_uint_t  w, words;
+    uintptr_t   bits;
+
+    words = (set->npatterns + NGX_REGEX_SET_BITS - 1) / NGX_REGEX_SET_BITS;
+
+    w = i / NGX_REGEX_SET_BITS;
+
+    if (w >= words) {
+        return set->npatterns;
+    }
+
+    bits = set->candidates[w] >> (i % NGX_REGEX_SET_BITS);
+
+    if (bits == 0) {
+
+        do {
+            if (++w == words) {
+                return set->npatterns;
+            }
+
+            bits = set->candidates[w];
+
+        } while (bits == 0);
+
+        i = w * NGX_REGEX_SET_BITS;
+    }
+
+    while ((bits & 1) == 0) {
+        bits >>= 1;
+        i++;
+    }
+
+    return i;
+}
+
+
+ngx_int_t
+ngx_regex_exec_set(ngx_regex_set_t *set, ngx_array_t *a, ngx_str_t *s,
+    ngx_log_t *log)
+{
+    ngx_int_t         n;
+    ngx_uint_t        i;
+    ngx_regex_elt_t  *re;
+
+    if (set == NULL) {
+        return ngx_regex_exec_array(a, s, log);
+    }
+
+    re = a->elts;
+
+    for (i = ngx_regex_set_scan(set, s);
+         i < a->nelts;
+         i = ngx_regex_set_next(set, i + 1))
+    {
+        n = ngx_regex_exec(re[i].regex, s, NULL, 0);
+
+        if (n == NGX_REGEX_NO_MATCHED) {
+            continue;
+        }
+
+        if (n < 0) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          ngx_regex_exec_n " failed: %i on \"%V\" using \"%s\"",
+                          n, s, re[i].name);
+            return NGX_ERROR;
+        }
+
+        /* match */
+
+        return NGX_OK;
+    }
+
+    return NGX_DECLINED;
+}
+
+
+/*
+ * the runs of literal characters outside of groups and classes, which
+ * any match must contain, lowercased and truncated; none are returned
+ * if the pattern is not understood, e.g., has alternatives
+ */
+
+static ngx_uint_t
+ngx_regex_set_runs(ngx_str_t *pattern, ngx_str_t *runs)
+{
+    u_char      *p, *q, *last, ch;
+    size_t       len;
+    ngx_uint_t   n;
+    u_char       run[NGX_REGEX_SET_LITERAL_LEN];
+
+    p = pattern->data;
+    last = p + pattern->len;
+
+    if (ngx_strnstr(p, "\\Q", pattern->len) != NULL) {
+        return 0;
+    }
+
+    len = 0;
+    n = 0;
+
+    while (p < last) {
+        ch = *p++;
+
+        switch (ch) {
+
+        case '\\':
+            if (p == last) {
+                return 0;
+            }
+
+            ch = *p++;
+
+            if ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')
+                || (ch >= '0' && ch <= '9'))
+            {
+                /* back references, octal, hex and property escapes */
+
+                if (ngx_strchr("0123456789xgkopPNc", ch) != NULL) {
+                    return 0;
+                }
+
+                /* character types and assertions */
+
+                goto end;
+            }
+
+            if (ch >= 0x80) {
+                goto end;
+            }
+
+            goto add;
+
+        case '[':
+            p = ngx_regex_set_skip_class(p, last);
+            goto end;
+
+        case '(':
+            if (p < last && *p == '?') {
+
+                for (q = p + 1; q < last; q++) {
+                    if (!((*q >= 'a' && *q <= 'z') || (*q >= 'A' && *q <= 'Z')
+                          || *q == '-'))
+                    {
+                        break;
+                    }
+                }
+
+                if (q < last && *q == ')') {
+
+                    /* the option settings, the case is ignored anyway */
+
+                    if (ngx_strlchr(p, q, 'x') != NULL) {
+                        return 0;
+                    }
+
+                    p = q + 1;
+                    goto end;
+                }
+            }
+
+            p = ngx_regex_set_skip_group(p, last);
+            goto end;
+
+        case '|':
+            return 0;
+
+        case '?':
+        case '*':
+            goto optional;
+
+        case '+':
+            goto quantifier;
+
+        case '{':
+            for (q = p; q < last && *q >= '0' && *q <= '9'; q++) {
+                /* void */
+            }
+
+            if (q == p) {
+                goto add;
+            }
+
+            if (q < last && *q == ',') {
+                for (q++; q < last && *q >= '0' && *q <= '9'; q++) {
+                    /* void */
+                }
+            }
+
+            if (q == last || *q != '}') {
+                goto add;
+            }
+
+            p = q + 1;
+            goto optional;
+
+        case '.':
+        case '^':
+        case '$':
+            goto end;
+
+        default:
+            if (ch >= 0x80) {
+                goto end;
+            }
+
+            goto add;
+        }
+
+    add:
+
+        if (len < NGX_REGEX_SET_LITERAL_LEN) {
+            run[len] = ngx_tolower(ch);
+        }
+
+        len++;
+        continue;
+
+    optional:
+
+        /* the previous character may be absent */
+
+        if (len) {
+            len--;
+        }
+
+    quantifier:
+
+        /* lazy and possessive quantifiers */
+
+        if (p < last && (*p == '?' || *p == '+')) {
+            p++;
+        }
+
+    end:
+
+        ngx_regex_set_add_run(runs, &n, run, len);
+        len = 0;
+    }
+
+    ngx_regex_set_add_run(runs, &n, run, len);
+
+    return n;
+}
+
+
+/* the longest runs are kept */
+
+static void
+ngx_regex_set_add_run(ngx_str_t *runs, ngx_uint_t *n, u_char *run, size_t len)
+{
+    ngx_uint_t  i, k;
+
+    len = ngx_min(len, NGX_REGEX_SET_LITERAL_LEN);
+
+    if (len == 0) {
+        return;
+    }
+
+    if (*n < NGX_REGEX_SET_RUNS) {
+        k = (*n)++;
+
+    } else {
+        k = 0;
+
+        for (i = 1; i < NGX_REGEX_SET_RUNS; i++) {
+            if (runs[i].len < runs[k].len) {
+                k = i;
+            }
+        }
+
+        if (runs[k].len >= len) {
+            return;
+        }
+    }
+
+    ngx_memcpy(runs[k].data, run, len);
+    runs[k].len = len;
+}
+
+
+static int ngx_libc_cdecl
+ngx_regex_set_cmp_runs(const void *one, const void *two)
+{
+    ngx_int_t   rc;
+    ngx_str_t  *first, *second;
+
+    first = *(ngx_str_t **) one;
+    second = *(ngx_str_t **) two;
+
+    rc = ngx_memcmp(first->data, second->data,
+                    ngx_min(first->len, second->len));
+
+    if (rc != 0) {
+        return (int) rc;
+    }
+
+    return (int) first->len - (int) second->len;
+}
+
+
+static u_char *
+ngx_regex_set_skip_class(u_char *p, u_char *last)
+{
+    if (p < last && *p == '^') {
+        p++;
+    }
+
+    /* "]" is a literal as the first character */
+
+    if (p < last && *p == ']') {
+        p++;
+    }
+
+    while (p < last) {
+
+        switch (*p) {
+
+        case '\\':
+            p += 2;
+            break;
+
+        case '[':
+            if (p + 1 < last && p[1] == ':') {
+                p = ngx_strnstr(p + 2, ":]", last - p - 2);
+
+                if (p == NULL) {
+                    return last;
+                }
+
+                p += 2;
+                break;
+            }
+
+            p++;
+            break;
+
+        case ']':
+            return p + 1;
+
+        default:
+            p++;
+        }
+    }
+
+    return last;
+}
+
+
+static u_char *
+ngx_regex_set_skip_group(u_char *p, u_char *last)
+{
+    ngx_uint_t  depth;
+
+    depth = 1;
+
+    while (p < last) {
+
+        switch (*p++) {
+
+        case '\\':
+            p++;
+            break;
+
+        case '[':
+            p = ngx_regex_set_skip_class(p, last);
+            break;
+
+        case '(':
+            depth++;
+            break;
+
+        case ')':
+            if (--depth == 0) {
+                return p;
+            }
+
+            break;
+        }
+    }
+
+    return last;
+}
+
+
 static void * ngx_libc_cdecl
 ngx_regex_malloc(size_t size)
 {
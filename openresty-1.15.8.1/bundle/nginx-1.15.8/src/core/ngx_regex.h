@@ -46,6 +46,37 @@ typedef struct {
 } ngx_regex_elt_t;
 
 
+/*
+ * a prefilter for a list of regexes: a literal required by each regex
+ * is looked up in a single pass over the subject, and only the regexes
+ * whose literal was found, or which have none, are to be executed
+ */
+
+typedef struct {
+    ngx_uint_t    npatterns;
+    ngx_uint_t    nclasses;
+
+    /* the bytes are mapped to classes, case-insensitively */
+    u_char        classes[256];
+
+    /* the Aho-Corasick automaton, nstates * nclasses transitions */
+    uint32_t     *next;
+
+    /* the first pattern with the literal ending in a state */
+    uint32_t     *output;
+
+    /* the longest suffix state with an output, 0 if none */
+    uint32_t     *link;
+
+    /* the next pattern with the same literal */
+    uint32_t     *same;
+
+    /* the patterns without a literal, and the scan result */
+    uintptr_t    *always;
+    uintptr_t    *candidates;
+} ngx_regex_set_t;
+
+
 void ngx_regex_init(void);
 ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
@@ -56,5 +87,14 @@ ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
 ngx_int_t ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log);
 
+ngx_int_t ngx_regex_set_create(ngx_conf_t *cf, ngx_regex_set_t **set,
+    ngx_str_t *patterns, ngx_uint_t n);
+ngx_int_t ngx_regex_set_create_array(ngx_conf_t *cf, ngx_regex_set_t **set,
+    ngx_array_t *a);
+ngx_uint_t ngx_regex_set_scan(ngx_regex_set_t *set, ngx_str_t *s);
+ngx_uint_t ngx_regex_set_next(ngx_regex_set_t *set, ngx_uint_t i);
+ngx_int_t ngx_regex_exec_set(ngx_regex_set_t *set, ngx_array_t *a,
+    ngx_str_t *s, ngx_log_t *log);
+
 
 #endif /* _NGX_REGEX_H_INCLUDED_ */
@@ -70,6 +70,53 @@ typedef struct {
         ((u_char *) (n) - offsetof(ngx_resolver_node_t, node))
 
 
+/* a background refresh of a shared cache entry gets that many resends */
+#define NGX_RESOLVER_REFRESH_TRIES  3
+
+
+typedef struct {
+    ngx_rbtree_t              rbtree;
+    ngx_rbtree_node_t         sentinel;
+    ngx_queue_t               queue;
+    ngx_uint_t                entries;
+
+    ngx_atomic_t              hits;
+    ngx_atomic_t              stale;
+    ngx_atomic_t              misses;
+    ngx_atomic_t              prefetches;
+} ngx_resolver_cache_sh_t;
+
+
+typedef struct {
+    ngx_resolver_cache_sh_t  *sh;
+    ngx_slab_pool_t          *shpool;
+} ngx_resolver_cache_t;
+
+
+typedef struct {
+    ngx_rbtree_node_t         node;
+    ngx_queue_t               queue;
+
+    time_t                    valid;
+    time_t                    updating;
+
+    u_short                   nlen;
+    u_short                   naddrs;
+    u_short                   naddrs6;
+    u_char                    ipv6;
+
+    /* naddrs IPv4 addresses, naddrs6 IPv6 addresses, the name */
+    in_addr_t                 addrs[1];
+} ngx_resolver_cache_node_t;
+
+
+#define ngx_resolver_cache_addrs6(cn)                                        \
+    ((struct in6_addr *) &(cn)->addrs[(cn)->naddrs])
+
+#define ngx_resolver_cache_name(cn)                                          \
+    ((u_char *) (ngx_resolver_cache_addrs6(cn) + (cn)->naddrs6))
+
+
 static ngx_int_t ngx_udp_connect(ngx_resolver_connection_t *rec);
 static ngx_int_t ngx_tcp_connect(ngx_resolver_connection_t *rec);
 
@@ -136,6 +183,25 @@ static void ngx_resolver_resolve_srv_names(ngx_resolver_ctx_t *ctx,
     ngx_resolver_node_t *rn);
 static void ngx_resolver_srv_names_handler(ngx_resolver_ctx_t *ctx);
 static ngx_int_t ngx_resolver_cmp_srvs(const void *one, const void *two);
+static ngx_int_t ngx_resolver_init_cache_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_resolver_cache_lookup(ngx_resolver_t *r,
+    ngx_resolver_ctx_t *ctx, ngx_str_t *name, uint32_t hash);
+static ngx_int_t ngx_resolver_prev_answer(ngx_resolver_t *r,
+    ngx_resolver_ctx_t *ctx, ngx_resolver_node_t *pn);
+static void ngx_resolver_keep_prev(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static ngx_resolver_ctx_t *ngx_resolver_cache_prefetch(ngx_resolver_t *r,
+    ngx_str_t *name, uint32_t hash);
+static ngx_resolver_ctx_t *ngx_resolver_cache_refresh(ngx_resolver_t *r,
+    ngx_str_t *name);
+static void ngx_resolver_cache_refresh_handler(ngx_resolver_ctx_t *ctx);
+static void ngx_resolver_cache_store(ngx_resolver_t *r,
+    ngx_resolver_node_t *rn);
+static ngx_resolver_cache_node_t *ngx_resolver_cache_lookup_node(
+    ngx_resolver_cache_t *cache, ngx_str_t *name, uint32_t hash);
+static void ngx_resolver_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
 #if (NGX_HAVE_INET6)
 static void ngx_resolver_rbtree_insert_addr6_value(ngx_rbtree_node_t *temp,
@@ -145,6 +211,10 @@ static ngx_resolver_node_t *ngx_resolver_lookup_addr6(ngx_resolver_t *r,
 #endif
 
 
+/* identifies resolver cache zones among the shared memory zones */
+static ngx_uint_t  ngx_resolver_cache_tag;
+
+
 #if !(NGX_WIN32)
 static ngx_int_t
 ngx_resolver_read_resolv_conf(ngx_conf_t *cf, ngx_resolver_t *r, u_char *path,
@@ -333,10 +403,13 @@ ngx_resolver_read_resolv_conf(ngx_conf_t *cf, ngx_resolver_t *r, u_char *path,
 ngx_resolver_t *
 ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
 {
-    ngx_str_t                   s;
+    u_char                     *p;
+    ssize_t                     size;
+    ngx_str_t                   s, v;
     ngx_url_t                   u;
     ngx_uint_t                  i, j;
     ngx_resolver_t             *r;
+    ngx_resolver_cache_t       *cache;
     ngx_pool_cleanup_t         *cln;
     ngx_resolver_connection_t  *rec;
 
@@ -425,6 +498,87 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
             continue;
         }
 
+        if (ngx_strncmp(names[i].data, "cache_zone=", 11) == 0) {
+
+            s.data = names[i].data + 11;
+
+            p = (u_char *) ngx_strchr(s.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid cache zone size \"%V\"",
+                                   &names[i]);
+                return NULL;
+            }
+
+            s.len = p - s.data;
+
+            v.data = p + 1;
+            v.len = names[i].data + names[i].len - v.data;
+
+            size = ngx_parse_size(&v);
+
+            if (size == NGX_ERROR || s.len == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid cache zone \"%V\"", &names[i]);
+                return NULL;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "cache zone \"%V\" is too small", &s);
+                return NULL;
+            }
+
+            r->cache_zone = ngx_shared_memory_add(cf, &s, size,
+                                                  &ngx_resolver_cache_tag);
+            if (r->cache_zone == NULL) {
+                return NULL;
+            }
+
+            if (r->cache_zone->data == NULL) {
+                cache = ngx_pcalloc(cf->pool, sizeof(ngx_resolver_cache_t));
+                if (cache == NULL) {
+                    return NULL;
+                }
+
+                r->cache_zone->init = ngx_resolver_init_cache_zone;
+                r->cache_zone->data = cache;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "stale=", 6) == 0) {
+            s.len = names[i].len - 6;
+            s.data = names[i].data + 6;
+
+            r->stale = ngx_parse_time(&s, 1);
+
+            if (r->stale == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(names[i].data, "prefetch=", 9) == 0) {
+            s.len = names[i].len - 9;
+            s.data = names[i].data + 9;
+
+            r->prefetch = ngx_parse_time(&s, 1);
+
+            if (r->prefetch == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid parameter: %V", &names[i]);
+                return NULL;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(names[i].data, "ipv6=", 5) == 0) {
 
             if (ngx_strcmp(&names[i].data[5], "on") == 0) {
@@ -519,6 +673,13 @@ ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names, ngx_uint_t n)
         return NULL;
     }
 
+    if ((r->stale || r->prefetch) && r->cache_zone == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"stale\" and \"prefetch\" require "
+                           "\"cache_zone\" in resolver");
+        return NULL;
+    }
+
     return r;
 }
 
@@ -826,7 +987,7 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
     ngx_uint_t            i, naddrs;
     ngx_queue_t          *resend_queue, *expire_queue;
     ngx_rbtree_t         *tree;
-    ngx_resolver_ctx_t   *next, *last;
+    ngx_resolver_ctx_t   *next, *last, *refresh;
     ngx_resolver_addr_t  *addrs;
     ngx_resolver_node_t  *rn;
 
@@ -854,7 +1015,16 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
         /* ctx can be a list after NGX_RESOLVE_CNAME */
         for (last = ctx; last->next; last = last->next);
 
-        if (rn->valid >= ngx_time()) {
+        if (rn->prev
+            && (rn->valid || rn->prev->valid < ngx_time()))
+        {
+            /* the prefetch has been answered or the old answer expired */
+
+            ngx_resolver_free_node(r, rn->prev);
+            rn->prev = NULL;
+        }
+
+        if (rn->valid >= ngx_time() && !ctx->refresh) {
 
             ngx_log_debug0(NGX_LOG_DEBUG_CORE, r->log, 0, "resolve cached");
 
@@ -881,6 +1051,13 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
                     }
                 }
 
+                if (rn->shared && rn->valid < ngx_time() + r->prefetch) {
+                    refresh = ngx_resolver_cache_prefetch(r, name, hash);
+
+                } else {
+                    refresh = NULL;
+                }
+
                 last->next = rn->waiting;
                 rn->waiting = NULL;
 
@@ -915,6 +1092,10 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
                     ngx_resolver_free(r, addrs);
                 }
 
+                if (refresh) {
+                    (void) ngx_resolve_name(refresh);
+                }
+
                 return NGX_OK;
             }
 
@@ -963,6 +1144,18 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
             return NGX_OK;
         }
 
+        if (rn->prev && !ctx->refresh) {
+            return ngx_resolver_prev_answer(r, ctx, rn->prev);
+        }
+
+        if (r->cache_zone && ctx->service.len == 0 && !ctx->refresh) {
+            rc = ngx_resolver_cache_lookup(r, ctx, name, hash);
+
+            if (rc != NGX_DECLINED) {
+                return rc;
+            }
+        }
+
         if (rn->waiting) {
             if (ngx_resolver_set_timeout(r, ctx) != NGX_OK) {
                 return NGX_ERROR;
@@ -983,6 +1176,10 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
 
         ngx_queue_remove(&rn->queue);
 
+        if (ctx->refresh && rn->valid >= ngx_time()) {
+            ngx_resolver_keep_prev(r, rn);
+        }
+
         /* lock alloc mutex */
 
         if (rn->query) {
@@ -1021,6 +1218,14 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
 
     } else {
 
+        if (r->cache_zone && ctx->service.len == 0 && !ctx->refresh) {
+            rc = ngx_resolver_cache_lookup(r, ctx, name, hash);
+
+            if (rc != NGX_DECLINED) {
+                return rc;
+            }
+        }
+
         rn = ngx_resolver_alloc(r, sizeof(ngx_resolver_node_t));
         if (rn == NULL) {
             return NGX_ERROR;
@@ -1038,6 +1243,7 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
 #if (NGX_HAVE_INET6)
         rn->query6 = NULL;
 #endif
+        rn->prev = NULL;
 
         ngx_rbtree_insert(tree, &rn->node);
     }
@@ -1056,6 +1262,10 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
     if (rc == NGX_DECLINED) {
         ngx_rbtree_delete(tree, &rn->node);
 
+        if (rn->prev) {
+            ngx_resolver_free_node(r, rn->prev);
+        }
+
         ngx_resolver_free(r, rn->query);
         ngx_resolver_free(r, rn->name);
         ngx_resolver_free(r, rn);
@@ -1083,6 +1293,7 @@ ngx_resolve_name_locked(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
     rn->naddrs6 = r->ipv6 ? (u_short) -1 : 0;
     rn->tcp6 = 0;
 #endif
+    rn->shared = 0;
     rn->nsrvs = 0;
 
     if (ngx_resolver_send_query(r, rn) != NGX_OK) {
@@ -1129,6 +1340,10 @@ failed:
 
     ngx_rbtree_delete(tree, &rn->node);
 
+    if (rn->prev) {
+        ngx_resolver_free_node(r, rn->prev);
+    }
+
     if (rn->query) {
         ngx_resolver_free(r, rn->query);
     }
@@ -1259,6 +1474,8 @@ ngx_resolve_addr(ngx_resolver_ctx_t *ctx)
             goto failed;
         }
 
+        rn->prev = NULL;
+
         switch (ctx->addr.sockaddr->sa_family) {
 
 #if (NGX_HAVE_INET6)
@@ -2635,6 +2852,10 @@ ngx_resolver_process_a(ngx_resolver_t *r, u_char *buf, size_t n,
 
         ngx_queue_insert_head(&r->name_expire_queue, &rn->queue);
 
+        if (r->cache_zone) {
+            ngx_resolver_cache_store(r, rn);
+        }
+
         next = rn->waiting;
         rn->waiting = NULL;
 
@@ -4326,6 +4547,10 @@ ngx_resolver_free_node(ngx_resolver_t *r, ngx_resolver_node_t *rn)
         ngx_resolver_free_locked(r, rn->u.srvs);
     }
 
+    if (rn->prev) {
+        ngx_resolver_free_node(r, rn->prev);
+    }
+
     ngx_resolver_free_locked(r, rn);
 
     /* unlock alloc mutex */
@@ -4931,3 +5156,632 @@ ngx_resolver_cmp_srvs(const void *one, const void *two)
 
     return p1 - p2;
 }
+
+
+static ngx_int_t
+ngx_resolver_init_cache_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_resolver_cache_t  *ocache = data;
+
+    size_t                 len;
+    ngx_resolver_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool, sizeof(ngx_resolver_cache_sh_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_resolver_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    cache->sh->entries = 0;
+    cache->sh->hits = 0;
+    cache->sh->stale = 0;
+    cache->sh->misses = 0;
+    cache->sh->prefetches = 0;
+
+    len = sizeof(" in resolver cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in resolver cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* old entries are evicted when the zone is full */
+
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_resolver_cache_lookup(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
+    ngx_str_t *name, uint32_t hash)
+{
+    time_t                      now, valid;
+    ngx_uint_t                  naddrs;
+    ngx_resolver_ctx_t         *next, *refresh;
+    ngx_resolver_addr_t        *addrs;
+    ngx_resolver_node_t         rn;
+    ngx_resolver_cache_t       *cache;
+    ngx_resolver_cache_node_t  *cn;
+
+    cache = r->cache_zone->data;
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = ngx_resolver_cache_lookup_node(cache, name, hash);
+
+    if (cn == NULL
+        || cn->valid + r->stale < now
+#if (NGX_HAVE_INET6)
+        || (r->ipv6 && !cn->ipv6)
+        || (!r->ipv6 && cn->naddrs == 0)
+#endif
+       )
+    {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        (void) ngx_atomic_fetch_add(&cache->sh->misses, 1);
+
+        return NGX_DECLINED;
+    }
+
+    /* a node on stack to export the shared addresses */
+
+    ngx_memzero(&rn, sizeof(ngx_resolver_node_t));
+
+    rn.naddrs = cn->naddrs;
+
+    if (cn->naddrs == 1) {
+        rn.u.addr = cn->addrs[0];
+
+    } else {
+        rn.u.addrs = cn->addrs;
+    }
+
+    naddrs = rn.naddrs;
+
+#if (NGX_HAVE_INET6)
+    rn.naddrs6 = r->ipv6 ? cn->naddrs6 : 0;
+
+    if (rn.naddrs6 == 1) {
+        rn.u6.addr6 = ngx_resolver_cache_addrs6(cn)[0];
+
+    } else {
+        rn.u6.addrs6 = ngx_resolver_cache_addrs6(cn);
+    }
+
+    naddrs += rn.naddrs6;
+#endif
+
+    if (naddrs == 1 && rn.naddrs == 1) {
+        addrs = NULL;
+
+    } else {
+        addrs = ngx_resolver_export(r, &rn, 1);
+        if (addrs == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+            return NGX_ERROR;
+        }
+    }
+
+    valid = cn->valid;
+
+    /* the first worker to see an expiring entry refreshes it */
+
+    refresh = NULL;
+
+    if (valid < now + r->prefetch && cn->updating < now) {
+        cn->updating = now + NGX_RESOLVER_REFRESH_TRIES * r->resend_timeout;
+
+        refresh = ngx_resolver_cache_refresh(r, name);
+
+        if (refresh) {
+            (void) ngx_atomic_fetch_add(&cache->sh->prefetches, 1);
+        }
+    }
+
+    ngx_queue_remove(&cn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (valid >= now) {
+        (void) ngx_atomic_fetch_add(&cache->sh->hits, 1);
+
+    } else {
+        (void) ngx_atomic_fetch_add(&cache->sh->stale, 1);
+        valid = now;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolve shared cached, valid:%T refresh:%d",
+                   valid, refresh != NULL);
+
+    do {
+        ctx->state = NGX_OK;
+        ctx->valid = valid;
+        ctx->naddrs = naddrs;
+
+        if (addrs == NULL) {
+            ctx->addrs = &ctx->addr;
+            ctx->addr.sockaddr = (struct sockaddr *) &ctx->sin;
+            ctx->addr.socklen = sizeof(struct sockaddr_in);
+            ngx_memzero(&ctx->sin, sizeof(struct sockaddr_in));
+            ctx->sin.sin_family = AF_INET;
+            ctx->sin.sin_addr.s_addr = rn.u.addr;
+
+        } else {
+            ctx->addrs = addrs;
+        }
+
+        next = ctx->next;
+
+        ctx->handler(ctx);
+
+        ctx = next;
+    } while (ctx);
+
+    if (addrs != NULL) {
+        ngx_resolver_free(r, addrs->sockaddr);
+        ngx_resolver_free(r, addrs);
+    }
+
+    if (refresh) {
+        (void) ngx_resolve_name(refresh);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_resolver_prev_answer(ngx_resolver_t *r, ngx_resolver_ctx_t *ctx,
+    ngx_resolver_node_t *pn)
+{
+    ngx_uint_t            naddrs;
+    ngx_resolver_ctx_t   *next;
+    ngx_resolver_addr_t  *addrs;
+
+    naddrs = pn->naddrs;
+#if (NGX_HAVE_INET6)
+    naddrs += pn->naddrs6;
+#endif
+
+    if (naddrs == 1 && pn->naddrs == 1) {
+        addrs = NULL;
+
+    } else {
+        addrs = ngx_resolver_export(r, pn, 1);
+        if (addrs == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, r->log, 0,
+                   "resolve cached while prefetching, valid:%T", pn->valid);
+
+    do {
+        ctx->state = NGX_OK;
+        ctx->valid = pn->valid;
+        ctx->naddrs = naddrs;
+
+        if (addrs == NULL) {
+            ctx->addrs = &ctx->addr;
+            ctx->addr.sockaddr = (struct sockaddr *) &ctx->sin;
+            ctx->addr.socklen = sizeof(struct sockaddr_in);
+            ngx_memzero(&ctx->sin, sizeof(struct sockaddr_in));
+            ctx->sin.sin_family = AF_INET;
+            ctx->sin.sin_addr.s_addr = pn->u.addr;
+
+        } else {
+            ctx->addrs = addrs;
+        }
+
+        next = ctx->next;
+
+        ctx->handler(ctx);
+
+        ctx = next;
+    } while (ctx);
+
+    if (addrs != NULL) {
+        ngx_resolver_free(r, addrs->sockaddr);
+        ngx_resolver_free(r, addrs);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_resolver_keep_prev(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    ngx_resolver_node_t  *pn;
+
+    /*
+     * a prefetch requeries a node that is still valid: its addresses
+     * move to a bare node and are served until the response arrives
+     */
+
+    if (rn->prev
+        || rn->cnlen
+        || rn->nsrvs
+        || rn->naddrs == (u_short) -1
+#if (NGX_HAVE_INET6)
+        || rn->naddrs6 == (u_short) -1
+        || rn->naddrs + rn->naddrs6 == 0
+#else
+        || rn->naddrs == 0
+#endif
+       )
+    {
+        return;
+    }
+
+    pn = ngx_resolver_calloc(r, sizeof(ngx_resolver_node_t));
+    if (pn == NULL) {
+        return;
+    }
+
+    pn->u = rn->u;
+    pn->naddrs = rn->naddrs;
+#if (NGX_HAVE_INET6)
+    pn->u6 = rn->u6;
+    pn->naddrs6 = rn->naddrs6;
+#endif
+    pn->valid = rn->valid;
+
+    rn->naddrs = 0;
+#if (NGX_HAVE_INET6)
+    rn->naddrs6 = 0;
+#endif
+    rn->prev = pn;
+}
+
+
+static ngx_resolver_ctx_t *
+ngx_resolver_cache_prefetch(ngx_resolver_t *r, ngx_str_t *name,
+    uint32_t hash)
+{
+    time_t                      now;
+    ngx_resolver_ctx_t         *refresh;
+    ngx_resolver_cache_t       *cache;
+    ngx_resolver_cache_node_t  *cn;
+
+    cache = r->cache_zone->data;
+
+    now = ngx_time();
+
+    refresh = NULL;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    cn = ngx_resolver_cache_lookup_node(cache, name, hash);
+
+    /* another worker may have refreshed the entry already */
+
+    if (cn && cn->valid < now + r->prefetch && cn->updating < now) {
+        cn->updating = now + NGX_RESOLVER_REFRESH_TRIES * r->resend_timeout;
+
+        refresh = ngx_resolver_cache_refresh(r, name);
+
+        if (refresh) {
+            (void) ngx_atomic_fetch_add(&cache->sh->prefetches, 1);
+        }
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    return refresh;
+}
+
+
+static ngx_resolver_ctx_t *
+ngx_resolver_cache_refresh(ngx_resolver_t *r, ngx_str_t *name)
+{
+    ngx_resolver_ctx_t  *ctx;
+
+    /* the name is copied as the caller's one may go away */
+
+    ctx = ngx_resolver_calloc(r, sizeof(ngx_resolver_ctx_t) + name->len);
+    if (ctx == NULL) {
+        return NULL;
+    }
+
+    ctx->resolver = r;
+    ctx->name.len = name->len;
+    ctx->name.data = (u_char *) (ctx + 1);
+    ngx_memcpy(ctx->name.data, name->data, name->len);
+
+    ctx->handler = ngx_resolver_cache_refresh_handler;
+    ctx->timeout = NGX_RESOLVER_REFRESH_TRIES * r->resend_timeout * 1000;
+    ctx->cancelable = 1;
+    ctx->refresh = 1;
+
+    return ctx;
+}
+
+
+static void
+ngx_resolver_cache_refresh_handler(ngx_resolver_ctx_t *ctx)
+{
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ctx->resolver->log, 0,
+                   "resolver refreshed \"%V\": %i", &ctx->name, ctx->state);
+
+    /* the response is in the shared cache already, if any */
+
+    ngx_resolve_name_done(ctx);
+}
+
+
+static void
+ngx_resolver_cache_store(ngx_resolver_t *r, ngx_resolver_node_t *rn)
+{
+    size_t                      size;
+    time_t                      now;
+    in_addr_t                  *addr;
+    ngx_str_t                   name;
+    ngx_uint_t                  i, naddrs6;
+    ngx_queue_t                *q;
+    ngx_resolver_cache_t       *cache;
+    ngx_resolver_cache_node_t  *cn;
+#if (NGX_HAVE_INET6)
+    struct in6_addr            *addr6;
+#endif
+
+    cache = r->cache_zone->data;
+
+    name.len = rn->nlen;
+    name.data = rn->name;
+
+#if (NGX_HAVE_INET6)
+    naddrs6 = rn->naddrs6;
+#else
+    naddrs6 = 0;
+#endif
+
+    size = offsetof(ngx_resolver_cache_node_t, addrs)
+           + rn->naddrs * sizeof(in_addr_t)
+           + naddrs6 * sizeof(struct in6_addr)
+           + rn->nlen;
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    /* drop one or two entries that are too old even to be served stale */
+
+    for (i = 0; i < 2; i++) {
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            break;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+        cn = ngx_queue_data(q, ngx_resolver_cache_node_t, queue);
+
+        if (cn->valid + r->stale >= now) {
+            break;
+        }
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->sh->rbtree, &cn->node);
+        ngx_slab_free_locked(cache->shpool, cn);
+        cache->sh->entries--;
+    }
+
+    cn = ngx_resolver_cache_lookup_node(cache, &name, rn->node.key);
+
+    if (cn && (cn->naddrs != rn->naddrs || cn->naddrs6 != naddrs6)) {
+        ngx_queue_remove(&cn->queue);
+        ngx_rbtree_delete(&cache->sh->rbtree, &cn->node);
+        ngx_slab_free_locked(cache->shpool, cn);
+        cache->sh->entries--;
+
+        cn = NULL;
+    }
+
+    if (cn == NULL) {
+
+        for ( ;; ) {
+            cn = ngx_slab_alloc_locked(cache->shpool, size);
+
+            if (cn || ngx_queue_empty(&cache->sh->queue)) {
+                break;
+            }
+
+            /* evict the least recently used entry */
+
+            q = ngx_queue_last(&cache->sh->queue);
+            cn = ngx_queue_data(q, ngx_resolver_cache_node_t, queue);
+
+            ngx_queue_remove(q);
+            ngx_rbtree_delete(&cache->sh->rbtree, &cn->node);
+            ngx_slab_free_locked(cache->shpool, cn);
+            cache->sh->entries--;
+        }
+
+        if (cn == NULL) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+
+            ngx_log_error(NGX_LOG_ALERT, r->log, 0,
+                          "could not allocate node%s",
+                          cache->shpool->log_ctx);
+            return;
+        }
+
+        cn->node.key = rn->node.key;
+        cn->nlen = rn->nlen;
+        cn->naddrs = rn->naddrs;
+        cn->naddrs6 = (u_short) naddrs6;
+
+        ngx_memcpy(ngx_resolver_cache_name(cn), rn->name, rn->nlen);
+
+        ngx_rbtree_insert(&cache->sh->rbtree, &cn->node);
+        cache->sh->entries++;
+
+    } else {
+        ngx_queue_remove(&cn->queue);
+    }
+
+    ngx_queue_insert_head(&cache->sh->queue, &cn->queue);
+
+    addr = (rn->naddrs == 1) ? &rn->u.addr : rn->u.addrs;
+    ngx_memcpy(cn->addrs, addr, rn->naddrs * sizeof(in_addr_t));
+
+#if (NGX_HAVE_INET6)
+    addr6 = (rn->naddrs6 == 1) ? &rn->u6.addr6 : rn->u6.addrs6;
+    ngx_memcpy(ngx_resolver_cache_addrs6(cn), addr6,
+               rn->naddrs6 * sizeof(struct in6_addr));
+
+    cn->ipv6 = (u_char) r->ipv6;
+#else
+    cn->ipv6 = 0;
+#endif
+
+    cn->valid = rn->valid;
+    cn->updating = 0;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    rn->shared = 1;
+}
+
+
+static ngx_resolver_cache_node_t *
+ngx_resolver_cache_lookup_node(ngx_resolver_cache_t *cache, ngx_str_t *name,
+    uint32_t hash)
+{
+    ngx_int_t                   rc;
+    ngx_rbtree_node_t          *node, *sentinel;
+    ngx_resolver_cache_node_t  *cn;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        cn = (ngx_resolver_cache_node_t *) node;
+
+        rc = ngx_memn2cmp(name->data, ngx_resolver_cache_name(cn),
+                          name->len, cn->nlen);
+
+        if (rc == 0) {
+            return cn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static void
+ngx_resolver_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t          **p;
+    ngx_resolver_cache_node_t   *cn, *cn_temp;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            cn = (ngx_resolver_cache_node_t *) node;
+            cn_temp = (ngx_resolver_cache_node_t *) temp;
+
+            p = (ngx_memn2cmp(ngx_resolver_cache_name(cn),
+                              ngx_resolver_cache_name(cn_temp),
+                              cn->nlen, cn_temp->nlen)
+                 < 0) ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+ngx_int_t
+ngx_resolver_cache_stat(ngx_shm_zone_t *shm_zone,
+    ngx_resolver_cache_stat_t *stat)
+{
+    ngx_resolver_cache_t  *cache;
+
+    if (shm_zone->tag != &ngx_resolver_cache_tag) {
+        return NGX_DECLINED;
+    }
+
+    cache = shm_zone->data;
+
+    if (cache == NULL || cache->sh == NULL) {
+        return NGX_DECLINED;
+    }
+
+    stat->hits = cache->sh->hits;
+    stat->stale = cache->sh->stale;
+    stat->misses = cache->sh->misses;
+    stat->prefetches = cache->sh->prefetches;
+    stat->entries = cache->sh->entries;
+
+    return NGX_OK;
+}
@@ -89,7 +89,9 @@ typedef struct {
 } ngx_resolver_srv_name_t;
 
 
-typedef struct {
+typedef struct ngx_resolver_node_s  ngx_resolver_node_t;
+
+struct ngx_resolver_node_s {
     ngx_rbtree_node_t         node;
     ngx_queue_t               queue;
 
@@ -138,11 +140,15 @@ typedef struct {
 #if (NGX_HAVE_INET6)
     unsigned                  tcp6:1;
 #endif
+    unsigned                  shared:1;
 
     ngx_uint_t                last_connection;
 
     ngx_resolver_ctx_t       *waiting;
-} ngx_resolver_node_t;
+
+    /* addresses served while a prefetch of the name is in flight */
+    ngx_resolver_node_t      *prev;
+};
 
 
 struct ngx_resolver_s {
@@ -188,6 +194,11 @@ struct ngx_resolver_s {
     time_t                    expire;
     time_t                    valid;
 
+    /* shared cache of name lookups */
+    ngx_shm_zone_t           *cache_zone;
+    time_t                    stale;
+    time_t                    prefetch;
+
     ngx_uint_t                log_level;
 };
 
@@ -221,11 +232,21 @@ struct ngx_resolver_ctx_s {
     unsigned                  quick:1;
     unsigned                  async:1;
     unsigned                  cancelable:1;
+    unsigned                  refresh:1;
     ngx_uint_t                recursion;
     ngx_event_t              *event;
 };
 
 
+typedef struct {
+    ngx_atomic_uint_t         hits;
+    ngx_atomic_uint_t         stale;
+    ngx_atomic_uint_t         misses;
+    ngx_atomic_uint_t         prefetches;
+    ngx_uint_t                entries;
+} ngx_resolver_cache_stat_t;
+
+
 ngx_resolver_t *ngx_resolver_create(ngx_conf_t *cf, ngx_str_t *names,
     ngx_uint_t n);
 ngx_resolver_ctx_t *ngx_resolve_start(ngx_resolver_t *r,
@@ -235,6 +256,8 @@ void ngx_resolve_name_done(ngx_resolver_ctx_t *ctx);
 ngx_int_t ngx_resolve_addr(ngx_resolver_ctx_t *ctx);
 void ngx_resolve_addr_done(ngx_resolver_ctx_t *ctx);
 char *ngx_resolver_strerror(ngx_int_t err);
+ngx_int_t ngx_resolver_cache_stat(ngx_shm_zone_t *shm_zone,
+    ngx_resolver_cache_stat_t *stat);
 
 
 #endif /* _NGX_RESOLVER_H_INCLUDED_ */
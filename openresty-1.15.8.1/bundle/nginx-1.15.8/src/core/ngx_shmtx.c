@@ -12,13 +12,39 @@
 #if (NGX_HAVE_ATOMIC_OPS)
 
 
+/*
+ * a spinning waiter gives up after twice the average number of pauses
+ * the recent contended acquisitions needed, but never after less than
+ * NGX_SHMTX_SPIN_MIN or more than mtx->spin pauses
+ */
+
+#define NGX_SHMTX_SPIN_MIN  16
+
+
+#if (NGX_HAVE_FUTEX)
+
+/* the futex word is the low 32 bits of the wait word */
+
+#if (NGX_HAVE_LITTLE_ENDIAN)
+#define ngx_shmtx_futex(mtx)  ((uint32_t *) (mtx)->wait)
+#else
+#define ngx_shmtx_futex(mtx)                                                  \
+    ((uint32_t *) (mtx)->wait + sizeof(ngx_atomic_t) / sizeof(uint32_t) - 1)
+#endif
+
+#endif
+
+
+static void ngx_shmtx_wait(ngx_shmtx_t *mtx);
 static void ngx_shmtx_wakeup(ngx_shmtx_t *mtx);
+static uint64_t ngx_shmtx_time(void);
 
 
 ngx_int_t
 ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 {
     mtx->lock = &addr->lock;
+    mtx->sh = addr;
 
     if (mtx->spin == (ngx_uint_t) -1) {
         return NGX_OK;
@@ -26,7 +52,11 @@ ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 
     mtx->spin = 2048;
 
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_FUTEX)
+
+    mtx->wait = &addr->wait;
+
+#elif (NGX_HAVE_POSIX_SEM)
 
     mtx->wait = &addr->wait;
 
@@ -46,7 +76,7 @@ ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 void
 ngx_shmtx_destroy(ngx_shmtx_t *mtx)
 {
-#if (NGX_HAVE_POSIX_SEM)
+#if (NGX_HAVE_POSIX_SEM && !NGX_HAVE_FUTEX)
 
     if (mtx->semaphore) {
         if (sem_destroy(&mtx->sem) == -1) {
@@ -62,39 +92,176 @@ ngx_shmtx_destroy(ngx_shmtx_t *mtx)
 ngx_uint_t
 ngx_shmtx_trylock(ngx_shmtx_t *mtx)
 {
-    return (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid));
+    if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+        mtx->sh->stat.acquired++;
+        return 1;
+    }
+
+    return 0;
 }
 
 
 void
 ngx_shmtx_lock(ngx_shmtx_t *mtx)
 {
-    ngx_uint_t         i, n;
+    uint64_t           start;
+    ngx_uint_t         n, max;
+    ngx_shmtx_sh_t    *sh;
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx lock");
 
+    sh = mtx->sh;
+
+    if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+        sh->stat.acquired++;
+        return;
+    }
+
+    start = ngx_shmtx_time();
+
+    n = 0;
+
+    if (ngx_ncpu > 1) {
+
+        max = 2 * (ngx_uint_t) sh->spins + NGX_SHMTX_SPIN_MIN;
+
+        if (max > mtx->spin) {
+            max = mtx->spin;
+        }
+
+        for (n = 1; n <= max; n++) {
+
+            ngx_cpu_pause();
+
+            if (*mtx->lock == 0
+                && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid))
+            {
+                /* the lock owner updates the average */
+                sh->spins += ((ngx_atomic_int_t) n - sh->spins) / 8;
+                goto locked;
+            }
+        }
+    }
+
+    ngx_shmtx_wait(mtx);
+
+    /* spinning did not pay off, spin less next time */
+
+    sh->spins -= sh->spins / 8;
+
+locked:
+
+    sh->stat.acquired++;
+    sh->stat.contended++;
+    sh->stat.wait_time += ngx_shmtx_time() - start;
+}
+
+
+void
+ngx_shmtx_unlock(ngx_shmtx_t *mtx)
+{
+    if (mtx->spin != (ngx_uint_t) -1) {
+        ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx unlock");
+    }
+
+    if (ngx_atomic_cmp_set(mtx->lock, ngx_pid, 0)) {
+        ngx_shmtx_wakeup(mtx);
+    }
+}
+
+
+ngx_uint_t
+ngx_shmtx_force_unlock(ngx_shmtx_t *mtx, ngx_pid_t pid)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shmtx forced unlock");
+
+    if (ngx_atomic_cmp_set(mtx->lock, pid, 0)) {
+        ngx_shmtx_wakeup(mtx);
+        return 1;
+    }
+
+    return 0;
+}
+
+
+#if (NGX_HAVE_FUTEX)
+
+/*
+ * the wait word is set by each waiter before it tests the lock
+ * and goes to sleep, and is cleared by the unlock that wakes one waiter;
+ * the woken waiter sets it again, so a lock passed between sleeping
+ * waiters costs one FUTEX_WAKE per unlock at most
+ */
+
+static void
+ngx_shmtx_wait(ngx_shmtx_t *mtx)
+{
+    ngx_err_t  err;
+
     for ( ;; ) {
 
+        /* a locked operation orders the store before the lock test */
+
+        (void) ngx_atomic_cmp_set(mtx->wait, 0, 1);
+
         if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
             return;
         }
 
-        if (ngx_ncpu > 1) {
-
-            for (n = 1; n < mtx->spin; n <<= 1) {
+        ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx wait");
 
-                for (i = 0; i < n; i++) {
-                    ngx_cpu_pause();
-                }
+        if (syscall(SYS_futex, ngx_shmtx_futex(mtx), FUTEX_WAIT, 1,
+                    NULL, NULL, 0)
+            == -1)
+        {
+            err = ngx_errno;
 
-                if (*mtx->lock == 0
-                    && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid))
-                {
-                    return;
-                }
+            if (err != NGX_EAGAIN && err != NGX_EINTR) {
+                ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, err,
+                              "futex() failed while waiting on shmtx");
+                ngx_sched_yield();
             }
         }
 
+        ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                       "shmtx awoke");
+    }
+}
+
+
+static void
+ngx_shmtx_wakeup(ngx_shmtx_t *mtx)
+{
+    if (mtx->spin == (ngx_uint_t) -1
+        || *mtx->wait == 0
+        || !ngx_atomic_cmp_set(mtx->wait, 1, 0))
+    {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx wake");
+
+    if (syscall(SYS_futex, ngx_shmtx_futex(mtx), FUTEX_WAKE, 1,
+                NULL, NULL, 0)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "futex() failed while wake shmtx");
+    }
+}
+
+#else
+
+static void
+ngx_shmtx_wait(ngx_shmtx_t *mtx)
+{
+    for ( ;; ) {
+
+        if (*mtx->lock == 0 && ngx_atomic_cmp_set(mtx->lock, 0, ngx_pid)) {
+            return;
+        }
+
 #if (NGX_HAVE_POSIX_SEM)
 
         if (mtx->semaphore) {
@@ -133,34 +300,6 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
 }
 
 
-void
-ngx_shmtx_unlock(ngx_shmtx_t *mtx)
-{
-    if (mtx->spin != (ngx_uint_t) -1) {
-        ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0, "shmtx unlock");
-    }
-
-    if (ngx_atomic_cmp_set(mtx->lock, ngx_pid, 0)) {
-        ngx_shmtx_wakeup(mtx);
-    }
-}
-
-
-ngx_uint_t
-ngx_shmtx_force_unlock(ngx_shmtx_t *mtx, ngx_pid_t pid)
-{
-    ngx_log_debug0(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
-                   "shmtx forced unlock");
-
-    if (ngx_atomic_cmp_set(mtx->lock, pid, 0)) {
-        ngx_shmtx_wakeup(mtx);
-        return 1;
-    }
-
-    return 0;
-}
-
-
 static void
 ngx_shmtx_wakeup(ngx_shmtx_t *mtx)
 {
@@ -195,6 +334,27 @@ ngx_shmtx_wakeup(ngx_shmtx_t *mtx)
 #endif
 }
 
+#endif
+
+
+static uint64_t
+ngx_shmtx_time(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval   tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
 
 #else
 
@@ -206,6 +366,7 @@ ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
 
         if (ngx_strcmp(name, mtx->name) == 0) {
             mtx->name = name;
+            mtx->sh = addr;
             return NGX_OK;
         }
 
@@ -227,6 +388,7 @@ ngx_shmtx_create(ngx_shmtx_t *mtx, ngx_shmtx_sh_t *addr, u_char *name)
     }
 
     mtx->name = name;
+    mtx->sh = addr;
 
     return NGX_OK;
 }
@@ -250,6 +412,7 @@ ngx_shmtx_trylock(ngx_shmtx_t *mtx)
     err = ngx_trylock_fd(mtx->fd);
 
     if (err == 0) {
+        mtx->sh->stat.acquired++;
         return 1;
     }
 
@@ -279,6 +442,7 @@ ngx_shmtx_lock(ngx_shmtx_t *mtx)
     err = ngx_lock_fd(mtx->fd);
 
     if (err == 0) {
+        mtx->sh->stat.acquired++;
         return;
     }
 
@@ -308,3 +472,12 @@ ngx_shmtx_force_unlock(ngx_shmtx_t *mtx, ngx_pid_t pid)
 }
 
 #endif
+
+
+void
+ngx_shmtx_stat(ngx_shmtx_t *mtx, ngx_shmtx_stat_t *stat)
+{
+    /* the counters are read without locking */
+
+    *stat = mtx->sh->stat;
+}
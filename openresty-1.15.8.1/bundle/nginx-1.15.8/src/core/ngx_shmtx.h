@@ -14,26 +14,40 @@
 
 
 typedef struct {
-    ngx_atomic_t   lock;
-#if (NGX_HAVE_POSIX_SEM)
-    ngx_atomic_t   wait;
+    ngx_atomic_uint_t  acquired;
+    ngx_atomic_uint_t  contended;
+    uint64_t           wait_time;       /* nanoseconds */
+} ngx_shmtx_stat_t;
+
+
+typedef struct {
+    ngx_atomic_t       lock;
+#if (NGX_HAVE_FUTEX || NGX_HAVE_POSIX_SEM)
+    ngx_atomic_t       wait;
 #endif
+
+    /* updated by the lock owner */
+    ngx_atomic_int_t   spins;
+    ngx_shmtx_stat_t   stat;
 } ngx_shmtx_sh_t;
 
 
 typedef struct {
 #if (NGX_HAVE_ATOMIC_OPS)
-    ngx_atomic_t  *lock;
-#if (NGX_HAVE_POSIX_SEM)
-    ngx_atomic_t  *wait;
-    ngx_uint_t     semaphore;
-    sem_t          sem;
+    ngx_atomic_t      *lock;
+#if (NGX_HAVE_FUTEX)
+    ngx_atomic_t      *wait;
+#elif (NGX_HAVE_POSIX_SEM)
+    ngx_atomic_t      *wait;
+    ngx_uint_t         semaphore;
+    sem_t              sem;
 #endif
 #else
-    ngx_fd_t       fd;
-    u_char        *name;
+    ngx_fd_t           fd;
+    u_char            *name;
 #endif
-    ngx_uint_t     spin;
+    ngx_shmtx_sh_t    *sh;
+    ngx_uint_t         spin;
 } ngx_shmtx_t;
 
 
@@ -44,6 +58,7 @@ ngx_uint_t ngx_shmtx_trylock(ngx_shmtx_t *mtx);
 void ngx_shmtx_lock(ngx_shmtx_t *mtx);
 void ngx_shmtx_unlock(ngx_shmtx_t *mtx);
 ngx_uint_t ngx_shmtx_force_unlock(ngx_shmtx_t *mtx, ngx_pid_t pid);
+void ngx_shmtx_stat(ngx_shmtx_t *mtx, ngx_shmtx_stat_t *stat);
 
 
 #endif /* _NGX_SHMTX_H_INCLUDED_ */
@@ -69,6 +69,32 @@
 
 #endif
 
+struct ngx_slab_cache_s {
+    ngx_uint_t        hits;
+    ngx_uint_t        misses;
+    ngx_uint_t        locks;
+
+    ngx_uint_t        size;
+    ngx_uint_t        cached;
+
+    /* chunks cached per slot, "size" entries per slot */
+    ngx_uint_t       *n;
+    void            **chunks;
+};
+
+
+static void *ngx_slab_alloc_list(ngx_slab_pool_t *pool, size_t size);
+static void ngx_slab_free_list(ngx_slab_pool_t *pool, void *p);
+static ngx_slab_cache_t *ngx_slab_cache_get(ngx_slab_pool_t *pool);
+static ngx_slab_cache_t *ngx_slab_cache_create_locked(ngx_slab_pool_t *pool);
+static void *ngx_slab_cache_alloc(ngx_slab_pool_t *pool,
+    ngx_slab_cache_t *cache, size_t size);
+static void *ngx_slab_cache_refill_locked(ngx_slab_pool_t *pool,
+    ngx_slab_cache_t *cache, size_t size);
+static ngx_int_t ngx_slab_cache_free(ngx_slab_pool_t *pool,
+    ngx_slab_cache_t *cache, void *p, ngx_uint_t locked);
+static void ngx_slab_cache_flush_locked(ngx_slab_pool_t *pool,
+    ngx_slab_cache_t *cache);
 static ngx_slab_page_t *ngx_slab_alloc_pages(ngx_slab_pool_t *pool,
     ngx_uint_t pages);
 static void ngx_slab_free_pages(ngx_slab_pool_t *pool, ngx_slab_page_t *page,
@@ -159,6 +185,9 @@ ngx_slab_init(ngx_slab_pool_t *pool)
     pool->last = pool->pages + pages;
     pool->pfree = pages;
 
+    pool->cache_size = 0;
+    pool->caches = NULL;
+
     pool->log_nomem = 1;
     pool->log_ctx = &pool->zero;
     pool->zero = '\0';
@@ -168,7 +197,19 @@ ngx_slab_init(ngx_slab_pool_t *pool)
 void *
 ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 {
-    void  *p;
+    void              *p;
+    ngx_slab_cache_t  *cache;
+
+    cache = ngx_slab_cache_get(pool);
+
+    if (cache) {
+        p = ngx_slab_cache_alloc(pool, cache, size);
+        if (p) {
+            return p;
+        }
+
+        cache->locks++;
+    }
 
     ngx_shmtx_lock(&pool->mutex);
 
@@ -182,6 +223,31 @@ ngx_slab_alloc(ngx_slab_pool_t *pool, size_t size)
 
 void *
 ngx_slab_alloc_locked(ngx_slab_pool_t *pool, size_t size)
+{
+    void              *p;
+    ngx_slab_cache_t  *cache;
+
+    cache = ngx_slab_cache_get(pool);
+
+    if (cache == NULL) {
+        cache = ngx_slab_cache_create_locked(pool);
+
+        if (cache == NULL) {
+            return ngx_slab_alloc_list(pool, size);
+        }
+    }
+
+    p = ngx_slab_cache_alloc(pool, cache, size);
+    if (p) {
+        return p;
+    }
+
+    return ngx_slab_cache_refill_locked(pool, cache, size);
+}
+
+
+static void *
+ngx_slab_alloc_list(ngx_slab_pool_t *pool, size_t size)
 {
     size_t            s;
     uintptr_t         p, m, mask, *bitmap;
@@ -422,11 +488,10 @@ ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size)
 {
     void  *p;
 
-    ngx_shmtx_lock(&pool->mutex);
-
-    p = ngx_slab_calloc_locked(pool, size);
-
-    ngx_shmtx_unlock(&pool->mutex);
+    p = ngx_slab_alloc(pool, size);
+    if (p) {
+        ngx_memzero(p, size);
+    }
 
     return p;
 }
@@ -449,6 +514,18 @@ ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size)
 void
 ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 {
+    ngx_slab_cache_t  *cache;
+
+    cache = ngx_slab_cache_get(pool);
+
+    if (cache) {
+        if (ngx_slab_cache_free(pool, cache, p, 0) == NGX_OK) {
+            return;
+        }
+
+        cache->locks++;
+    }
+
     ngx_shmtx_lock(&pool->mutex);
 
     ngx_slab_free_locked(pool, p);
@@ -459,6 +536,21 @@ ngx_slab_free(ngx_slab_pool_t *pool, void *p)
 
 void
 ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p)
+{
+    ngx_slab_cache_t  *cache;
+
+    cache = ngx_slab_cache_get(pool);
+
+    if (cache && ngx_slab_cache_free(pool, cache, p, 1) == NGX_OK) {
+        return;
+    }
+
+    ngx_slab_free_list(pool, p);
+}
+
+
+static void
+ngx_slab_free_list(ngx_slab_pool_t *pool, void *p)
 {
     size_t            size;
     uintptr_t         slab, m, *bitmap;
@@ -675,6 +767,348 @@ fail:
 }
 
 
+void
+ngx_slab_cache_flush(ngx_slab_pool_t *pool)
+{
+    ngx_slab_cache_t  *cache;
+
+    if (pool->caches == NULL || ngx_process_slot < 0) {
+        return;
+    }
+
+    cache = pool->caches[ngx_process_slot];
+
+    if (cache == NULL || cache->cached == 0) {
+        return;
+    }
+
+    ngx_shmtx_lock(&pool->mutex);
+
+    ngx_slab_cache_flush_locked(pool, cache);
+
+    ngx_shmtx_unlock(&pool->mutex);
+}
+
+
+void
+ngx_slab_cache_stat(ngx_slab_pool_t *pool, ngx_slab_cache_stat_t *stat)
+{
+    ngx_uint_t         i;
+    ngx_slab_cache_t  *cache;
+
+    ngx_memzero(stat, sizeof(ngx_slab_cache_stat_t));
+
+    if (pool->caches == NULL) {
+        return;
+    }
+
+    /* the counters are updated by their owners without locking */
+
+    for (i = 0; i < NGX_MAX_PROCESSES; i++) {
+        cache = pool->caches[i];
+
+        if (cache == NULL) {
+            continue;
+        }
+
+        stat->hits += cache->hits;
+        stat->misses += cache->misses;
+        stat->locks += cache->locks;
+        stat->cached += cache->cached;
+    }
+}
+
+
+static ngx_slab_cache_t *
+ngx_slab_cache_get(ngx_slab_pool_t *pool)
+{
+    if (pool->cache_size == 0
+        || pool->caches == NULL
+        || ngx_process != NGX_PROCESS_WORKER
+        || ngx_process_slot < 0)
+    {
+        return NULL;
+    }
+
+    return pool->caches[ngx_process_slot];
+}
+
+
+static ngx_slab_cache_t *
+ngx_slab_cache_create_locked(ngx_slab_pool_t *pool)
+{
+    size_t             size;
+    ngx_uint_t         n;
+    ngx_slab_cache_t  *cache;
+
+    if (pool->cache_size == 0
+        || ngx_process != NGX_PROCESS_WORKER
+        || ngx_process_slot < 0)
+    {
+        return NULL;
+    }
+
+    if (pool->caches == NULL) {
+        size = NGX_MAX_PROCESSES * sizeof(ngx_slab_cache_t *);
+
+        pool->caches = ngx_slab_alloc_list(pool, size);
+        if (pool->caches == NULL) {
+            goto failed;
+        }
+
+        ngx_memzero(pool->caches, size);
+    }
+
+    /*
+     * a process respawned in the same slot adopts the cache left
+     * by its predecessor along with the chunks still cached there
+     */
+
+    cache = pool->caches[ngx_process_slot];
+
+    if (cache == NULL) {
+        n = ngx_pagesize_shift - pool->min_shift;
+
+        size = sizeof(ngx_slab_cache_t) + n * sizeof(ngx_uint_t)
+               + n * pool->cache_size * sizeof(void *);
+
+        cache = ngx_slab_alloc_list(pool, size);
+        if (cache == NULL) {
+            goto failed;
+        }
+
+        ngx_memzero(cache, size);
+
+        cache->size = pool->cache_size;
+        cache->n = (ngx_uint_t *) &cache[1];
+        cache->chunks = (void **) &cache->n[n];
+
+        pool->caches[ngx_process_slot] = cache;
+    }
+
+    return cache;
+
+failed:
+
+    /* fall back to the shared lists for good */
+
+    pool->cache_size = 0;
+
+    ngx_slab_error(pool, NGX_LOG_WARN,
+                   "ngx_slab_alloc() failed: no memory for worker cache");
+
+    return NULL;
+}
+
+
+static void *
+ngx_slab_cache_alloc(ngx_slab_pool_t *pool, ngx_slab_cache_t *cache,
+    size_t size)
+{
+    void        *p;
+    size_t       s;
+    ngx_uint_t   slot, shift;
+
+    if (size > ngx_slab_max_size) {
+        return NULL;
+    }
+
+    if (size > pool->min_size) {
+        shift = 1;
+        for (s = size - 1; s >>= 1; shift++) { /* void */ }
+        slot = shift - pool->min_shift;
+
+    } else {
+        slot = 0;
+    }
+
+    if (cache->n[slot] == 0) {
+        return NULL;
+    }
+
+    cache->hits++;
+    cache->cached--;
+
+    p = cache->chunks[slot * cache->size + --cache->n[slot]];
+
+    ngx_log_debug2(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab cache alloc: %uz %p", size, p);
+
+    return p;
+}
+
+
+static void *
+ngx_slab_cache_refill_locked(ngx_slab_pool_t *pool, ngx_slab_cache_t *cache,
+    size_t size)
+{
+    void        *p, *chunk, **chunks;
+    size_t       s;
+    ngx_uint_t   i, slot, shift, batch, fails, nomem;
+
+    if (size > ngx_slab_max_size) {
+
+        /* pages are not cached, though cached chunks may hold them */
+
+        slot = 0;
+        shift = 0;
+
+    } else if (size > pool->min_size) {
+        shift = 1;
+        for (s = size - 1; s >>= 1; shift++) { /* void */ }
+        slot = shift - pool->min_shift;
+
+    } else {
+        shift = pool->min_shift;
+        slot = 0;
+    }
+
+    if (shift) {
+        cache->misses++;
+        size = (size_t) 1 << shift;
+    }
+
+    /*
+     * chunks cached by this worker may be all that is left
+     * in the zone, so return them before giving up
+     */
+
+    nomem = pool->log_nomem;
+
+    if (cache->cached) {
+        pool->log_nomem = 0;
+    }
+
+    p = ngx_slab_alloc_list(pool, size);
+
+    pool->log_nomem = nomem;
+
+    if (p == NULL && cache->cached) {
+        ngx_slab_cache_flush_locked(pool, cache);
+        p = ngx_slab_alloc_list(pool, size);
+    }
+
+    if (p == NULL || shift == 0) {
+        return p;
+    }
+
+    /* refill up to a half; a short refill is not a failure */
+
+    chunks = &cache->chunks[slot * cache->size];
+    batch = (cache->size + 1) / 2;
+    fails = pool->stats[slot].fails;
+    pool->log_nomem = 0;
+
+    for (i = 0; i < batch; i++) {
+        chunk = ngx_slab_alloc_list(pool, size);
+        if (chunk == NULL) {
+            break;
+        }
+
+        chunks[cache->n[slot]++] = chunk;
+        cache->cached++;
+    }
+
+    pool->log_nomem = nomem;
+    pool->stats[slot].fails = fails;
+
+    return p;
+}
+
+
+static ngx_int_t
+ngx_slab_cache_free(ngx_slab_pool_t *pool, ngx_slab_cache_t *cache, void *p,
+    ngx_uint_t locked)
+{
+    void             **chunks;
+    ngx_uint_t         i, n, slot, shift, half;
+    ngx_slab_page_t   *page;
+
+    if ((u_char *) p < pool->start || (u_char *) p >= pool->end) {
+        return NGX_DECLINED;
+    }
+
+    page = &pool->pages[((u_char *) p - pool->start) >> ngx_pagesize_shift];
+
+    switch (ngx_slab_page_type(page)) {
+
+    case NGX_SLAB_SMALL:
+    case NGX_SLAB_BIG:
+        shift = page->slab & NGX_SLAB_SHIFT_MASK;
+        break;
+
+    case NGX_SLAB_EXACT:
+        shift = ngx_slab_exact_shift;
+        break;
+
+    default: /* NGX_SLAB_PAGE */
+        return NGX_DECLINED;
+    }
+
+    /* let ngx_slab_free_list() report bad pointers */
+
+    if ((uintptr_t) p & (((uintptr_t) 1 << shift) - 1)) {
+        return NGX_DECLINED;
+    }
+
+    slot = shift - pool->min_shift;
+    chunks = &cache->chunks[slot * cache->size];
+    n = cache->n[slot];
+
+    if (n == cache->size) {
+
+        if (!locked) {
+            return NGX_BUSY;
+        }
+
+        /* return the older half to the shared lists */
+
+        half = (n + 1) / 2;
+
+        for (i = 0; i < half; i++) {
+            ngx_slab_free_list(pool, chunks[i]);
+        }
+
+        n -= half;
+        ngx_memmove(chunks, &chunks[half], n * sizeof(void *));
+
+        cache->cached -= half;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, ngx_cycle->log, 0,
+                   "slab cache free: %p", p);
+
+    chunks[n++] = p;
+
+    cache->n[slot] = n;
+    cache->cached++;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_slab_cache_flush_locked(ngx_slab_pool_t *pool, ngx_slab_cache_t *cache)
+{
+    void       **chunks;
+    ngx_uint_t   i, slot, n;
+
+    n = ngx_pagesize_shift - pool->min_shift;
+
+    for (slot = 0; slot < n; slot++) {
+        chunks = &cache->chunks[slot * cache->size];
+
+        for (i = 0; i < cache->n[slot]; i++) {
+            ngx_slab_free_list(pool, chunks[i]);
+        }
+
+        cache->n[slot] = 0;
+    }
+
+    cache->cached = 0;
+}
+
+
 static ngx_slab_page_t *
 ngx_slab_alloc_pages(ngx_slab_pool_t *pool, ngx_uint_t pages)
 {
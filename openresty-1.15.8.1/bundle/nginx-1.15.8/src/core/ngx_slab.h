@@ -31,6 +31,17 @@ typedef struct {
 } ngx_slab_stat_t;
 
 
+typedef struct ngx_slab_cache_s  ngx_slab_cache_t;
+
+
+typedef struct {
+    ngx_uint_t        hits;
+    ngx_uint_t        misses;
+    ngx_uint_t        locks;
+    ngx_uint_t        cached;
+} ngx_slab_cache_stat_t;
+
+
 typedef struct {
     ngx_shmtx_sh_t    lock;
 
@@ -44,6 +55,10 @@ typedef struct {
     ngx_slab_stat_t  *stats;
     ngx_uint_t        pfree;
 
+    /* per-worker chunk caches, indexed by ngx_process_slot */
+    ngx_uint_t        cache_size;
+    ngx_slab_cache_t **caches;
+
     u_char           *start;
     u_char           *end;
 
@@ -67,6 +82,8 @@ void *ngx_slab_calloc(ngx_slab_pool_t *pool, size_t size);
 void *ngx_slab_calloc_locked(ngx_slab_pool_t *pool, size_t size);
 void ngx_slab_free(ngx_slab_pool_t *pool, void *p);
 void ngx_slab_free_locked(ngx_slab_pool_t *pool, void *p);
+void ngx_slab_cache_flush(ngx_slab_pool_t *pool);
+void ngx_slab_cache_stat(ngx_slab_pool_t *pool, ngx_slab_cache_stat_t *stat);
 
 
 #endif /* _NGX_SLAB_H_INCLUDED_ */
@@ -26,11 +26,38 @@ typedef struct {
     (q)->last = &(q)->first
 
 
-struct ngx_thread_pool_s {
+/*
+ * each thread owns a queue per priority; the event loop posts tasks
+ * to an idle thread if there is one, and an idle thread steals tasks
+ * queued to busy ones before it goes to sleep
+ */
+
+typedef struct {
     ngx_thread_mutex_t        mtx;
-    ngx_thread_pool_queue_t   queue;
-    ngx_int_t                 waiting;
+    ngx_thread_pool_queue_t   queue[2];
     ngx_thread_cond_t         cond;
+    ngx_uint_t                wakeup;
+    ngx_atomic_t              sleeping;
+
+    ngx_thread_pool_t        *tp;
+
+    /* updated by the thread only */
+    ngx_uint_t                tasks;
+    ngx_uint_t                stolen;
+    uint64_t                  wait_time;
+    uint64_t                  run_time;
+    ngx_uint_t                wait_hist[NGX_THREAD_POOL_HIST];
+    ngx_uint_t                run_hist[NGX_THREAD_POOL_HIST];
+} ngx_thread_pool_thread_t;
+
+
+struct ngx_thread_pool_s {
+    ngx_thread_pool_thread_t *thread;
+    ngx_uint_t                next;
+
+    ngx_atomic_t              waiting;
+    ngx_atomic_t              idle;
+    ngx_int_t                 max_waiting;
 
     ngx_log_t                *log;
 
@@ -48,8 +75,15 @@ static ngx_int_t ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log,
 static void ngx_thread_pool_destroy(ngx_thread_pool_t *tp);
 static void ngx_thread_pool_exit_handler(void *data, ngx_log_t *log);
 
+static ngx_int_t ngx_thread_pool_wakeup(ngx_thread_pool_thread_t *thr,
+    ngx_thread_task_t *task);
 static void *ngx_thread_pool_cycle(void *data);
+static ngx_thread_task_t *ngx_thread_pool_next(ngx_thread_pool_thread_t *thr);
+static ngx_thread_task_t *ngx_thread_pool_take(ngx_thread_pool_thread_t *thr,
+    ngx_uint_t prio);
 static void ngx_thread_pool_handler(ngx_event_t *ev);
+static uint64_t ngx_thread_pool_time(void);
+static ngx_uint_t ngx_thread_pool_bucket(uint64_t ns);
 
 static char *ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
@@ -99,17 +133,19 @@ ngx_module_t  ngx_thread_pool_module = {
 static ngx_str_t  ngx_thread_pool_default = ngx_string("default");
 
 static ngx_uint_t               ngx_thread_pool_task_id;
-static ngx_atomic_t             ngx_thread_pool_done_lock;
-static ngx_thread_pool_queue_t  ngx_thread_pool_done;
+
+/* completed tasks, a stack pushed by threads without locking */
+static ngx_atomic_t             ngx_thread_pool_done;
 
 
 static ngx_int_t
 ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
 {
-    int             err;
-    pthread_t       tid;
-    ngx_uint_t      n;
-    pthread_attr_t  attr;
+    int                        err;
+    pthread_t                  tid;
+    ngx_uint_t                 n;
+    pthread_attr_t             attr;
+    ngx_thread_pool_thread_t  *thr;
 
     if (ngx_notify == NULL) {
         ngx_log_error(NGX_LOG_ALERT, log, 0,
@@ -117,15 +153,28 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
         return NGX_ERROR;
     }
 
-    ngx_thread_pool_queue_init(&tp->queue);
-
-    if (ngx_thread_mutex_create(&tp->mtx, log) != NGX_OK) {
+    tp->thread = ngx_pcalloc(pool,
+                             tp->threads * sizeof(ngx_thread_pool_thread_t));
+    if (tp->thread == NULL) {
         return NGX_ERROR;
     }
 
-    if (ngx_thread_cond_create(&tp->cond, log) != NGX_OK) {
-        (void) ngx_thread_mutex_destroy(&tp->mtx, log);
-        return NGX_ERROR;
+    for (n = 0; n < tp->threads; n++) {
+        thr = &tp->thread[n];
+
+        thr->tp = tp;
+
+        ngx_thread_pool_queue_init(&thr->queue[NGX_THREAD_TASK_NORMAL]);
+        ngx_thread_pool_queue_init(&thr->queue[NGX_THREAD_TASK_HIGH]);
+
+        if (ngx_thread_mutex_create(&thr->mtx, log) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (ngx_thread_cond_create(&thr->cond, log) != NGX_OK) {
+            (void) ngx_thread_mutex_destroy(&thr->mtx, log);
+            return NGX_ERROR;
+        }
     }
 
     tp->log = log;
@@ -154,7 +203,8 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
 #endif
 
     for (n = 0; n < tp->threads; n++) {
-        err = pthread_create(&tid, &attr, ngx_thread_pool_cycle, tp);
+        err = pthread_create(&tid, &attr, ngx_thread_pool_cycle,
+                             &tp->thread[n]);
         if (err) {
             ngx_log_error(NGX_LOG_ALERT, log, err,
                           "pthread_create() failed");
@@ -171,9 +221,22 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
 static void
 ngx_thread_pool_destroy(ngx_thread_pool_t *tp)
 {
-    ngx_uint_t           n;
-    ngx_thread_task_t    task;
-    volatile ngx_uint_t  lock;
+    ngx_uint_t              n;
+    ngx_thread_task_t       task;
+    ngx_thread_pool_stat_t  stat;
+    volatile ngx_uint_t     lock;
+
+    if (tp->thread == NULL) {
+        return;
+    }
+
+    ngx_thread_pool_stat(tp, &stat);
+
+    ngx_log_error(NGX_LOG_INFO, tp->log, 0,
+                  "thread pool \"%V\": %ui tasks, %ui stolen, "
+                  "max queue %i, wait %uLns, run %uLns",
+                  &tp->name, stat.tasks, stat.stolen, stat.max_waiting,
+                  stat.wait_time, stat.run_time);
 
     ngx_memzero(&task, sizeof(ngx_thread_task_t));
 
@@ -194,9 +257,10 @@ ngx_thread_pool_destroy(ngx_thread_pool_t *tp)
         task.event.active = 0;
     }
 
-    (void) ngx_thread_cond_destroy(&tp->cond, tp->log);
-
-    (void) ngx_thread_mutex_destroy(&tp->mtx, tp->log);
+    for (n = 0; n < tp->threads; n++) {
+        (void) ngx_thread_cond_destroy(&tp->thread[n].cond, tp->log);
+        (void) ngx_thread_mutex_destroy(&tp->thread[n].mtx, tp->log);
+    }
 }
 
 
@@ -230,59 +294,134 @@ ngx_thread_task_alloc(ngx_pool_t *pool, size_t size)
 ngx_int_t
 ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 {
+    ngx_int_t                  waiting;
+    ngx_uint_t                 n, i;
+    ngx_thread_pool_thread_t  *thr, *idle;
+
     if (task->event.active) {
         ngx_log_error(NGX_LOG_ALERT, tp->log, 0,
                       "task #%ui already active", task->id);
         return NGX_ERROR;
     }
 
-    if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
-        return NGX_ERROR;
-    }
-
-    if (tp->waiting >= tp->max_queue) {
-        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    waiting = (ngx_int_t) tp->waiting;
 
+    if (waiting >= tp->max_queue) {
         ngx_log_error(NGX_LOG_ERR, tp->log, 0,
                       "thread pool \"%V\" queue overflow: %i tasks waiting",
-                      &tp->name, tp->waiting);
+                      &tp->name, waiting);
         return NGX_ERROR;
     }
 
+    if (waiting >= tp->max_waiting) {
+        tp->max_waiting = waiting + 1;
+    }
+
     task->event.active = 1;
 
     task->id = ngx_thread_pool_task_id++;
     task->next = NULL;
+    task->posted = ngx_thread_pool_time();
+
+    if (task->priority > NGX_THREAD_TASK_HIGH) {
+        task->priority = NGX_THREAD_TASK_HIGH;
+    }
 
-    if (ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK) {
-        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    (void) ngx_atomic_fetch_add(&tp->waiting, 1);
+
+    /* prefer an idle thread, else queue round robin */
+
+    n = tp->next++ % tp->threads;
+    thr = &tp->thread[n];
+    idle = NULL;
+
+    if (tp->idle) {
+        for (i = 0; i < tp->threads; i++) {
+            if (tp->thread[(n + i) % tp->threads].sleeping) {
+                thr = &tp->thread[(n + i) % tp->threads];
+                break;
+            }
+        }
+    }
+
+    if (ngx_thread_pool_wakeup(thr, task) != NGX_OK) {
+        (void) ngx_atomic_fetch_add(&tp->waiting, -1);
+        task->event.active = 0;
         return NGX_ERROR;
     }
 
-    *tp->queue.last = task;
-    tp->queue.last = &task->next;
+    /*
+     * a thread may have gone idle after failing to find the task;
+     * it has announced itself before its last look at the queues
+     */
 
-    tp->waiting++;
+    ngx_memory_barrier();
 
-    (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    if (tp->idle && !thr->sleeping) {
+        for (i = 0; i < tp->threads; i++) {
+            if (tp->thread[i].sleeping) {
+                idle = &tp->thread[i];
+                break;
+            }
+        }
 
-    ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
-                   "task #%ui added to thread pool \"%V\"",
-                   task->id, &tp->name);
+        if (idle && ngx_thread_pool_wakeup(idle, NULL) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, tp->log, 0,
+                   "task #%ui added to thread pool \"%V\" thread %ui",
+                   task->id, &tp->name, (ngx_uint_t) (thr - tp->thread));
 
     return NGX_OK;
 }
 
 
+static ngx_int_t
+ngx_thread_pool_wakeup(ngx_thread_pool_thread_t *thr, ngx_thread_task_t *task)
+{
+    ngx_thread_pool_queue_t  *q;
+
+    if (ngx_thread_mutex_lock(&thr->mtx, thr->tp->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (task) {
+        q = &thr->queue[task->priority];
+
+        *q->last = task;
+        q->last = &task->next;
+
+    } else {
+        thr->wakeup = 1;
+    }
+
+    if (thr->sleeping
+        && ngx_thread_cond_signal(&thr->cond, thr->tp->log) != NGX_OK)
+    {
+        (void) ngx_thread_mutex_unlock(&thr->mtx, thr->tp->log);
+        return NGX_ERROR;
+    }
+
+    return ngx_thread_mutex_unlock(&thr->mtx, thr->tp->log);
+}
+
+
 static void *
 ngx_thread_pool_cycle(void *data)
 {
-    ngx_thread_pool_t *tp = data;
+    ngx_thread_pool_thread_t *thr = data;
 
     int                 err;
+    uint64_t            started, wait, run;
     sigset_t            set;
+    ngx_atomic_uint_t   done;
+    ngx_thread_pool_t  *tp;
     ngx_thread_task_t  *task;
 
+    tp = thr->tp;
+
 #if 0
     ngx_time_update();
 #endif
@@ -304,31 +443,50 @@ ngx_thread_pool_cycle(void *data)
     }
 
     for ( ;; ) {
-        if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
-            return NULL;
-        }
-
-        /* the number may become negative */
-        tp->waiting--;
-
-        while (tp->queue.first == NULL) {
-            if (ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log)
-                != NGX_OK)
-            {
-                (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
-                return NULL;
+        task = ngx_thread_pool_next(thr);
+
+        if (task == NULL) {
+
+            /*
+             * announce going idle before the last look at the queues,
+             * so a task posted meanwhile either is found or wakes us up
+             */
+
+            thr->sleeping = 1;
+            (void) ngx_atomic_fetch_add(&tp->idle, 1);
+
+            task = ngx_thread_pool_next(thr);
+
+            if (task == NULL) {
+                if (ngx_thread_mutex_lock(&thr->mtx, tp->log) != NGX_OK) {
+                    return NULL;
+                }
+
+                while (thr->queue[NGX_THREAD_TASK_HIGH].first == NULL
+                       && thr->queue[NGX_THREAD_TASK_NORMAL].first == NULL
+                       && !thr->wakeup)
+                {
+                    if (ngx_thread_cond_wait(&thr->cond, &thr->mtx, tp->log)
+                        != NGX_OK)
+                    {
+                        (void) ngx_thread_mutex_unlock(&thr->mtx, tp->log);
+                        return NULL;
+                    }
+                }
+
+                thr->wakeup = 0;
+
+                if (ngx_thread_mutex_unlock(&thr->mtx, tp->log) != NGX_OK) {
+                    return NULL;
+                }
             }
-        }
 
-        task = tp->queue.first;
-        tp->queue.first = task->next;
+            thr->sleeping = 0;
+            (void) ngx_atomic_fetch_add(&tp->idle, -1);
 
-        if (tp->queue.first == NULL) {
-            tp->queue.last = &tp->queue.first;
-        }
-
-        if (ngx_thread_mutex_unlock(&tp->mtx, tp->log) != NGX_OK) {
-            return NULL;
+            if (task == NULL) {
+                continue;
+            }
         }
 
 #if 0
@@ -339,25 +497,104 @@ ngx_thread_pool_cycle(void *data)
                        "run task #%ui in thread pool \"%V\"",
                        task->id, &tp->name);
 
+        started = ngx_thread_pool_time();
+
         task->handler(task->ctx, tp->log);
 
+        wait = started - task->posted;
+        run = ngx_thread_pool_time() - started;
+
+        thr->tasks++;
+        thr->wait_time += wait;
+        thr->run_time += run;
+        thr->wait_hist[ngx_thread_pool_bucket(wait)]++;
+        thr->run_hist[ngx_thread_pool_bucket(run)]++;
+
         ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
                        "complete task #%ui in thread pool \"%V\"",
                        task->id, &tp->name);
 
-        task->next = NULL;
+        do {
+            done = ngx_thread_pool_done;
+            task->next = (ngx_thread_task_t *) done;
 
-        ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
+        } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, done,
+                                     (ngx_atomic_uint_t) task));
 
-        *ngx_thread_pool_done.last = task;
-        ngx_thread_pool_done.last = &task->next;
+        /* the event loop is notified once per batch of completions */
 
-        ngx_memory_barrier();
+        if (done == 0) {
+            (void) ngx_notify(ngx_thread_pool_handler);
+        }
+    }
+}
 
-        ngx_unlock(&ngx_thread_pool_done_lock);
 
-        (void) ngx_notify(ngx_thread_pool_handler);
+static ngx_thread_task_t *
+ngx_thread_pool_next(ngx_thread_pool_thread_t *thr)
+{
+    ngx_uint_t                 i, n, prio;
+    ngx_thread_pool_t         *tp;
+    ngx_thread_task_t         *task;
+    ngx_thread_pool_thread_t  *victim;
+
+    tp = thr->tp;
+    n = thr - tp->thread;
+
+    for (prio = NGX_THREAD_TASK_HIGH + 1; prio-- > 0; /* void */) {
+
+        /* the own queue first, then the others starting from a neighbour */
+
+        for (i = 0; i < tp->threads; i++) {
+            victim = &tp->thread[(n + i) % tp->threads];
+
+            if (victim->queue[prio].first == NULL) {
+                continue;
+            }
+
+            task = ngx_thread_pool_take(victim, prio);
+
+            if (task) {
+                if (victim != thr) {
+                    thr->stolen++;
+                }
+
+                (void) ngx_atomic_fetch_add(&tp->waiting, -1);
+
+                return task;
+            }
+        }
     }
+
+    return NULL;
+}
+
+
+static ngx_thread_task_t *
+ngx_thread_pool_take(ngx_thread_pool_thread_t *thr, ngx_uint_t prio)
+{
+    ngx_thread_task_t        *task;
+    ngx_thread_pool_queue_t  *q;
+
+    if (ngx_thread_mutex_lock(&thr->mtx, thr->tp->log) != NGX_OK) {
+        return NULL;
+    }
+
+    q = &thr->queue[prio];
+
+    task = q->first;
+
+    if (task) {
+        q->first = task->next;
+
+        if (q->first == NULL) {
+            q->last = &q->first;
+        }
+    }
+
+    (void) ngx_thread_mutex_unlock(&thr->mtx, thr->tp->log);
+
+    return task;
 }
 
 
@@ -365,19 +602,27 @@ static void
 ngx_thread_pool_handler(ngx_event_t *ev)
 {
     ngx_event_t        *event;
-    ngx_thread_task_t  *task;
+    ngx_atomic_uint_t   done;
+    ngx_thread_task_t  *task, *next, *first;
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0, "thread pool handler");
 
-    ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
+    do {
+        done = ngx_thread_pool_done;
 
-    task = ngx_thread_pool_done.first;
-    ngx_thread_pool_done.first = NULL;
-    ngx_thread_pool_done.last = &ngx_thread_pool_done.first;
+    } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, done, 0));
 
-    ngx_memory_barrier();
+    /* the stack holds the latest completion first */
 
-    ngx_unlock(&ngx_thread_pool_done_lock);
+    first = NULL;
+
+    for (task = (ngx_thread_task_t *) done; task; task = next) {
+        next = task->next;
+        task->next = first;
+        first = task;
+    }
+
+    task = first;
 
     while (task) {
         ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
@@ -394,6 +639,103 @@ ngx_thread_pool_handler(ngx_event_t *ev)
 }
 
 
+void
+ngx_thread_pool_stat(ngx_thread_pool_t *tp, ngx_thread_pool_stat_t *stat)
+{
+    ngx_uint_t                 n, i;
+    ngx_thread_pool_thread_t  *thr;
+
+    ngx_memzero(stat, sizeof(ngx_thread_pool_stat_t));
+
+    stat->name = tp->name;
+    stat->threads = tp->threads;
+    stat->waiting = (ngx_int_t) tp->waiting;
+    stat->max_waiting = tp->max_waiting;
+
+    if (tp->thread == NULL) {
+        return;
+    }
+
+    /* the per-thread counters are read without locking */
+
+    for (n = 0; n < tp->threads; n++) {
+        thr = &tp->thread[n];
+
+        stat->tasks += thr->tasks;
+        stat->stolen += thr->stolen;
+        stat->wait_time += thr->wait_time;
+        stat->run_time += thr->run_time;
+
+        for (i = 0; i < NGX_THREAD_POOL_HIST; i++) {
+            stat->wait_hist[i] += thr->wait_hist[i];
+            stat->run_hist[i] += thr->run_hist[i];
+        }
+    }
+}
+
+
+ngx_uint_t
+ngx_thread_pool_stats(ngx_cycle_t *cycle, ngx_thread_pool_stat_t *stat,
+    ngx_uint_t n)
+{
+    ngx_uint_t                i;
+    ngx_thread_pool_t       **tpp;
+    ngx_thread_pool_conf_t   *tcf;
+
+    /* the pools in the order of configuration, at most n of them */
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    if (tcf == NULL) {
+        return 0;
+    }
+
+    tpp = tcf->pools.elts;
+
+    for (i = 0; i < tcf->pools.nelts && i < n; i++) {
+        ngx_thread_pool_stat(tpp[i], &stat[i]);
+    }
+
+    return i;
+}
+
+
+static uint64_t
+ngx_thread_pool_time(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval   tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+
+static ngx_uint_t
+ngx_thread_pool_bucket(uint64_t ns)
+{
+    uint64_t    us;
+    ngx_uint_t  n;
+
+    us = ns / 1000;
+
+    for (n = 0; us && n < NGX_THREAD_POOL_HIST - 1; n++) {
+        us >>= 1;
+    }
+
+    return n;
+}
+
+
 static void *
 ngx_thread_pool_create_conf(ngx_cycle_t *cycle)
 {
@@ -599,7 +941,7 @@ ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
         return NGX_OK;
     }
 
-    ngx_thread_pool_queue_init(&ngx_thread_pool_done);
+    ngx_thread_pool_done = 0;
 
     tpp = tcf->pools.elts;
 
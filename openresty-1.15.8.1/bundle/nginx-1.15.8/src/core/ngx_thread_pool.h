@@ -14,23 +14,55 @@
 #include <ngx_event.h>
 
 
+#define NGX_THREAD_TASK_NORMAL  0
+#define NGX_THREAD_TASK_HIGH    1
+
+/* bucket n counts tasks under 2^n microseconds, the last one the rest */
+#define NGX_THREAD_POOL_HIST    16
+
+
 struct ngx_thread_task_s {
     ngx_thread_task_t   *next;
     ngx_uint_t           id;
     void                *ctx;
     void               (*handler)(void *data, ngx_log_t *log);
     ngx_event_t          event;
+
+    ngx_uint_t           priority;
+    uint64_t             posted;
 };
 
 
 typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
 
 
+typedef struct {
+    ngx_str_t            name;
+    ngx_uint_t           threads;
+
+    ngx_int_t            waiting;
+    ngx_int_t            max_waiting;
+
+    ngx_uint_t           tasks;
+    ngx_uint_t           stolen;
+
+    /* nanoseconds */
+    uint64_t             wait_time;
+    uint64_t             run_time;
+
+    ngx_uint_t           wait_hist[NGX_THREAD_POOL_HIST];
+    ngx_uint_t           run_hist[NGX_THREAD_POOL_HIST];
+} ngx_thread_pool_stat_t;
+
+
 ngx_thread_pool_t *ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name);
 ngx_thread_pool_t *ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name);
 
 ngx_thread_task_t *ngx_thread_task_alloc(ngx_pool_t *pool, size_t size);
 ngx_int_t ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task);
+void ngx_thread_pool_stat(ngx_thread_pool_t *tp, ngx_thread_pool_stat_t *stat);
+ngx_uint_t ngx_thread_pool_stats(ngx_cycle_t *cycle,
+    ngx_thread_pool_stat_t *stat, ngx_uint_t n);
 
 
 #endif /* _NGX_THREAD_POOL_H_INCLUDED_ */
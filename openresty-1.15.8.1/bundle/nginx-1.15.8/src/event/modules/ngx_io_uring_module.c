@@ -0,0 +1,2108 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * The module uses io_uring as a readiness notification mechanism:
+ * every connection is registered with IORING_OP_POLL_ADD and the poll
+ * completions are handled exactly as epoll_wait() events, so the rest
+ * of nginx still uses the ordinary recv()/send() based ngx_io methods.
+ *
+ * Edge-triggered registrations are multishot polls, level-triggered ones
+ * (the listening sockets) are one-shot polls rearmed after each completion.
+ * Registration changes are queued to the submission ring and passed
+ * to the kernel in a single io_uring_enter() call that also waits for
+ * the completions, so an event loop iteration costs one system call.
+ *
+ * With "io_uring_multishot on" and Linux 6.0, the listening sockets use
+ * multishot IORING_OP_ACCEPT instead of polls: the accepted sockets are
+ * queued per listening connection and handed to ngx_event_accept() through
+ * ngx_io_uring_accept().  Connections enabled with ngx_io_uring_recv_init()
+ * receive data with multishot IORING_OP_RECV into a ring of provided
+ * buffers; c->recv() then copies the queued data instead of calling recv().
+ */
+
+
+typedef struct {
+    ngx_uint_t  entries;
+    ngx_flag_t  multishot;
+    ngx_bufs_t  buffers;
+} ngx_io_uring_conf_t;
+
+
+typedef struct {
+    u_char                *ring;
+    size_t                 ring_size;
+
+    struct io_uring_sqe   *sqes;
+    size_t                 sqes_size;
+
+    unsigned              *sq_head;
+    unsigned              *sq_tail;
+    unsigned              *sq_flags;
+    unsigned              *sq_array;
+    unsigned               sq_mask;
+    unsigned               sq_entries;
+    unsigned               sq_local_tail;
+
+    unsigned              *cq_head;
+    unsigned              *cq_tail;
+    struct io_uring_cqe   *cqes;
+    unsigned               cq_mask;
+} ngx_io_uring_t;
+
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+typedef struct {
+    uint32_t               len;
+    uint32_t               pos;
+    uint16_t               next;
+} ngx_io_uring_buf_t;
+
+
+typedef struct {
+    struct io_uring_buf_ring  *ring;
+    u_char                    *start;
+    ngx_io_uring_buf_t        *bufs;
+    size_t                     size;
+    ngx_uint_t                 number;
+    ngx_uint_t                 free;
+    uint16_t                   tail;
+    ngx_queue_t                starved;
+} ngx_io_uring_pbuf_t;
+
+
+typedef struct {
+    /* received data */
+    ngx_queue_t            queue;
+    uint16_t               first;
+    uint16_t               last;
+    uint16_t               nbufs;
+    unsigned               recv:1;
+    unsigned               armed:1;
+    unsigned               paused:1;
+    unsigned               starved:1;
+    unsigned               eof:1;
+    ngx_err_t              err;
+
+    /* accepted sockets */
+    ngx_socket_t          *accepted;
+    ngx_uint_t             naccepted;
+    ngx_uint_t             head;
+    ngx_uint_t             nalloc;
+} ngx_io_uring_conn_t;
+
+#endif
+
+
+static ngx_int_t ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer);
+static ngx_int_t ngx_io_uring_setup(ngx_cycle_t *cycle,
+    ngx_io_uring_conf_t *urcf);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_io_uring_notify_init(ngx_log_t *log);
+static void ngx_io_uring_notify_handler(ngx_event_t *ev);
+#endif
+static void ngx_io_uring_done(ngx_cycle_t *cycle);
+static ngx_int_t ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event,
+    ngx_uint_t flags);
+static ngx_int_t ngx_io_uring_add_connection(ngx_connection_t *c);
+static ngx_int_t ngx_io_uring_del_connection(ngx_connection_t *c,
+    ngx_uint_t flags);
+#if (NGX_HAVE_EVENTFD)
+static ngx_int_t ngx_io_uring_notify(ngx_event_handler_pt handler);
+#endif
+static ngx_int_t ngx_io_uring_process_events(ngx_cycle_t *cycle,
+    ngx_msec_t timer, ngx_uint_t flags);
+
+static struct io_uring_sqe *ngx_io_uring_get_sqe(ngx_log_t *log);
+static ngx_int_t ngx_io_uring_submit(ngx_log_t *log);
+static ngx_int_t ngx_io_uring_poll_add(ngx_connection_t *c, uintptr_t data,
+    uint32_t events, ngx_log_t *log);
+static ngx_int_t ngx_io_uring_poll_update(ngx_connection_t *c,
+    uintptr_t data, uint32_t events, ngx_log_t *log);
+static ngx_int_t ngx_io_uring_cancel(uint8_t opcode, uintptr_t data,
+    ngx_log_t *log);
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+static ngx_int_t ngx_io_uring_multishot_init(ngx_cycle_t *cycle,
+    ngx_io_uring_conf_t *urcf);
+static void ngx_io_uring_multishot_done(ngx_cycle_t *cycle);
+static ngx_inline ngx_io_uring_conn_t *ngx_io_uring_conn(ngx_connection_t *c);
+static void ngx_io_uring_buf_release(uint16_t bid);
+
+static ngx_int_t ngx_io_uring_recv_add(ngx_connection_t *c,
+    ngx_io_uring_conn_t *uc, ngx_log_t *log);
+static void ngx_io_uring_recv_close(ngx_connection_t *c,
+    ngx_io_uring_conn_t *uc);
+static void ngx_io_uring_recv_event(ngx_connection_t *c, ngx_uint_t instance,
+    int res, uint32_t cflags, ngx_uint_t flags, ngx_log_t *log);
+static ssize_t ngx_io_uring_recv(ngx_connection_t *c, u_char *buf,
+    size_t size);
+
+static ngx_int_t ngx_io_uring_accept_add(ngx_connection_t *c,
+    ngx_io_uring_conn_t *uc, ngx_log_t *log);
+static void ngx_io_uring_accept_close(ngx_event_t *ev,
+    ngx_io_uring_conn_t *uc);
+static ngx_int_t ngx_io_uring_accept_push(ngx_io_uring_conn_t *uc,
+    ngx_socket_t s, ngx_log_t *log);
+static void ngx_io_uring_accept_event(ngx_connection_t *c,
+    ngx_uint_t instance, int res, uint32_t cflags, ngx_uint_t flags,
+    ngx_log_t *log);
+#endif
+
+static void *ngx_io_uring_create_conf(ngx_cycle_t *cycle);
+static char *ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf);
+
+
+/* the user data low bits: the event instance and the request type */
+#define NGX_IO_URING_INSTANCE  0x1
+#define NGX_IO_URING_RECV      0x2
+#define NGX_IO_URING_ACCEPT    0x4
+#define NGX_IO_URING_DATA      (uintptr_t) ~0x7
+
+/* the end of a received data queue */
+#define NGX_IO_URING_NONE      0xffff
+
+/* a connection stops receiving when that many buffers are queued */
+#define NGX_IO_URING_RECV_BUFS  4
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+#define ngx_io_uring_recv_enabled(c)  ((c)->recv == ngx_io_uring_recv)
+#else
+#define ngx_io_uring_recv_enabled(c)  0
+#endif
+
+
+/* the poll mask bits which persist over the registration lifetime */
+#define NGX_IO_URING_MODE  (EPOLLET|EPOLLEXCLUSIVE)
+
+#if !(NGX_HAVE_EPOLLEXCLUSIVE)
+#undef  NGX_IO_URING_MODE
+#define NGX_IO_URING_MODE  EPOLLET
+#endif
+
+
+static int                  uring = -1;
+static ngx_io_uring_t       ring;
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+static ngx_io_uring_pbuf_t   pbuf;
+static ngx_io_uring_conn_t  *conns;
+#endif
+
+#if (NGX_HAVE_EVENTFD)
+static int                  notify_fd = -1;
+static ngx_event_t          notify_event;
+static ngx_connection_t     notify_conn;
+#endif
+
+#if (NGX_HAVE_EPOLLRDHUP)
+extern ngx_uint_t           ngx_use_epoll_rdhup;
+#endif
+
+static ngx_str_t      io_uring_name = ngx_string("io_uring");
+
+static ngx_command_t  ngx_io_uring_commands[] = {
+
+    { ngx_string("io_uring_entries"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      0,
+      offsetof(ngx_io_uring_conf_t, entries),
+      NULL },
+
+    { ngx_string("io_uring_multishot"),
+      NGX_EVENT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_io_uring_conf_t, multishot),
+      NULL },
+
+    { ngx_string("io_uring_buffers"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE2,
+      ngx_conf_set_bufs_slot,
+      0,
+      offsetof(ngx_io_uring_conf_t, buffers),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_event_module_t  ngx_io_uring_module_ctx = {
+    &io_uring_name,
+    ngx_io_uring_create_conf,            /* create configuration */
+    ngx_io_uring_init_conf,              /* init configuration */
+
+    {
+        ngx_io_uring_add_event,          /* add an event */
+        ngx_io_uring_del_event,          /* delete an event */
+        ngx_io_uring_add_event,          /* enable an event */
+        ngx_io_uring_del_event,          /* disable an event */
+        ngx_io_uring_add_connection,     /* add an connection */
+        ngx_io_uring_del_connection,     /* delete an connection */
+#if (NGX_HAVE_EVENTFD)
+        ngx_io_uring_notify,             /* trigger a notify */
+#else
+        NULL,                            /* trigger a notify */
+#endif
+        ngx_io_uring_process_events,     /* process the events */
+        ngx_io_uring_init,               /* init the events */
+        ngx_io_uring_done,               /* done the events */
+    }
+};
+
+ngx_module_t  ngx_io_uring_module = {
+    NGX_MODULE_V1,
+    &ngx_io_uring_module_ctx,            /* module context */
+    ngx_io_uring_commands,               /* module directives */
+    NGX_EVENT_MODULE,                    /* module type */
+    NULL,                                /* init master */
+    NULL,                                /* init module */
+    NULL,                                /* init process */
+    NULL,                                /* init thread */
+    NULL,                                /* exit thread */
+    NULL,                                /* exit process */
+    NULL,                                /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/*
+ * We call io_uring_setup() and io_uring_enter() directly as syscalls
+ * to avoid the liburing dependency.
+ */
+
+static int
+io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+    unsigned flags, void *arg, size_t argsz)
+{
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, argsz);
+}
+
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+static int
+io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return syscall(SYS_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_io_uring_init(ngx_cycle_t *cycle, ngx_msec_t timer)
+{
+    ngx_io_uring_conf_t  *urcf;
+
+    urcf = ngx_event_get_conf(cycle->conf_ctx, ngx_io_uring_module);
+
+    if (uring == -1) {
+        if (ngx_io_uring_setup(cycle, urcf) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+#if (NGX_HAVE_EVENTFD)
+        if (ngx_io_uring_notify_init(cycle->log) != NGX_OK) {
+            ngx_io_uring_module_ctx.actions.notify = NULL;
+        }
+#endif
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+        if (urcf->multishot
+            && ngx_io_uring_multishot_init(cycle, urcf) == NGX_ERROR)
+        {
+            return NGX_ERROR;
+        }
+#endif
+    }
+
+#if (NGX_HAVE_FILE_AIO)
+    /* the Linux AIO completions are delivered via epoll only */
+    ngx_file_aio = 0;
+#endif
+
+#if (NGX_HAVE_EPOLLRDHUP)
+    /* the kernels providing multishot poll always report EPOLLRDHUP */
+    ngx_use_epoll_rdhup = 1;
+#endif
+
+    ngx_io = ngx_os_io;
+
+    ngx_event_actions = ngx_io_uring_module_ctx.actions;
+
+    ngx_event_flags = NGX_USE_CLEAR_EVENT
+                      |NGX_USE_GREEDY_EVENT
+                      |NGX_USE_EPOLL_EVENT;
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+    if (conns) {
+        ngx_event_flags |= NGX_USE_IO_URING_EVENT;
+    }
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_setup(ngx_cycle_t *cycle, ngx_io_uring_conf_t *urcf)
+{
+    size_t                  size;
+    u_char                 *sq;
+    ngx_err_t               err;
+    struct io_uring_params  p;
+
+    ngx_memzero(&p, sizeof(struct io_uring_params));
+
+    p.flags = IORING_SETUP_CQSIZE
+#ifdef IORING_SETUP_SUBMIT_ALL
+              |IORING_SETUP_SUBMIT_ALL
+#endif
+#ifdef IORING_SETUP_COOP_TASKRUN
+              |IORING_SETUP_COOP_TASKRUN
+#endif
+              ;
+
+    /* the completion ring holds a poll event per connection and direction */
+
+    p.cq_entries = ngx_max(2 * urcf->entries, 2 * cycle->connection_n);
+
+    uring = io_uring_setup(urcf->entries, &p);
+
+    if (uring == -1 && ngx_errno == NGX_EINVAL) {
+
+        /* the optional setup flags are not supported by the kernel */
+
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = ngx_max(2 * urcf->entries, 2 * cycle->connection_n);
+
+        uring = io_uring_setup(urcf->entries, &p);
+    }
+
+    if (uring == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "io_uring_setup(%ui) failed", urcf->entries);
+        return NGX_ERROR;
+    }
+
+    if ((p.features & IORING_FEAT_SINGLE_MMAP) == 0
+        || (p.features & IORING_FEAT_NODROP) == 0
+        || (p.features & IORING_FEAT_EXT_ARG) == 0)
+    {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "io_uring features %08XD are not sufficient, "
+                      "at least Linux 5.13 is required", p.features);
+        goto failed;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring: fd:%d sq:%uD cq:%uD",
+                   uring, p.sq_entries, p.cq_entries);
+
+    ring.ring_size = ngx_max(p.sq_off.array + p.sq_entries * sizeof(unsigned),
+                             p.cq_off.cqes
+                             + p.cq_entries * sizeof(struct io_uring_cqe));
+
+    ring.ring = mmap(NULL, ring.ring_size, PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_POPULATE, uring, IORING_OFF_SQ_RING);
+
+    if (ring.ring == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(%uz) io_uring rings failed", ring.ring_size);
+        ring.ring = NULL;
+        goto failed;
+    }
+
+    size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring.sqes = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_POPULATE, uring, IORING_OFF_SQES);
+
+    if (ring.sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "mmap(%uz) io_uring entries failed", size);
+        ring.sqes = NULL;
+        goto failed;
+    }
+
+    ring.sqes_size = size;
+
+    sq = ring.ring;
+
+    ring.sq_head = (unsigned *) (sq + p.sq_off.head);
+    ring.sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    ring.sq_flags = (unsigned *) (sq + p.sq_off.flags);
+    ring.sq_array = (unsigned *) (sq + p.sq_off.array);
+    ring.sq_mask = *(unsigned *) (sq + p.sq_off.ring_mask);
+    ring.sq_entries = p.sq_entries;
+    ring.sq_local_tail = *ring.sq_tail;
+
+    ring.cq_head = (unsigned *) (sq + p.cq_off.head);
+    ring.cq_tail = (unsigned *) (sq + p.cq_off.tail);
+    ring.cqes = (struct io_uring_cqe *) (sq + p.cq_off.cqes);
+    ring.cq_mask = *(unsigned *) (sq + p.cq_off.ring_mask);
+
+    return NGX_OK;
+
+failed:
+
+    err = ngx_errno;
+
+    if (ring.ring) {
+        (void) munmap(ring.ring, ring.ring_size);
+        ring.ring = NULL;
+    }
+
+    if (close(uring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    uring = -1;
+
+    ngx_set_errno(err);
+
+    return NGX_ERROR;
+}
+
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+static ngx_int_t
+ngx_io_uring_multishot_init(ngx_cycle_t *cycle, ngx_io_uring_conf_t *urcf)
+{
+    size_t                    size;
+    uint16_t                  i;
+    struct io_uring_probe    *probe;
+    struct io_uring_buf_reg   reg;
+
+    /*
+     * multishot receive and provided buffer rings appeared in Linux 6.0
+     * along with IORING_OP_SEND_ZC, which is looked for in the probe
+     */
+
+    size = sizeof(struct io_uring_probe)
+           + 256 * sizeof(struct io_uring_probe_op);
+
+    probe = ngx_calloc(size, cycle->log);
+    if (probe == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (io_uring_register(uring, IORING_REGISTER_PROBE, probe, 256) == -1
+        || probe->last_op < IORING_OP_SEND_ZC
+        || !(probe->ops[IORING_OP_SEND_ZC].flags & IO_URING_OP_SUPPORTED))
+    {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "io_uring multishot requests are not supported, "
+                      "at least Linux 6.0 is required");
+        ngx_free(probe);
+        return NGX_DECLINED;
+    }
+
+    ngx_free(probe);
+
+    pbuf.number = urcf->buffers.num;
+    pbuf.size = urcf->buffers.size;
+
+    pbuf.ring = ngx_memalign(ngx_pagesize,
+                             pbuf.number * sizeof(struct io_uring_buf),
+                             cycle->log);
+    if (pbuf.ring == NULL) {
+        return NGX_ERROR;
+    }
+
+    pbuf.start = ngx_alloc(pbuf.number * pbuf.size, cycle->log);
+    if (pbuf.start == NULL) {
+        goto failed;
+    }
+
+    pbuf.bufs = ngx_alloc(pbuf.number * sizeof(ngx_io_uring_buf_t),
+                          cycle->log);
+    if (pbuf.bufs == NULL) {
+        goto failed;
+    }
+
+    conns = ngx_calloc(cycle->connection_n * sizeof(ngx_io_uring_conn_t),
+                       cycle->log);
+    if (conns == NULL) {
+        goto failed;
+    }
+
+    ngx_memzero(pbuf.ring, pbuf.number * sizeof(struct io_uring_buf));
+
+    ngx_memzero(&reg, sizeof(struct io_uring_buf_reg));
+    reg.ring_addr = (uintptr_t) pbuf.ring;
+    reg.ring_entries = pbuf.number;
+    reg.bgid = 0;
+
+    if (io_uring_register(uring, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
+                      "io_uring buffer ring registration failed");
+        goto failed;
+    }
+
+    pbuf.tail = 0;
+    pbuf.free = 0;
+    ngx_queue_init(&pbuf.starved);
+
+    for (i = 0; i < pbuf.number; i++) {
+        ngx_io_uring_buf_release(i);
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring buffers: %ui %uz", pbuf.number, pbuf.size);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_io_uring_multishot_done(cycle);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_io_uring_multishot_done(ngx_cycle_t *cycle)
+{
+    ngx_uint_t  i, n;
+
+    if (conns) {
+        for (i = 0; i < cycle->connection_n; i++) {
+
+            /* the sockets accepted but not yet handled */
+
+            for (n = 0; n < conns[i].naccepted; n++) {
+                (void) ngx_close_socket(
+                    conns[i].accepted[(conns[i].head + n)
+                                      & (conns[i].nalloc - 1)]);
+            }
+
+            if (conns[i].accepted) {
+                ngx_free(conns[i].accepted);
+            }
+        }
+
+        ngx_free(conns);
+        conns = NULL;
+    }
+
+    if (pbuf.bufs) {
+        ngx_free(pbuf.bufs);
+        pbuf.bufs = NULL;
+    }
+
+    if (pbuf.start) {
+        ngx_free(pbuf.start);
+        pbuf.start = NULL;
+    }
+
+    if (pbuf.ring) {
+        ngx_free(pbuf.ring);
+        pbuf.ring = NULL;
+    }
+}
+
+#endif
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_io_uring_notify_init(ngx_log_t *log)
+{
+#if (NGX_HAVE_SYS_EVENTFD_H)
+    notify_fd = eventfd(0, 0);
+#else
+    notify_fd = syscall(SYS_eventfd, 0);
+#endif
+
+    if (notify_fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno, "eventfd() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "notify eventfd: %d", notify_fd);
+
+    notify_event.handler = ngx_io_uring_notify_handler;
+    notify_event.log = log;
+    notify_event.active = 1;
+
+    notify_conn.fd = notify_fd;
+    notify_conn.read = &notify_event;
+    notify_conn.log = log;
+
+    if (ngx_io_uring_poll_add(&notify_conn, (uintptr_t) &notify_conn,
+                              EPOLLIN|EPOLLET, log)
+        != NGX_OK)
+    {
+        if (close(notify_fd) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                            "eventfd close() failed");
+        }
+
+        notify_fd = -1;
+
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_notify_handler(ngx_event_t *ev)
+{
+    ssize_t               n;
+    uint64_t              count;
+    ngx_err_t             err;
+    ngx_event_handler_pt  handler;
+
+    /*
+     * unlike epoll, the read event index keeps the poll mask,
+     * so the counter is reset on each notification
+     */
+
+    n = read(notify_fd, &count, sizeof(uint64_t));
+
+    err = ngx_errno;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "read() eventfd %d: %z count:%uL", notify_fd, n, count);
+
+    if ((size_t) n != sizeof(uint64_t)) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                      "read() eventfd %d failed", notify_fd);
+    }
+
+    handler = ev->data;
+    handler(ev);
+}
+
+#endif
+
+
+static void
+ngx_io_uring_done(ngx_cycle_t *cycle)
+{
+    /* closing the ring cancels all requests */
+
+    if (ring.sqes) {
+        if (munmap(ring.sqes, ring.sqes_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap() io_uring entries failed");
+        }
+
+        ring.sqes = NULL;
+    }
+
+    if (ring.ring) {
+        if (munmap(ring.ring, ring.ring_size) == -1) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                          "munmap() io_uring rings failed");
+        }
+
+        ring.ring = NULL;
+    }
+
+    if (close(uring) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    uring = -1;
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+    ngx_io_uring_multishot_done(cycle);
+#endif
+
+#if (NGX_HAVE_EVENTFD)
+
+    if (notify_fd != -1 && close(notify_fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
+                      "eventfd close() failed");
+    }
+
+    notify_fd = -1;
+
+#endif
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t           events, prev;
+    ngx_int_t          rc;
+    uintptr_t          data;
+    ngx_event_t       *e;
+    ngx_connection_t  *c;
+
+    c = ev->data;
+
+    data = (uintptr_t) c | ev->instance;
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    if (ev->accept && (ngx_event_flags & NGX_USE_IO_URING_EVENT)
+        && c->type == SOCK_STREAM)
+    {
+        if (ngx_io_uring_accept_add(c, ngx_io_uring_conn(c), ev->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        ev->active = 1;
+
+        return NGX_OK;
+    }
+
+    if (c->recv == ngx_io_uring_recv) {
+
+        /* the data are delivered by the receive request */
+
+        if (event == NGX_WRITE_EVENT) {
+            events = EPOLLOUT | ((uint32_t) flags & NGX_IO_URING_MODE);
+
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "io_uring add event: fd:%d ev:%08XD",
+                           c->fd, events);
+
+            if (ngx_io_uring_poll_add(c, data, events, ev->log) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        ev->active = 1;
+
+        return NGX_OK;
+    }
+
+#endif
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        prev = EPOLLOUT;
+        events = EPOLLIN|EPOLLRDHUP;
+
+    } else {
+        e = c->read;
+        prev = EPOLLIN|EPOLLRDHUP;
+        events = EPOLLOUT;
+    }
+
+    if (e->active) {
+        events |= prev;
+
+        /* the registration mode cannot be changed by an update */
+
+        events |= (uint32_t) c->read->index & NGX_IO_URING_MODE;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "io_uring update event: fd:%d ev:%08XD",
+                       c->fd, events);
+
+        rc = ngx_io_uring_poll_update(c, data, events, ev->log);
+
+    } else {
+        events |= (uint32_t) flags & NGX_IO_URING_MODE;
+
+#if (NGX_HAVE_EPOLLEXCLUSIVE && NGX_HAVE_EPOLLRDHUP)
+        if (flags & NGX_EXCLUSIVE_EVENT) {
+            events &= ~EPOLLRDHUP;
+        }
+#endif
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "io_uring add event: fd:%d ev:%08XD",
+                       c->fd, events);
+
+        rc = ngx_io_uring_poll_add(c, data, events, ev->log);
+    }
+
+    if (rc != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_event(ngx_event_t *ev, ngx_int_t event, ngx_uint_t flags)
+{
+    uint32_t             prev;
+    ngx_int_t            rc;
+    uintptr_t            data;
+    ngx_event_t         *e;
+    ngx_connection_t    *c;
+
+    /*
+     * unlike epoll, a poll request holds a reference to the file,
+     * so it has to be removed explicitly even if the descriptor
+     * is going to be closed
+     */
+
+    c = ev->data;
+
+    data = (uintptr_t) c | ev->instance;
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    if (ev->accept && (ngx_event_flags & NGX_USE_IO_URING_EVENT)
+        && c->type == SOCK_STREAM)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "io_uring del accept: fd:%d", c->fd);
+
+        ev->active = 0;
+
+        if (ngx_io_uring_cancel(IORING_OP_ASYNC_CANCEL,
+                                data | NGX_IO_URING_ACCEPT, ev->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        if (!(flags & NGX_DISABLE_EVENT)) {
+            ngx_io_uring_accept_close(ev, ngx_io_uring_conn(c));
+        }
+
+        return NGX_OK;
+    }
+
+    if (c->recv == ngx_io_uring_recv) {
+        if (event == NGX_WRITE_EVENT && ev->active) {
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                           "io_uring del event: fd:%d", c->fd);
+
+            if (ngx_io_uring_cancel(IORING_OP_POLL_REMOVE, data, ev->log)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+
+        ev->active = 0;
+
+        return NGX_OK;
+    }
+
+#endif
+
+    if (event == NGX_READ_EVENT) {
+        e = c->write;
+        prev = EPOLLOUT;
+
+    } else {
+        e = c->read;
+        prev = EPOLLIN|EPOLLRDHUP;
+    }
+
+    if (e->active && !(flags & NGX_CLOSE_EVENT)) {
+        prev |= (uint32_t) c->read->index & NGX_IO_URING_MODE;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "io_uring update event: fd:%d ev:%08XD",
+                       c->fd, prev);
+
+        rc = ngx_io_uring_poll_update(c, data, prev, ev->log);
+
+        if (rc != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ev->active = 0;
+
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring del event: fd:%d", c->fd);
+
+    if (ngx_io_uring_cancel(IORING_OP_POLL_REMOVE, data, ev->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ev->active = 0;
+
+    if (flags & NGX_CLOSE_EVENT) {
+        e->active = 0;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_add_connection(ngx_connection_t *c)
+{
+    uint32_t  events;
+
+    events = EPOLLIN|EPOLLOUT|EPOLLET|EPOLLRDHUP;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring add connection: fd:%d ev:%08XD", c->fd, events);
+
+    if (ngx_io_uring_poll_add(c, (uintptr_t) c | c->read->instance, events,
+                              c->log)
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    c->read->active = 1;
+    c->write->active = 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_del_connection(ngx_connection_t *c, ngx_uint_t flags)
+{
+    uintptr_t  data;
+
+    data = (uintptr_t) c | c->read->instance;
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    if (c->recv == ngx_io_uring_recv) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "io_uring del connection: fd:%d", c->fd);
+
+        ngx_io_uring_recv_close(c, ngx_io_uring_conn(c));
+
+        c->read->active = 0;
+
+        if (!c->write->active) {
+            return NGX_OK;
+        }
+
+        c->write->active = 0;
+
+        return ngx_io_uring_cancel(IORING_OP_POLL_REMOVE, data, c->log);
+    }
+
+#endif
+
+    if (!c->read->active && !c->write->active) {
+        return NGX_OK;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring del connection: fd:%d", c->fd);
+
+    if (ngx_io_uring_cancel(IORING_OP_POLL_REMOVE, data, c->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    c->read->active = 0;
+    c->write->active = 0;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_EVENTFD)
+
+static ngx_int_t
+ngx_io_uring_notify(ngx_event_handler_pt handler)
+{
+    static uint64_t inc = 1;
+
+    notify_event.data = handler;
+
+    if ((size_t) write(notify_fd, &inc, sizeof(uint64_t)) != sizeof(uint64_t)) {
+        ngx_log_error(NGX_LOG_ALERT, notify_event.log, ngx_errno,
+                      "write() to eventfd %d failed", notify_fd);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_io_uring_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
+    ngx_uint_t flags)
+{
+    int                              n;
+    unsigned                         head, tail, wait, pending, more;
+    uint32_t                         revents, cflags;
+    ngx_int_t                        instance, res;
+    ngx_uint_t                       level, events;
+    ngx_err_t                        err;
+    uintptr_t                        data;
+    ngx_event_t                     *rev, *wev;
+    ngx_queue_t                     *queue;
+    ngx_connection_t                *c;
+    struct io_uring_cqe             *cqe;
+    struct __kernel_timespec         ts;
+    struct io_uring_getevents_arg    arg;
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+    ngx_io_uring_conn_t             *uc;
+#endif
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring timer: %M", timer);
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+    /* restart the receive requests which ran out of buffers */
+
+    while (pbuf.free && !ngx_queue_empty(&pbuf.starved)) {
+        queue = ngx_queue_head(&pbuf.starved);
+        ngx_queue_remove(queue);
+
+        uc = ngx_queue_data(queue, ngx_io_uring_conn_t, queue);
+        uc->starved = 0;
+
+        c = &cycle->connections[uc - conns];
+
+        if (ngx_io_uring_recv_add(c, uc, cycle->log) != NGX_OK) {
+            uc->err = NGX_ENOMEM;
+            c->read->ready = 1;
+
+            if (c->read->active) {
+                ngx_post_event(c->read, &ngx_posted_events);
+            }
+        }
+    }
+
+#endif
+
+    ngx_memory_barrier();
+
+    *ring.sq_tail = ring.sq_local_tail;
+    pending = ring.sq_local_tail - *ring.sq_head;
+
+    /* do not wait if there are completions left from the previous call */
+
+    wait = (timer != 0 && *ring.cq_head == *ring.cq_tail) ? 1 : 0;
+
+    ngx_memzero(&arg, sizeof(struct io_uring_getevents_arg));
+
+    if (wait && timer != NGX_TIMER_INFINITE) {
+        ts.tv_sec = timer / 1000;
+        ts.tv_nsec = (timer % 1000) * 1000000;
+        arg.ts = (uintptr_t) &ts;
+    }
+
+    n = io_uring_enter(uring, pending, wait,
+                       IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG,
+                       &arg, sizeof(struct io_uring_getevents_arg));
+
+    err = (n == -1) ? ngx_errno : 0;
+
+    if (flags & NGX_UPDATE_TIME || ngx_event_timer_alarm) {
+        ngx_time_update();
+    }
+
+    if (err == ETIME || err == NGX_EBUSY || err == NGX_EAGAIN) {
+
+        /*
+         * the timeout has expired, or the submission was postponed
+         * until the overflown completions are consumed
+         */
+
+        err = 0;
+    }
+
+    if (err) {
+        if (err == NGX_EINTR) {
+
+            if (ngx_event_timer_alarm) {
+                ngx_event_timer_alarm = 0;
+                return NGX_OK;
+            }
+
+            level = NGX_LOG_INFO;
+
+        } else {
+            level = NGX_LOG_ALERT;
+        }
+
+        ngx_log_error(level, cycle->log, err, "io_uring_enter() failed");
+        return NGX_ERROR;
+    }
+
+    events = 0;
+
+again:
+
+    head = *ring.cq_head;
+    tail = *ring.cq_tail;
+
+    ngx_memory_barrier();
+
+    for ( /* void */ ; head != tail; head++) {
+        cqe = &ring.cqes[head & ring.cq_mask];
+
+        data = (uintptr_t) cqe->user_data;
+        res = cqe->res;
+        cflags = cqe->flags;
+
+        more = cflags & IORING_CQE_F_MORE;
+
+        ngx_memory_barrier();
+
+        *ring.cq_head = head + 1;
+
+        if (data == 0) {
+            /* update and remove requests */
+            continue;
+        }
+
+        instance = data & NGX_IO_URING_INSTANCE;
+        c = (ngx_connection_t *) (data & NGX_IO_URING_DATA);
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+        if (data & NGX_IO_URING_RECV) {
+            events++;
+            ngx_io_uring_recv_event(c, instance, res, cflags, flags,
+                                    cycle->log);
+            continue;
+        }
+
+        if (data & NGX_IO_URING_ACCEPT) {
+            events++;
+            ngx_io_uring_accept_event(c, instance, res, cflags, flags,
+                                      cycle->log);
+            continue;
+        }
+
+#endif
+
+        if (res == -NGX_ECANCELED) {
+            continue;
+        }
+
+        events++;
+
+        rev = c->read;
+
+        if (c->fd == -1 || rev->instance != instance) {
+
+            /*
+             * the stale event from a file descriptor
+             * that was just closed in this iteration
+             */
+
+            ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring: stale event %p", c);
+            continue;
+        }
+
+        wev = c->write;
+
+        if (res < 0) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, -res,
+                          "io_uring poll on fd:%d failed", c->fd);
+
+            res = EPOLLERR;
+
+        } else if (!more
+                   && ((rev->active && !ngx_io_uring_recv_enabled(c))
+                       || (wev && wev->active)))
+        {
+            /* the one-shot or terminated multishot poll is rearmed */
+
+            if (ngx_io_uring_poll_add(c, data, (uint32_t) rev->index,
+                                      cycle->log)
+                != NGX_OK)
+            {
+                res = EPOLLERR;
+            }
+        }
+
+        revents = (uint32_t) res;
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                       "io_uring: fd:%d ev:%04XD d:%p",
+                       c->fd, revents, data);
+
+        if (revents & (EPOLLERR|EPOLLHUP)) {
+            ngx_log_debug2(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                           "io_uring error on fd:%d ev:%04XD",
+                           c->fd, revents);
+
+            /*
+             * if the error events were returned, add EPOLLIN and EPOLLOUT
+             * to handle the events at least in one active handler
+             */
+
+            revents |= EPOLLIN|EPOLLOUT;
+        }
+
+        if ((revents & EPOLLIN) && rev->active
+            && !ngx_io_uring_recv_enabled(c))
+        {
+
+#if (NGX_HAVE_EPOLLRDHUP)
+            if (revents & EPOLLRDHUP) {
+                rev->pending_eof = 1;
+            }
+
+            rev->available = 1;
+#endif
+
+            rev->ready = 1;
+
+            if (flags & NGX_POST_EVENTS) {
+                queue = rev->accept ? &ngx_posted_accept_events
+                                    : &ngx_posted_events;
+
+                ngx_post_event(rev, queue);
+
+            } else {
+                ngx_event_call(rev);
+            }
+        }
+
+        if ((revents & EPOLLOUT) && wev && wev->active) {
+
+            if (c->fd == -1 || wev->instance != instance) {
+
+                /*
+                 * the stale event from a file descriptor
+                 * that was just closed in this iteration
+                 */
+
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                               "io_uring: stale event %p", c);
+                continue;
+            }
+
+            wev->ready = 1;
+#if (NGX_THREADS)
+            wev->complete = 1;
+#endif
+
+            if (flags & NGX_POST_EVENTS) {
+                ngx_post_event(wev, &ngx_posted_events);
+
+            } else {
+                ngx_event_call(wev);
+            }
+        }
+    }
+
+    if (*ring.sq_flags & IORING_SQ_CQ_OVERFLOW) {
+
+        /* flush the completions kept by the kernel on the ring overflow */
+
+        if (io_uring_enter(uring, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0)
+            != -1)
+        {
+            goto again;
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
+                   "io_uring events: %ui", events);
+
+    return NGX_OK;
+}
+
+
+static struct io_uring_sqe *
+ngx_io_uring_get_sqe(ngx_log_t *log)
+{
+    unsigned              n;
+    struct io_uring_sqe  *sqe;
+
+    if (ring.sq_local_tail - *ring.sq_head >= ring.sq_entries) {
+        if (ngx_io_uring_submit(log) != NGX_OK) {
+            return NULL;
+        }
+    }
+
+    n = ring.sq_local_tail & ring.sq_mask;
+
+    sqe = &ring.sqes[n];
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    ring.sq_array[n] = n;
+    ring.sq_local_tail++;
+
+    return sqe;
+}
+
+
+static ngx_int_t
+ngx_io_uring_submit(ngx_log_t *log)
+{
+    int       n;
+    unsigned  pending;
+
+    ngx_memory_barrier();
+
+    *ring.sq_tail = ring.sq_local_tail;
+    pending = ring.sq_local_tail - *ring.sq_head;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring submit: %uD", pending);
+
+    n = io_uring_enter(uring, pending, 0, 0, NULL, 0);
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "io_uring_enter(%uD) failed", pending);
+        return NGX_ERROR;
+    }
+
+    if (ring.sq_local_tail - *ring.sq_head >= ring.sq_entries) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      "io_uring submission queue is full");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_poll_add(ngx_connection_t *c, uintptr_t data, uint32_t events,
+    ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->poll32_events = events & ~NGX_IO_URING_MODE;
+    sqe->user_data = data;
+
+    if (events & EPOLLET) {
+        sqe->len = IORING_POLL_ADD_MULTI;
+    }
+
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+    sqe->poll32_events |= events & EPOLLEXCLUSIVE;
+#endif
+
+    /* the mask is kept to rearm the poll */
+
+    c->read->index = events;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_poll_update(ngx_connection_t *c, uintptr_t data,
+    uint32_t events, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * if the one-shot poll has already completed, the update fails
+     * with ENOENT and the new mask is used to rearm the poll
+     */
+
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->poll32_events = events & ~NGX_IO_URING_MODE;
+    sqe->len = IORING_POLL_UPDATE_EVENTS;
+
+    if (events & EPOLLET) {
+        sqe->len |= IORING_POLL_ADD_MULTI;
+    }
+
+    c->read->index = events;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_cancel(uint8_t opcode, uintptr_t data, ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = opcode;
+    sqe->fd = -1;
+    sqe->addr = data;
+
+    return NGX_OK;
+}
+
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+static ngx_inline ngx_io_uring_conn_t *
+ngx_io_uring_conn(ngx_connection_t *c)
+{
+    if (conns == NULL
+        || c < ngx_cycle->connections
+        || c >= ngx_cycle->connections + ngx_cycle->connection_n)
+    {
+        return NULL;
+    }
+
+    return &conns[c - ngx_cycle->connections];
+}
+
+
+static void
+ngx_io_uring_buf_release(uint16_t bid)
+{
+    struct io_uring_buf  *b;
+
+    b = &pbuf.ring->bufs[pbuf.tail & (pbuf.number - 1)];
+
+    b->addr = (uintptr_t) (pbuf.start + bid * pbuf.size);
+    b->len = pbuf.size;
+    b->bid = bid;
+
+    pbuf.tail++;
+    pbuf.free++;
+
+    /* the kernel must see the buffer before the new tail */
+
+    ngx_memory_barrier();
+
+    pbuf.ring->tail = pbuf.tail;
+}
+
+
+ngx_int_t
+ngx_io_uring_recv_init(ngx_connection_t *c)
+{
+    uintptr_t             data;
+    ngx_io_uring_conn_t  *uc;
+
+    if (c->recv == ngx_io_uring_recv) {
+        return NGX_OK;
+    }
+
+    if (!(ngx_event_flags & NGX_USE_IO_URING_EVENT)
+        || c->type != SOCK_STREAM
+        || c->recv != ngx_recv
+#if (NGX_SSL)
+        || c->ssl
+#endif
+        )
+    {
+        return NGX_DECLINED;
+    }
+
+    uc = ngx_io_uring_conn(c);
+    if (uc == NULL) {
+        return NGX_DECLINED;
+    }
+
+    data = (uintptr_t) c | c->read->instance;
+
+    /* the receive request replaces the read readiness notifications */
+
+    if (c->write->active) {
+        if (ngx_io_uring_poll_update(c, data,
+                                     EPOLLOUT | ((uint32_t) c->read->index
+                                                 & NGX_IO_URING_MODE),
+                                     c->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+    } else if (c->read->active) {
+        if (ngx_io_uring_cancel(IORING_OP_POLL_REMOVE, data, c->log)
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+    }
+
+    uc->first = NGX_IO_URING_NONE;
+    uc->last = NGX_IO_URING_NONE;
+    uc->nbufs = 0;
+    uc->recv = 1;
+    uc->armed = 0;
+    uc->paused = 0;
+    uc->starved = 0;
+    uc->eof = 0;
+    uc->err = 0;
+
+    c->recv = ngx_io_uring_recv;
+
+    if (ngx_io_uring_recv_add(c, uc, c->log) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring recv init: fd:%d", c->fd);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_recv_add(ngx_connection_t *c, ngx_io_uring_conn_t *uc,
+    ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (uc->armed || uc->paused || uc->starved || uc->eof || uc->err) {
+        return NGX_OK;
+    }
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = (uintptr_t) c | c->read->instance | NGX_IO_URING_RECV;
+
+    uc->armed = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_recv_close(ngx_connection_t *c, ngx_io_uring_conn_t *uc)
+{
+    uint16_t  bid;
+
+    if (uc->armed) {
+        (void) ngx_io_uring_cancel(IORING_OP_ASYNC_CANCEL,
+                                   (uintptr_t) c | c->read->instance
+                                   | NGX_IO_URING_RECV,
+                                   c->log);
+    }
+
+    if (uc->starved) {
+        ngx_queue_remove(&uc->queue);
+    }
+
+    while (uc->first != NGX_IO_URING_NONE) {
+        bid = uc->first;
+        uc->first = pbuf.bufs[bid].next;
+        ngx_io_uring_buf_release(bid);
+    }
+
+    uc->last = NGX_IO_URING_NONE;
+    uc->nbufs = 0;
+    uc->recv = 0;
+    uc->armed = 0;
+    uc->paused = 0;
+    uc->starved = 0;
+    uc->eof = 0;
+    uc->err = 0;
+}
+
+
+static void
+ngx_io_uring_recv_event(ngx_connection_t *c, ngx_uint_t instance, int res,
+    uint32_t cflags, ngx_uint_t flags, ngx_log_t *log)
+{
+    uint16_t              bid;
+    ngx_event_t          *rev;
+    ngx_io_uring_buf_t   *b;
+    ngx_io_uring_conn_t  *uc;
+
+    bid = NGX_IO_URING_NONE;
+
+    if (cflags & IORING_CQE_F_BUFFER) {
+        bid = (uint16_t) (cflags >> IORING_CQE_BUFFER_SHIFT);
+        pbuf.free--;
+    }
+
+    rev = c->read;
+    uc = ngx_io_uring_conn(c);
+
+    if (c->fd == -1 || rev->instance != instance || uc == NULL || !uc->recv) {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "io_uring: stale recv %p", c);
+
+        if (bid != NGX_IO_URING_NONE) {
+            ngx_io_uring_buf_release(bid);
+        }
+
+        return;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring recv: fd:%d res:%d f:%uD", c->fd, res, cflags);
+
+    if (!(cflags & IORING_CQE_F_MORE)) {
+        uc->armed = 0;
+    }
+
+    if (bid != NGX_IO_URING_NONE) {
+        b = &pbuf.bufs[bid];
+        b->len = res;
+        b->pos = 0;
+        b->next = NGX_IO_URING_NONE;
+
+        if (uc->last == NGX_IO_URING_NONE) {
+            uc->first = bid;
+
+        } else {
+            pbuf.bufs[uc->last].next = bid;
+        }
+
+        uc->last = bid;
+        uc->nbufs++;
+
+        if (uc->nbufs >= NGX_IO_URING_RECV_BUFS && uc->armed && !uc->paused) {
+
+            /*
+             * the data are not consumed, stop receiving to leave
+             * the buffers to other connections
+             */
+
+            uc->paused = 1;
+
+            (void) ngx_io_uring_cancel(IORING_OP_ASYNC_CANCEL,
+                                       (uintptr_t) c | instance
+                                       | NGX_IO_URING_RECV,
+                                       log);
+        }
+
+    } else if (res == 0) {
+        uc->eof = 1;
+
+    } else if (res == -NGX_ENOBUFS) {
+
+        /* restarted when the buffers are returned */
+
+        uc->starved = 1;
+        ngx_queue_insert_tail(&pbuf.starved, &uc->queue);
+
+        return;
+
+    } else if (res == -NGX_ECANCELED) {
+
+        /*
+         * the paused request was cancelled, it is restarted
+         * as soon as the queued data are consumed
+         */
+
+        if (ngx_io_uring_recv_add(c, uc, log) == NGX_OK) {
+            return;
+        }
+
+        uc->err = NGX_ENOMEM;
+
+    } else if (res < 0) {
+        uc->err = -res;
+    }
+
+    if (ngx_io_uring_recv_add(c, uc, log) != NGX_OK) {
+        uc->err = NGX_ENOMEM;
+    }
+
+    rev->ready = 1;
+
+#if (NGX_HAVE_EPOLLRDHUP)
+    if (uc->eof) {
+        rev->pending_eof = 1;
+    }
+#endif
+
+    if (!rev->active) {
+        return;
+    }
+
+    if (flags & NGX_POST_EVENTS) {
+        ngx_post_event(rev, &ngx_posted_events);
+
+    } else {
+        ngx_event_call(rev);
+    }
+}
+
+
+static ssize_t
+ngx_io_uring_recv(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    size_t                n, len;
+    uint16_t              bid;
+    ngx_event_t          *rev;
+    ngx_io_uring_buf_t   *b;
+    ngx_io_uring_conn_t  *uc;
+
+    rev = c->read;
+    uc = ngx_io_uring_conn(c);
+
+    n = 0;
+
+    while (n < size && uc->first != NGX_IO_URING_NONE) {
+        bid = uc->first;
+        b = &pbuf.bufs[bid];
+
+        len = ngx_min(size - n, b->len - b->pos);
+
+        ngx_memcpy(buf + n, pbuf.start + bid * pbuf.size + b->pos, len);
+
+        n += len;
+        b->pos += len;
+
+        if (b->pos == b->len) {
+            uc->first = b->next;
+
+            if (uc->first == NGX_IO_URING_NONE) {
+                uc->last = NGX_IO_URING_NONE;
+            }
+
+            uc->nbufs--;
+
+            ngx_io_uring_buf_release(bid);
+        }
+    }
+
+    if (uc->paused && uc->first == NGX_IO_URING_NONE) {
+        uc->paused = 0;
+
+        if (ngx_io_uring_recv_add(c, uc, c->log) != NGX_OK) {
+            uc->err = NGX_ENOMEM;
+        }
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "io_uring recv: fd:%d %uz of %uz", c->fd, n, size);
+
+    if (n) {
+        if (uc->first == NGX_IO_URING_NONE && !uc->eof && !uc->err) {
+            rev->ready = 0;
+        }
+
+        return n;
+    }
+
+    rev->ready = 0;
+
+    if (uc->err) {
+        rev->error = 1;
+        return ngx_connection_error(c, uc->err, "recv() failed");
+    }
+
+    if (uc->eof) {
+        rev->eof = 1;
+        return 0;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_int_t
+ngx_io_uring_accept_add(ngx_connection_t *c, ngx_io_uring_conn_t *uc,
+    ngx_log_t *log)
+{
+    struct io_uring_sqe  *sqe;
+
+    if (uc == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe = ngx_io_uring_get_sqe(log);
+    if (sqe == NULL) {
+        return NGX_ERROR;
+    }
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = c->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK|SOCK_CLOEXEC;
+    sqe->user_data = (uintptr_t) c | c->read->instance | NGX_IO_URING_ACCEPT;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring add accept: fd:%d", c->fd);
+
+    if (uc->naccepted) {
+        c->read->ready = 1;
+        ngx_post_event(c->read, &ngx_posted_accept_events);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_accept_close(ngx_event_t *ev, ngx_io_uring_conn_t *uc)
+{
+    ngx_uint_t  n;
+
+    if (uc == NULL) {
+        return;
+    }
+
+    /*
+     * the listening socket is being closed: the sockets already
+     * accepted by the kernel are handled rather than reset
+     */
+
+    while (uc->naccepted) {
+        n = uc->naccepted;
+
+        ev->handler(ev);
+
+        if (uc->naccepted >= n) {
+            break;
+        }
+    }
+
+    if (ev->posted) {
+        ngx_delete_posted_event(ev);
+    }
+
+    while (uc->naccepted) {
+        (void) ngx_close_socket(uc->accepted[uc->head]);
+
+        uc->head = (uc->head + 1) & (uc->nalloc - 1);
+        uc->naccepted--;
+    }
+}
+
+
+static ngx_int_t
+ngx_io_uring_accept_push(ngx_io_uring_conn_t *uc, ngx_socket_t s,
+    ngx_log_t *log)
+{
+    ngx_uint_t     i, n;
+    ngx_socket_t  *p;
+
+    if (uc->naccepted == uc->nalloc) {
+        n = uc->nalloc ? 2 * uc->nalloc : 16;
+
+        p = ngx_alloc(n * sizeof(ngx_socket_t), log);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < uc->naccepted; i++) {
+            p[i] = uc->accepted[(uc->head + i) & (uc->nalloc - 1)];
+        }
+
+        if (uc->accepted) {
+            ngx_free(uc->accepted);
+        }
+
+        uc->accepted = p;
+        uc->nalloc = n;
+        uc->head = 0;
+    }
+
+    uc->accepted[(uc->head + uc->naccepted) & (uc->nalloc - 1)] = s;
+    uc->naccepted++;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_io_uring_accept_event(ngx_connection_t *c, ngx_uint_t instance, int res,
+    uint32_t cflags, ngx_uint_t flags, ngx_log_t *log)
+{
+    ngx_event_t          *rev;
+    ngx_io_uring_conn_t  *uc;
+
+    rev = c->read;
+    uc = ngx_io_uring_conn(c);
+
+    if (c->fd == -1 || !rev->accept || rev->instance != instance
+        || uc == NULL)
+    {
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, log, 0,
+                       "io_uring: stale accept %p", c);
+
+        if (res >= 0) {
+            (void) ngx_close_socket(res);
+        }
+
+        return;
+    }
+
+    if (res == -NGX_ECANCELED) {
+        return;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring accept: fd:%d res:%d f:%uD", c->fd, res, cflags);
+
+    /* the errors are queued to be reported by ngx_event_accept() */
+
+    if (ngx_io_uring_accept_push(uc, res, log) != NGX_OK) {
+        if (res >= 0) {
+            (void) ngx_close_socket(res);
+        }
+
+        return;
+    }
+
+    if (!(cflags & IORING_CQE_F_MORE) && rev->active
+        && res != -NGX_EMFILE && res != -NGX_ENFILE)
+    {
+        /*
+         * the multishot request was terminated; on EMFILE and ENFILE
+         * ngx_event_accept() disables accept events and enables them later
+         */
+
+        (void) ngx_io_uring_accept_add(c, uc, log);
+    }
+
+    if (!rev->active) {
+        return;
+    }
+
+    rev->ready = 1;
+
+    if (flags & NGX_POST_EVENTS) {
+        ngx_post_event(rev, &ngx_posted_accept_events);
+
+    } else {
+        ngx_event_call(rev);
+    }
+}
+
+
+ngx_socket_t
+ngx_io_uring_accept(ngx_event_t *ev, struct sockaddr *sa, socklen_t *socklen)
+{
+    ngx_socket_t          s;
+    ngx_connection_t     *c;
+    ngx_io_uring_conn_t  *uc;
+
+    c = ev->data;
+    uc = ngx_io_uring_conn(c);
+
+    if (uc == NULL || uc->naccepted == 0) {
+        ngx_set_socket_errno(NGX_EAGAIN);
+        return (ngx_socket_t) -1;
+    }
+
+    s = uc->accepted[uc->head];
+
+    uc->head = (uc->head + 1) & (uc->nalloc - 1);
+    uc->naccepted--;
+
+    if (s < 0) {
+        ngx_set_socket_errno(-s);
+        return (ngx_socket_t) -1;
+    }
+
+    if (getpeername(s, sa, socklen) == -1) {
+
+        /* the connection was reset before it was handled */
+
+        (void) ngx_close_socket(s);
+
+        ngx_set_socket_errno(NGX_ECONNABORTED);
+        return (ngx_socket_t) -1;
+    }
+
+    if (uc->naccepted && !ev->available) {
+
+        /* the rest of the queue is handled in the next handler call */
+
+        ngx_post_event(ev, &ngx_posted_accept_events);
+    }
+
+    return s;
+}
+
+#endif
+
+
+static void *
+ngx_io_uring_create_conf(ngx_cycle_t *cycle)
+{
+    ngx_io_uring_conf_t  *urcf;
+
+    urcf = ngx_palloc(cycle->pool, sizeof(ngx_io_uring_conf_t));
+    if (urcf == NULL) {
+        return NULL;
+    }
+
+    urcf->entries = NGX_CONF_UNSET;
+    urcf->multishot = NGX_CONF_UNSET;
+    urcf->buffers.num = 0;
+
+    return urcf;
+}
+
+
+static char *
+ngx_io_uring_init_conf(ngx_cycle_t *cycle, void *conf)
+{
+    ngx_io_uring_conf_t *urcf = conf;
+
+    ngx_conf_init_uint_value(urcf->entries, 512);
+    ngx_conf_init_value(urcf->multishot, 0);
+
+    if (urcf->buffers.num == 0) {
+        urcf->buffers.num = 64;
+        urcf->buffers.size = 16384;
+    }
+
+    if (urcf->buffers.num > 32768
+        || (urcf->buffers.num & (urcf->buffers.num - 1)))
+    {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "the number of \"io_uring_buffers\" must be a power "
+                      "of 2 not greater than 32768");
+        return NGX_CONF_ERROR;
+    }
+
+    if (urcf->buffers.size > NGX_MAX_INT32_VALUE) {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "the size of \"io_uring_buffers\" is too big");
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
@@ -8,6 +8,7 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_event.h>
+#include <ngx_event_stat.h>
 
 
 #define DEFAULT_CONNECTIONS  512
@@ -30,6 +31,8 @@ static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd,
 static char *ngx_event_use(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_event_loop_profile(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 static void *ngx_event_core_create_conf(ngx_cycle_t *cycle);
 static char *ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf);
@@ -161,6 +164,13 @@ static ngx_command_t  ngx_event_core_commands[] = {
       0,
       NULL },
 
+    { ngx_string("loop_profile"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_event_loop_profile,
+      0,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -247,12 +257,20 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
         }
     }
 
+    if (ngx_event_profile_rate) {
+        ngx_event_profile_begin();
+    }
+
     delta = ngx_current_msec;
 
     (void) ngx_process_events(cycle, timer, flags);
 
     delta = ngx_current_msec - delta;
 
+    if (ngx_event_profiling) {
+        ngx_event_profile_polled();
+    }
+
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
                    "timer delta: %M", delta);
 
@@ -294,7 +312,11 @@ ngx_process_events_and_timers(ngx_cycle_t *cycle)
 
         ngx_delete_posted_event(ev);
 
-        ev->handler(ev);
+        ngx_event_call(ev);
+    }
+
+    if (ngx_event_profile_rate) {
+        ngx_event_profile_end(cycle);
     }
 }
 
@@ -548,6 +570,9 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     }
 #endif /* !(NGX_WIN32) */
 
+    if (ngx_event_stat_init(cycle) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
     if (ccf->master == 0) {
         return NGX_OK;
@@ -578,9 +603,15 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 
 #endif
 
+    /* ngx_shm_alloc() reads every field, so unset ones must be zero */
+
+    ngx_memzero(&shm, sizeof(ngx_shm_t));
+
     shm.size = size;
     ngx_str_set(&shm.name, "nginx_shared_zone");
     shm.log = cycle->log;
+    shm.hugepages = NGX_SHM_HUGEPAGES_OFF;
+    shm.interleave = 0;
 
     if (ngx_shm_alloc(&shm) != NGX_OK) {
         return NGX_ERROR;
@@ -681,10 +712,14 @@ ngx_event_process_init(ngx_cycle_t *cycle)
     ngx_queue_init(&ngx_posted_events);
     ngx_queue_init(&ngx_posted_delayed_events);
 
+    ngx_event_profile_rate = ecf->loop_profile;
+
     if (ngx_event_timer_init(cycle->log) == NGX_ERROR) {
         return NGX_ERROR;
     }
 
+    ngx_event_stat_init_process(cycle);
+
     for (m = 0; cycle->modules[m]; m++) {
         if (cycle->modules[m]->type != NGX_EVENT_MODULE) {
             continue;
@@ -1251,6 +1286,40 @@ ngx_event_debug_connection(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+static char *
+ngx_event_loop_profile(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_event_conf_t  *ecf = conf;
+
+    ngx_int_t   n;
+    ngx_str_t  *value;
+
+    if (ecf->loop_profile != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        ecf->loop_profile = 0;
+        return NGX_CONF_OK;
+    }
+
+    /* every n-th iteration of the event loop is measured */
+
+    n = ngx_atoi(value[1].data, value[1].len);
+    if (n == NGX_ERROR || n == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid sampling rate \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    ecf->loop_profile = n;
+
+    return NGX_CONF_OK;
+}
+
+
 static void *
 ngx_event_core_create_conf(ngx_cycle_t *cycle)
 {
@@ -1267,6 +1336,7 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
     ecf->name = (void *) NGX_CONF_UNSET;
+    ecf->loop_profile = NGX_CONF_UNSET_UINT;
 
 #if (NGX_DEBUG)
 
@@ -1365,6 +1435,7 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_value(ecf->multi_accept, 0);
     ngx_conf_init_value(ecf->accept_mutex, 0);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    ngx_conf_init_uint_value(ecf->loop_profile, 0);
 
     return NGX_CONF_OK;
 }
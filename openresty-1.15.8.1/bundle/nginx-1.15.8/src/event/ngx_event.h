@@ -281,6 +281,12 @@ extern ngx_uint_t            ngx_use_epoll_rdhup;
  */
 #define NGX_USE_VNODE_EVENT      0x00002000
 
+/*
+ * The event filter accepts connections and receives data by itself:
+ * io_uring multishot requests.
+ */
+#define NGX_USE_IO_URING_EVENT   0x00004000
+
 
 /*
  * The event filter is deleted just before the closing file.
@@ -451,6 +457,8 @@ typedef struct {
 
     u_char       *name;
 
+    ngx_uint_t    loop_profile;
+
 #if (NGX_DEBUG)
     ngx_array_t   debug_connection;
 #endif
@@ -526,6 +534,13 @@ ngx_int_t ngx_handle_read_event(ngx_event_t *rev, ngx_uint_t flags);
 ngx_int_t ngx_handle_write_event(ngx_event_t *wev, size_t lowat);
 
 
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+ngx_socket_t ngx_io_uring_accept(ngx_event_t *ev, struct sockaddr *sa,
+    socklen_t *socklen);
+ngx_int_t ngx_io_uring_recv_init(ngx_connection_t *c);
+#endif
+
+
 #if (NGX_WIN32)
 void ngx_event_acceptex(ngx_event_t *ev);
 ngx_int_t ngx_event_post_acceptex(ngx_listening_t *ls, ngx_uint_t n);
@@ -542,6 +557,7 @@ ngx_int_t ngx_send_lowat(ngx_connection_t *c, size_t lowat);
 
 #include <ngx_event_timer.h>
 #include <ngx_event_posted.h>
+#include <ngx_event_profile.h>
 
 #if (NGX_WIN32)
 #include <ngx_iocp_module.h>
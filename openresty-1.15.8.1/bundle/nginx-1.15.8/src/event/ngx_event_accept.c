@@ -55,6 +55,12 @@ ngx_event_accept(ngx_event_t *ev)
     do {
         socklen = sizeof(ngx_sockaddr_t);
 
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+        if (ngx_event_flags & NGX_USE_IO_URING_EVENT) {
+            s = ngx_io_uring_accept(ev, &sa.sockaddr, &socklen);
+
+        } else
+#endif
 #if (NGX_HAVE_ACCEPT4)
         if (use_accept4) {
             s = accept4(lc->fd, &sa.sockaddr, &socklen,
@@ -12,12 +12,65 @@
 
 #define NGX_SSL_PASSWORD_BUFFER_SIZE  4096
 
+#if (NGX_THREADS && OPENSSL_VERSION_NUMBER >= 0x10100000L)
+#define NGX_SSL_PRELOAD  1
+#endif
+
+#define NGX_SSL_PRELOAD_MAX_THREADS  32
+
+
+#if (NGX_SSL_PRELOAD)
 
 typedef struct {
-    ngx_uint_t  engine;   /* unsigned  engine:1; */
+    ngx_str_node_t           sn;
+
+    X509                    *x509;
+    STACK_OF(X509)          *chain;
+    EVP_PKEY                *pkey;
+
+    unsigned                 cert:1;
+    unsigned                 key:1;
+    unsigned                 pending:1;
+    unsigned                 used:1;
+} ngx_ssl_preload_file_t;
+
+
+typedef struct {
+    ngx_rbtree_t             rbtree;
+    ngx_rbtree_node_t        sentinel;
+
+    /* ngx_ssl_preload_file_t *, the ones from "loaded" on are pending */
+    ngx_array_t              files;
+    ngx_uint_t               loaded;
+
+    ngx_atomic_t             next;
+} ngx_ssl_preload_t;
+
+#endif
+
+
+typedef struct {
+    ngx_uint_t               engine;   /* unsigned  engine:1; */
+#if (NGX_SSL_PRELOAD)
+    ngx_ssl_preload_t       *preload;
+#endif
 } ngx_openssl_conf_t;
 
 
+static ngx_int_t ngx_ssl_add_chain_certificate(ngx_ssl_t *ssl, X509 *x509,
+    ngx_str_t *cert);
+#if (NGX_SSL_PRELOAD)
+static char *ngx_ssl_preload_add(ngx_conf_t *cf, ngx_str_t *name,
+    ngx_uint_t key);
+static ngx_ssl_preload_file_t *ngx_ssl_preload_find(ngx_conf_t *cf,
+    ngx_str_t *name);
+static void *ngx_ssl_preload_thread(void *data);
+static void ngx_ssl_preload_file(ngx_ssl_preload_file_t *file);
+static int ngx_ssl_preload_password_callback(char *buf, int size, int rwflag,
+    void *userdata);
+static X509 *ngx_ssl_preload_x509(ngx_ssl_preload_file_t *file);
+static void ngx_ssl_preload_cleanup(void *data);
+#endif
 static int ngx_ssl_password_callback(char *buf, int size, int rwflag,
     void *userdata);
 static int ngx_ssl_verify_callback(int ok, X509_STORE_CTX *x509_store);
@@ -59,7 +112,9 @@ static ngx_ssl_session_t *ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 #endif
     u_char *id, int len, int *copy);
 static void ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess);
-static void ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
+static void *ngx_ssl_session_alloc(ngx_ssl_session_cache_t *cache,
+    ngx_ssl_session_shard_t *shard, ngx_slab_pool_t *shpool, size_t size);
+static void ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard,
     ngx_slab_pool_t *shpool, ngx_uint_t n);
 static void ngx_ssl_session_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
@@ -406,35 +461,58 @@ ngx_int_t
 ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
     ngx_str_t *key, ngx_array_t *passwords)
 {
-    BIO         *bio;
-    X509        *x509;
-    u_long       n;
-    ngx_str_t   *pwd;
-    ngx_uint_t   tries;
+    BIO                     *bio;
+    X509                    *x509;
+    u_long                   n;
+    ngx_str_t               *pwd;
+    ngx_uint_t               tries;
+#if (NGX_SSL_PRELOAD)
+    int                      i;
+    ngx_ssl_preload_file_t  *file;
+#endif
 
     if (ngx_conf_full_name(cf->cycle, cert, 1) != NGX_OK) {
         return NGX_ERROR;
     }
 
-    /*
-     * we can't use SSL_CTX_use_certificate_chain_file() as it doesn't
-     * allow to access certificate later from SSL_CTX, so we reimplement
-     * it here
-     */
+    bio = NULL;
 
-    bio = BIO_new_file((char *) cert->data, "r");
-    if (bio == NULL) {
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "BIO_new_file(\"%s\") failed", cert->data);
-        return NGX_ERROR;
-    }
+#if (NGX_SSL_PRELOAD)
 
-    x509 = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL);
-    if (x509 == NULL) {
-        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                      "PEM_read_bio_X509_AUX(\"%s\") failed", cert->data);
-        BIO_free(bio);
-        return NGX_ERROR;
+    file = ngx_ssl_preload_find(cf, cert);
+
+    if (file && file->x509) {
+        x509 = ngx_ssl_preload_x509(file);
+        if (x509 == NULL) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "d2i_X509_AUX(\"%s\") failed", cert->data);
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        /*
+         * we can't use SSL_CTX_use_certificate_chain_file() as it doesn't
+         * allow to access certificate later from SSL_CTX, so we reimplement
+         * it here
+         */
+
+        bio = BIO_new_file((char *) cert->data, "r");
+        if (bio == NULL) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "BIO_new_file(\"%s\") failed", cert->data);
+            return NGX_ERROR;
+        }
+
+        x509 = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL);
+        if (x509 == NULL) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "PEM_read_bio_X509_AUX(\"%s\") failed",
+                          cert->data);
+            BIO_free(bio);
+            return NGX_ERROR;
+        }
     }
 
     if (SSL_CTX_use_certificate(ssl->ctx, x509) == 0) {
@@ -474,9 +552,24 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
         return NGX_ERROR;
     }
 
+#if (NGX_SSL_PRELOAD)
+
+    if (bio == NULL) {
+        for (i = 0; i < sk_X509_num(file->chain); i++) {
+            x509 = sk_X509_value(file->chain, i);
+            X509_up_ref(x509);
+
+            if (ngx_ssl_add_chain_certificate(ssl, x509, cert) != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+#endif
+
     /* read rest of the chain */
 
-    for ( ;; ) {
+    while (bio) {
 
         x509 = PEM_read_bio_X509(bio, NULL, NULL, NULL);
         if (x509 == NULL) {
@@ -498,36 +591,15 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
             return NGX_ERROR;
         }
 
-#ifdef SSL_CTRL_CHAIN_CERT
-
-        /*
-         * SSL_CTX_add0_chain_cert() is needed to add chain to
-         * a particular certificate when multiple certificates are used;
-         * only available in OpenSSL 1.0.2+
-         */
-
-        if (SSL_CTX_add0_chain_cert(ssl->ctx, x509) == 0) {
-            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                          "SSL_CTX_add0_chain_cert(\"%s\") failed",
-                          cert->data);
-            X509_free(x509);
+        if (ngx_ssl_add_chain_certificate(ssl, x509, cert) != NGX_OK) {
             BIO_free(bio);
             return NGX_ERROR;
         }
-
-#else
-        if (SSL_CTX_add_extra_chain_cert(ssl->ctx, x509) == 0) {
-            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
-                          "SSL_CTX_add_extra_chain_cert(\"%s\") failed",
-                          cert->data);
-            X509_free(x509);
-            BIO_free(bio);
-            return NGX_ERROR;
-        }
-#endif
     }
 
-    BIO_free(bio);
+    if (bio) {
+        BIO_free(bio);
+    }
 
     if (ngx_strncmp(key->data, "engine:", sizeof("engine:") - 1) == 0) {
 
@@ -594,6 +666,22 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
         return NGX_ERROR;
     }
 
+#if (NGX_SSL_PRELOAD)
+
+    file = ngx_ssl_preload_find(cf, key);
+
+    if (file && file->pkey) {
+        if (SSL_CTX_use_PrivateKey(ssl->ctx, file->pkey) == 0) {
+            ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                          "SSL_CTX_use_PrivateKey(\"%s\") failed", key->data);
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+#endif
+
     if (passwords) {
         tries = passwords->nelts;
         pwd = passwords->elts;
@@ -634,6 +722,441 @@ ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *cert,
 }
 
 
+static ngx_int_t
+ngx_ssl_add_chain_certificate(ngx_ssl_t *ssl, X509 *x509, ngx_str_t *cert)
+{
+#ifdef SSL_CTRL_CHAIN_CERT
+
+    /*
+     * SSL_CTX_add0_chain_cert() is needed to add chain to
+     * a particular certificate when multiple certificates are used;
+     * only available in OpenSSL 1.0.2+
+     */
+
+    if (SSL_CTX_add0_chain_cert(ssl->ctx, x509) == 0) {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_add0_chain_cert(\"%s\") failed", cert->data);
+        X509_free(x509);
+        return NGX_ERROR;
+    }
+
+#else
+    if (SSL_CTX_add_extra_chain_cert(ssl->ctx, x509) == 0) {
+        ngx_ssl_error(NGX_LOG_EMERG, ssl->log, 0,
+                      "SSL_CTX_add_extra_chain_cert(\"%s\") failed",
+                      cert->data);
+        X509_free(x509);
+        return NGX_ERROR;
+    }
+#endif
+
+    return NGX_OK;
+}
+
+
+char *
+ngx_ssl_preload_certificate(ngx_conf_t *cf, void *post, void *data)
+{
+#if (NGX_SSL_PRELOAD)
+    return ngx_ssl_preload_add(cf, data, 0);
+#else
+    return NGX_CONF_OK;
+#endif
+}
+
+
+char *
+ngx_ssl_preload_certificate_key(ngx_conf_t *cf, void *post, void *data)
+{
+#if (NGX_SSL_PRELOAD)
+    return ngx_ssl_preload_add(cf, data, 1);
+#else
+    return NGX_CONF_OK;
+#endif
+}
+
+
+#if (NGX_SSL_PRELOAD)
+
+/*
+ * certificate and key files named in the configuration are queued
+ * while it is parsed, and the first ngx_ssl_certificate() call decodes
+ * all queued files at once in temporary threads; the SSL contexts are
+ * still only modified from the main thread
+ */
+
+static char *
+ngx_ssl_preload_add(ngx_conf_t *cf, ngx_str_t *name, ngx_uint_t key)
+{
+    uint32_t                  hash;
+    ngx_str_t                 full;
+    ngx_pool_cleanup_t       *cln;
+    ngx_ssl_preload_t        *pl;
+    ngx_openssl_conf_t       *oscf;
+    ngx_ssl_preload_file_t   *file, **fp;
+
+    if (key && ngx_strncmp(name->data, "engine:", sizeof("engine:") - 1) == 0)
+    {
+        return NGX_CONF_OK;
+    }
+
+    full = *name;
+
+    if (ngx_conf_full_name(cf->cycle, &full, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    oscf = (ngx_openssl_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                               ngx_openssl_module);
+
+    pl = oscf->preload;
+
+    if (pl == NULL) {
+        cln = ngx_pool_cleanup_add(cf->temp_pool, 0);
+        if (cln == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        pl = ngx_pcalloc(cf->temp_pool, sizeof(ngx_ssl_preload_t));
+        if (pl == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_rbtree_init(&pl->rbtree, &pl->sentinel,
+                        ngx_str_rbtree_insert_value);
+
+        if (ngx_array_init(&pl->files, cf->temp_pool, 64,
+                           sizeof(ngx_ssl_preload_file_t *))
+            != NGX_OK)
+        {
+            return NGX_CONF_ERROR;
+        }
+
+        cln->handler = ngx_ssl_preload_cleanup;
+        cln->data = oscf;
+
+        oscf->preload = pl;
+    }
+
+    hash = ngx_crc32_long(full.data, full.len);
+
+    file = (ngx_ssl_preload_file_t *)
+               ngx_str_rbtree_lookup(&pl->rbtree, &full, hash);
+
+    if (file == NULL) {
+        file = ngx_pcalloc(cf->temp_pool, sizeof(ngx_ssl_preload_file_t));
+        if (file == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        file->sn.node.key = hash;
+        file->sn.str = full;
+
+        ngx_rbtree_insert(&pl->rbtree, &file->sn.node);
+
+    } else if (key ? file->key : file->cert) {
+        return NGX_CONF_OK;
+    }
+
+    if (key) {
+        file->key = 1;
+
+    } else {
+        file->cert = 1;
+    }
+
+    if (!file->pending) {
+        fp = ngx_array_push(&pl->files);
+        if (fp == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *fp = file;
+        file->pending = 1;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_ssl_preload_file_t *
+ngx_ssl_preload_find(ngx_conf_t *cf, ngx_str_t *name)
+{
+    int                       err;
+    sigset_t                  set, old;
+    pthread_t                 tid[NGX_SSL_PRELOAD_MAX_THREADS];
+    ngx_msec_t                start;
+    ngx_uint_t                i, n, nthreads, blocked;
+    ngx_ssl_preload_t        *pl;
+    ngx_openssl_conf_t       *oscf;
+    ngx_ssl_preload_file_t  **files;
+
+    oscf = (ngx_openssl_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                               ngx_openssl_module);
+
+    pl = oscf->preload;
+
+    if (pl == NULL) {
+        return NULL;
+    }
+
+    n = pl->files.nelts - pl->loaded;
+
+    if (n) {
+        ngx_time_update();
+        start = ngx_current_msec;
+
+        nthreads = ngx_min((ngx_uint_t) ngx_ncpu, n);
+        nthreads = ngx_min(nthreads, NGX_SSL_PRELOAD_MAX_THREADS);
+
+        pl->next = pl->loaded;
+
+        blocked = 0;
+
+        if (nthreads > 1) {
+
+            /* the threads inherit the mask and leave signals to the master */
+
+            sigfillset(&set);
+
+            sigdelset(&set, SIGILL);
+            sigdelset(&set, SIGFPE);
+            sigdelset(&set, SIGSEGV);
+            sigdelset(&set, SIGBUS);
+
+            err = pthread_sigmask(SIG_BLOCK, &set, &old);
+
+            if (err) {
+                ngx_log_error(NGX_LOG_ALERT, cf->log, err,
+                              "pthread_sigmask() failed");
+                nthreads = 1;
+
+            } else {
+                blocked = 1;
+            }
+        }
+
+        for (i = 1; i < nthreads; i++) {
+            err = pthread_create(&tid[i], NULL, ngx_ssl_preload_thread, pl);
+            if (err) {
+                ngx_log_error(NGX_LOG_ALERT, cf->log, err,
+                              "pthread_create() failed");
+                break;
+            }
+        }
+
+        nthreads = i;
+
+        if (blocked) {
+            (void) pthread_sigmask(SIG_SETMASK, &old, NULL);
+        }
+
+        (void) ngx_ssl_preload_thread(pl);
+
+        for (i = 1; i < nthreads; i++) {
+            err = pthread_join(tid[i], NULL);
+            if (err) {
+                ngx_log_error(NGX_LOG_ALERT, cf->log, err,
+                              "pthread_join() failed");
+            }
+        }
+
+        files = pl->files.elts;
+
+        for (i = pl->loaded; i < pl->files.nelts; i++) {
+            files[i]->pending = 0;
+        }
+
+        pl->loaded = pl->files.nelts;
+
+        ngx_time_update();
+
+        ngx_log_error(NGX_LOG_INFO, cf->log, 0,
+                      "ssl certificate files decoded: %ui in %Mms "
+                      "by %ui threads", n, ngx_current_msec - start, nthreads);
+    }
+
+    return (ngx_ssl_preload_file_t *)
+               ngx_str_rbtree_lookup(&pl->rbtree, name,
+                                     ngx_crc32_long(name->data, name->len));
+}
+
+
+static void *
+ngx_ssl_preload_thread(void *data)
+{
+    ngx_ssl_preload_t  *pl = data;
+
+    ngx_uint_t                i;
+    ngx_ssl_preload_file_t  **files;
+
+    files = pl->files.elts;
+
+    for ( ;; ) {
+        i = ngx_atomic_fetch_add(&pl->next, 1);
+
+        if (i >= pl->files.nelts) {
+            break;
+        }
+
+        ngx_ssl_preload_file(files[i]);
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_ssl_preload_file(ngx_ssl_preload_file_t *file)
+{
+    BIO             *bio;
+    X509            *x509, *cert;
+    u_long           n;
+    STACK_OF(X509)  *chain;
+
+    /* errors are left to the usual loading in ngx_ssl_certificate() */
+
+    bio = BIO_new_file((char *) file->sn.str.data, "r");
+    if (bio == NULL) {
+        goto done;
+    }
+
+    if (file->cert && file->x509 == NULL) {
+
+        cert = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL);
+        if (cert == NULL) {
+            goto key;
+        }
+
+        chain = sk_X509_new_null();
+        if (chain == NULL) {
+            X509_free(cert);
+            goto key;
+        }
+
+        for ( ;; ) {
+            x509 = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+
+            if (x509 == NULL) {
+                n = ERR_peek_last_error();
+
+                if (ERR_GET_LIB(n) == ERR_LIB_PEM
+                    && ERR_GET_REASON(n) == PEM_R_NO_START_LINE)
+                {
+                    file->x509 = cert;
+                    file->chain = chain;
+                    break;
+                }
+
+                X509_free(cert);
+                sk_X509_pop_free(chain, X509_free);
+                break;
+            }
+
+            if (sk_X509_push(chain, x509) == 0) {
+                X509_free(x509);
+                X509_free(cert);
+                sk_X509_pop_free(chain, X509_free);
+                break;
+            }
+        }
+
+        ERR_clear_error();
+    }
+
+key:
+
+    if (file->key && file->pkey == NULL) {
+        (void) BIO_reset(bio);
+
+        file->pkey = PEM_read_bio_PrivateKey(bio, NULL,
+                                             ngx_ssl_preload_password_callback,
+                                             NULL);
+    }
+
+    BIO_free(bio);
+
+done:
+
+    ERR_clear_error();
+}
+
+
+static int
+ngx_ssl_preload_password_callback(char *buf, int size, int rwflag,
+    void *userdata)
+{
+    /* encrypted keys are loaded later with the configured passwords */
+
+    return 0;
+}
+
+
+static X509 *
+ngx_ssl_preload_x509(ngx_ssl_preload_file_t *file)
+{
+    int             len;
+    X509           *x509;
+    u_char         *buf;
+    const u_char   *p;
+
+    if (!file->used) {
+        file->used = 1;
+        X509_up_ref(file->x509);
+        return file->x509;
+    }
+
+    /*
+     * the certificate is linked into the list of its SSL context
+     * through ex_data, so each further context gets its own copy
+     */
+
+    buf = NULL;
+
+    len = i2d_X509_AUX(file->x509, &buf);
+    if (len <= 0) {
+        return NULL;
+    }
+
+    p = buf;
+    x509 = d2i_X509_AUX(NULL, &p, len);
+
+    OPENSSL_free(buf);
+
+    return x509;
+}
+
+
+static void
+ngx_ssl_preload_cleanup(void *data)
+{
+    ngx_openssl_conf_t  *oscf = data;
+
+    ngx_uint_t                i;
+    ngx_ssl_preload_file_t  **files;
+
+    files = oscf->preload->files.elts;
+
+    for (i = 0; i < oscf->preload->files.nelts; i++) {
+
+        if (files[i]->x509) {
+            X509_free(files[i]->x509);
+            sk_X509_pop_free(files[i]->chain, X509_free);
+            files[i]->x509 = NULL;
+        }
+
+        if (files[i]->pkey) {
+            EVP_PKEY_free(files[i]->pkey);
+            files[i]->pkey = NULL;
+        }
+    }
+
+    oscf->preload = NULL;
+}
+
+#endif
+
+
 static int
 ngx_ssl_password_callback(char *buf, int size, int rwflag, void *userdata)
 {
@@ -2971,8 +3494,11 @@ failed:
 ngx_int_t
 ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 {
+    u_char                   *file;
     size_t                    len;
+    ngx_uint_t                i;
     ngx_slab_pool_t          *shpool;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
 
     if (data) {
@@ -2992,13 +3518,50 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
         return NGX_ERROR;
     }
 
-    shpool->data = cache;
-    shm_zone->data = cache;
+    /*
+     * sessions are spread over shards by the hash of their id, and
+     * a lookup locks only its own shard; the shards are allocated
+     * separately, so their locks do not share cache lines
+     */
+
+    for (i = 0; i < NGX_SSL_SESSION_CACHE_SHARDS; i++) {
+
+        shard = ngx_slab_calloc(shpool, sizeof(ngx_ssl_session_shard_t));
+        if (shard == NULL) {
+            return NGX_ERROR;
+        }
+
+#if (NGX_HAVE_ATOMIC_OPS)
+
+        file = NULL;
+
+#else
+
+        len = ngx_strlen(shpool->mutex.name) + sizeof(".") + NGX_INT_T_LEN;
+
+        file = ngx_slab_alloc(shpool, len);
+        if (file == NULL) {
+            return NGX_ERROR;
+        }
+
+        (void) ngx_sprintf(file, "%s.%ui%Z", shpool->mutex.name, i);
+
+#endif
+
+        if (ngx_shmtx_create(&shard->mutex, &shard->lock, file) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        ngx_rbtree_init(&shard->session_rbtree, &shard->sentinel,
+                        ngx_ssl_session_rbtree_insert_value);
 
-    ngx_rbtree_init(&cache->session_rbtree, &cache->sentinel,
-                    ngx_ssl_session_rbtree_insert_value);
+        ngx_queue_init(&shard->expire_queue);
 
-    ngx_queue_init(&cache->expire_queue);
+        cache->shards[i] = shard;
+    }
+
+    shpool->data = cache;
+    shm_zone->data = cache;
 
     len = sizeof(" in SSL session shared cache \"\"") + shm_zone->shm.name.len;
 
@@ -3016,6 +3579,45 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 }
 
 
+ngx_int_t
+ngx_ssl_session_cache_stat(ngx_shm_zone_t *shm_zone,
+    ngx_ssl_session_cache_stat_t *stat)
+{
+    ngx_uint_t                i;
+    ngx_shmtx_stat_t          lock;
+    ngx_ssl_session_shard_t  *shard;
+    ngx_ssl_session_cache_t  *cache;
+
+    if (shm_zone->init != ngx_ssl_session_cache_init) {
+        return NGX_DECLINED;
+    }
+
+    cache = shm_zone->data;
+
+    if (cache == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ngx_memzero(stat, sizeof(ngx_ssl_session_cache_stat_t));
+
+    /* the counters are read without locking */
+
+    for (i = 0; i < NGX_SSL_SESSION_CACHE_SHARDS; i++) {
+        shard = cache->shards[i];
+
+        ngx_shmtx_stat(&shard->mutex, &lock);
+
+        stat->lookups += shard->lookups;
+        stat->hits += shard->hits;
+        stat->acquired += lock.acquired;
+        stat->contended += lock.contended;
+        stat->wait_time += lock.wait_time;
+    }
+
+    return NGX_OK;
+}
+
+
 /*
  * The length of the session id is 16 bytes for SSLv2 sessions and
  * between 1 and 32 bytes for SSLv3/TLSv1, typically 32 bytes.
@@ -3030,7 +3632,10 @@ ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data)
  * and an ASN1 representation, they take accordingly 128 and 128 bytes.
  *
  * OpenSSL's i2d_SSL_SESSION() and d2i_SSL_SESSION are slow,
- * so they are outside the code locked by shared pool mutex
+ * so they are outside the code locked by shard and shared pool mutexes.
+ *
+ * The shared pool mutex is only taken after the shard one, to allocate
+ * and free memory; lookups of cached sessions do not take it at all.
  */
 
 static int
@@ -3045,6 +3650,7 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     ngx_connection_t         *c;
     ngx_slab_pool_t          *shpool;
     ngx_ssl_sess_id_t        *sess_id;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
 
@@ -3064,55 +3670,42 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
     ssl_ctx = c->ssl->session_ctx;
     shm_zone = SSL_CTX_get_ex_data(ssl_ctx, ngx_ssl_session_cache_index);
 
-    cache = shm_zone->data;
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
-
-    ngx_shmtx_lock(&shpool->mutex);
-
-    /* drop one or two expired sessions */
-    ngx_ssl_expire_sessions(cache, shpool, 1);
-
-    cached_sess = ngx_slab_alloc_locked(shpool, len);
-
-    if (cached_sess == NULL) {
+#if OPENSSL_VERSION_NUMBER >= 0x0090800fL
 
-        /* drop the oldest non-expired session and try once more */
+    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+#else
 
-        cached_sess = ngx_slab_alloc_locked(shpool, len);
+    session_id = sess->session_id;
+    session_id_length = sess->session_id_length;
 
-        if (cached_sess == NULL) {
-            sess_id = NULL;
-            goto failed;
-        }
-    }
+#endif
 
-    sess_id = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_sess_id_t));
+    hash = ngx_crc32c(session_id, session_id_length);
 
-    if (sess_id == NULL) {
+    cache = shm_zone->data;
+    shard = cache->shards[hash % NGX_SSL_SESSION_CACHE_SHARDS];
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
-        /* drop the oldest non-expired session and try once more */
+    ngx_shmtx_lock(&shard->mutex);
+    ngx_shmtx_lock(&shpool->mutex);
 
-        ngx_ssl_expire_sessions(cache, shpool, 0);
+    /* drop one or two expired sessions of the shard */
+    ngx_ssl_expire_sessions(shard, shpool, 1);
 
-        sess_id = ngx_slab_alloc_locked(shpool, sizeof(ngx_ssl_sess_id_t));
+    cached_sess = ngx_ssl_session_alloc(cache, shard, shpool, len);
 
-        if (sess_id == NULL) {
-            goto failed;
-        }
+    if (cached_sess == NULL) {
+        sess_id = NULL;
+        goto failed;
     }
 
-#if OPENSSL_VERSION_NUMBER >= 0x0090800fL
-
-    session_id = (u_char *) SSL_SESSION_get_id(sess, &session_id_length);
-
-#else
-
-    session_id = sess->session_id;
-    session_id_length = sess->session_id_length;
+    sess_id = ngx_ssl_session_alloc(cache, shard, shpool,
+                                    sizeof(ngx_ssl_sess_id_t));
 
-#endif
+    if (sess_id == NULL) {
+        goto failed;
+    }
 
 #if (NGX_PTR_SIZE == 8)
 
@@ -3120,29 +3713,20 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
 #else
 
-    id = ngx_slab_alloc_locked(shpool, session_id_length);
+    id = ngx_ssl_session_alloc(cache, shard, shpool, session_id_length);
 
     if (id == NULL) {
-
-        /* drop the oldest non-expired session and try once more */
-
-        ngx_ssl_expire_sessions(cache, shpool, 0);
-
-        id = ngx_slab_alloc_locked(shpool, session_id_length);
-
-        if (id == NULL) {
-            goto failed;
-        }
+        goto failed;
     }
 
 #endif
 
+    ngx_shmtx_unlock(&shpool->mutex);
+
     ngx_memcpy(cached_sess, buf, len);
 
     ngx_memcpy(id, session_id, session_id_length);
 
-    hash = ngx_crc32_short(session_id, session_id_length);
-
     ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
                    "ssl new session: %08XD:%ud:%d",
                    hash, session_id_length, len);
@@ -3155,11 +3739,11 @@ ngx_ssl_new_session(ngx_ssl_conn_t *ssl_conn, ngx_ssl_session_t *sess)
 
     sess_id->expire = ngx_time() + SSL_CTX_get_timeout(ssl_ctx);
 
-    ngx_queue_insert_head(&cache->expire_queue, &sess_id->queue);
+    ngx_queue_insert_head(&shard->expire_queue, &sess_id->queue);
 
-    ngx_rbtree_insert(&cache->session_rbtree, &sess_id->node);
+    ngx_rbtree_insert(&shard->session_rbtree, &sess_id->node);
 
-    ngx_shmtx_unlock(&shpool->mutex);
+    ngx_shmtx_unlock(&shard->mutex);
 
     return 0;
 
@@ -3174,6 +3758,7 @@ failed:
     }
 
     ngx_shmtx_unlock(&shpool->mutex);
+    ngx_shmtx_unlock(&shard->mutex);
 
     ngx_log_error(NGX_LOG_ALERT, c->log, 0,
                   "could not allocate new session%s", shpool->log_ctx);
@@ -3201,11 +3786,12 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_session_t        *sess;
     ngx_ssl_sess_id_t        *sess_id;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
     u_char                    buf[NGX_SSL_MAX_SESSION_SIZE];
     ngx_connection_t         *c;
 
-    hash = ngx_crc32_short((u_char *) (uintptr_t) id, (size_t) len);
+    hash = ngx_crc32c((u_char *) (uintptr_t) id, (size_t) len);
     *copy = 0;
 
     c = ngx_ssl_get_connection(ssl_conn);
@@ -3217,15 +3803,14 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
                                    ngx_ssl_session_cache_index);
 
     cache = shm_zone->data;
+    shard = cache->shards[hash % NGX_SSL_SESSION_CACHE_SHARDS];
 
-    sess = NULL;
+    ngx_shmtx_lock(&shard->mutex);
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
-
-    ngx_shmtx_lock(&shpool->mutex);
+    shard->lookups++;
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -3249,11 +3834,13 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
         if (rc == 0) {
 
             if (sess_id->expire > ngx_time()) {
+                shard->hits++;
+
                 slen = sess_id->len;
 
                 ngx_memcpy(buf, sess_id->session, slen);
 
-                ngx_shmtx_unlock(&shpool->mutex);
+                ngx_shmtx_unlock(&shard->mutex);
 
                 p = buf;
                 sess = d2i_SSL_SESSION(NULL, &p, slen);
@@ -3263,7 +3850,15 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
+
+            ngx_shmtx_unlock(&shard->mutex);
+
+            /* the session is not reachable anymore */
+
+            shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+            ngx_shmtx_lock(&shpool->mutex);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -3271,19 +3866,17 @@ ngx_ssl_get_cached_session(ngx_ssl_conn_t *ssl_conn,
 #endif
             ngx_slab_free_locked(shpool, sess_id);
 
-            sess = NULL;
+            ngx_shmtx_unlock(&shpool->mutex);
 
-            goto done;
+            return NULL;
         }
 
         node = (rc < 0) ? node->left : node->right;
     }
 
-done:
-
-    ngx_shmtx_unlock(&shpool->mutex);
+    ngx_shmtx_unlock(&shard->mutex);
 
-    return sess;
+    return NULL;
 }
 
 
@@ -3307,6 +3900,7 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
     ngx_slab_pool_t          *shpool;
     ngx_rbtree_node_t        *node, *sentinel;
     ngx_ssl_sess_id_t        *sess_id;
+    ngx_ssl_session_shard_t  *shard;
     ngx_ssl_session_cache_t  *cache;
 
     shm_zone = SSL_CTX_get_ex_data(ssl, ngx_ssl_session_cache_index);
@@ -3328,17 +3922,17 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 
 #endif
 
-    hash = ngx_crc32_short(id, len);
+    hash = ngx_crc32c(id, len);
 
     ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                    "ssl remove session: %08XD:%ud", hash, len);
 
-    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+    shard = cache->shards[hash % NGX_SSL_SESSION_CACHE_SHARDS];
 
-    ngx_shmtx_lock(&shpool->mutex);
+    ngx_shmtx_lock(&shard->mutex);
 
-    node = cache->session_rbtree.root;
-    sentinel = cache->session_rbtree.sentinel;
+    node = shard->session_rbtree.root;
+    sentinel = shard->session_rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -3362,7 +3956,13 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 
             ngx_queue_remove(&sess_id->queue);
 
-            ngx_rbtree_delete(&cache->session_rbtree, node);
+            ngx_rbtree_delete(&shard->session_rbtree, node);
+
+            ngx_shmtx_unlock(&shard->mutex);
+
+            shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+            ngx_shmtx_lock(&shpool->mutex);
 
             ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -3370,20 +3970,67 @@ ngx_ssl_remove_session(SSL_CTX *ssl, ngx_ssl_session_t *sess)
 #endif
             ngx_slab_free_locked(shpool, sess_id);
 
-            goto done;
+            ngx_shmtx_unlock(&shpool->mutex);
+
+            return;
         }
 
         node = (rc < 0) ? node->left : node->right;
     }
 
-done:
+    ngx_shmtx_unlock(&shard->mutex);
+}
 
-    ngx_shmtx_unlock(&shpool->mutex);
+
+static void *
+ngx_ssl_session_alloc(ngx_ssl_session_cache_t *cache,
+    ngx_ssl_session_shard_t *shard, ngx_slab_pool_t *shpool, size_t size)
+{
+    void        *p;
+    ngx_uint_t   i;
+
+    p = ngx_slab_alloc_locked(shpool, size);
+
+    if (p) {
+        return p;
+    }
+
+    /* drop the oldest non-expired session and try once more */
+
+    ngx_ssl_expire_sessions(shard, shpool, 0);
+
+    p = ngx_slab_alloc_locked(shpool, size);
+
+    if (p) {
+        return p;
+    }
+
+    /*
+     * the memory may be held by sessions of other shards: drop the oldest
+     * one of each shard and try for the last time; the shard mutexes are
+     * taken before the shared pool one, so a busy shard is skipped rather
+     * than waited for
+     */
+
+    for (i = 0; i < NGX_SSL_SESSION_CACHE_SHARDS; i++) {
+
+        if (cache->shards[i] == shard
+            || !ngx_shmtx_trylock(&cache->shards[i]->mutex))
+        {
+            continue;
+        }
+
+        ngx_ssl_expire_sessions(cache->shards[i], shpool, 0);
+
+        ngx_shmtx_unlock(&cache->shards[i]->mutex);
+    }
+
+    return ngx_slab_alloc_locked(shpool, size);
 }
 
 
 static void
-ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
+ngx_ssl_expire_sessions(ngx_ssl_session_shard_t *shard,
     ngx_slab_pool_t *shpool, ngx_uint_t n)
 {
     time_t              now;
@@ -3394,11 +4041,11 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
 
     while (n < 3) {
 
-        if (ngx_queue_empty(&cache->expire_queue)) {
+        if (ngx_queue_empty(&shard->expire_queue)) {
             return;
         }
 
-        q = ngx_queue_last(&cache->expire_queue);
+        q = ngx_queue_last(&shard->expire_queue);
 
         sess_id = ngx_queue_data(q, ngx_ssl_sess_id_t, queue);
 
@@ -3411,7 +4058,7 @@ ngx_ssl_expire_sessions(ngx_ssl_session_cache_t *cache,
         ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ngx_cycle->log, 0,
                        "expire session: %08Xi", sess_id->node.key);
 
-        ngx_rbtree_delete(&cache->session_rbtree, &sess_id->node);
+        ngx_rbtree_delete(&shard->session_rbtree, &sess_id->node);
 
         ngx_slab_free_locked(shpool, sess_id->session);
 #if (NGX_PTR_SIZE == 4)
@@ -126,13 +126,33 @@ struct ngx_ssl_sess_id_s {
 };
 
 
+#define NGX_SSL_SESSION_CACHE_SHARDS  16
+
 typedef struct {
+    ngx_shmtx_sh_t              lock;
+    ngx_shmtx_t                 mutex;
     ngx_rbtree_t                session_rbtree;
     ngx_rbtree_node_t           sentinel;
     ngx_queue_t                 expire_queue;
+    ngx_atomic_uint_t           lookups;
+    ngx_atomic_uint_t           hits;
+} ngx_ssl_session_shard_t;
+
+
+typedef struct {
+    ngx_ssl_session_shard_t    *shards[NGX_SSL_SESSION_CACHE_SHARDS];
 } ngx_ssl_session_cache_t;
 
 
+typedef struct {
+    ngx_atomic_uint_t           lookups;
+    ngx_atomic_uint_t           hits;
+    ngx_atomic_uint_t           acquired;
+    ngx_atomic_uint_t           contended;
+    uint64_t                    wait_time;
+} ngx_ssl_session_cache_stat_t;
+
+
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
 
 typedef struct {
@@ -165,6 +185,9 @@ ngx_int_t ngx_ssl_certificates(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_array_t *certs, ngx_array_t *keys, ngx_array_t *passwords);
 ngx_int_t ngx_ssl_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_str_t *cert, ngx_str_t *key, ngx_array_t *passwords);
+char *ngx_ssl_preload_certificate(ngx_conf_t *cf, void *post, void *data);
+char *ngx_ssl_preload_certificate_key(ngx_conf_t *cf, void *post,
+    void *data);
 ngx_int_t ngx_ssl_ciphers(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *ciphers,
     ngx_uint_t prefer_server_ciphers);
 ngx_int_t ngx_ssl_client_certificate(ngx_conf_t *cf, ngx_ssl_t *ssl,
@@ -190,6 +213,8 @@ ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
 ngx_int_t ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_array_t *paths);
 ngx_int_t ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data);
+ngx_int_t ngx_ssl_session_cache_stat(ngx_shm_zone_t *shm_zone,
+    ngx_ssl_session_cache_stat_t *stat);
 ngx_int_t ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c,
     ngx_uint_t flags);
 
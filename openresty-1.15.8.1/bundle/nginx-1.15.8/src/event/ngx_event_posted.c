@@ -31,6 +31,6 @@ ngx_event_process_posted(ngx_cycle_t *cycle, ngx_queue_t *posted)
 
         ngx_delete_posted_event(ev);
 
-        ev->handler(ev);
+        ngx_event_call(ev);
     }
 }
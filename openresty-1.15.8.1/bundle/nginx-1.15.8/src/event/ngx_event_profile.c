@@ -0,0 +1,405 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+static ngx_event_profile_handler_t *ngx_event_profile_handler(
+    ngx_event_handler_pt handler);
+static void ngx_event_profile_add(ngx_event_profile_hist_t *hist,
+    uint64_t value);
+static uint64_t ngx_event_profile_percentile(ngx_event_profile_hist_t *hist,
+    ngx_uint_t percent);
+static u_char *ngx_event_profile_line(u_char *p,
+    ngx_event_profile_hist_t *hist);
+static u_char *ngx_event_profile_name(u_char *p,
+    ngx_event_profile_handler_t *h, ngx_event_profile_t *ep);
+static void ngx_event_profile_log(ngx_log_t *log);
+static uint64_t ngx_event_profile_time(void);
+
+
+ngx_uint_t                   ngx_event_profile_rate;
+ngx_uint_t                   ngx_event_profiling;
+
+static ngx_event_profile_t   ngx_event_profile;
+
+/* nanoseconds */
+static uint64_t              ngx_event_profile_start;
+static uint64_t              ngx_event_profile_wait;
+static uint64_t              ngx_event_profile_handled;
+
+#if !(NGX_WIN32)
+static sig_atomic_t          ngx_event_profile_dump;
+#endif
+
+
+void
+ngx_event_profile_begin(void)
+{
+    /* every ngx_event_profile_rate'th iteration is measured */
+
+    if (ngx_event_profile.iterations++ % ngx_event_profile_rate) {
+        return;
+    }
+
+    ngx_event_profiling = 1;
+
+    ngx_event_profile_handled = 0;
+    ngx_event_profile_wait = 0;
+    ngx_event_profile_start = ngx_event_profile_time();
+}
+
+
+void
+ngx_event_profile_polled(void)
+{
+    uint64_t      now;
+    ngx_uint_t    n;
+    ngx_queue_t  *q;
+
+    now = ngx_event_profile_time();
+
+    /* the handlers called by the events module are not waiting */
+
+    if (now - ngx_event_profile_start > ngx_event_profile_handled) {
+        ngx_event_profile_wait = now - ngx_event_profile_start
+                                 - ngx_event_profile_handled;
+    }
+
+    n = 0;
+
+    for (q = ngx_queue_head(&ngx_posted_accept_events);
+         q != ngx_queue_sentinel(&ngx_posted_accept_events);
+         q = ngx_queue_next(q))
+    {
+        n++;
+    }
+
+    for (q = ngx_queue_head(&ngx_posted_events);
+         q != ngx_queue_sentinel(&ngx_posted_events);
+         q = ngx_queue_next(q))
+    {
+        n++;
+    }
+
+    ngx_event_profile_add(&ngx_event_profile.posted, n);
+}
+
+
+void
+ngx_event_profile_end(ngx_cycle_t *cycle)
+{
+    uint64_t  busy;
+
+    if (ngx_event_profiling) {
+        ngx_event_profiling = 0;
+
+        busy = ngx_event_profile_time() - ngx_event_profile_start;
+
+        busy = (busy > ngx_event_profile_wait) ? busy - ngx_event_profile_wait
+                                               : 0;
+
+        ngx_event_profile_add(&ngx_event_profile.loop, busy / 1000);
+    }
+
+#if !(NGX_WIN32)
+
+    if (ngx_event_profile_dump != ngx_dump) {
+        ngx_event_profile_dump = ngx_dump;
+        ngx_event_profile_log(cycle->log);
+    }
+
+#endif
+}
+
+
+void
+ngx_event_profile_call(ngx_event_t *ev)
+{
+    uint64_t               start, time;
+    ngx_event_handler_pt   handler;
+
+    /* the handler may free the event */
+
+    handler = ev->handler;
+
+    start = ngx_event_profile_time();
+
+    handler(ev);
+
+    time = ngx_event_profile_time() - start;
+
+    ngx_event_profile_handled += time;
+
+    ngx_event_profile_add(&ngx_event_profile_handler(handler)->time,
+                          time / 1000);
+}
+
+
+void
+ngx_event_profile_timer(ngx_event_t *ev)
+{
+    ngx_msec_int_t  late;
+
+    late = (ngx_msec_int_t) (ngx_current_msec - ev->timer.key);
+
+    ngx_event_profile_add(&ngx_event_profile.timers, late > 0 ? late : 0);
+}
+
+
+ngx_event_profile_t *
+ngx_event_profile_stat(void)
+{
+    if (ngx_event_profile_rate == 0) {
+        return NULL;
+    }
+
+    return &ngx_event_profile;
+}
+
+
+static ngx_event_profile_handler_t *
+ngx_event_profile_handler(ngx_event_handler_pt handler)
+{
+    ngx_uint_t                    i, n, k;
+    ngx_event_profile_handler_t  *h;
+
+    n = NGX_EVENT_PROFILE_HANDLERS - 1;
+
+    i = ((uintptr_t) handler >> 4) % n;
+
+    for (k = 0; k < n; k++) {
+        h = &ngx_event_profile.handlers[i];
+
+        if (h->handler == handler) {
+            return h;
+        }
+
+        if (h->handler == NULL) {
+            h->handler = handler;
+            return h;
+        }
+
+        i = (i + 1) % n;
+    }
+
+    return &ngx_event_profile.handlers[n];
+}
+
+
+static void
+ngx_event_profile_add(ngx_event_profile_hist_t *hist, uint64_t value)
+{
+    ngx_uint_t  n;
+
+    hist->count++;
+    hist->total += value;
+
+    if (hist->max < value) {
+        hist->max = value;
+    }
+
+    for (n = 0; value && n < NGX_EVENT_PROFILE_BUCKETS - 1; n++) {
+        value >>= 1;
+    }
+
+    hist->bucket[n]++;
+}
+
+
+static uint64_t
+ngx_event_profile_percentile(ngx_event_profile_hist_t *hist,
+    ngx_uint_t percent)
+{
+    uint64_t    sum, want, bound;
+    ngx_uint_t  n;
+
+    want = (hist->count * percent + 99) / 100;
+    sum = 0;
+
+    for (n = 0; n < NGX_EVENT_PROFILE_BUCKETS; n++) {
+        sum += hist->bucket[n];
+
+        if (sum >= want) {
+            break;
+        }
+    }
+
+    /* the upper bound of the bucket */
+
+    bound = n ? ((uint64_t) 1 << n) - 1 : 0;
+
+    return ngx_min(bound, hist->max);
+}
+
+
+u_char *
+ngx_event_profile_print(u_char *p, ngx_event_profile_t *ep)
+{
+    ngx_uint_t                    i;
+    ngx_event_profile_handler_t  *h;
+
+    p = ngx_sprintf(p, "loop usec");
+    p = ngx_event_profile_line(p, &ep->loop);
+
+    p = ngx_sprintf(p, "posted events");
+    p = ngx_event_profile_line(p, &ep->posted);
+
+    p = ngx_sprintf(p, "timers late msec");
+    p = ngx_event_profile_line(p, &ep->timers);
+
+    for (i = 0; i < NGX_EVENT_PROFILE_HANDLERS; i++) {
+        h = &ep->handlers[i];
+
+        if (h->time.count == 0) {
+            continue;
+        }
+
+        p = ngx_event_profile_name(p, h, ep);
+        p = ngx_event_profile_line(p, &h->time);
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_event_profile_line(u_char *p, ngx_event_profile_hist_t *hist)
+{
+    ngx_uint_t  n;
+
+    p = ngx_sprintf(p, " count %uL avg %uL p50 %uL p99 %uL max %uL",
+                    hist->count, hist->count ? hist->total / hist->count : 0,
+                    ngx_event_profile_percentile(hist, 50),
+                    ngx_event_profile_percentile(hist, 99),
+                    hist->max);
+
+    /* "upper bound:count" of the non-empty buckets */
+
+    for (n = 0; n < NGX_EVENT_PROFILE_BUCKETS; n++) {
+        if (hist->bucket[n]) {
+            p = ngx_sprintf(p, " %uL:%uL",
+                            n ? ((uint64_t) 1 << n) - 1 : 0,
+                            hist->bucket[n]);
+        }
+    }
+
+    *p++ = LF;
+
+    return p;
+}
+
+
+static u_char *
+ngx_event_profile_name(u_char *p, ngx_event_profile_handler_t *h,
+    ngx_event_profile_t *ep)
+{
+#if (NGX_HAVE_DLOPEN)
+    u_char   *name;
+    size_t    len;
+    Dl_info   info, self;
+#endif
+
+    if (h == &ep->handlers[NGX_EVENT_PROFILE_HANDLERS - 1]) {
+        return ngx_sprintf(p, "handler other");
+    }
+
+#if (NGX_HAVE_DLOPEN)
+
+    if (dladdr((void *) h->handler, &info) == 0) {
+        return ngx_sprintf(p, "handler %p", h->handler);
+    }
+
+    if (info.dli_sname && info.dli_saddr == (void *) h->handler) {
+        name = (u_char *) info.dli_sname;
+        len = ngx_min(ngx_strlen(name), 64);
+
+        return ngx_sprintf(p, "handler %*s", len, name);
+    }
+
+    /*
+     * static functions are not in the dynamic symbol table,
+     * the offset in the object can be resolved with addr2line
+     */
+
+    if (dladdr((void *) ngx_event_profile_call, &self)
+        && self.dli_fbase == info.dli_fbase)
+    {
+        /* argv[0] of the binary is overwritten by ngx_setproctitle() */
+
+        name = (u_char *) "nginx";
+
+    } else {
+        name = (u_char *) info.dli_fname;
+        len = ngx_strlen(name);
+
+        while (len && name[len - 1] != '/') {
+            len--;
+        }
+
+        name += len;
+    }
+
+    len = ngx_min(ngx_strlen(name), 64);
+
+    return ngx_sprintf(p, "handler %*s+0x%xL", len, name,
+                       (uint64_t) ((u_char *) h->handler
+                                   - (u_char *) info.dli_fbase));
+
+#else
+
+    return ngx_sprintf(p, "handler %p", h->handler);
+
+#endif
+}
+
+
+static void
+ngx_event_profile_log(ngx_log_t *log)
+{
+    u_char  *buf, *p, *lf, *last;
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "event profile: %uL iterations, 1 of %ui sampled",
+                  ngx_event_profile.iterations, ngx_event_profile_rate);
+
+    buf = ngx_alloc(NGX_EVENT_PROFILE_LEN, log);
+    if (buf == NULL) {
+        return;
+    }
+
+    last = ngx_event_profile_print(buf, &ngx_event_profile);
+
+    for (p = buf; p < last; p = lf + 1) {
+        lf = ngx_strlchr(p, last, LF);
+
+        ngx_log_error(NGX_LOG_NOTICE, log, 0, "event profile %*s", lf - p, p);
+    }
+
+    ngx_free(buf);
+}
+
+
+static uint64_t
+ngx_event_profile_time(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval   tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
@@ -0,0 +1,93 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_PROFILE_H_INCLUDED_
+#define _NGX_EVENT_PROFILE_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/* bucket 0 counts zero values, bucket n counts values below 2^n */
+#define NGX_EVENT_PROFILE_BUCKETS   24
+
+/* the last slot collects the handlers that did not fit */
+#define NGX_EVENT_PROFILE_HANDLERS  64
+
+
+typedef struct {
+    uint64_t                      count;
+    uint64_t                      total;
+    uint64_t                      max;
+    uint64_t                      bucket[NGX_EVENT_PROFILE_BUCKETS];
+} ngx_event_profile_hist_t;
+
+
+typedef struct {
+    ngx_event_handler_pt          handler;
+    ngx_event_profile_hist_t      time;
+} ngx_event_profile_handler_t;
+
+
+typedef struct {
+    uint64_t                      iterations;
+
+    /* microseconds spent outside of the event wait per sampled iteration */
+    ngx_event_profile_hist_t      loop;
+
+    /* events queued for processing after the event wait */
+    ngx_event_profile_hist_t      posted;
+
+    /* milliseconds an expired timer was late */
+    ngx_event_profile_hist_t      timers;
+
+    ngx_event_profile_handler_t   handlers[NGX_EVENT_PROFILE_HANDLERS];
+} ngx_event_profile_t;
+
+
+#define NGX_EVENT_PROFILE_LINE_LEN                                            \
+    (sizeof("handler  +0x count  avg  p50  p99  max \n") - 1                  \
+     + 2 * NGX_PTR_SIZE + 64 + 6 * NGX_INT64_LEN                              \
+     + NGX_EVENT_PROFILE_BUCKETS * (2 * NGX_INT64_LEN + 2))
+
+#define NGX_EVENT_PROFILE_LEN                                                 \
+    ((3 + NGX_EVENT_PROFILE_HANDLERS) * NGX_EVENT_PROFILE_LINE_LEN)
+
+
+#define ngx_event_call(ev)                                                    \
+                                                                              \
+    if (ngx_event_profiling) {                                                \
+        ngx_event_profile_call(ev);                                           \
+                                                                              \
+    } else {                                                                  \
+        (ev)->handler(ev);                                                    \
+    }
+
+
+#define ngx_event_profile_expire(ev)                                          \
+                                                                              \
+    if (ngx_event_profiling) {                                                \
+        ngx_event_profile_timer(ev);                                          \
+    }
+
+
+void ngx_event_profile_begin(void);
+void ngx_event_profile_polled(void);
+void ngx_event_profile_end(ngx_cycle_t *cycle);
+void ngx_event_profile_call(ngx_event_t *ev);
+void ngx_event_profile_timer(ngx_event_t *ev);
+ngx_event_profile_t *ngx_event_profile_stat(void);
+u_char *ngx_event_profile_print(u_char *p, ngx_event_profile_t *ep);
+
+
+extern ngx_uint_t  ngx_event_profile_rate;
+extern ngx_uint_t  ngx_event_profiling;
+
+
+#endif /* _NGX_EVENT_PROFILE_H_INCLUDED_ */
@@ -0,0 +1,390 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_event_stat.h>
+
+
+static void ngx_event_stat_handler(ngx_event_t *ev);
+static u_char *ngx_event_stat_zone(u_char *p, ngx_shm_zone_t *shm_zone);
+#if (NGX_THREADS)
+static u_char *ngx_event_stat_thread_pool(u_char *p, ngx_str_t *name,
+    ngx_thread_pool_stat_t *tps);
+#endif
+
+
+static ngx_shm_t                 ngx_event_stat_shm;
+static ngx_event_stat_worker_t  *ngx_event_stat_workers;
+static ngx_uint_t                ngx_event_stat_nworkers;
+static ngx_event_t               ngx_event_stat_event;
+static ngx_connection_t          ngx_event_stat_dumb;
+
+
+void
+ngx_event_stat_enable(ngx_conf_t *cf)
+{
+    ngx_core_conf_t  *ccf;
+
+    /* called by the modules that render the statistics */
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                           ngx_core_module);
+
+    ccf->worker_stats = 1;
+}
+
+
+ngx_int_t
+ngx_event_stat_init(ngx_cycle_t *cycle)
+{
+    ngx_shm_t         shm;
+    ngx_core_conf_t  *ccf;
+
+    /*
+     * the workers of the previous cycle keep their own mapping,
+     * the slots of the new ones are sized by the new configuration
+     */
+
+    if (ngx_event_stat_shm.addr) {
+        ngx_shm_free(&ngx_event_stat_shm);
+        ngx_event_stat_shm.addr = NULL;
+    }
+
+    ngx_event_stat_workers = NULL;
+    ngx_event_stat_nworkers = 0;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    if (!ccf->worker_stats) {
+        return NGX_OK;
+    }
+
+    ngx_memzero(&shm, sizeof(ngx_shm_t));
+
+    shm.size = ccf->worker_processes * sizeof(ngx_event_stat_worker_t);
+    ngx_str_set(&shm.name, "nginx_worker_stats");
+    shm.log = cycle->log;
+    shm.hugepages = NGX_SHM_HUGEPAGES_OFF;
+
+    if (ngx_shm_alloc(&shm) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(shm.addr, shm.size);
+
+    ngx_event_stat_shm = shm;
+    ngx_event_stat_workers = (ngx_event_stat_worker_t *) shm.addr;
+    ngx_event_stat_nworkers = ccf->worker_processes;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_event_stat_init_process(ngx_cycle_t *cycle)
+{
+    if (ngx_event_stat_workers == NULL
+        || (ngx_process != NGX_PROCESS_WORKER
+            && ngx_process != NGX_PROCESS_SINGLE)
+        || (ngx_uint_t) ngx_worker >= ngx_event_stat_nworkers)
+    {
+        return;
+    }
+
+    ngx_event_stat_event.handler = ngx_event_stat_handler;
+    ngx_event_stat_event.data = &ngx_event_stat_dumb;
+    ngx_event_stat_event.log = cycle->log;
+    ngx_event_stat_event.cancelable = 1;
+
+    ngx_event_stat_dumb.fd = (ngx_socket_t) -1;
+
+    ngx_event_stat_handler(&ngx_event_stat_event);
+}
+
+
+static void
+ngx_event_stat_handler(ngx_event_t *ev)
+{
+    ngx_event_profile_t      *ep;
+    ngx_event_stat_worker_t  *w;
+
+    /*
+     * the slot is written by its worker only; a reader may see
+     * an update in progress, which is tolerable for counters
+     */
+
+    w = &ngx_event_stat_workers[ngx_worker];
+
+    w->pid = ngx_pid;
+    w->updated = ngx_time();
+
+    ngx_pool_cache_stat(&w->pool_cache);
+    ngx_log_async_stat(&w->error_log);
+
+    ep = ngx_event_profile_stat();
+
+    if (ep) {
+        w->profile = *ep;
+    }
+
+    w->profiled = (ep != NULL);
+
+#if (NGX_THREADS)
+    w->thread_pools = ngx_thread_pool_stats((ngx_cycle_t *) ngx_cycle,
+                                            w->thread_pool,
+                                            NGX_EVENT_STAT_THREAD_POOLS);
+#endif
+
+    ngx_add_timer(ev, NGX_EVENT_STAT_INTERVAL);
+}
+
+
+size_t
+ngx_event_stat_len(ngx_cycle_t *cycle)
+{
+    size_t                   size;
+    ngx_uint_t               i;
+    ngx_shm_zone_t          *shm_zone;
+    ngx_list_part_t         *part;
+#if (NGX_THREADS)
+    ngx_uint_t               npools;
+    ngx_thread_pool_stat_t   pools[NGX_EVENT_STAT_THREAD_POOLS];
+#endif
+
+    size = 0;
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        size += sizeof("zone \"\" lock acquired  contended  wait ns "
+                       "cache hits  misses  locks  cached \n") - 1
+                + shm_zone[i].shm.name.len
+                + 2 * NGX_ATOMIC_T_LEN + NGX_INT64_LEN + 4 * NGX_INT_T_LEN
+                + sizeof("resolver hits  stale  misses  prefetches  "
+                         "entries \n") - 1
+                + 4 * NGX_ATOMIC_T_LEN + NGX_INT_T_LEN
+#if (NGX_SSL)
+                + sizeof("ssl sessions lookups  hits  lock acquired  "
+                         "contended  wait ns\n") - 1
+                + 4 * NGX_ATOMIC_T_LEN + NGX_INT64_LEN
+#endif
+                ;
+    }
+
+#if (NGX_HAVE_NUMA)
+    size += NGX_NUMA_MAX_NODES
+            * (sizeof("numa node  cpus  workers  shared \n") - 1
+               + 3 * NGX_INT_T_LEN + NGX_SIZE_T_LEN);
+#endif
+
+    size += ngx_event_stat_nworkers
+            * (sizeof("worker  pid  updated \n") - 1
+               + 2 * NGX_INT_T_LEN + NGX_TIME_T_LEN
+               + sizeof("pool cache hits  misses  full  blocks  size \n") - 1
+               + 4 * NGX_INT_T_LEN + NGX_SIZE_T_LEN
+               + sizeof("error log queued  dropped  blocked \n") - 1
+               + 3 * NGX_INT_T_LEN
+               + NGX_EVENT_PROFILE_LEN);
+
+#if (NGX_THREADS)
+
+    npools = ngx_thread_pool_stats(cycle, pools, NGX_EVENT_STAT_THREAD_POOLS);
+
+    for (i = 0; i < npools; i++) {
+        size += ngx_event_stat_nworkers
+                * (3 * (sizeof("thread pool \"\" \n") - 1
+                        + pools[i].name.len)
+                   + sizeof("threads  waiting  max  tasks  stolen  "
+                            "wait ns run ns") - 1
+                   + 6 * NGX_INT_T_LEN + 2 * NGX_INT64_LEN
+                   + 2 * (sizeof("wait histogram") - 1
+                          + NGX_THREAD_POOL_HIST * (1 + NGX_INT_T_LEN)));
+    }
+
+#endif
+
+    return size;
+}
+
+
+u_char *
+ngx_event_stat_print(u_char *p, ngx_cycle_t *cycle)
+{
+    ngx_uint_t                i;
+    ngx_shm_zone_t           *shm_zone;
+    ngx_list_part_t          *part;
+    ngx_event_stat_worker_t  *w;
+#if (NGX_HAVE_NUMA)
+    ngx_uint_t                nnodes;
+    ngx_numa_stat_t           numa[NGX_NUMA_MAX_NODES];
+#endif
+#if (NGX_THREADS)
+    ngx_uint_t                j, npools;
+    ngx_thread_pool_stat_t    pools[NGX_EVENT_STAT_THREAD_POOLS];
+
+    /* the names are those of this worker, the slots use the same order */
+
+    npools = ngx_thread_pool_stats(cycle, pools, NGX_EVENT_STAT_THREAD_POOLS);
+#endif
+
+    /* all shared zones of the cycle */
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        p = ngx_event_stat_zone(p, &shm_zone[i]);
+    }
+
+#if (NGX_HAVE_NUMA)
+
+    nnodes = ngx_numa_stat(cycle, numa);
+
+    for (i = 0; i < nnodes; i++) {
+        p = ngx_sprintf(p, "numa node %ui cpus %ui workers %ui shared %uz\n",
+                        numa[i].node, numa[i].cpus, numa[i].workers,
+                        numa[i].shared);
+    }
+
+#endif
+
+    for (i = 0; i < ngx_event_stat_nworkers; i++) {
+
+        w = &ngx_event_stat_workers[i];
+
+        if (w->pid == 0) {
+            continue;
+        }
+
+        p = ngx_sprintf(p, "worker %ui pid %P updated %T\n",
+                        i, w->pid, w->updated);
+
+        p = ngx_sprintf(p, "pool cache hits %ui misses %ui full %ui "
+                           "blocks %ui size %uz\n",
+                        w->pool_cache.hits, w->pool_cache.misses,
+                        w->pool_cache.full, w->pool_cache.blocks,
+                        w->pool_cache.size);
+
+        p = ngx_sprintf(p, "error log queued %ui dropped %ui blocked %ui\n",
+                        w->error_log.queued, w->error_log.dropped,
+                        w->error_log.blocked);
+
+        if (w->profiled) {
+            p = ngx_event_profile_print(p, &w->profile);
+        }
+
+#if (NGX_THREADS)
+        for (j = 0; j < w->thread_pools && j < npools; j++) {
+            p = ngx_event_stat_thread_pool(p, &pools[j].name,
+                                           &w->thread_pool[j]);
+        }
+#endif
+    }
+
+    return p;
+}
+
+
+static u_char *
+ngx_event_stat_zone(u_char *p, ngx_shm_zone_t *shm_zone)
+{
+    ngx_slab_pool_t               *shpool;
+    ngx_shmtx_stat_t               lock;
+    ngx_slab_cache_stat_t          cache;
+    ngx_resolver_cache_stat_t      resolver;
+#if (NGX_SSL)
+    ngx_ssl_session_cache_stat_t   ssl;
+#endif
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    ngx_shmtx_stat(&shpool->mutex, &lock);
+    ngx_slab_cache_stat(shpool, &cache);
+
+    p = ngx_sprintf(p, "zone \"%V\" lock acquired %uA contended %uA "
+                       "wait %uLns cache hits %ui misses %ui locks %ui "
+                       "cached %ui\n",
+                    &shm_zone->shm.name, lock.acquired, lock.contended,
+                    lock.wait_time, cache.hits, cache.misses, cache.locks,
+                    cache.cached);
+
+    if (ngx_resolver_cache_stat(shm_zone, &resolver) == NGX_OK) {
+        p = ngx_sprintf(p, "resolver hits %uA stale %uA misses %uA "
+                           "prefetches %uA entries %ui\n",
+                        resolver.hits, resolver.stale, resolver.misses,
+                        resolver.prefetches, resolver.entries);
+    }
+
+#if (NGX_SSL)
+
+    if (ngx_ssl_session_cache_stat(shm_zone, &ssl) == NGX_OK) {
+        p = ngx_sprintf(p, "ssl sessions lookups %uA hits %uA "
+                           "lock acquired %uA contended %uA wait %uLns\n",
+                        ssl.lookups, ssl.hits, ssl.acquired, ssl.contended,
+                        ssl.wait_time);
+    }
+
+#endif
+
+    return p;
+}
+
+
+#if (NGX_THREADS)
+
+static u_char *
+ngx_event_stat_thread_pool(u_char *p, ngx_str_t *name,
+    ngx_thread_pool_stat_t *tps)
+{
+    ngx_uint_t  i;
+
+    p = ngx_sprintf(p, "thread pool \"%V\" threads %ui waiting %i max %i "
+                       "tasks %ui stolen %ui wait %uLns run %uLns\n",
+                    name, tps->threads, tps->waiting, tps->max_waiting,
+                    tps->tasks, tps->stolen, tps->wait_time, tps->run_time);
+
+    p = ngx_sprintf(p, "thread pool \"%V\" wait histogram", name);
+
+    for (i = 0; i < NGX_THREAD_POOL_HIST; i++) {
+        p = ngx_sprintf(p, " %ui", tps->wait_hist[i]);
+    }
+
+    p = ngx_sprintf(p, "\nthread pool \"%V\" run histogram", name);
+
+    for (i = 0; i < NGX_THREAD_POOL_HIST; i++) {
+        p = ngx_sprintf(p, " %ui", tps->run_hist[i]);
+    }
+
+    *p++ = LF;
+
+    return p;
+}
+
+#endif
@@ -0,0 +1,50 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_EVENT_STAT_H_INCLUDED_
+#define _NGX_EVENT_STAT_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#if (NGX_THREADS)
+#include <ngx_thread_pool.h>
+#endif
+
+
+#define NGX_EVENT_STAT_INTERVAL      1000
+#define NGX_EVENT_STAT_THREAD_POOLS  8
+
+
+typedef struct {
+    ngx_pid_t                   pid;
+    time_t                      updated;
+
+    ngx_pool_cache_stat_t       pool_cache;
+    ngx_log_async_stat_t        error_log;
+
+    /* the loop_profile counters, if enabled */
+    ngx_uint_t                  profiled;
+    ngx_event_profile_t         profile;
+
+#if (NGX_THREADS)
+    /* the first pools of the configuration */
+    ngx_uint_t                  thread_pools;
+    ngx_thread_pool_stat_t      thread_pool[NGX_EVENT_STAT_THREAD_POOLS];
+#endif
+} ngx_event_stat_worker_t;
+
+
+void ngx_event_stat_enable(ngx_conf_t *cf);
+ngx_int_t ngx_event_stat_init(ngx_cycle_t *cycle);
+void ngx_event_stat_init_process(ngx_cycle_t *cycle);
+size_t ngx_event_stat_len(ngx_cycle_t *cycle);
+u_char *ngx_event_stat_print(u_char *p, ngx_cycle_t *cycle);
+
+
+#endif /* _NGX_EVENT_STAT_H_INCLUDED_ */
@@ -11,6 +11,480 @@
 #include <ngx_event_probe.h>
 
 
+#if (NGX_TIMER_WHEEL)
+
+/*
+ * The hierarchical timer wheel.  The first level has 256 slots of 1ms,
+ * each of the next four levels has 64 slots of 64 times the previous
+ * level slot, so the wheel covers 2^32 milliseconds.  A timer is added
+ * to the level and slot determined by its key relative to the current
+ * wheel time, the higher level slots are cascaded to the lower levels
+ * when the first level wraps around, so the timers expire exactly
+ * at their keys.  Adding and deleting a timer is O(1), the bitmap
+ * of non-empty slots allows to skip over the empty ones quickly.
+ *
+ * The rbtree node fields are reused: the left and right pointers
+ * link the slot list, and the parent points to the slot head.
+ */
+
+#define NGX_TIMER_WHEEL_BITS0   8
+#define NGX_TIMER_WHEEL_BITS    6
+#define NGX_TIMER_WHEEL_LEVELS  5
+
+#define NGX_TIMER_WHEEL_SLOTS0  (1 << NGX_TIMER_WHEEL_BITS0)
+#define NGX_TIMER_WHEEL_SLOTS   (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK0   (NGX_TIMER_WHEEL_SLOTS0 - 1)
+#define NGX_TIMER_WHEEL_MASK    (NGX_TIMER_WHEEL_SLOTS - 1)
+
+#define NGX_TIMER_WHEEL_SIZE                                                  \
+    (NGX_TIMER_WHEEL_SLOTS0                                                   \
+     + (NGX_TIMER_WHEEL_LEVELS - 1) * NGX_TIMER_WHEEL_SLOTS)
+
+#define ngx_timer_wheel_shift(level)                                          \
+    (NGX_TIMER_WHEEL_BITS0 + ((level) - 1) * NGX_TIMER_WHEEL_BITS)
+
+#define ngx_timer_wheel_slot(level, n)                                        \
+    (NGX_TIMER_WHEEL_SLOTS0 + ((level) - 1) * NGX_TIMER_WHEEL_SLOTS + (n))
+
+
+typedef struct {
+    /* the next millisecond to process */
+    ngx_msec_t          current;
+
+    /* the timers added with the key in the past */
+    ngx_rbtree_node_t   expired;
+
+    uint64_t            bitmap[NGX_TIMER_WHEEL_SIZE / 64];
+    ngx_rbtree_node_t   slots[NGX_TIMER_WHEEL_SIZE];
+} ngx_event_timer_wheel_t;
+
+
+static void ngx_event_timer_expire(ngx_rbtree_node_t *head);
+static void ngx_event_timer_cascade(void);
+static ngx_msec_t ngx_event_timer_level_next(ngx_uint_t level);
+static ngx_uint_t ngx_event_timer_first_bit(uint64_t w);
+
+
+static ngx_event_timer_wheel_t  ngx_event_timer_wheel;
+
+
+ngx_int_t
+ngx_event_timer_init(ngx_log_t *log)
+{
+    ngx_uint_t          i;
+    ngx_rbtree_node_t  *head;
+
+    ngx_event_timer_wheel.current = ngx_current_msec;
+
+    head = &ngx_event_timer_wheel.expired;
+    head->left = head;
+    head->right = head;
+
+    for (i = 0; i < NGX_TIMER_WHEEL_SIZE; i++) {
+        head = &ngx_event_timer_wheel.slots[i];
+        head->left = head;
+        head->right = head;
+    }
+
+    ngx_memzero(ngx_event_timer_wheel.bitmap,
+                sizeof(ngx_event_timer_wheel.bitmap));
+
+    return NGX_OK;
+}
+
+
+void
+ngx_event_timer_insert(ngx_rbtree_node_t *node)
+{
+    uint64_t            range;
+    ngx_uint_t          n, level, shift;
+    ngx_msec_t          key;
+    ngx_msec_int_t      delta;
+    ngx_rbtree_node_t  *head;
+
+    key = node->key;
+    delta = (ngx_msec_int_t) (key - ngx_event_timer_wheel.current);
+
+    if (delta < 0) {
+        head = &ngx_event_timer_wheel.expired;
+        goto insert;
+    }
+
+    if (delta < NGX_TIMER_WHEEL_SLOTS0) {
+        n = key & NGX_TIMER_WHEEL_MASK0;
+        goto found;
+    }
+
+    for (level = 1; /* void */; level++) {
+        shift = ngx_timer_wheel_shift(level);
+        range = (uint64_t) 1 << (shift + NGX_TIMER_WHEEL_BITS);
+
+        if ((uint64_t) delta < range) {
+            break;
+        }
+
+        if (level == NGX_TIMER_WHEEL_LEVELS - 1) {
+
+            /* the timer is cascaded to the proper slot later */
+
+            key = ngx_event_timer_wheel.current + (ngx_msec_t) (range - 1);
+            break;
+        }
+    }
+
+    n = ngx_timer_wheel_slot(level, (key >> shift) & NGX_TIMER_WHEEL_MASK);
+
+found:
+
+    head = &ngx_event_timer_wheel.slots[n];
+
+    ngx_event_timer_wheel.bitmap[n / 64] |= (uint64_t) 1 << (n % 64);
+
+insert:
+
+    node->parent = head;
+    node->left = head->left;
+    node->right = head;
+    head->left->right = node;
+    head->left = node;
+}
+
+
+void
+ngx_event_timer_delete(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          n;
+    ngx_rbtree_node_t  *head;
+
+    node->left->right = node->right;
+    node->right->left = node->left;
+
+    head = node->parent;
+
+    if (head->right == head && head != &ngx_event_timer_wheel.expired) {
+        n = head - ngx_event_timer_wheel.slots;
+        ngx_event_timer_wheel.bitmap[n / 64] &= ~((uint64_t) 1 << (n % 64));
+    }
+}
+
+
+ngx_rbtree_node_t *
+ngx_event_timer_next(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t          n;
+    ngx_rbtree_node_t  *head;
+
+    if (node == NULL) {
+        head = &ngx_event_timer_wheel.expired;
+        node = head;
+
+    } else {
+        head = node->parent;
+    }
+
+    if (node->right != head) {
+        return node->right;
+    }
+
+    if (head == &ngx_event_timer_wheel.expired) {
+        n = 0;
+
+    } else {
+        n = head - ngx_event_timer_wheel.slots + 1;
+    }
+
+    for ( /* void */ ; n < NGX_TIMER_WHEEL_SIZE; n++) {
+        head = &ngx_event_timer_wheel.slots[n];
+
+        if (head->right != head) {
+            return head->right;
+        }
+    }
+
+    return NULL;
+}
+
+
+ngx_msec_t
+ngx_event_find_timer(void)
+{
+    ngx_uint_t          level;
+    ngx_msec_t          next, t;
+    ngx_msec_int_t      timer;
+    ngx_rbtree_node_t  *head;
+
+    head = &ngx_event_timer_wheel.expired;
+
+    if (head->right != head) {
+        return 0;
+    }
+
+    next = NGX_TIMER_INFINITE;
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        t = ngx_event_timer_level_next(level);
+
+        if (t == NGX_TIMER_INFINITE) {
+            continue;
+        }
+
+        if (next == NGX_TIMER_INFINITE || (ngx_msec_int_t) (t - next) < 0) {
+            next = t;
+        }
+    }
+
+    if (next == NGX_TIMER_INFINITE) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    timer = (ngx_msec_int_t) (next - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+static ngx_msec_t
+ngx_event_timer_level_next(ngx_uint_t level)
+{
+    uint64_t     w;
+    ngx_uint_t   i, n, shift;
+    ngx_msec_t   current, base;
+
+    current = ngx_event_timer_wheel.current;
+
+    if (level == 0) {
+
+        /*
+         * the first level slots before the current one
+         * belong to the next round of the wheel
+         */
+
+        n = current & NGX_TIMER_WHEEL_MASK0;
+        base = current - n;
+
+        for (i = n / 64; i < NGX_TIMER_WHEEL_SLOTS0 / 64; i++) {
+            w = ngx_event_timer_wheel.bitmap[i];
+
+            if (i == n / 64) {
+                w &= ~(uint64_t) 0 << (n % 64);
+            }
+
+            if (w) {
+                return base + i * 64 + ngx_event_timer_first_bit(w);
+            }
+        }
+
+        for (i = 0; i <= n / 64; i++) {
+            w = ngx_event_timer_wheel.bitmap[i];
+
+            if (w) {
+                return base + NGX_TIMER_WHEEL_SLOTS0 + i * 64
+                       + ngx_event_timer_first_bit(w);
+            }
+        }
+
+        return NGX_TIMER_INFINITE;
+    }
+
+    w = ngx_event_timer_wheel.bitmap[ngx_timer_wheel_slot(level, 0) / 64];
+
+    if (w == 0) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    /*
+     * a slot is cascaded when the wheel time reaches its start,
+     * so find the first non-empty slot starting at the next boundary
+     */
+
+    shift = ngx_timer_wheel_shift(level);
+
+    base = (current + ((ngx_msec_t) 1 << shift) - 1) >> shift;
+    n = base & NGX_TIMER_WHEEL_MASK;
+
+    if (n) {
+        w = (w >> n) | (w << (64 - n));
+    }
+
+    return (base + ngx_event_timer_first_bit(w)) << shift;
+}
+
+
+static ngx_uint_t
+ngx_event_timer_first_bit(uint64_t w)
+{
+#if (__GNUC__ >= 4)
+
+    return __builtin_ctzll(w);
+
+#else
+
+    ngx_uint_t  n;
+
+    for (n = 0; (w & 1) == 0; n++) {
+        w >>= 1;
+    }
+
+    return n;
+
+#endif
+}
+
+
+void
+ngx_event_expire_timers(void)
+{
+    uint64_t     w;
+    ngx_uint_t   n, i;
+
+    /* the timers added with the key in the past */
+
+    ngx_event_timer_expire(&ngx_event_timer_wheel.expired);
+
+    while ((ngx_msec_int_t) (ngx_current_msec - ngx_event_timer_wheel.current)
+           >= 0)
+    {
+        n = ngx_event_timer_wheel.current & NGX_TIMER_WHEEL_MASK0;
+
+        if (n == 0) {
+            ngx_event_timer_cascade();
+        }
+
+        ngx_event_timer_expire(&ngx_event_timer_wheel.slots[n]);
+
+        /* skip to the next non-empty slot or to the end of the round */
+
+        for (i = n + 1; i < NGX_TIMER_WHEEL_SLOTS0; i++) {
+            w = ngx_event_timer_wheel.bitmap[i / 64] >> (i % 64);
+
+            if (w) {
+                i += ngx_event_timer_first_bit(w);
+                break;
+            }
+
+            i |= 63;
+        }
+
+        ngx_event_timer_wheel.current += i - n;
+
+        if ((ngx_msec_int_t) (ngx_event_timer_wheel.current - ngx_current_msec)
+            > 1)
+        {
+            ngx_event_timer_wheel.current = ngx_current_msec + 1;
+        }
+    }
+}
+
+
+static void
+ngx_event_timer_expire(ngx_rbtree_node_t *head)
+{
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node;
+
+    while (head->right != head) {
+        node = head->right;
+
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        /* the key is reset on deletion */
+
+        ngx_event_profile_expire(ev);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer del: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ngx_event_timer_delete(&ev->timer);
+
+#if (NGX_DEBUG)
+        ev->timer.left = NULL;
+        ev->timer.right = NULL;
+        ev->timer.parent = NULL;
+#endif
+
+        ev->timer_set = 0;
+
+        ev->timedout = 1;
+
+        ngx_event_probe_timer_expire(ev);
+
+        ngx_event_call(ev);
+    }
+}
+
+
+static void
+ngx_event_timer_cascade(void)
+{
+    ngx_uint_t          level, n, shift;
+    ngx_rbtree_node_t  *head, *node, list;
+
+    for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        shift = ngx_timer_wheel_shift(level);
+
+        n = (ngx_event_timer_wheel.current >> shift) & NGX_TIMER_WHEEL_MASK;
+
+        head = &ngx_event_timer_wheel.slots[ngx_timer_wheel_slot(level, n)];
+
+        if (head->right != head) {
+
+            /* the timers may go back to the same slot */
+
+            list.right = head->right;
+            list.left = head->left;
+            list.right->left = &list;
+            list.left->right = &list;
+
+            head->left = head;
+            head->right = head;
+
+            n = ngx_timer_wheel_slot(level, n);
+
+            ngx_event_timer_wheel.bitmap[n / 64] &=
+                                                ~((uint64_t) 1 << (n % 64));
+
+            while (list.right != &list) {
+                node = list.right;
+
+                list.right = node->right;
+                node->right->left = &list;
+
+                ngx_event_timer_insert(node);
+            }
+        }
+
+        if ((ngx_event_timer_wheel.current >> shift) & NGX_TIMER_WHEEL_MASK) {
+            return;
+        }
+    }
+}
+
+
+ngx_int_t
+ngx_event_no_timers_left(void)
+{
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node;
+
+    for (node = ngx_event_timer_next(NULL);
+         node;
+         node = ngx_event_timer_next(node))
+    {
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        if (!ev->cancelable) {
+            return NGX_AGAIN;
+        }
+    }
+
+    /* only cancelable timers left */
+
+    return NGX_OK;
+}
+
+#else
+
 ngx_rbtree_t              ngx_event_timer_rbtree;
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 
@@ -76,6 +550,10 @@ ngx_event_expire_timers(void)
 
         ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
 
+        /* the key is reset on deletion */
+
+        ngx_event_profile_expire(ev);
+
         ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                        "event timer del: %d: %M",
                        ngx_event_ident(ev->data), ev->timer.key);
@@ -94,7 +572,7 @@ ngx_event_expire_timers(void)
 
         ngx_event_probe_timer_expire(ev);
 
-        ev->handler(ev);
+        ngx_event_call(ev);
     }
 }
 
@@ -128,6 +606,8 @@ ngx_event_no_timers_left(void)
     return NGX_OK;
 }
 
+#endif
+
 
 #if (NGX_DTRACE)
 void
@@ -32,8 +32,23 @@ void ngx_event_probe_timer_del_helper(ngx_event_t *ev);
 #endif
 
 
+#if (NGX_TIMER_WHEEL)
+
+void ngx_event_timer_insert(ngx_rbtree_node_t *node);
+void ngx_event_timer_delete(ngx_rbtree_node_t *node);
+ngx_rbtree_node_t *ngx_event_timer_next(ngx_rbtree_node_t *node);
+
+#else
+
 extern ngx_rbtree_t  ngx_event_timer_rbtree;
 
+#define ngx_event_timer_insert(node)                                          \
+    ngx_rbtree_insert(&ngx_event_timer_rbtree, node)
+#define ngx_event_timer_delete(node)                                          \
+    ngx_rbtree_delete(&ngx_event_timer_rbtree, node)
+
+#endif
+
 
 static ngx_inline void
 ngx_event_del_timer(ngx_event_t *ev)
@@ -46,7 +61,7 @@ ngx_event_del_timer(ngx_event_t *ev)
                    "event timer del: %d: %M",
                     ngx_event_ident(ev->data), ev->timer.key);
 
-    ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+    ngx_event_timer_delete(&ev->timer);
 
 #if (NGX_DEBUG)
     ev->timer.left = NULL;
@@ -96,7 +111,7 @@ ngx_event_add_timer(ngx_event_t *ev, ngx_msec_t timer)
                    "event timer add: %d: %M:%M",
                     ngx_event_ident(ev->data), timer, ev->timer.key);
 
-    ngx_rbtree_insert(&ngx_event_timer_rbtree, &ev->timer);
+    ngx_event_timer_insert(&ev->timer);
 
     ev->timer_set = 1;
 }
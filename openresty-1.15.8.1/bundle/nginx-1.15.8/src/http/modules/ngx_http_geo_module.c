@@ -566,7 +566,15 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         {
             goto failed;
         }
+
+        if (ngx_radix_tree_compile(ctx.tree6, ctx.temp_pool) != NGX_OK) {
+            goto failed;
+        }
 #endif
+
+        if (ngx_radix_tree_compile(ctx.tree, ctx.temp_pool) != NGX_OK) {
+            goto failed;
+        }
     }
 
     ngx_destroy_pool(ctx.temp_pool);
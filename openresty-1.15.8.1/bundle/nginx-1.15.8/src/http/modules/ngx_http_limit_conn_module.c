@@ -181,7 +181,7 @@ ngx_http_limit_conn_handler(ngx_http_request_t *r)
 
         r->main->limit_conn_set = 1;
 
-        hash = ngx_crc32_short(key.data, key.len);
+        hash = ngx_crc32c(key.data, key.len);
 
         shpool = (ngx_slab_pool_t *) limits[i].shm_zone->shm.addr;
 
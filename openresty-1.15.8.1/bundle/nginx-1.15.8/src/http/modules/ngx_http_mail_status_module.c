@@ -0,0 +1,255 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+#include <ngx_mail_status_module.h>
+
+
+static ngx_int_t ngx_http_mail_status_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_mail_sessions_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_mail_sessions_kill(ngx_http_request_t *r,
+    ngx_buf_t **bp);
+static ngx_int_t ngx_http_mail_status_send(ngx_http_request_t *r,
+    ngx_buf_t *b);
+static char *ngx_http_mail_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_mail_sessions(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_mail_status_commands[] = {
+
+    { ngx_string("mail_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_mail_status,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("mail_sessions"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_mail_sessions,
+      0,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_mail_status_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_mail_status_module = {
+    NGX_MODULE_V1,
+    &ngx_http_mail_status_module_ctx,      /* module context */
+    ngx_http_mail_status_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_mail_status_handler(ngx_http_request_t *r)
+{
+    ngx_int_t   rc;
+    ngx_buf_t  *b;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    rc = ngx_mail_status_report(r->pool, &b);
+
+    if (rc == NGX_DECLINED) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "mail \"status_zone\" is not configured");
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    if (rc != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    return ngx_http_mail_status_send(r, b);
+}
+
+
+static ngx_int_t
+ngx_http_mail_sessions_handler(ngx_http_request_t *r)
+{
+    ngx_int_t   rc;
+    ngx_buf_t  *b;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD|NGX_HTTP_DELETE))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    if (r->method == NGX_HTTP_DELETE) {
+        rc = ngx_http_mail_sessions_kill(r, &b);
+
+    } else {
+        rc = ngx_mail_status_list_sessions(r->pool, &b);
+    }
+
+    if (rc == NGX_DECLINED) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "mail \"session_zone\" is not configured");
+        return NGX_HTTP_NOT_FOUND;
+    }
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    return ngx_http_mail_status_send(r, b);
+}
+
+
+static ngx_int_t
+ngx_http_mail_sessions_kill(ngx_http_request_t *r, ngx_buf_t **bp)
+{
+    u_char      *dst, *src;
+    ngx_int_t    rc, id;
+    ngx_str_t    value, login;
+    ngx_buf_t   *b;
+    ngx_uint_t   n;
+
+    /* DELETE ?id=<id> or ?login=<login> */
+
+    if (ngx_http_arg(r, (u_char *) "login", 5, &value) == NGX_OK) {
+
+        login.data = ngx_pnalloc(r->pool, value.len);
+        if (login.data == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        dst = login.data;
+        src = value.data;
+
+        ngx_unescape_uri(&dst, &src, value.len, 0);
+
+        login.len = dst - login.data;
+
+        rc = ngx_mail_status_kill(0, &login, &n);
+
+    } else if (ngx_http_arg(r, (u_char *) "id", 2, &value) == NGX_OK) {
+
+        id = ngx_atoi(value.data, value.len);
+
+        if (id == NGX_ERROR) {
+            return NGX_HTTP_BAD_REQUEST;
+        }
+
+        rc = ngx_mail_status_kill((ngx_atomic_uint_t) id, NULL, &n);
+
+    } else {
+        return NGX_HTTP_BAD_REQUEST;
+    }
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    b = ngx_create_temp_buf(r->pool,
+                            sizeof("Terminating  sessions\n") + NGX_INT_T_LEN);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_sprintf(b->last, "Terminating %ui sessions\n", n);
+
+    *bp = b;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_mail_status_send(ngx_http_request_t *r, ngx_buf_t *b)
+{
+    ngx_int_t    rc;
+    ngx_chain_t  out;
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static char *
+ngx_http_mail_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_mail_status_handler;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_mail_sessions(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_mail_sessions_handler;
+
+    return NGX_CONF_OK;
+}
@@ -19,6 +19,8 @@ typedef struct {
 #if (NGX_PCRE)
     ngx_array_t             *regex;
     ngx_array_t             *server_name_regex;
+    ngx_regex_set_t         *regex_set;
+    ngx_regex_set_t         *server_name_regex_set;
 #endif
 
     ngx_flag_t               no_referer;
@@ -45,6 +47,8 @@ static ngx_int_t ngx_http_add_regex_referer(ngx_conf_t *cf,
 #if (NGX_PCRE)
 static ngx_int_t ngx_http_add_regex_server_name(ngx_conf_t *cf,
     ngx_http_referer_conf_t *rlcf, ngx_http_regex_t *regex);
+static ngx_int_t ngx_http_referer_merge_regex_set(ngx_conf_t *cf,
+    ngx_http_referer_conf_t *prev, ngx_http_referer_conf_t *conf);
 #endif
 static int ngx_libc_cdecl ngx_http_cmp_referer_wildcards(const void *one,
     const void *two);
@@ -202,8 +206,9 @@ valid_scheme:
         referer.len = p - ref;
         referer.data = buf;
 
-        rc = ngx_regex_exec_array(rlcf->server_name_regex, &referer,
-                                  r->connection->log);
+        rc = ngx_regex_exec_set(rlcf->server_name_regex_set,
+                                rlcf->server_name_regex, &referer,
+                                r->connection->log);
 
         if (rc == NGX_OK) {
             goto valid;
@@ -220,7 +225,8 @@ valid_scheme:
         referer.len = len;
         referer.data = ref;
 
-        rc = ngx_regex_exec_array(rlcf->regex, &referer, r->connection->log);
+        rc = ngx_regex_exec_set(rlcf->regex_set, rlcf->regex, &referer,
+                                r->connection->log);
 
         if (rc == NGX_OK) {
             goto valid;
@@ -300,6 +306,8 @@ ngx_http_referer_create_conf(ngx_conf_t *cf)
      *     conf->hash = { NULL };
      *     conf->server_names = 0;
      *     conf->keys = NULL;
+     *     conf->regex_set = NULL;
+     *     conf->server_name_regex_set = NULL;
      */
 
 #if (NGX_PCRE)
@@ -334,6 +342,10 @@ ngx_http_referer_merge_conf(ngx_conf_t *cf, void *parent, void *child)
         ngx_conf_merge_ptr_value(conf->regex, prev->regex, NULL);
         ngx_conf_merge_ptr_value(conf->server_name_regex,
                                  prev->server_name_regex, NULL);
+
+        if (ngx_http_referer_merge_regex_set(cf, prev, conf) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
 #endif
         ngx_conf_merge_value(conf->no_referer, prev->no_referer, 0);
         ngx_conf_merge_value(conf->blocked_referer, prev->blocked_referer, 0);
@@ -452,6 +464,10 @@ ngx_http_referer_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_ptr_value(conf->regex, prev->regex, NULL);
     ngx_conf_merge_ptr_value(conf->server_name_regex, prev->server_name_regex,
                              NULL);
+
+    if (ngx_http_referer_merge_regex_set(cf, prev, conf) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
 #endif
 
     if (conf->no_referer == NGX_CONF_UNSET) {
@@ -667,6 +683,37 @@ ngx_http_add_regex_server_name(ngx_conf_t *cf, ngx_http_referer_conf_t *rlcf,
     return NGX_OK;
 }
 
+
+static ngx_int_t
+ngx_http_referer_merge_regex_set(ngx_conf_t *cf,
+    ngx_http_referer_conf_t *prev, ngx_http_referer_conf_t *conf)
+{
+    /* the inherited lists share the prefilter */
+
+    if (conf->regex == prev->regex && prev->regex_set) {
+        conf->regex_set = prev->regex_set;
+
+    } else if (ngx_regex_set_create_array(cf, &conf->regex_set, conf->regex)
+               != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (conf->server_name_regex == prev->server_name_regex
+        && prev->server_name_regex_set)
+    {
+        conf->server_name_regex_set = prev->server_name_regex_set;
+
+    } else if (ngx_regex_set_create_array(cf, &conf->server_name_regex_set,
+                                          conf->server_name_regex)
+               != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
 #endif
 
 
@@ -76,6 +76,13 @@ static ngx_conf_deprecated_t  ngx_http_ssl_deprecated = {
 };
 
 
+static ngx_conf_post_t  ngx_http_ssl_certificate_post =
+    { ngx_ssl_preload_certificate };
+
+static ngx_conf_post_t  ngx_http_ssl_certificate_key_post =
+    { ngx_ssl_preload_certificate_key };
+
+
 static ngx_command_t  ngx_http_ssl_commands[] = {
 
     { ngx_string("ssl"),
@@ -90,14 +97,14 @@ static ngx_command_t  ngx_http_ssl_commands[] = {
       ngx_conf_set_str_array_slot,
       NGX_HTTP_SRV_CONF_OFFSET,
       offsetof(ngx_http_ssl_srv_conf_t, certificates),
-      NULL },
+      &ngx_http_ssl_certificate_post },
 
     { ngx_string("ssl_certificate_key"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_str_array_slot,
       NGX_HTTP_SRV_CONF_OFFSET,
       offsetof(ngx_http_ssl_srv_conf_t, certificate_keys),
-      NULL },
+      &ngx_http_ssl_certificate_key_post },
 
     { ngx_string("ssl_password_file"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
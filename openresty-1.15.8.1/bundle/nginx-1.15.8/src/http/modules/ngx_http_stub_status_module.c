@@ -8,9 +8,13 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 #include <ngx_http.h>
+#include <ngx_event_stat.h>
 
 
 static ngx_int_t ngx_http_stub_status_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_stub_status_workers_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_stub_status(ngx_http_request_t *r,
+    ngx_uint_t workers);
 static ngx_int_t ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_stub_status_add_variables(ngx_conf_t *cf);
@@ -82,6 +86,20 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
 
 static ngx_int_t
 ngx_http_stub_status_handler(ngx_http_request_t *r)
+{
+    return ngx_http_stub_status(r, 0);
+}
+
+
+static ngx_int_t
+ngx_http_stub_status_workers_handler(ngx_http_request_t *r)
+{
+    return ngx_http_stub_status(r, 1);
+}
+
+
+static ngx_int_t
+ngx_http_stub_status(ngx_http_request_t *r, ngx_uint_t workers)
 {
     size_t             size;
     ngx_int_t          rc;
@@ -118,6 +136,10 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
            + 6 + 3 * NGX_ATOMIC_T_LEN
            + sizeof("Reading:  Writing:  Waiting:  \n") + 3 * NGX_ATOMIC_T_LEN;
 
+    if (workers) {
+        size += ngx_event_stat_len((ngx_cycle_t *) ngx_cycle);
+    }
+
     b = ngx_create_temp_buf(r->pool, size);
     if (b == NULL) {
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
@@ -144,6 +166,10 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
     b->last = ngx_sprintf(b->last, "Reading: %uA Writing: %uA Waiting: %uA \n",
                           rd, wr, wa);
 
+    if (workers) {
+        b->last = ngx_event_stat_print(b->last, (ngx_cycle_t *) ngx_cycle);
+    }
+
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = b->last - b->pos;
 
@@ -227,9 +253,22 @@ ngx_http_stub_status_add_variables(ngx_conf_t *cf)
 static char *
 ngx_http_set_stub_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
+    ngx_str_t                 *value;
     ngx_http_core_loc_conf_t  *clcf;
 
     clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+    value = cf->args->elts;
+
+    /* other parameters are ignored for compatibility */
+
+    if (cf->args->nelts == 2 && ngx_strcmp(value[1].data, "workers") == 0) {
+        clcf->handler = ngx_http_stub_status_workers_handler;
+        ngx_event_stat_enable(cf);
+
+        return NGX_CONF_OK;
+    }
+
     clcf->handler = ngx_http_stub_status_handler;
 
     return NGX_CONF_OK;
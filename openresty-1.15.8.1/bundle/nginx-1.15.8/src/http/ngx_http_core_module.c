@@ -2080,9 +2080,9 @@ ok:
 
     if (clcf->gzip_disable && r->headers_in.user_agent) {
 
-        if (ngx_regex_exec_array(clcf->gzip_disable,
-                                 &r->headers_in.user_agent->value,
-                                 r->connection->log)
+        if (ngx_regex_exec_set(clcf->gzip_disable_set, clcf->gzip_disable,
+                               &r->headers_in.user_agent->value,
+                               r->connection->log)
             != NGX_DECLINED)
         {
             return NGX_DECLINED;
@@ -3385,6 +3385,7 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
      *     clcf->auto_redirect = 0;
      *     clcf->alias = 0;
      *     clcf->gzip_proxied = 0;
+     *     clcf->gzip_disable_set = NULL;
      *     clcf->keepalive_disable = 0;
      */
 
@@ -3731,6 +3732,16 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
 
 #if (NGX_PCRE)
     ngx_conf_merge_ptr_value(conf->gzip_disable, prev->gzip_disable, NULL);
+
+    if (conf->gzip_disable == prev->gzip_disable && prev->gzip_disable_set) {
+        conf->gzip_disable_set = prev->gzip_disable_set;
+
+    } else if (ngx_regex_set_create_array(cf, &conf->gzip_disable_set,
+                                          conf->gzip_disable)
+               != NGX_OK)
+    {
+        return NGX_CONF_ERROR;
+    }
 #endif
 
     if (conf->gzip_disable_msie6 == 3) {
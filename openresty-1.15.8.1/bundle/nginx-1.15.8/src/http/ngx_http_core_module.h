@@ -405,6 +405,7 @@ struct ngx_http_core_loc_conf_s {
 
 #if (NGX_PCRE)
     ngx_array_t  *gzip_disable;            /* gzip_disable */
+    ngx_regex_set_t  *gzip_disable_set;
 #endif
 #endif
 
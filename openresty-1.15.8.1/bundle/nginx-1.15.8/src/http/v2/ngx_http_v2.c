@@ -296,6 +296,13 @@ ngx_http_v2_init(ngx_event_t *rev)
         return;
     }
 
+    if (ngx_http_v2_table_init_encoder(h2c, h2scf->hpack_table_size)
+        != NGX_OK)
+    {
+        ngx_http_close_connection(c);
+        return;
+    }
+
     if (ngx_http_v2_send_settings(h2c) == NGX_ERROR) {
         ngx_http_close_connection(c);
         return;
@@ -2076,7 +2083,7 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
 
         case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
 
-            h2c->table_update = 1;
+            ngx_http_v2_table_limit(h2c, value);
             break;
 
         default:
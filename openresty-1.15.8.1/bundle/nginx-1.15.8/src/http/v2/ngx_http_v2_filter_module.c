@@ -135,7 +135,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 {
     u_char                     status, *pos, *start, *p, *tmp;
     size_t                     len, tmp_len;
-    ngx_str_t                  host, location;
+    ngx_str_t                  host, location, server, value;
     ngx_uint_t                 i, port, fin;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
@@ -147,6 +147,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
+    u_char                     buf[sizeof("Wed, 31 Dec 1986 18:00:00 GMT")];
 
     static const u_char nginx[8] = "\x87\x3d\x65\xaa\xc2\xa1\x3e\xbf";
 #if (NGX_HTTP_GZIP)
@@ -253,7 +254,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
     }
 
-    len = h2c->table_update ? 1 : 0;
+    len = h2c->table_update ? 2 * NGX_HTTP_V2_INT_OCTETS : 0;
 
     len += status ? 1 : 1 + ngx_http_v2_literal_size("418");
 
@@ -376,6 +377,11 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         len += 1 + NGX_HTTP_V2_INT_OCTETS + r->headers_out.location->value.len;
     }
 
+    if (h2c->hpack_enc.capacity) {
+        /* static name indices above 15 take two octets without indexing */
+        len += 7;
+    }
+
     tmp_len = len;
 
 #if (NGX_HTTP_GZIP)
@@ -444,10 +450,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     start = pos;
 
     if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
-        h2c->table_update = 0;
+        pos = ngx_http_v2_table_update(h2c, pos);
     }
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
@@ -457,6 +460,13 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     if (status) {
         *pos++ = status;
 
+    } else if (h2c->hpack_enc.capacity) {
+        value.data = buf;
+        value.len = ngx_sprintf(buf, "%03ui", r->headers_out.status) - buf;
+
+        pos = ngx_http_v2_table_encode(h2c, pos, NGX_HTTP_V2_STATUS_INDEX,
+                                       NULL, &value, 1, tmp);
+
     } else {
         *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
         *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
@@ -466,43 +476,49 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     if (r->headers_out.server == NULL) {
 
         if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: %s\"",
-                           NGINX_VER);
+            ngx_str_set(&server, NGINX_VER);
 
         } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: %s\"",
-                           NGINX_VER_BUILD);
+            ngx_str_set(&server, NGINX_VER_BUILD);
 
         } else {
-            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                           "http2 output header: \"server: nginx\"");
+            ngx_str_set(&server, "nginx");
         }
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"server: %V\"", &server);
 
-        if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
-            if (nginx_ver[0] == '\0') {
-                p = ngx_http_v2_write_value(nginx_ver, (u_char *) NGINX_VER,
-                                            sizeof(NGINX_VER) - 1, tmp);
-                nginx_ver_len = p - nginx_ver;
-            }
+        if (h2c->hpack_enc.capacity) {
+            pos = ngx_http_v2_table_encode(h2c, pos, NGX_HTTP_V2_SERVER_INDEX,
+                                           NULL, &server, 1, tmp);
 
-            pos = ngx_cpymem(pos, nginx_ver, nginx_ver_len);
+        } else {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
+
+            if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
+                if (nginx_ver[0] == '\0') {
+                    p = ngx_http_v2_write_value(nginx_ver,
+                                                (u_char *) NGINX_VER,
+                                                sizeof(NGINX_VER) - 1, tmp);
+                    nginx_ver_len = p - nginx_ver;
+                }
 
-        } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
-            if (nginx_ver_build[0] == '\0') {
-                p = ngx_http_v2_write_value(nginx_ver_build,
-                                            (u_char *) NGINX_VER_BUILD,
-                                            sizeof(NGINX_VER_BUILD) - 1, tmp);
-                nginx_ver_build_len = p - nginx_ver_build;
-            }
+                pos = ngx_cpymem(pos, nginx_ver, nginx_ver_len);
 
-            pos = ngx_cpymem(pos, nginx_ver_build, nginx_ver_build_len);
+            } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
+                if (nginx_ver_build[0] == '\0') {
+                    p = ngx_http_v2_write_value(nginx_ver_build,
+                                                (u_char *) NGINX_VER_BUILD,
+                                                sizeof(NGINX_VER_BUILD) - 1,
+                                                tmp);
+                    nginx_ver_build_len = p - nginx_ver_build;
+                }
 
-        } else {
-            pos = ngx_cpymem(pos, nginx, sizeof(nginx));
+                pos = ngx_cpymem(pos, nginx_ver_build, nginx_ver_build_len);
+
+            } else {
+                pos = ngx_cpymem(pos, nginx, sizeof(nginx));
+            }
         }
     }
 
@@ -511,13 +527,13 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"date: %V\"",
                        &ngx_cached_http_time);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
-        pos = ngx_http_v2_write_value(pos, ngx_cached_http_time.data,
-                                      ngx_cached_http_time.len, tmp);
+        value = ngx_cached_http_time;
+
+        pos = ngx_http_v2_table_encode(h2c, pos, NGX_HTTP_V2_DATE_INDEX, NULL,
+                                       &value, 0, tmp);
     }
 
     if (r->headers_out.content_type.len) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
 
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
@@ -548,8 +564,9 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-type: %V\"",
                        &r->headers_out.content_type);
 
-        pos = ngx_http_v2_write_value(pos, r->headers_out.content_type.data,
-                                      r->headers_out.content_type.len, tmp);
+        pos = ngx_http_v2_table_encode(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_TYPE_INDEX, NULL,
+                                       &r->headers_out.content_type, 1, tmp);
     }
 
     if (r->headers_out.content_length == NULL
@@ -559,30 +576,29 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-length: %O\"",
                        r->headers_out.content_length_n);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
+        value.data = buf;
+        value.len = ngx_sprintf(buf, "%O", r->headers_out.content_length_n)
+                    - buf;
 
-        p = pos;
-        pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
-        *p = NGX_HTTP_V2_ENCODE_RAW | (u_char) (pos - p - 1);
+        pos = ngx_http_v2_table_encode(h2c, pos,
+                                       NGX_HTTP_V2_CONTENT_LENGTH_INDEX, NULL,
+                                       &value, 0, tmp);
     }
 
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
-
-        ngx_http_time(pos, r->headers_out.last_modified_time);
-        len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
+        value.data = buf;
+        value.len = ngx_http_time(buf, r->headers_out.last_modified_time)
+                    - buf;
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 output header: \"last-modified: %*s\"",
-                       len, pos);
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
+                       "http2 output header: \"last-modified: %V\"",
+                       &value);
 
-        /*
-         * Date will always be encoded using huffman in the temporary buffer,
-         * so it's safe here to use src and dst pointing to the same address.
-         */
-        pos = ngx_http_v2_write_value(pos, pos, len, tmp);
+        pos = ngx_http_v2_table_encode(h2c, pos,
+                                       NGX_HTTP_V2_LAST_MODIFIED_INDEX, NULL,
+                                       &value, 0, tmp);
     }
 
     if (r->headers_out.location && r->headers_out.location->value.len) {
@@ -590,9 +606,9 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"location: %V\"",
                        &r->headers_out.location->value);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
-        pos = ngx_http_v2_write_value(pos, r->headers_out.location->value.data,
-                                      r->headers_out.location->value.len, tmp);
+        pos = ngx_http_v2_table_encode(h2c, pos, NGX_HTTP_V2_LOCATION_INDEX,
+                                       NULL, &r->headers_out.location->value,
+                                       0, tmp);
     }
 
 #if (NGX_HTTP_GZIP)
@@ -600,8 +616,16 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"vary: Accept-Encoding\"");
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
-        pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        if (h2c->hpack_enc.capacity) {
+            ngx_str_set(&value, "Accept-Encoding");
+
+            pos = ngx_http_v2_table_encode(h2c, pos, NGX_HTTP_V2_VARY_INDEX,
+                                           NULL, &value, 1, tmp);
+
+        } else {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
+            pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        }
     }
 #endif
 
@@ -634,13 +658,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
 #endif
 
-        *pos++ = 0;
-
-        pos = ngx_http_v2_write_name(pos, header[i].key.data,
-                                     header[i].key.len, tmp);
-
-        pos = ngx_http_v2_write_value(pos, header[i].value.data,
-                                      header[i].value.len, tmp);
+        pos = ngx_http_v2_table_encode(h2c, pos, 0, &header[i].key,
+                                       &header[i].value, 1, tmp);
     }
 
     fin = r->header_only
@@ -991,7 +1010,7 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
         }
     }
 
-    len = (h2c->table_update ? 1 : 0)
+    len = (h2c->table_update ? 2 * NGX_HTTP_V2_INT_OCTETS : 0)
           + 1
           + 1 + NGX_HTTP_V2_INT_OCTETS + path->len
           + 1 + NGX_HTTP_V2_INT_OCTETS + r->schema.len;
@@ -1008,10 +1027,7 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
     start = pos;
 
     if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
-        h2c->table_update = 0;
+        pos = ngx_http_v2_table_update(h2c, pos);
     }
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
@@ -1025,6 +1041,10 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
     *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_PATH_INDEX);
     pos = ngx_http_v2_write_value(pos, path->data, path->len, tmp);
 
+    /* the client adds these headers to its table, mirror them */
+
+    ngx_http_v2_table_insert(h2c, NGX_HTTP_V2_PATH_INDEX, path);
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 push header: \":scheme: %V\"", &r->schema);
 
@@ -1039,6 +1059,9 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
     } else {
         *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SCHEME_HTTP_INDEX);
         pos = ngx_http_v2_write_value(pos, r->schema.data, r->schema.len, tmp);
+
+        ngx_http_v2_table_insert(h2c, NGX_HTTP_V2_SCHEME_HTTP_INDEX,
+                                 &r->schema);
     }
 
     for (i = 0; i < NGX_HTTP_V2_PUSH_HEADERS; i++) {
@@ -1053,6 +1076,8 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
                        &ph[i].name, &(*h)->value);
 
         pos = ngx_cpymem(pos, binary[i].data, binary[i].len);
+
+        ngx_http_v2_table_insert(h2c, ph[i].index, &(*h)->value);
     }
 
     frame = ngx_http_v2_create_push_frame(r, start, pos);
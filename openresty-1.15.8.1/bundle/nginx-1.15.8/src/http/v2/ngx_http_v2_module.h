@@ -28,6 +28,7 @@ typedef struct {
     size_t                          max_field_size;
     size_t                          max_header_size;
     size_t                          preread_size;
+    size_t                          hpack_table_size;
     ngx_uint_t                      streams_index_mask;
     ngx_msec_t                      recv_timeout;
     ngx_msec_t                      idle_timeout;
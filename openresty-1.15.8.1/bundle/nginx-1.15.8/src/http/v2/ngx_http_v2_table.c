@@ -15,6 +15,16 @@
 
 static ngx_int_t ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c,
     size_t size);
+static void ngx_http_v2_table_add_encoded(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value, ngx_uint_t hash, ngx_uint_t name_hash);
+static void ngx_http_v2_table_resize(ngx_http_v2_hpack_enc_t *enc,
+    size_t size);
+static ngx_uint_t ngx_http_v2_table_seen(ngx_http_v2_hpack_enc_t *enc,
+    ngx_uint_t hash);
+static ngx_int_t ngx_http_v2_table_cmp(ngx_http_v2_hpack_enc_t *enc,
+    u_char *data, u_char *s, size_t len, ngx_uint_t lower);
+static u_char *ngx_http_v2_table_copy(ngx_http_v2_hpack_enc_t *enc,
+    u_char *src, size_t len, ngx_uint_t lower);
 
 
 static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
@@ -361,3 +371,432 @@ ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size)
 
     return NGX_OK;
 }
+
+
+/*
+ * The encoder table mirrors the dynamic table of the client for response
+ * headers.  It is stored the same way as the decoder one, in a ring of
+ * the configured size, so that no entry has to be allocated or freed.
+ *
+ * Only headers seen twice on the connection are inserted: an entry is
+ * only worth its 32 bytes of overhead and the evictions it causes if
+ * the header is repeated across streams.
+ *
+ * The entries are found through two hashes, of the whole header and of
+ * its name.  A bucket refers to its newest entry, and each entry to the
+ * older one of the same bucket, by the number of the entry since the
+ * connection start.  The chains are never unlinked: an entry numbered
+ * below the deleted ones ends a chain.
+ */
+
+ngx_int_t
+ngx_http_v2_table_init_encoder(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    ngx_uint_t                n;
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+
+    enc->capacity = size;
+    enc->limit = NGX_HTTP_V2_TABLE_SIZE;
+    enc->lowest = enc->limit;
+
+    if (size == 0) {
+        return NGX_OK;
+    }
+
+    enc->allocated = size / 32 + 1;
+
+    enc->entries = ngx_palloc(h2c->connection->pool,
+                              sizeof(ngx_http_v2_hpack_entry_t)
+                              * enc->allocated);
+    if (enc->entries == NULL) {
+        return NGX_ERROR;
+    }
+
+    enc->storage = ngx_palloc(h2c->connection->pool, size);
+    if (enc->storage == NULL) {
+        return NGX_ERROR;
+    }
+
+    /*
+     * entries are rarely under 64 bytes, a bucket per two of them;
+     * the headers seen once are remembered in four times as many slots
+     */
+
+    for (n = 16; n < enc->allocated / 2; n <<= 1) { /* void */ }
+
+    enc->buckets = ngx_pcalloc(h2c->connection->pool,
+                               6 * n * sizeof(ngx_uint_t));
+    if (enc->buckets == NULL) {
+        return NGX_ERROR;
+    }
+
+    enc->name_buckets = enc->buckets + n;
+    enc->seen = enc->name_buckets + n;
+    enc->mask = n - 1;
+
+    enc->pos = enc->storage;
+
+    /* the size is announced in the first header block */
+
+    h2c->table_update = 1;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_http_v2_table_limit(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 client hpack table size: %uz was:%uz",
+                   size, h2c->hpack_enc.limit);
+
+    h2c->hpack_enc.limit = size;
+
+    if (size < h2c->hpack_enc.lowest) {
+        h2c->hpack_enc.lowest = size;
+    }
+
+    h2c->table_update = 1;
+}
+
+
+u_char *
+ngx_http_v2_table_update(ngx_http_v2_connection_t *h2c, u_char *pos)
+{
+    size_t                    size;
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+
+    h2c->table_update = 0;
+
+    /*
+     * if the client lowered its limit and raised it again
+     * since the last update, the lowest size is signaled first
+     */
+
+    size = ngx_min(enc->capacity, enc->lowest);
+
+    if (size < ngx_min(enc->capacity, enc->limit)) {
+        ngx_http_v2_table_resize(enc, size);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 table size update: %uz", size);
+
+        *pos = 0x20;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5), size);
+    }
+
+    size = ngx_min(enc->capacity, enc->limit);
+    enc->lowest = enc->limit;
+
+    ngx_http_v2_table_resize(enc, size);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table size update: %uz", size);
+
+    *pos = 0x20;
+    return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5), size);
+}
+
+
+u_char *
+ngx_http_v2_table_encode(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, ngx_uint_t indexing,
+    u_char *tmp)
+{
+    ngx_uint_t                  i, n, hash, name_hash;
+    ngx_http_v2_hpack_enc_t    *enc;
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    enc = &h2c->hpack_enc;
+
+    if (name == NULL) {
+        name = &ngx_http_v2_static_table[index - 1].name;
+    }
+
+    if (enc->capacity == 0) {
+
+        /* no table: static name with incremental indexing, as before */
+
+        if (index) {
+            *pos++ = ngx_http_v2_inc_indexed(index);
+
+        } else {
+            *pos++ = 0;
+            pos = ngx_http_v2_write_name(pos, name->data, name->len, tmp);
+        }
+
+        return ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+    }
+
+    if (index && !indexing) {
+
+        /* such headers are never inserted, nothing to look up */
+
+        *pos = 0;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4), index);
+
+        return ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+    }
+
+    name_hash = ngx_hash_key_lc(name->data, name->len);
+
+    hash = name_hash;
+
+    for (i = 0; i < value->len; i++) {
+        hash = ngx_hash(hash, value->data[i]);
+    }
+
+    for (n = enc->buckets[hash & enc->mask];
+         n > enc->deleted;
+         n = entry->next)
+    {
+        entry = &enc->entries[(n - 1) % enc->allocated];
+
+        if (entry->hash == hash
+            && entry->header.name.len == name->len
+            && entry->header.value.len == value->len
+            && ngx_http_v2_table_cmp(enc, entry->header.name.data,
+                                     name->data, name->len, 1)
+               == 0
+            && ngx_http_v2_table_cmp(enc, entry->header.value.data,
+                                     value->data, value->len, 0)
+               == 0)
+        {
+            i = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + enc->added - n + 1;
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                           "http2 table indexed: %ui", i);
+
+            *pos = 0x80;
+            return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7), i);
+        }
+    }
+
+    if (index == 0) {
+
+        /* the newest entry with the name */
+
+        for (n = enc->name_buckets[name_hash & enc->mask];
+             n > enc->deleted;
+             n = entry->name_next)
+        {
+            entry = &enc->entries[(n - 1) % enc->allocated];
+
+            if (entry->name_hash == name_hash
+                && entry->header.name.len == name->len
+                && ngx_http_v2_table_cmp(enc, entry->header.name.data,
+                                         name->data, name->len, 1)
+                   == 0)
+            {
+                index = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + enc->added - n + 1;
+                break;
+            }
+        }
+    }
+
+    if (indexing
+        && 32 + name->len + value->len <= enc->size / 2
+        && ngx_http_v2_table_seen(enc, hash))
+    {
+        /* the name index refers to the table before the insertion */
+
+        *pos = 0x40;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(6), index);
+
+        ngx_http_v2_table_add_encoded(h2c, name, value, hash, name_hash);
+
+    } else {
+        *pos = 0;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4), index);
+    }
+
+    if (index == 0) {
+        pos = ngx_http_v2_write_name(pos, name->data, name->len, tmp);
+    }
+
+    return ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+}
+
+
+void
+ngx_http_v2_table_insert(ngx_http_v2_connection_t *h2c, ngx_uint_t index,
+    ngx_str_t *value)
+{
+    ngx_str_t   *name;
+    ngx_uint_t   i, hash, name_hash;
+
+    /* accounts a header already encoded with incremental indexing */
+
+    if (h2c->hpack_enc.capacity == 0) {
+        return;
+    }
+
+    name = &ngx_http_v2_static_table[index - 1].name;
+
+    name_hash = ngx_hash_key_lc(name->data, name->len);
+
+    hash = name_hash;
+
+    for (i = 0; i < value->len; i++) {
+        hash = ngx_hash(hash, value->data[i]);
+    }
+
+    ngx_http_v2_table_add_encoded(h2c, name, value, hash, name_hash);
+}
+
+
+static void
+ngx_http_v2_table_add_encoded(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value, ngx_uint_t hash, ngx_uint_t name_hash)
+{
+    size_t                      size;
+    ngx_http_v2_hpack_enc_t    *enc;
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    enc = &h2c->hpack_enc;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table add encoded: \"%V: %V\"", name, value);
+
+    size = 32 + name->len + value->len;
+
+    if (size > enc->size) {
+
+        /* the client empties its table */
+
+        enc->deleted = enc->added;
+        enc->free = enc->size;
+        return;
+    }
+
+    while (size > enc->free) {
+        entry = &enc->entries[enc->deleted++ % enc->allocated];
+        enc->free += 32 + entry->header.name.len + entry->header.value.len;
+    }
+
+    enc->free -= size;
+
+    entry = &enc->entries[enc->added % enc->allocated];
+
+    entry->hash = hash;
+    entry->name_hash = name_hash;
+
+    entry->next = enc->buckets[hash & enc->mask];
+    entry->name_next = enc->name_buckets[name_hash & enc->mask];
+
+    enc->added++;
+
+    enc->buckets[hash & enc->mask] = enc->added;
+    enc->name_buckets[name_hash & enc->mask] = enc->added;
+
+    entry->header.name.len = name->len;
+    entry->header.name.data = ngx_http_v2_table_copy(enc, name->data,
+                                                     name->len, 1);
+
+    entry->header.value.len = value->len;
+    entry->header.value.data = ngx_http_v2_table_copy(enc, value->data,
+                                                      value->len, 0);
+}
+
+
+static void
+ngx_http_v2_table_resize(ngx_http_v2_hpack_enc_t *enc, size_t size)
+{
+    size_t                      used;
+    ngx_http_v2_hpack_entry_t  *entry;
+
+    used = enc->size - enc->free;
+
+    while (used > size) {
+        entry = &enc->entries[enc->deleted++ % enc->allocated];
+        used -= 32 + entry->header.name.len + entry->header.value.len;
+    }
+
+    enc->size = size;
+    enc->free = size - used;
+}
+
+
+static ngx_uint_t
+ngx_http_v2_table_seen(ngx_http_v2_hpack_enc_t *enc, ngx_uint_t hash)
+{
+    ngx_uint_t  *seen;
+
+    /* the low bits of the hash depend on the last characters only */
+
+    seen = &enc->seen[(hash ^ (hash >> 16)) & (4 * enc->mask + 3)];
+
+    if (*seen == hash) {
+        return 1;
+    }
+
+    *seen = hash;
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_http_v2_table_cmp(ngx_http_v2_hpack_enc_t *enc, u_char *data, u_char *s,
+    size_t len, ngx_uint_t lower)
+{
+    size_t  rest;
+
+    rest = enc->storage + enc->capacity - data;
+
+    if (len > rest) {
+
+        if (lower ? ngx_strncasecmp(data, s, rest) : ngx_memcmp(data, s, rest))
+        {
+            return 1;
+        }
+
+        data = enc->storage;
+        s += rest;
+        len -= rest;
+    }
+
+    return lower ? ngx_strncasecmp(data, s, len) : ngx_memcmp(data, s, len);
+}
+
+
+static u_char *
+ngx_http_v2_table_copy(ngx_http_v2_hpack_enc_t *enc, u_char *src, size_t len,
+    ngx_uint_t lower)
+{
+    u_char  *data;
+    size_t   avail;
+
+    data = enc->pos;
+    avail = enc->storage + enc->capacity - enc->pos;
+
+    if (len >= avail) {
+
+        if (lower) {
+            ngx_strlow(enc->pos, src, avail);
+
+        } else {
+            ngx_memcpy(enc->pos, src, avail);
+        }
+
+        enc->pos = enc->storage;
+        src += avail;
+        len -= avail;
+    }
+
+    if (lower) {
+        ngx_strlow(enc->pos, src, len);
+
+    } else {
+        ngx_memcpy(enc->pos, src, len);
+    }
+
+    enc->pos += len;
+
+    return data;
+}
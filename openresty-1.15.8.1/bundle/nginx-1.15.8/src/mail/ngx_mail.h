@@ -39,6 +39,7 @@ typedef struct {
 #if (NGX_HAVE_INET6)
     unsigned                ipv6only:1;
 #endif
+    unsigned                reuseport:1;
     unsigned                so_keepalive:2;
 #if (NGX_HAVE_KEEPALIVE_TUNABLE)
     int                     tcp_keepidle;
@@ -117,6 +118,9 @@ typedef struct {
     u_char                 *file_name;
     ngx_uint_t              line;
 
+    /* index in ngx_mail_core_main_conf_t.servers */
+    ngx_uint_t              index;
+
     ngx_resolver_t         *resolver;
     ngx_log_t              *error_log;
 
@@ -179,9 +183,33 @@ typedef enum {
 typedef struct {
     ngx_peer_connection_t   upstream;
     ngx_buf_t              *buffer;
+
+    /* SMTP replies the client has not received yet */
+    ngx_uint_t              pending;
+
+    ngx_uint_t              data_state;
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+    /* MSG_ZEROCOPY state of the client and upstream connections */
+    ngx_linux_zerocopy_t   *zerocopy[2];
+#endif
+
+    unsigned                keepalive:1;
+    unsigned                data:1;
+    unsigned                data_end:1;
 } ngx_mail_proxy_ctx_t;
 
 
+#define NGX_MAIL_PHASE_AUTH     0
+#define NGX_MAIL_PHASE_PROXY    1
+#define NGX_MAIL_PHASE_SLEEP    2
+
+#define NGX_MAIL_PHASES         3
+
+
+typedef struct ngx_mail_status_session_s  ngx_mail_status_session_t;
+
+
 typedef struct {
     uint32_t                signature;         /* "MAIL" */
 
@@ -199,6 +227,9 @@ typedef struct {
 
     ngx_mail_proxy_ctx_t   *proxy;
 
+    ngx_queue_t             queue;
+    ngx_mail_status_session_t  *status;
+
     ngx_uint_t              mail_state;
     ngx_uint_t              client_state;
 
@@ -212,6 +243,8 @@ typedef struct {
     unsigned                esmtp:1;
     unsigned                auth_method:3;
     unsigned                auth_wait:1;
+    unsigned                phase:2;
+    unsigned                killed:1;
 
     ngx_str_t               login;
     ngx_str_t               passwd;
@@ -409,11 +442,18 @@ char *ngx_mail_capabilities(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 /* STUB */
 void ngx_mail_proxy_init(ngx_mail_session_t *s, ngx_addr_t *peer);
+ngx_int_t ngx_mail_proxy_smtp_keepalive(ngx_mail_session_t *s);
 void ngx_mail_auth_http_init(ngx_mail_session_t *s);
+void ngx_mail_auth_http_pool_stat(ngx_mail_session_t *s,
+    ngx_pool_stat_t *stat);
+ngx_uint_t ngx_mail_auth_http_pending(ngx_mail_session_t *s);
+ngx_int_t ngx_mail_status_init_session(ngx_mail_session_t *s);
+void ngx_mail_status_update_session(ngx_mail_session_t *s);
 /**/
 
 
 extern ngx_uint_t    ngx_mail_max_module;
+extern ngx_module_t  ngx_mail_module;
 extern ngx_module_t  ngx_mail_core_module;
 
 
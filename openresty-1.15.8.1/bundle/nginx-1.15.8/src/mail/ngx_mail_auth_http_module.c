@@ -12,8 +12,65 @@
 #include <ngx_mail.h>
 
 
+#if (NGX_HAVE_UNIX_DOMAIN)
+
+/*
+ * auth_uds framing: every message in either direction is
+ *
+ *     uint32  length of the rest of the message, network byte order
+ *     uint32  request id, echoed back by the auth server
+ *     TLV*    uint16 type, uint16 length, value
+ *
+ * Request values carry the same data as the auth_http request headers,
+ * unescaped.  Response types map onto the auth_http response headers,
+ * so a reply is processed exactly like "Auth-Status", "Auth-Server", etc.
+ */
+
+#define NGX_MAIL_AUTH_UDS_METHOD           1
+#define NGX_MAIL_AUTH_UDS_USER             2
+#define NGX_MAIL_AUTH_UDS_PASS             3
+#define NGX_MAIL_AUTH_UDS_SALT             4
+#define NGX_MAIL_AUTH_UDS_PROTOCOL         5
+#define NGX_MAIL_AUTH_UDS_LOGIN_ATTEMPT    6
+#define NGX_MAIL_AUTH_UDS_CLIENT_IP        7
+#define NGX_MAIL_AUTH_UDS_CLIENT_HOST      8
+#define NGX_MAIL_AUTH_UDS_SMTP_HELO        9
+#define NGX_MAIL_AUTH_UDS_SMTP_FROM        10
+#define NGX_MAIL_AUTH_UDS_SMTP_TO          11
+#define NGX_MAIL_AUTH_UDS_SSL              12
+#define NGX_MAIL_AUTH_UDS_SSL_VERIFY       13
+#define NGX_MAIL_AUTH_UDS_SSL_SUBJECT      14
+#define NGX_MAIL_AUTH_UDS_SSL_ISSUER       15
+#define NGX_MAIL_AUTH_UDS_SSL_SERIAL       16
+#define NGX_MAIL_AUTH_UDS_SSL_FINGERPRINT  17
+#define NGX_MAIL_AUTH_UDS_SSL_CERT         18
+#define NGX_MAIL_AUTH_UDS_HEADER           19
+
+#define NGX_MAIL_AUTH_UDS_BUFFER_SIZE      65536
+
+
+typedef struct {
+    ngx_addr_t                     *addr;
+
+    ngx_connection_t               *connection;
+
+    ngx_buf_t                       in;
+    ngx_buf_t                       out;
+
+    ngx_rbtree_t                    rbtree;
+    ngx_rbtree_node_t               sentinel;
+
+    uint32_t                        id;
+} ngx_mail_auth_uds_peer_t;
+
+#endif
+
+
 typedef struct {
     ngx_addr_t                     *peer;
+#if (NGX_HAVE_UNIX_DOMAIN)
+    ngx_mail_auth_uds_peer_t       *uds;
+#endif
 
     ngx_msec_t                      timeout;
     ngx_flag_t                      pass_client_cert;
@@ -57,6 +114,11 @@ struct ngx_mail_auth_http_ctx_s {
     time_t                          sleep;
 
     ngx_pool_t                     *pool;
+    ngx_mail_session_t             *session;
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    ngx_rbtree_node_t               node;
+#endif
 };
 
 
@@ -66,7 +128,12 @@ static void ngx_mail_auth_http_ignore_status_line(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx);
 static void ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx);
+static ngx_int_t ngx_mail_auth_http_process_header(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_str_t *name, ngx_str_t *value);
+static void ngx_mail_auth_http_finalize(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx);
 static void ngx_mail_auth_sleep_handler(ngx_event_t *rev);
+static void ngx_mail_auth_http_cleanup(void *data);
 static ngx_int_t ngx_mail_auth_http_parse_header_line(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx);
 static void ngx_mail_auth_http_block_read(ngx_event_t *rev);
@@ -76,12 +143,37 @@ static ngx_buf_t *ngx_mail_auth_http_create_request(ngx_mail_session_t *s,
 static ngx_int_t ngx_mail_auth_http_escape(ngx_pool_t *pool, ngx_str_t *text,
     ngx_str_t *escaped);
 
+#if (NGX_HAVE_UNIX_DOMAIN)
+static void ngx_mail_auth_uds_init(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_mail_auth_http_conf_t *ahcf);
+static ngx_int_t ngx_mail_auth_uds_connect(ngx_mail_auth_uds_peer_t *peer,
+    ngx_mail_auth_http_conf_t *ahcf);
+static void ngx_mail_auth_uds_write_handler(ngx_event_t *wev);
+static void ngx_mail_auth_uds_read_handler(ngx_event_t *rev);
+static ngx_int_t ngx_mail_auth_uds_send(ngx_mail_auth_uds_peer_t *peer);
+static ngx_int_t ngx_mail_auth_uds_process(ngx_mail_auth_uds_peer_t *peer);
+static void ngx_mail_auth_uds_process_reply(ngx_mail_auth_uds_peer_t *peer,
+    uint32_t id, u_char *p, u_char *last);
+static void ngx_mail_auth_uds_block_read(ngx_event_t *rev);
+static void ngx_mail_auth_uds_cancel(ngx_mail_auth_http_ctx_t *ctx);
+static void ngx_mail_auth_uds_reset(ngx_mail_auth_uds_peer_t *peer);
+static ngx_buf_t *ngx_mail_auth_uds_create_request(ngx_mail_session_t *s,
+    ngx_pool_t *pool, ngx_mail_auth_http_conf_t *ahcf, uint32_t id);
+static u_char *ngx_mail_auth_uds_write_tlv(u_char *p, ngx_uint_t type,
+    u_char *data, size_t len);
+static ngx_int_t ngx_mail_auth_uds_append(ngx_mail_auth_uds_peer_t *peer,
+    ngx_buf_t *b);
+#endif
+
 static void *ngx_mail_auth_http_create_conf(ngx_conf_t *cf);
 static char *ngx_mail_auth_http_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
 static char *ngx_mail_auth_http(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_mail_auth_http_header(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+#if (NGX_HAVE_UNIX_DOMAIN)
+static char *ngx_mail_auth_uds(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+#endif
 
 
 static ngx_command_t  ngx_mail_auth_http_commands[] = {
@@ -93,6 +185,17 @@ static ngx_command_t  ngx_mail_auth_http_commands[] = {
       0,
       NULL },
 
+#if (NGX_HAVE_UNIX_DOMAIN)
+
+    { ngx_string("auth_uds"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_mail_auth_uds,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+#endif
+
     { ngx_string("auth_http_timeout"),
       NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_msec_slot,
@@ -157,12 +260,28 @@ static ngx_str_t   ngx_mail_auth_http_method[] = {
 
 static ngx_str_t   ngx_mail_smtp_errcode = ngx_string("535 5.7.0");
 
+#if (NGX_HAVE_UNIX_DOMAIN)
+
+static ngx_str_t   ngx_mail_auth_uds_reply[] = {
+    ngx_null_string,
+    ngx_string("Auth-Status"),
+    ngx_string("Auth-Server"),
+    ngx_string("Auth-Port"),
+    ngx_string("Auth-User"),
+    ngx_string("Auth-Pass"),
+    ngx_string("Auth-Wait"),
+    ngx_string("Auth-Error-Code")
+};
+
+#endif
+
 
 void
 ngx_mail_auth_http_init(ngx_mail_session_t *s)
 {
     ngx_int_t                   rc;
     ngx_pool_t                 *pool;
+    ngx_pool_cleanup_t         *cln;
     ngx_mail_auth_http_ctx_t   *ctx;
     ngx_mail_auth_http_conf_t  *ahcf;
 
@@ -182,9 +301,29 @@ ngx_mail_auth_http_init(ngx_mail_session_t *s)
     }
 
     ctx->pool = pool;
+    ctx->session = s;
+
+    /* the context is allocated from its own pool, forget it with the pool */
+
+    cln = ngx_pool_cleanup_add(pool, 0);
+    if (cln == NULL) {
+        ngx_destroy_pool(pool);
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
+
+    cln->handler = ngx_mail_auth_http_cleanup;
+    cln->data = ctx;
 
     ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
 
+#if (NGX_HAVE_UNIX_DOMAIN)
+    if (ahcf->uds) {
+        ngx_mail_auth_uds_init(s, ctx, ahcf);
+        return;
+    }
+#endif
+
     ctx->request = ngx_mail_auth_http_create_request(s, pool, ahcf);
     if (ctx->request == NULL) {
         ngx_destroy_pool(ctx->pool);
@@ -463,11 +602,8 @@ static void
 ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
     ngx_mail_auth_http_ctx_t *ctx)
 {
-    u_char      *p;
-    time_t       timer;
-    size_t       len, size;
-    ngx_int_t    rc, port, n;
-    ngx_addr_t  *peer;
+    ngx_int_t  rc;
+    ngx_str_t  name, value;
 
     ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
                    "mail auth http process headers");
@@ -477,381 +613,389 @@ ngx_mail_auth_http_process_headers(ngx_mail_session_t *s,
 
         if (rc == NGX_OK) {
 
-#if (NGX_DEBUG)
-            {
-            ngx_str_t  key, value;
-
-            key.len = ctx->header_name_end - ctx->header_name_start;
-            key.data = ctx->header_name_start;
+            name.len = ctx->header_name_end - ctx->header_name_start;
+            name.data = ctx->header_name_start;
             value.len = ctx->header_end - ctx->header_start;
             value.data = ctx->header_start;
 
             ngx_log_debug2(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
                            "mail auth http header: \"%V: %V\"",
-                           &key, &value);
-            }
-#endif
+                           &name, &value);
 
-            len = ctx->header_name_end - ctx->header_name_start;
-
-            if (len == sizeof("Auth-Status") - 1
-                && ngx_strncasecmp(ctx->header_name_start,
-                                   (u_char *) "Auth-Status",
-                                   sizeof("Auth-Status") - 1)
-                   == 0)
+            if (ngx_mail_auth_http_process_header(s, ctx, &name, &value)
+                != NGX_OK)
             {
-                len = ctx->header_end - ctx->header_start;
-
-                if (len == 2
-                    && ctx->header_start[0] == 'O'
-                    && ctx->header_start[1] == 'K')
-                {
-                    continue;
-                }
-
-                if (len == 4
-                    && ctx->header_start[0] == 'W'
-                    && ctx->header_start[1] == 'A'
-                    && ctx->header_start[2] == 'I'
-                    && ctx->header_start[3] == 'T')
-                {
-                    s->auth_wait = 1;
-                    continue;
-                }
-
-                ctx->errmsg.len = len;
-                ctx->errmsg.data = ctx->header_start;
+                ngx_close_connection(ctx->peer.connection);
+                ngx_destroy_pool(ctx->pool);
+                ngx_mail_session_internal_server_error(s);
+                return;
+            }
 
-                switch (s->protocol) {
+            continue;
+        }
 
-                case NGX_MAIL_POP3_PROTOCOL:
-                    size = sizeof("-ERR ") - 1 + len + sizeof(CRLF) - 1;
-                    break;
+        if (rc == NGX_DONE) {
+            ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                           "mail auth http header done");
 
-                case NGX_MAIL_IMAP_PROTOCOL:
-                    size = s->tag.len + sizeof("NO ") - 1 + len
-                           + sizeof(CRLF) - 1;
-                    break;
+            ngx_close_connection(ctx->peer.connection);
 
-                default: /* NGX_MAIL_SMTP_PROTOCOL */
-                    ctx->err = ctx->errmsg;
-                    continue;
-                }
+            ngx_mail_auth_http_finalize(s, ctx);
+            return;
+        }
 
-                p = ngx_pnalloc(s->connection->pool, size);
-                if (p == NULL) {
-                    ngx_close_connection(ctx->peer.connection);
-                    ngx_destroy_pool(ctx->pool);
-                    ngx_mail_session_internal_server_error(s);
-                    return;
-                }
+        if (rc == NGX_AGAIN ) {
+            return;
+        }
 
-                ctx->err.data = p;
+        /* rc == NGX_ERROR */
 
-                switch (s->protocol) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V sent invalid header in response",
+                      ctx->peer.name);
+        ngx_close_connection(ctx->peer.connection);
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
 
-                case NGX_MAIL_POP3_PROTOCOL:
-                    *p++ = '-'; *p++ = 'E'; *p++ = 'R'; *p++ = 'R'; *p++ = ' ';
-                    break;
+        return;
+    }
+}
 
-                case NGX_MAIL_IMAP_PROTOCOL:
-                    p = ngx_cpymem(p, s->tag.data, s->tag.len);
-                    *p++ = 'N'; *p++ = 'O'; *p++ = ' ';
-                    break;
 
-                default: /* NGX_MAIL_SMTP_PROTOCOL */
-                    break;
-                }
+static ngx_int_t
+ngx_mail_auth_http_process_header(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx, ngx_str_t *name, ngx_str_t *value)
+{
+    u_char     *p;
+    size_t      len, size;
+    ngx_int_t   n;
+
+    len = name->len;
+
+    if (len == sizeof("Auth-Status") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Auth-Status",
+                           sizeof("Auth-Status") - 1)
+           == 0)
+    {
+        len = value->len;
+
+        if (len == 2
+            && value->data[0] == 'O'
+            && value->data[1] == 'K')
+        {
+            return NGX_OK;
+        }
 
-                p = ngx_cpymem(p, ctx->header_start, len);
-                *p++ = CR; *p++ = LF;
+        if (len == 4
+            && value->data[0] == 'W'
+            && value->data[1] == 'A'
+            && value->data[2] == 'I'
+            && value->data[3] == 'T')
+        {
+            s->auth_wait = 1;
+            return NGX_OK;
+        }
 
-                ctx->err.len = p - ctx->err.data;
+        ctx->errmsg.len = len;
+        ctx->errmsg.data = value->data;
 
-                continue;
-            }
+        switch (s->protocol) {
 
-            if (len == sizeof("Auth-Server") - 1
-                && ngx_strncasecmp(ctx->header_name_start,
-                                   (u_char *) "Auth-Server",
-                                   sizeof("Auth-Server") - 1)
-                    == 0)
-            {
-                ctx->addr.len = ctx->header_end - ctx->header_start;
-                ctx->addr.data = ctx->header_start;
+        case NGX_MAIL_POP3_PROTOCOL:
+            size = sizeof("-ERR ") - 1 + len + sizeof(CRLF) - 1;
+            break;
 
-                continue;
-            }
+        case NGX_MAIL_IMAP_PROTOCOL:
+            size = s->tag.len + sizeof("NO ") - 1 + len
+                   + sizeof(CRLF) - 1;
+            break;
 
-            if (len == sizeof("Auth-Port") - 1
-                && ngx_strncasecmp(ctx->header_name_start,
-                                   (u_char *) "Auth-Port",
-                                   sizeof("Auth-Port") - 1)
-                   == 0)
-            {
-                ctx->port.len = ctx->header_end - ctx->header_start;
-                ctx->port.data = ctx->header_start;
+        default: /* NGX_MAIL_SMTP_PROTOCOL */
+            ctx->err = ctx->errmsg;
+            return NGX_OK;
+        }
 
-                continue;
-            }
+        p = ngx_pnalloc(s->connection->pool, size);
+        if (p == NULL) {
+            return NGX_ERROR;
+        }
 
-            if (len == sizeof("Auth-User") - 1
-                && ngx_strncasecmp(ctx->header_name_start,
-                                   (u_char *) "Auth-User",
-                                   sizeof("Auth-User") - 1)
-                   == 0)
-            {
-                s->login.len = ctx->header_end - ctx->header_start;
-
-                s->login.data = ngx_pnalloc(s->connection->pool, s->login.len);
-                if (s->login.data == NULL) {
-                    ngx_close_connection(ctx->peer.connection);
-                    ngx_destroy_pool(ctx->pool);
-                    ngx_mail_session_internal_server_error(s);
-                    return;
-                }
+        ctx->err.data = p;
 
-                ngx_memcpy(s->login.data, ctx->header_start, s->login.len);
+        switch (s->protocol) {
 
-                continue;
-            }
+        case NGX_MAIL_POP3_PROTOCOL:
+            *p++ = '-'; *p++ = 'E'; *p++ = 'R'; *p++ = 'R'; *p++ = ' ';
+            break;
 
-            if (len == sizeof("Auth-Pass") - 1
-                && ngx_strncasecmp(ctx->header_name_start,
-                                   (u_char *) "Auth-Pass",
-                                   sizeof("Auth-Pass") - 1)
-                   == 0)
-            {
-                s->passwd.len = ctx->header_end - ctx->header_start;
-
-                s->passwd.data = ngx_pnalloc(s->connection->pool,
-                                             s->passwd.len);
-                if (s->passwd.data == NULL) {
-                    ngx_close_connection(ctx->peer.connection);
-                    ngx_destroy_pool(ctx->pool);
-                    ngx_mail_session_internal_server_error(s);
-                    return;
-                }
+        case NGX_MAIL_IMAP_PROTOCOL:
+            p = ngx_cpymem(p, s->tag.data, s->tag.len);
+            *p++ = 'N'; *p++ = 'O'; *p++ = ' ';
+            break;
 
-                ngx_memcpy(s->passwd.data, ctx->header_start, s->passwd.len);
+        default: /* NGX_MAIL_SMTP_PROTOCOL */
+            break;
+        }
 
-                continue;
-            }
+        p = ngx_cpymem(p, value->data, len);
+        *p++ = CR; *p++ = LF;
 
-            if (len == sizeof("Auth-Wait") - 1
-                && ngx_strncasecmp(ctx->header_name_start,
-                                   (u_char *) "Auth-Wait",
-                                   sizeof("Auth-Wait") - 1)
-                   == 0)
-            {
-                n = ngx_atoi(ctx->header_start,
-                             ctx->header_end - ctx->header_start);
+        ctx->err.len = p - ctx->err.data;
 
-                if (n != NGX_ERROR) {
-                    ctx->sleep = n;
-                }
+        return NGX_OK;
+    }
 
-                continue;
-            }
+    if (len == sizeof("Auth-Server") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Auth-Server",
+                           sizeof("Auth-Server") - 1)
+            == 0)
+    {
+        ctx->addr = *value;
 
-            if (len == sizeof("Auth-Error-Code") - 1
-                && ngx_strncasecmp(ctx->header_name_start,
-                                   (u_char *) "Auth-Error-Code",
-                                   sizeof("Auth-Error-Code") - 1)
-                   == 0)
-            {
-                ctx->errcode.len = ctx->header_end - ctx->header_start;
-
-                ctx->errcode.data = ngx_pnalloc(s->connection->pool,
-                                                ctx->errcode.len);
-                if (ctx->errcode.data == NULL) {
-                    ngx_close_connection(ctx->peer.connection);
-                    ngx_destroy_pool(ctx->pool);
-                    ngx_mail_session_internal_server_error(s);
-                    return;
-                }
+        return NGX_OK;
+    }
 
-                ngx_memcpy(ctx->errcode.data, ctx->header_start,
-                           ctx->errcode.len);
+    if (len == sizeof("Auth-Port") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Auth-Port",
+                           sizeof("Auth-Port") - 1)
+           == 0)
+    {
+        ctx->port = *value;
 
-                continue;
-            }
+        return NGX_OK;
+    }
 
-            /* ignore other headers */
+    if (len == sizeof("Auth-User") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Auth-User",
+                           sizeof("Auth-User") - 1)
+           == 0)
+    {
+        s->login.len = value->len;
 
-            continue;
+        s->login.data = ngx_pnalloc(s->connection->pool, s->login.len);
+        if (s->login.data == NULL) {
+            return NGX_ERROR;
         }
 
-        if (rc == NGX_DONE) {
-            ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
-                           "mail auth http header done");
-
-            ngx_close_connection(ctx->peer.connection);
+        ngx_memcpy(s->login.data, value->data, s->login.len);
 
-            if (ctx->err.len) {
+        return NGX_OK;
+    }
 
-                ngx_log_error(NGX_LOG_INFO, s->connection->log, 0,
-                              "client login failed: \"%V\"", &ctx->errmsg);
+    if (len == sizeof("Auth-Pass") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Auth-Pass",
+                           sizeof("Auth-Pass") - 1)
+           == 0)
+    {
+        s->passwd.len = value->len;
 
-                if (s->protocol == NGX_MAIL_SMTP_PROTOCOL) {
+        s->passwd.data = ngx_pnalloc(s->connection->pool, s->passwd.len);
+        if (s->passwd.data == NULL) {
+            return NGX_ERROR;
+        }
 
-                    if (ctx->errcode.len == 0) {
-                        ctx->errcode = ngx_mail_smtp_errcode;
-                    }
+        ngx_memcpy(s->passwd.data, value->data, s->passwd.len);
 
-                    ctx->err.len = ctx->errcode.len + ctx->errmsg.len
-                                   + sizeof(" " CRLF) - 1;
+        return NGX_OK;
+    }
 
-                    p = ngx_pnalloc(s->connection->pool, ctx->err.len);
-                    if (p == NULL) {
-                        ngx_destroy_pool(ctx->pool);
-                        ngx_mail_session_internal_server_error(s);
-                        return;
-                    }
+    if (len == sizeof("Auth-Wait") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Auth-Wait",
+                           sizeof("Auth-Wait") - 1)
+           == 0)
+    {
+        n = ngx_atoi(value->data, value->len);
 
-                    ctx->err.data = p;
+        if (n != NGX_ERROR) {
+            ctx->sleep = n;
+        }
 
-                    p = ngx_cpymem(p, ctx->errcode.data, ctx->errcode.len);
-                    *p++ = ' ';
-                    p = ngx_cpymem(p, ctx->errmsg.data, ctx->errmsg.len);
-                    *p++ = CR; *p = LF;
-                }
+        return NGX_OK;
+    }
 
-                s->out = ctx->err;
-                timer = ctx->sleep;
+    if (len == sizeof("Auth-Error-Code") - 1
+        && ngx_strncasecmp(name->data, (u_char *) "Auth-Error-Code",
+                           sizeof("Auth-Error-Code") - 1)
+           == 0)
+    {
+        ctx->errcode.len = value->len;
 
-                ngx_destroy_pool(ctx->pool);
+        ctx->errcode.data = ngx_pnalloc(s->connection->pool,
+                                        ctx->errcode.len);
+        if (ctx->errcode.data == NULL) {
+            return NGX_ERROR;
+        }
 
-                if (timer == 0) {
-                    s->quit = 1;
-                    ngx_mail_send(s->connection->write);
-                    return;
-                }
+        ngx_memcpy(ctx->errcode.data, value->data, ctx->errcode.len);
 
-                ngx_add_timer(s->connection->read, (ngx_msec_t) (timer * 1000));
+        return NGX_OK;
+    }
 
-                s->connection->read->handler = ngx_mail_auth_sleep_handler;
+    /* ignore other headers */
 
-                return;
-            }
+    return NGX_OK;
+}
 
-            if (s->auth_wait) {
-                timer = ctx->sleep;
 
-                ngx_destroy_pool(ctx->pool);
+static void
+ngx_mail_auth_http_finalize(ngx_mail_session_t *s,
+    ngx_mail_auth_http_ctx_t *ctx)
+{
+    u_char      *p;
+    time_t       timer;
+    size_t       len;
+    ngx_int_t    rc, port;
+    ngx_addr_t  *peer;
 
-                if (timer == 0) {
-                    ngx_mail_auth_http_init(s);
-                    return;
-                }
+    if (ctx->err.len) {
 
-                ngx_add_timer(s->connection->read, (ngx_msec_t) (timer * 1000));
+        ngx_log_error(NGX_LOG_INFO, s->connection->log, 0,
+                      "client login failed: \"%V\"", &ctx->errmsg);
 
-                s->connection->read->handler = ngx_mail_auth_sleep_handler;
+        if (s->protocol == NGX_MAIL_SMTP_PROTOCOL) {
 
-                return;
+            if (ctx->errcode.len == 0) {
+                ctx->errcode = ngx_mail_smtp_errcode;
             }
 
-            if (ctx->addr.len == 0 || ctx->port.len == 0) {
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V did not send server or port",
-                              ctx->peer.name);
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
-            }
+            ctx->err.len = ctx->errcode.len + ctx->errmsg.len
+                           + sizeof(" " CRLF) - 1;
 
-            if (s->passwd.data == NULL
-                && s->protocol != NGX_MAIL_SMTP_PROTOCOL)
-            {
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V did not send password",
-                              ctx->peer.name);
+            p = ngx_pnalloc(s->connection->pool, ctx->err.len);
+            if (p == NULL) {
                 ngx_destroy_pool(ctx->pool);
                 ngx_mail_session_internal_server_error(s);
                 return;
             }
 
-            peer = ngx_pcalloc(s->connection->pool, sizeof(ngx_addr_t));
-            if (peer == NULL) {
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
-            }
+            ctx->err.data = p;
 
-            rc = ngx_parse_addr(s->connection->pool, peer,
-                                ctx->addr.data, ctx->addr.len);
+            p = ngx_cpymem(p, ctx->errcode.data, ctx->errcode.len);
+            *p++ = ' ';
+            p = ngx_cpymem(p, ctx->errmsg.data, ctx->errmsg.len);
+            *p++ = CR; *p = LF;
+        }
 
-            switch (rc) {
-            case NGX_OK:
-                break;
+        s->out = ctx->err;
+        timer = ctx->sleep;
 
-            case NGX_DECLINED:
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V sent invalid server "
-                              "address:\"%V\"",
-                              ctx->peer.name, &ctx->addr);
-                /* fall through */
+        ngx_destroy_pool(ctx->pool);
 
-            default:
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
-            }
+        if (timer == 0) {
+            s->quit = 1;
+            ngx_mail_send(s->connection->write);
+            return;
+        }
 
-            port = ngx_atoi(ctx->port.data, ctx->port.len);
-            if (port == NGX_ERROR || port < 1 || port > 65535) {
-                ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                              "auth http server %V sent invalid server "
-                              "port:\"%V\"",
-                              ctx->peer.name, &ctx->port);
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
-            }
+        ngx_add_timer(s->connection->read, (ngx_msec_t) (timer * 1000));
 
-            ngx_inet_set_port(peer->sockaddr, (in_port_t) port);
+        s->connection->read->handler = ngx_mail_auth_sleep_handler;
+        s->phase = NGX_MAIL_PHASE_SLEEP;
+        ngx_mail_status_update_session(s);
 
-            len = ctx->addr.len + 1 + ctx->port.len;
+        return;
+    }
 
-            peer->name.len = len;
+    if (s->auth_wait) {
+        timer = ctx->sleep;
 
-            peer->name.data = ngx_pnalloc(s->connection->pool, len);
-            if (peer->name.data == NULL) {
-                ngx_destroy_pool(ctx->pool);
-                ngx_mail_session_internal_server_error(s);
-                return;
-            }
+        ngx_destroy_pool(ctx->pool);
 
-            len = ctx->addr.len;
+        if (timer == 0) {
+            ngx_mail_auth_http_init(s);
+            return;
+        }
 
-            ngx_memcpy(peer->name.data, ctx->addr.data, len);
+        ngx_add_timer(s->connection->read, (ngx_msec_t) (timer * 1000));
 
-            peer->name.data[len++] = ':';
+        s->connection->read->handler = ngx_mail_auth_sleep_handler;
+        s->phase = NGX_MAIL_PHASE_SLEEP;
+        ngx_mail_status_update_session(s);
 
-            ngx_memcpy(peer->name.data + len, ctx->port.data, ctx->port.len);
+        return;
+    }
 
-            ngx_destroy_pool(ctx->pool);
-            ngx_mail_proxy_init(s, peer);
+    if (ctx->addr.len == 0 || ctx->port.len == 0) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V did not send server or port",
+                      ctx->peer.name);
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
 
-            return;
-        }
+    if (s->passwd.data == NULL
+        && s->protocol != NGX_MAIL_SMTP_PROTOCOL)
+    {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V did not send password",
+                      ctx->peer.name);
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
 
-        if (rc == NGX_AGAIN ) {
-            return;
-        }
+    peer = ngx_pcalloc(s->connection->pool, sizeof(ngx_addr_t));
+    if (peer == NULL) {
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
 
-        /* rc == NGX_ERROR */
+    rc = ngx_parse_addr(s->connection->pool, peer,
+                        ctx->addr.data, ctx->addr.len);
+
+    switch (rc) {
+    case NGX_OK:
+        break;
 
+    case NGX_DECLINED:
         ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
-                      "auth http server %V sent invalid header in response",
-                      ctx->peer.name);
-        ngx_close_connection(ctx->peer.connection);
+                      "auth http server %V sent invalid server "
+                      "address:\"%V\"",
+                      ctx->peer.name, &ctx->addr);
+        /* fall through */
+
+    default:
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
+
+    port = ngx_atoi(ctx->port.data, ctx->port.len);
+    if (port == NGX_ERROR || port < 1 || port > 65535) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "auth http server %V sent invalid server "
+                      "port:\"%V\"",
+                      ctx->peer.name, &ctx->port);
         ngx_destroy_pool(ctx->pool);
         ngx_mail_session_internal_server_error(s);
+        return;
+    }
 
+    ngx_inet_set_port(peer->sockaddr, (in_port_t) port);
+
+    len = ctx->addr.len + 1 + ctx->port.len;
+
+    peer->name.len = len;
+
+    peer->name.data = ngx_pnalloc(s->connection->pool, len);
+    if (peer->name.data == NULL) {
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
         return;
     }
+
+    len = ctx->addr.len;
+
+    ngx_memcpy(peer->name.data, ctx->addr.data, len);
+
+    peer->name.data[len++] = ':';
+
+    ngx_memcpy(peer->name.data + len, ctx->port.data, ctx->port.len);
+
+    ngx_destroy_pool(ctx->pool);
+    ngx_mail_proxy_init(s, peer);
 }
 
 
@@ -870,6 +1014,8 @@ ngx_mail_auth_sleep_handler(ngx_event_t *rev)
     if (rev->timedout) {
 
         rev->timedout = 0;
+        s->phase = NGX_MAIL_PHASE_AUTH;
+        ngx_mail_status_update_session(s);
 
         if (s->auth_wait) {
             s->auth_wait = 0;
@@ -1121,18 +1267,55 @@ ngx_mail_auth_http_block_read(ngx_event_t *rev)
 
 
 static void
-ngx_mail_auth_http_dummy_handler(ngx_event_t *ev)
+ngx_mail_auth_http_cleanup(void *data)
 {
-    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, ev->log, 0,
-                   "mail auth http dummy handler");
+    ngx_mail_auth_http_ctx_t  *ctx = data;
+
+    ngx_mail_delete_ctx(ctx->session, ngx_mail_auth_http_module);
 }
 
 
-static ngx_buf_t *
-ngx_mail_auth_http_create_request(ngx_mail_session_t *s, ngx_pool_t *pool,
-    ngx_mail_auth_http_conf_t *ahcf)
+void
+ngx_mail_auth_http_pool_stat(ngx_mail_session_t *s, ngx_pool_stat_t *stat)
 {
-    size_t                     len;
+    ngx_mail_auth_http_ctx_t  *ctx;
+
+    if (s->ctx == NULL) {
+        return;
+    }
+
+    ctx = ngx_mail_get_module_ctx(s, ngx_mail_auth_http_module);
+
+    if (ctx) {
+        ngx_pool_stat(ctx->pool, stat);
+    }
+}
+
+
+ngx_uint_t
+ngx_mail_auth_http_pending(ngx_mail_session_t *s)
+{
+    if (s->ctx == NULL) {
+        return 0;
+    }
+
+    return ngx_mail_get_module_ctx(s, ngx_mail_auth_http_module) != NULL;
+}
+
+
+static void
+ngx_mail_auth_http_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, ev->log, 0,
+                   "mail auth http dummy handler");
+}
+
+
+static ngx_buf_t *
+ngx_mail_auth_http_create_request(ngx_mail_session_t *s, ngx_pool_t *pool,
+    ngx_mail_auth_http_conf_t *ahcf)
+{
+    size_t                     len;
     ngx_buf_t                 *b;
     ngx_str_t                  login, passwd;
 #if (NGX_MAIL_SSL)
@@ -1415,160 +1598,1050 @@ ngx_mail_auth_http_escape(ngx_pool_t *pool, ngx_str_t *text, ngx_str_t *escaped)
 }
 
 
-static void *
-ngx_mail_auth_http_create_conf(ngx_conf_t *cf)
+#if (NGX_HAVE_UNIX_DOMAIN)
+
+static void
+ngx_mail_auth_uds_init(ngx_mail_session_t *s, ngx_mail_auth_http_ctx_t *ctx,
+    ngx_mail_auth_http_conf_t *ahcf)
 {
-    ngx_mail_auth_http_conf_t  *ahcf;
+    uint32_t                   id;
+    ngx_mail_auth_uds_peer_t  *peer;
 
-    ahcf = ngx_pcalloc(cf->pool, sizeof(ngx_mail_auth_http_conf_t));
-    if (ahcf == NULL) {
-        return NULL;
+    peer = ahcf->uds;
+
+    id = ++peer->id;
+
+    ctx->request = ngx_mail_auth_uds_create_request(s, ctx->pool, ahcf, id);
+    if (ctx->request == NULL) {
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+        return;
     }
 
-    ahcf->timeout = NGX_CONF_UNSET_MSEC;
-    ahcf->pass_client_cert = NGX_CONF_UNSET;
+    ngx_mail_set_ctx(s, ctx, ngx_mail_auth_http_module);
 
-    ahcf->file = cf->conf_file->file.name.data;
-    ahcf->line = cf->conf_file->line;
+    ctx->peer.name = &peer->addr->name;
+    ctx->node.key = id;
 
-    return ahcf;
+    if (peer->connection == NULL) {
+        if (ngx_mail_auth_uds_connect(peer, ahcf) != NGX_OK) {
+            ngx_destroy_pool(ctx->pool);
+            ngx_mail_session_internal_server_error(s);
+            return;
+        }
+    }
+
+    if (ngx_mail_auth_uds_append(peer, ctx->request) != NGX_OK) {
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
+
+    ngx_rbtree_insert(&peer->rbtree, &ctx->node);
+
+    peer->connection->idle = 0;
+
+    s->connection->read->handler = ngx_mail_auth_uds_block_read;
+    ngx_add_timer(s->connection->read, ahcf->timeout);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth uds request: %uD, %uz bytes",
+                   id, (size_t) (ctx->request->last - ctx->request->pos));
+
+    if (peer->connection->write->ready) {
+        ngx_mail_auth_uds_write_handler(peer->connection->write);
+    }
 }
 
 
-static char *
-ngx_mail_auth_http_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+static ngx_int_t
+ngx_mail_auth_uds_connect(ngx_mail_auth_uds_peer_t *peer,
+    ngx_mail_auth_http_conf_t *ahcf)
 {
-    ngx_mail_auth_http_conf_t *prev = parent;
-    ngx_mail_auth_http_conf_t *conf = child;
+    ngx_int_t               rc;
+    ngx_connection_t       *c;
+    ngx_peer_connection_t   pc;
+
+    if (peer->in.start == NULL) {
+        peer->in.start = ngx_alloc(NGX_MAIL_AUTH_UDS_BUFFER_SIZE,
+                                   ngx_cycle->log);
+        if (peer->in.start == NULL) {
+            return NGX_ERROR;
+        }
 
-    u_char           *p;
-    size_t            len;
-    ngx_uint_t        i;
-    ngx_table_elt_t  *header;
+        peer->in.pos = peer->in.start;
+        peer->in.last = peer->in.start;
+        peer->in.end = peer->in.start + NGX_MAIL_AUTH_UDS_BUFFER_SIZE;
+    }
 
-    if (conf->peer == NULL) {
-        conf->peer = prev->peer;
-        conf->host_header = prev->host_header;
-        conf->uri = prev->uri;
+    ngx_memzero(&pc, sizeof(ngx_peer_connection_t));
 
-        if (conf->peer == NULL) {
-            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
-                          "no \"auth_http\" is defined for server in %s:%ui",
-                          conf->file, conf->line);
+    pc.sockaddr = peer->addr->sockaddr;
+    pc.socklen = peer->addr->socklen;
+    pc.name = &peer->addr->name;
+    pc.get = ngx_event_get_peer;
+    pc.log = ngx_cycle->log;
+    pc.log_error = NGX_ERROR_ERR;
 
-            return NGX_CONF_ERROR;
+    rc = ngx_event_connect_peer(&pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        if (pc.connection) {
+            ngx_close_connection(pc.connection);
         }
+
+        return NGX_ERROR;
     }
 
-    ngx_conf_merge_msec_value(conf->timeout, prev->timeout, 60000);
+    c = pc.connection;
 
-    ngx_conf_merge_value(conf->pass_client_cert, prev->pass_client_cert, 0);
+    c->data = peer;
 
-    if (conf->headers == NULL) {
-        conf->headers = prev->headers;
-        conf->header = prev->header;
+    c->read->handler = ngx_mail_auth_uds_read_handler;
+    c->write->handler = ngx_mail_auth_uds_write_handler;
+
+    peer->connection = c;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, c->log, 0,
+                   "mail auth uds connect: %d", c->fd);
+
+    if (rc == NGX_AGAIN) {
+        ngx_add_timer(c->write, ahcf->timeout);
     }
 
-    if (conf->headers && conf->header.len == 0) {
-        len = 0;
-        header = conf->headers->elts;
-        for (i = 0; i < conf->headers->nelts; i++) {
-            len += header[i].key.len + 2 + header[i].value.len + 2;
+    return NGX_OK;
+}
+
+
+static void
+ngx_mail_auth_uds_write_handler(ngx_event_t *wev)
+{
+    ngx_connection_t          *c;
+    ngx_mail_auth_uds_peer_t  *peer;
+
+    c = wev->data;
+    peer = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, wev->log, 0,
+                   "mail auth uds write handler");
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, wev->log, NGX_ETIMEDOUT,
+                      "auth uds server %V timed out", &peer->addr->name);
+        ngx_mail_auth_uds_reset(peer);
+        return;
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    if (ngx_mail_auth_uds_send(peer) != NGX_OK) {
+        ngx_mail_auth_uds_reset(peer);
+    }
+}
+
+
+static ngx_int_t
+ngx_mail_auth_uds_send(ngx_mail_auth_uds_peer_t *peer)
+{
+    ssize_t            n;
+    ngx_buf_t         *b;
+    ngx_connection_t  *c;
+
+    c = peer->connection;
+    b = &peer->out;
+
+    while (b->pos < b->last) {
+
+        n = c->send(c, b->pos, b->last - b->pos);
+
+        if (n == NGX_ERROR) {
+            return NGX_ERROR;
         }
 
-        p = ngx_pnalloc(cf->pool, len);
-        if (p == NULL) {
-            return NGX_CONF_ERROR;
+        if (n == NGX_AGAIN) {
+            break;
         }
 
-        conf->header.len = len;
-        conf->header.data = p;
+        b->pos += n;
+    }
 
-        for (i = 0; i < conf->headers->nelts; i++) {
-            p = ngx_cpymem(p, header[i].key.data, header[i].key.len);
-            *p++ = ':'; *p++ = ' ';
-            p = ngx_cpymem(p, header[i].value.data, header[i].value.len);
-            *p++ = CR; *p++ = LF;
-        }
+    if (b->pos == b->last) {
+        b->pos = b->start;
+        b->last = b->start;
     }
 
-    return NGX_CONF_OK;
+    if (ngx_handle_write_event(c->write, 0) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
 }
 
 
-static char *
-ngx_mail_auth_http(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+static void
+ngx_mail_auth_uds_read_handler(ngx_event_t *rev)
 {
-    ngx_mail_auth_http_conf_t *ahcf = conf;
+    size_t                     size;
+    ssize_t                    n;
+    ngx_buf_t                 *b;
+    ngx_int_t                  rc;
+    ngx_connection_t          *c;
+    ngx_mail_auth_uds_peer_t  *peer;
 
-    ngx_str_t  *value;
-    ngx_url_t   u;
+    c = rev->data;
+    peer = c->data;
 
-    value = cf->args->elts;
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, rev->log, 0,
+                   "mail auth uds read handler");
 
-    ngx_memzero(&u, sizeof(ngx_url_t));
+    if (c->close) {
+        ngx_mail_auth_uds_reset(peer);
+        return;
+    }
 
-    u.url = value[1];
-    u.default_port = 80;
-    u.uri_part = 1;
+    b = &peer->in;
 
-    if (ngx_strncmp(u.url.data, "http://", 7) == 0) {
-        u.url.len -= 7;
-        u.url.data += 7;
-    }
+    for ( ;; ) {
 
-    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
-        if (u.err) {
-            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
-                               "%s in auth_http \"%V\"", u.err, &u.url);
+        if (b->last == b->end) {
+            size = b->last - b->pos;
+
+            if (b->pos == b->start) {
+                ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                              "auth uds server %V sent too large reply",
+                              &peer->addr->name);
+                ngx_mail_auth_uds_reset(peer);
+                return;
+            }
+
+            ngx_memmove(b->start, b->pos, size);
+
+            b->pos = b->start;
+            b->last = b->start + size;
         }
 
-        return NGX_CONF_ERROR;
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == NGX_ERROR || n == 0) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "auth uds server %V closed connection",
+                          &peer->addr->name);
+            ngx_mail_auth_uds_reset(peer);
+            return;
+        }
+
+        b->last += n;
+
+        rc = ngx_mail_auth_uds_process(peer);
+
+        if (rc == NGX_ERROR) {
+            ngx_mail_auth_uds_reset(peer);
+            return;
+        }
+
+        if (rc == NGX_DONE) {
+            /* the connection was reset while processing a reply */
+            return;
+        }
     }
 
-    ahcf->peer = u.addrs;
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_mail_auth_uds_reset(peer);
+    }
+}
 
-    if (u.family != AF_UNIX) {
-        ahcf->host_header = u.host;
 
-    } else {
-        ngx_str_set(&ahcf->host_header, "localhost");
+static ngx_int_t
+ngx_mail_auth_uds_process(ngx_mail_auth_uds_peer_t *peer)
+{
+    size_t             len;
+    uint32_t           id;
+    ngx_buf_t         *b;
+    ngx_connection_t  *c;
+
+    c = peer->connection;
+    b = &peer->in;
+
+    while (b->last - b->pos >= 8) {
+
+        len = ((size_t) b->pos[0] << 24) | (b->pos[1] << 16)
+              | (b->pos[2] << 8) | b->pos[3];
+
+        if (len < 4 || len > NGX_MAIL_AUTH_UDS_BUFFER_SIZE - 4) {
+            ngx_log_error(NGX_LOG_ERR, c->log, 0,
+                          "auth uds server %V sent invalid reply length %uz",
+                          &peer->addr->name, len);
+            return NGX_ERROR;
+        }
+
+        if ((size_t) (b->last - b->pos) < 4 + len) {
+            break;
+        }
+
+        id = ((uint32_t) b->pos[4] << 24) | (b->pos[5] << 16)
+             | (b->pos[6] << 8) | b->pos[7];
+
+        ngx_mail_auth_uds_process_reply(peer, id, b->pos + 8,
+                                        b->pos + 4 + len);
+
+        if (peer->connection != c) {
+            return NGX_DONE;
+        }
+
+        b->pos += 4 + len;
     }
 
-    ahcf->uri = u.uri;
+    if (b->pos == b->last) {
+        b->pos = b->start;
+        b->last = b->start;
+    }
 
-    if (ahcf->uri.len == 0) {
-        ngx_str_set(&ahcf->uri, "/");
+    if (peer->rbtree.root == peer->rbtree.sentinel) {
+        c->idle = 1;
     }
 
-    return NGX_CONF_OK;
+    return NGX_OK;
 }
 
 
-static char *
-ngx_mail_auth_http_header(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+static void
+ngx_mail_auth_uds_process_reply(ngx_mail_auth_uds_peer_t *peer, uint32_t id,
+    u_char *p, u_char *last)
 {
-    ngx_mail_auth_http_conf_t *ahcf = conf;
+    ngx_str_t                  value;
+    ngx_uint_t                 type;
+    ngx_rbtree_node_t         *node, *sentinel;
+    ngx_mail_session_t        *s;
+    ngx_mail_auth_http_ctx_t  *ctx;
 
-    ngx_str_t        *value;
-    ngx_table_elt_t  *header;
+    node = peer->rbtree.root;
+    sentinel = peer->rbtree.sentinel;
 
-    if (ahcf->headers == NULL) {
-        ahcf->headers = ngx_array_create(cf->pool, 1, sizeof(ngx_table_elt_t));
-        if (ahcf->headers == NULL) {
-            return NGX_CONF_ERROR;
+    while (node != sentinel) {
+
+        if (id == node->key) {
+            break;
         }
+
+        node = (id < node->key) ? node->left : node->right;
     }
 
-    header = ngx_array_push(ahcf->headers);
-    if (header == NULL) {
-        return NGX_CONF_ERROR;
+    if (node == sentinel) {
+        ngx_log_debug1(NGX_LOG_DEBUG_MAIL, peer->connection->log, 0,
+                       "mail auth uds stale reply: %uD", id);
+        return;
     }
 
-    value = cf->args->elts;
+    ngx_rbtree_delete(&peer->rbtree, node);
 
-    header->key = value[1];
-    header->value = value[2];
+    ctx = (ngx_mail_auth_http_ctx_t *)
+              ((u_char *) node - offsetof(ngx_mail_auth_http_ctx_t, node));
 
-    return NGX_CONF_OK;
-}
+    s = ctx->session;
+
+    if (s->connection->read->timer_set) {
+        ngx_del_timer(s->connection->read);
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail auth uds reply: %uD", id);
+
+    while (p < last) {
+
+        if (last - p < 4) {
+            goto invalid;
+        }
+
+        type = (p[0] << 8) | p[1];
+        value.len = (p[2] << 8) | p[3];
+        value.data = p + 4;
+
+        p += 4 + value.len;
+
+        if (p > last) {
+            goto invalid;
+        }
+
+        if (type == 0
+            || type >= sizeof(ngx_mail_auth_uds_reply) / sizeof(ngx_str_t))
+        {
+            /* ignore unknown types */
+            continue;
+        }
+
+        ngx_log_debug2(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                       "mail auth uds reply: \"%V: %V\"",
+                       &ngx_mail_auth_uds_reply[type], &value);
+
+        if (ngx_mail_auth_http_process_header(s, ctx,
+                                              &ngx_mail_auth_uds_reply[type],
+                                              &value)
+            != NGX_OK)
+        {
+            ngx_destroy_pool(ctx->pool);
+            ngx_mail_session_internal_server_error(s);
+            return;
+        }
+    }
+
+    ngx_mail_auth_http_finalize(s, ctx);
+
+    return;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                  "auth uds server %V sent invalid reply", ctx->peer.name);
+    ngx_destroy_pool(ctx->pool);
+    ngx_mail_session_internal_server_error(s);
+}
+
+
+static void
+ngx_mail_auth_uds_block_read(ngx_event_t *rev)
+{
+    ngx_connection_t          *c;
+    ngx_mail_session_t        *s;
+    ngx_mail_auth_http_ctx_t  *ctx;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, rev->log, 0,
+                   "mail auth uds block read");
+
+    c = rev->data;
+    s = c->data;
+
+    ctx = ngx_mail_get_module_ctx(s, ngx_mail_auth_http_module);
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, rev->log, NGX_ETIMEDOUT,
+                      "auth uds server %V timed out", ctx->peer.name);
+        ngx_mail_auth_uds_cancel(ctx);
+        return;
+    }
+
+    if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+        ngx_mail_auth_uds_cancel(ctx);
+    }
+}
+
+
+static void
+ngx_mail_auth_uds_cancel(ngx_mail_auth_http_ctx_t *ctx)
+{
+    ngx_mail_session_t         *s;
+    ngx_mail_auth_http_conf_t  *ahcf;
+
+    s = ctx->session;
+
+    ahcf = ngx_mail_get_module_srv_conf(s, ngx_mail_auth_http_module);
+
+    /*
+     * the request may be already written to the socket, so it is only
+     * forgotten here, and a late reply is ignored as stale
+     */
+
+    ngx_rbtree_delete(&ahcf->uds->rbtree, &ctx->node);
+
+    if (s->connection->read->timer_set) {
+        ngx_del_timer(s->connection->read);
+    }
+
+    ngx_destroy_pool(ctx->pool);
+    ngx_mail_session_internal_server_error(s);
+}
+
+
+static void
+ngx_mail_auth_uds_reset(ngx_mail_auth_uds_peer_t *peer)
+{
+    ngx_rbtree_node_t         *node;
+    ngx_mail_session_t        *s;
+    ngx_mail_auth_http_ctx_t  *ctx;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, ngx_cycle->log, 0,
+                   "close mail auth uds connection: %d",
+                   peer->connection->fd);
+
+    ngx_close_connection(peer->connection);
+    peer->connection = NULL;
+
+    peer->in.pos = peer->in.start;
+    peer->in.last = peer->in.start;
+    peer->out.pos = peer->out.start;
+    peer->out.last = peer->out.start;
+
+    while (peer->rbtree.root != peer->rbtree.sentinel) {
+
+        node = ngx_rbtree_min(peer->rbtree.root, peer->rbtree.sentinel);
+
+        ngx_rbtree_delete(&peer->rbtree, node);
+
+        ctx = (ngx_mail_auth_http_ctx_t *)
+                  ((u_char *) node - offsetof(ngx_mail_auth_http_ctx_t, node));
+
+        s = ctx->session;
+
+        if (s->connection->read->timer_set) {
+            ngx_del_timer(s->connection->read);
+        }
+
+        ngx_destroy_pool(ctx->pool);
+        ngx_mail_session_internal_server_error(s);
+    }
+}
+
+
+static ngx_int_t
+ngx_mail_auth_uds_append(ngx_mail_auth_uds_peer_t *peer, ngx_buf_t *b)
+{
+    u_char     *p;
+    size_t      len, size, n;
+    ngx_buf_t  *out;
+
+    out = &peer->out;
+
+    len = b->last - b->pos;
+    size = out->last - out->pos;
+
+    if ((size_t) (out->end - out->last) < len) {
+
+        if ((size_t) (out->end - out->start) < size + len) {
+
+            n = ngx_max((size_t) (out->end - out->start) * 2, size + len);
+            n = ngx_max(n, NGX_MAIL_AUTH_UDS_BUFFER_SIZE);
+
+            p = ngx_alloc(n, ngx_cycle->log);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            if (size) {
+                ngx_memcpy(p, out->pos, size);
+            }
+
+            if (out->start) {
+                ngx_free(out->start);
+            }
+
+            out->start = p;
+            out->end = p + n;
+
+        } else {
+            ngx_memmove(out->start, out->pos, size);
+        }
+
+        out->pos = out->start;
+        out->last = out->start + size;
+    }
+
+    out->last = ngx_cpymem(out->last, b->pos, len);
+
+    return NGX_OK;
+}
+
+
+static ngx_buf_t *
+ngx_mail_auth_uds_create_request(ngx_mail_session_t *s, ngx_pool_t *pool,
+    ngx_mail_auth_http_conf_t *ahcf, uint32_t id)
+{
+    u_char                    *p;
+    size_t                     len;
+    ngx_buf_t                 *b;
+    ngx_str_t                  attempt;
+    ngx_uint_t                 i;
+    ngx_table_elt_t           *header;
+    u_char                     buf[NGX_INT_T_LEN];
+#if (NGX_MAIL_SSL)
+    ngx_str_t                  verify, subject, issuer, serial, fingerprint,
+                               cert;
+    ngx_connection_t          *c;
+    ngx_mail_ssl_conf_t       *sslcf;
+#endif
+    ngx_mail_core_srv_conf_t  *cscf;
+
+#if (NGX_MAIL_SSL)
+
+    c = s->connection;
+    sslcf = ngx_mail_get_module_srv_conf(s, ngx_mail_ssl_module);
+
+    if (c->ssl && sslcf->verify) {
+
+        if (ngx_ssl_get_client_verify(c, pool, &verify) != NGX_OK) {
+            return NULL;
+        }
+
+        if (ngx_ssl_get_subject_dn(c, pool, &subject) != NGX_OK) {
+            return NULL;
+        }
+
+        if (ngx_ssl_get_issuer_dn(c, pool, &issuer) != NGX_OK) {
+            return NULL;
+        }
+
+        if (ngx_ssl_get_serial_number(c, pool, &serial) != NGX_OK) {
+            return NULL;
+        }
+
+        if (ngx_ssl_get_fingerprint(c, pool, &fingerprint) != NGX_OK) {
+            return NULL;
+        }
+
+        if (ahcf->pass_client_cert) {
+            if (ngx_ssl_get_raw_certificate(c, pool, &cert) != NGX_OK) {
+                return NULL;
+            }
+
+        } else {
+            ngx_str_null(&cert);
+        }
+
+    } else {
+        ngx_str_null(&verify);
+        ngx_str_null(&subject);
+        ngx_str_null(&issuer);
+        ngx_str_null(&serial);
+        ngx_str_null(&fingerprint);
+        ngx_str_null(&cert);
+    }
+
+    if (cert.len > 0xffff) {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "client certificate is too large for auth uds");
+        return NULL;
+    }
+
+#endif
+
+    if (s->login.len > 0xffff
+        || s->passwd.len > 0xffff
+        || s->smtp_helo.len > 0xffff
+        || s->smtp_from.len > 0xffff
+        || s->smtp_to.len > 0xffff)
+    {
+        ngx_log_error(NGX_LOG_ERR, s->connection->log, 0,
+                      "client data is too large for auth uds");
+        return NULL;
+    }
+
+    cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
+
+    attempt.data = buf;
+    attempt.len = ngx_sprintf(buf, "%ui", s->login_attempt) - buf;
+
+    len = 4 + 4
+          + 4 + ngx_mail_auth_http_method[s->auth_method].len
+          + 4 + s->login.len
+          + 4 + s->passwd.len
+          + 4 + s->salt.len
+          + 4 + cscf->protocol->name.len
+          + 4 + attempt.len
+          + 4 + s->connection->addr_text.len
+          + 4 + s->host.len
+          + 4 + s->smtp_helo.len
+          + 4 + s->smtp_from.len
+          + 4 + s->smtp_to.len
+#if (NGX_MAIL_SSL)
+          + 4 + sizeof("on") - 1
+          + 4 + verify.len
+          + 4 + subject.len
+          + 4 + issuer.len
+          + 4 + serial.len
+          + 4 + fingerprint.len
+          + 4 + cert.len
+#endif
+          ;
+
+    if (ahcf->headers) {
+        header = ahcf->headers->elts;
+        for (i = 0; i < ahcf->headers->nelts; i++) {
+            len += 4 + header[i].key.len + 2 + header[i].value.len;
+        }
+    }
+
+    b = ngx_create_temp_buf(pool, len);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    p = b->last + 8;
+
+    p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_METHOD,
+                                ngx_mail_auth_http_method[s->auth_method].data,
+                                ngx_mail_auth_http_method[s->auth_method].len);
+
+    p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_USER,
+                                    s->login.data, s->login.len);
+
+    p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_PASS,
+                                    s->passwd.data, s->passwd.len);
+
+    if (s->auth_method != NGX_MAIL_AUTH_PLAIN && s->salt.len) {
+        p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_SALT,
+                                        s->salt.data, s->salt.len);
+
+        s->passwd.data = NULL;
+    }
+
+    p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_PROTOCOL,
+                                    cscf->protocol->name.data,
+                                    cscf->protocol->name.len);
+
+    p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_LOGIN_ATTEMPT,
+                                    attempt.data, attempt.len);
+
+    p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_CLIENT_IP,
+                                    s->connection->addr_text.data,
+                                    s->connection->addr_text.len);
+
+    if (s->host.len) {
+        p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_CLIENT_HOST,
+                                        s->host.data, s->host.len);
+    }
+
+    if (s->auth_method == NGX_MAIL_AUTH_NONE) {
+        p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_SMTP_HELO,
+                                        s->smtp_helo.data, s->smtp_helo.len);
+        p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_SMTP_FROM,
+                                        s->smtp_from.data, s->smtp_from.len);
+        p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_SMTP_TO,
+                                        s->smtp_to.data, s->smtp_to.len);
+    }
+
+#if (NGX_MAIL_SSL)
+
+    if (c->ssl) {
+        p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_SSL,
+                                        (u_char *) "on", sizeof("on") - 1);
+
+        if (verify.len) {
+            p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_SSL_VERIFY,
+                                            verify.data, verify.len);
+        }
+
+        if (subject.len) {
+            p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_SSL_SUBJECT,
+                                            subject.data, subject.len);
+        }
+
+        if (issuer.len) {
+            p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_SSL_ISSUER,
+                                            issuer.data, issuer.len);
+        }
+
+        if (serial.len) {
+            p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_SSL_SERIAL,
+                                            serial.data, serial.len);
+        }
+
+        if (fingerprint.len) {
+            p = ngx_mail_auth_uds_write_tlv(p,
+                                            NGX_MAIL_AUTH_UDS_SSL_FINGERPRINT,
+                                            fingerprint.data, fingerprint.len);
+        }
+
+        if (cert.len) {
+            p = ngx_mail_auth_uds_write_tlv(p, NGX_MAIL_AUTH_UDS_SSL_CERT,
+                                            cert.data, cert.len);
+        }
+    }
+
+#endif
+
+    if (ahcf->headers) {
+        header = ahcf->headers->elts;
+        for (i = 0; i < ahcf->headers->nelts; i++) {
+            p[0] = (u_char) (NGX_MAIL_AUTH_UDS_HEADER >> 8);
+            p[1] = (u_char) NGX_MAIL_AUTH_UDS_HEADER;
+            len = header[i].key.len + 2 + header[i].value.len;
+            p[2] = (u_char) (len >> 8);
+            p[3] = (u_char) len;
+            p = ngx_cpymem(p + 4, header[i].key.data, header[i].key.len);
+            *p++ = ':'; *p++ = ' ';
+            p = ngx_cpymem(p, header[i].value.data, header[i].value.len);
+        }
+    }
+
+    len = p - b->last - 4;
+
+    b->last[0] = (u_char) (len >> 24);
+    b->last[1] = (u_char) (len >> 16);
+    b->last[2] = (u_char) (len >> 8);
+    b->last[3] = (u_char) len;
+    b->last[4] = (u_char) (id >> 24);
+    b->last[5] = (u_char) (id >> 16);
+    b->last[6] = (u_char) (id >> 8);
+    b->last[7] = (u_char) id;
+
+    b->last = p;
+
+    return b;
+}
+
+
+static u_char *
+ngx_mail_auth_uds_write_tlv(u_char *p, ngx_uint_t type, u_char *data,
+    size_t len)
+{
+    *p++ = (u_char) (type >> 8);
+    *p++ = (u_char) type;
+    *p++ = (u_char) (len >> 8);
+    *p++ = (u_char) len;
+
+    return ngx_cpymem(p, data, len);
+}
+
+#endif
+
+
+static void *
+ngx_mail_auth_http_create_conf(ngx_conf_t *cf)
+{
+    ngx_mail_auth_http_conf_t  *ahcf;
+
+    ahcf = ngx_pcalloc(cf->pool, sizeof(ngx_mail_auth_http_conf_t));
+    if (ahcf == NULL) {
+        return NULL;
+    }
+
+    ahcf->timeout = NGX_CONF_UNSET_MSEC;
+    ahcf->pass_client_cert = NGX_CONF_UNSET;
+
+    ahcf->file = cf->conf_file->file.name.data;
+    ahcf->line = cf->conf_file->line;
+
+    return ahcf;
+}
+
+
+static char *
+ngx_mail_auth_http_merge_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_mail_auth_http_conf_t *prev = parent;
+    ngx_mail_auth_http_conf_t *conf = child;
+
+    u_char           *p;
+    size_t            len;
+    ngx_uint_t        i;
+    ngx_table_elt_t  *header;
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    if (conf->peer == NULL && conf->uds == NULL) {
+        conf->uds = prev->uds;
+#else
+    if (conf->peer == NULL) {
+#endif
+        conf->peer = prev->peer;
+        conf->host_header = prev->host_header;
+        conf->uri = prev->uri;
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+        if (conf->peer == NULL && conf->uds == NULL) {
+#else
+        if (conf->peer == NULL) {
+#endif
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "no \"auth_http\" is defined for server in %s:%ui",
+                          conf->file, conf->line);
+
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    ngx_conf_merge_msec_value(conf->timeout, prev->timeout, 60000);
+
+    ngx_conf_merge_value(conf->pass_client_cert, prev->pass_client_cert, 0);
+
+    if (conf->headers == NULL) {
+        conf->headers = prev->headers;
+        conf->header = prev->header;
+    }
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+
+    if (conf->uds && conf->headers) {
+
+        /* each header is sent as one TLV with a 16-bit length */
+
+        header = conf->headers->elts;
+        for (i = 0; i < conf->headers->nelts; i++) {
+            if (header[i].key.len + 2 + header[i].value.len > 0xffff) {
+                ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                              "auth_http_header \"%V\" is too long "
+                              "for \"auth_uds\" in %s:%ui",
+                              &header[i].key, conf->file, conf->line);
+                return NGX_CONF_ERROR;
+            }
+        }
+    }
+
+#endif
+
+    if (conf->headers && conf->header.len == 0) {
+        len = 0;
+        header = conf->headers->elts;
+        for (i = 0; i < conf->headers->nelts; i++) {
+            len += header[i].key.len + 2 + header[i].value.len + 2;
+        }
+
+        p = ngx_pnalloc(cf->pool, len);
+        if (p == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        conf->header.len = len;
+        conf->header.data = p;
+
+        for (i = 0; i < conf->headers->nelts; i++) {
+            p = ngx_cpymem(p, header[i].key.data, header[i].key.len);
+            *p++ = ':'; *p++ = ' ';
+            p = ngx_cpymem(p, header[i].value.data, header[i].value.len);
+            *p++ = CR; *p++ = LF;
+        }
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_mail_auth_http(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_mail_auth_http_conf_t *ahcf = conf;
+
+    ngx_str_t  *value;
+    ngx_url_t   u;
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    if (ahcf->uds) {
+        return "is duplicate";
+    }
+#endif
+
+    value = cf->args->elts;
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = value[1];
+    u.default_port = 80;
+    u.uri_part = 1;
+
+    if (ngx_strncmp(u.url.data, "http://", 7) == 0) {
+        u.url.len -= 7;
+        u.url.data += 7;
+    }
+
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in auth_http \"%V\"", u.err, &u.url);
+        }
+
+        return NGX_CONF_ERROR;
+    }
+
+    ahcf->peer = u.addrs;
+
+    if (u.family != AF_UNIX) {
+        ahcf->host_header = u.host;
+
+    } else {
+        ngx_str_set(&ahcf->host_header, "localhost");
+    }
+
+    ahcf->uri = u.uri;
+
+    if (ahcf->uri.len == 0) {
+        ngx_str_set(&ahcf->uri, "/");
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_mail_auth_http_header(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_mail_auth_http_conf_t *ahcf = conf;
+
+    ngx_str_t        *value;
+    ngx_table_elt_t  *header;
+
+    if (ahcf->headers == NULL) {
+        ahcf->headers = ngx_array_create(cf->pool, 1, sizeof(ngx_table_elt_t));
+        if (ahcf->headers == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    header = ngx_array_push(ahcf->headers);
+    if (header == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    header->key = value[1];
+    header->value = value[2];
+
+    return NGX_CONF_OK;
+}
+
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+
+static char *
+ngx_mail_auth_uds(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_mail_auth_http_conf_t *ahcf = conf;
+
+    ngx_str_t                 *value;
+    ngx_url_t                  u;
+    ngx_mail_auth_uds_peer_t  *peer;
+
+    if (ahcf->uds || ahcf->peer) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    ngx_memzero(&u, sizeof(ngx_url_t));
+
+    u.url = value[1];
+
+    if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
+        if (u.err) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "%s in auth_uds \"%V\"", u.err, &u.url);
+        }
+
+        return NGX_CONF_ERROR;
+    }
+
+    if (u.family != AF_UNIX) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "auth_uds requires a \"unix:\" address, "
+                           "\"%V\" given", &u.url);
+        return NGX_CONF_ERROR;
+    }
+
+    peer = ngx_pcalloc(cf->pool, sizeof(ngx_mail_auth_uds_peer_t));
+    if (peer == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    peer->addr = u.addrs;
+
+    ngx_rbtree_init(&peer->rbtree, &peer->sentinel, ngx_rbtree_insert_value);
+
+    ahcf->uds = peer;
+
+    return NGX_CONF_OK;
+}
+
+#endif
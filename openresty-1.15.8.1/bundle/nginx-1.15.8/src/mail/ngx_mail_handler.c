@@ -134,6 +134,11 @@ ngx_mail_init_connection(ngx_connection_t *c)
     c->data = s;
     s->connection = c;
 
+    if (ngx_mail_status_init_session(s) != NGX_OK) {
+        ngx_mail_close_connection(c);
+        return;
+    }
+
     cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
 
     ngx_set_connection_log(c, cscf->error_log);
@@ -17,10 +17,38 @@ typedef struct {
     ngx_flag_t  pass_error_message;
     ngx_flag_t  xclient;
     size_t      buffer_size;
+    size_t      zerocopy;
     ngx_msec_t  timeout;
+
+    ngx_uint_t  keepalive;
+    ngx_msec_t  keepalive_timeout;
+
+    ngx_queue_t cache;
+    ngx_queue_t free;
 } ngx_mail_proxy_conf_t;
 
 
+typedef struct {
+    ngx_mail_proxy_conf_t  *conf;
+
+    ngx_queue_t             queue;
+    ngx_connection_t       *connection;
+
+    socklen_t               socklen;
+    ngx_sockaddr_t          sockaddr;
+
+    ngx_str_t               login;
+    ngx_str_t               passwd;
+
+    /* RSET reply parser */
+    ngx_uint_t              offset;
+    u_char                  code;
+    u_char                  sep;
+
+    unsigned                ready:1;
+} ngx_mail_proxy_cache_t;
+
+
 static void ngx_mail_proxy_block_read(ngx_event_t *rev);
 static void ngx_mail_proxy_pop3_handler(ngx_event_t *rev);
 static void ngx_mail_proxy_imap_handler(ngx_event_t *rev);
@@ -29,6 +57,27 @@ static void ngx_mail_proxy_dummy_handler(ngx_event_t *ev);
 static ngx_int_t ngx_mail_proxy_read_response(ngx_mail_session_t *s,
     ngx_uint_t state);
 static void ngx_mail_proxy_handler(ngx_event_t *ev);
+#if (NGX_HAVE_MSG_ZEROCOPY)
+static void ngx_mail_proxy_zerocopy(ngx_mail_session_t *s);
+static ssize_t ngx_mail_proxy_zerocopy_send(ngx_connection_t *c, u_char *buf,
+    size_t size);
+#endif
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+static ngx_int_t ngx_mail_proxy_io_uring(ngx_mail_session_t *s);
+#endif
+static ngx_int_t ngx_mail_proxy_smtp_get(ngx_mail_session_t *s,
+    ngx_addr_t *peer);
+static ngx_uint_t ngx_mail_proxy_smtp_replies(ngx_buf_t *b);
+static void ngx_mail_proxy_smtp_data(ngx_mail_session_t *s, u_char *pos,
+    size_t size);
+static void ngx_mail_proxy_smtp_data_done(ngx_mail_session_t *s);
+static void ngx_mail_proxy_keepalive_handler(ngx_event_t *ev);
+static void ngx_mail_proxy_keepalive_dummy_handler(ngx_event_t *ev);
+static void ngx_mail_proxy_keepalive_close(ngx_mail_proxy_cache_t *item);
+static void ngx_mail_proxy_close_peer(ngx_connection_t *c,
+    ngx_uint_t own_pool);
+static void ngx_mail_proxy_close_upstream(ngx_mail_session_t *s);
+static void ngx_mail_proxy_cleanup(void *data);
 static void ngx_mail_proxy_upstream_error(ngx_mail_session_t *s);
 static void ngx_mail_proxy_internal_server_error(ngx_mail_session_t *s);
 static void ngx_mail_proxy_close_session(ngx_mail_session_t *s);
@@ -53,6 +102,13 @@ static ngx_command_t  ngx_mail_proxy_commands[] = {
       offsetof(ngx_mail_proxy_conf_t, buffer_size),
       NULL },
 
+    { ngx_string("proxy_zerocopy"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      offsetof(ngx_mail_proxy_conf_t, zerocopy),
+      NULL },
+
     { ngx_string("proxy_timeout"),
       NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_msec_slot,
@@ -74,6 +130,20 @@ static ngx_command_t  ngx_mail_proxy_commands[] = {
       offsetof(ngx_mail_proxy_conf_t, xclient),
       NULL },
 
+    { ngx_string("proxy_smtp_keepalive"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      offsetof(ngx_mail_proxy_conf_t, keepalive),
+      NULL },
+
+    { ngx_string("proxy_smtp_keepalive_timeout"),
+      NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_MAIL_SRV_CONF_OFFSET,
+      offsetof(ngx_mail_proxy_conf_t, keepalive_timeout),
+      NULL },
+
       ngx_null_command
 };
 
@@ -174,6 +244,8 @@ void
 ngx_mail_proxy_init(ngx_mail_session_t *s, ngx_addr_t *peer)
 {
     ngx_int_t                  rc;
+    ngx_pool_t                *pool;
+    ngx_pool_cleanup_t        *cln;
     ngx_mail_proxy_ctx_t      *p;
     ngx_mail_proxy_conf_t     *pcf;
     ngx_mail_core_srv_conf_t  *cscf;
@@ -181,6 +253,7 @@ ngx_mail_proxy_init(ngx_mail_session_t *s, ngx_addr_t *peer)
     s->connection->log->action = "connecting to upstream";
 
     cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
+    pcf = ngx_mail_get_module_srv_conf(s, ngx_mail_proxy_module);
 
     p = ngx_pcalloc(s->connection->pool, sizeof(ngx_mail_proxy_ctx_t));
     if (p == NULL) {
@@ -188,8 +261,40 @@ ngx_mail_proxy_init(ngx_mail_session_t *s, ngx_addr_t *peer)
         return;
     }
 
+    cln = ngx_pool_cleanup_add(s->connection->pool, 0);
+    if (cln == NULL) {
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
+
+    cln->handler = ngx_mail_proxy_cleanup;
+    cln->data = s;
+
     s->proxy = p;
 
+    p->buffer = ngx_create_temp_buf(s->connection->pool, pcf->buffer_size);
+    if (p->buffer == NULL) {
+        ngx_mail_session_internal_server_error(s);
+        return;
+    }
+
+    /*
+     * only sessions authenticated by the proxy itself can be handed
+     * an upstream connection left by a previous session
+     */
+
+    if (s->protocol == NGX_MAIL_SMTP_PROTOCOL
+        && pcf->keepalive
+        && (s->auth_method == NGX_MAIL_AUTH_PLAIN
+            || s->auth_method == NGX_MAIL_AUTH_LOGIN))
+    {
+        p->keepalive = 1;
+
+        if (ngx_mail_proxy_smtp_get(s, peer) == NGX_OK) {
+            return;
+        }
+    }
+
     p->upstream.sockaddr = peer->sockaddr;
     p->upstream.socklen = peer->socklen;
     p->upstream.name = &peer->name;
@@ -207,18 +312,26 @@ ngx_mail_proxy_init(ngx_mail_session_t *s, ngx_addr_t *peer)
     ngx_add_timer(p->upstream.connection->read, cscf->timeout);
 
     p->upstream.connection->data = s;
-    p->upstream.connection->pool = s->connection->pool;
 
-    s->connection->read->handler = ngx_mail_proxy_block_read;
+    ngx_mail_status_update_session(s);
 
-    pcf = ngx_mail_get_module_srv_conf(s, ngx_mail_proxy_module);
+    if (p->keepalive) {
+        /* the connection may outlive the session */
 
-    s->proxy->buffer = ngx_create_temp_buf(s->connection->pool,
-                                           pcf->buffer_size);
-    if (s->proxy->buffer == NULL) {
-        ngx_mail_proxy_internal_server_error(s);
-        return;
+        pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, s->connection->log);
+        if (pool == NULL) {
+            ngx_mail_proxy_internal_server_error(s);
+            return;
+        }
+
+        p->upstream.connection->pool = pool;
+
+    } else {
+        p->upstream.connection->pool = s->connection->pool;
     }
+
+    s->connection->read->handler = ngx_mail_proxy_block_read;
+
     s->out.len = 0;
 	ngx_mail_proxy_set_handler(s, p);
 
@@ -348,10 +461,24 @@ ngx_mail_proxy_pop3_handler(ngx_event_t *rev)
         rev->handler = ngx_mail_proxy_handler;
         c->write->handler = ngx_mail_proxy_handler;
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+        ngx_mail_proxy_zerocopy(s);
+#endif
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+        if (ngx_mail_proxy_io_uring(s) != NGX_OK) {
+            ngx_mail_proxy_internal_server_error(s);
+            return;
+        }
+#endif
+
         pcf = ngx_mail_get_module_srv_conf(s, ngx_mail_proxy_module);
         ngx_add_timer(s->connection->read, pcf->timeout);
         ngx_del_timer(c->read);
 
+        s->phase = NGX_MAIL_PHASE_PROXY;
+        ngx_mail_status_update_session(s);
+
         c->log->action = NULL;
         ngx_log_error(NGX_LOG_INFO, c->log, 0, "client logged in");
 
@@ -483,10 +610,24 @@ ngx_mail_proxy_imap_handler(ngx_event_t *rev)
         rev->handler = ngx_mail_proxy_handler;
         c->write->handler = ngx_mail_proxy_handler;
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+        ngx_mail_proxy_zerocopy(s);
+#endif
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+        if (ngx_mail_proxy_io_uring(s) != NGX_OK) {
+            ngx_mail_proxy_internal_server_error(s);
+            return;
+        }
+#endif
+
         pcf = ngx_mail_get_module_srv_conf(s, ngx_mail_proxy_module);
         ngx_add_timer(s->connection->read, pcf->timeout);
         ngx_del_timer(c->read);
 
+        s->phase = NGX_MAIL_PHASE_PROXY;
+        ngx_mail_status_update_session(s);
+
         c->log->action = NULL;
         ngx_log_error(NGX_LOG_INFO, c->log, 0, "client logged in");
 
@@ -578,6 +719,7 @@ ngx_mail_proxy_smtp_handler(ngx_event_t *rev)
     u_char                    *p;
     ngx_int_t                  rc;
     ngx_str_t                  line;
+    ngx_uint_t                 n;
     ngx_connection_t          *c;
     ngx_mail_session_t        *s;
     ngx_mail_proxy_conf_t     *pcf;
@@ -723,6 +865,9 @@ ngx_mail_proxy_smtp_handler(ngx_event_t *rev)
         cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
         s->connection->read->handler = cscf->protocol->auth_state;
 
+        n = ngx_mail_proxy_smtp_replies(s->proxy->buffer);
+        s->proxy->pending -= ngx_min(n, s->proxy->pending);
+
 		s->out.data = s->proxy->buffer->pos;
 		s->out.len  = s->proxy->buffer->last - s->proxy->buffer->pos;
 		ngx_mail_send(s->connection->write);
@@ -732,18 +877,53 @@ ngx_mail_proxy_smtp_handler(ngx_event_t *rev)
 		return;
 		
 	case ngx_smtp_data:
+        if (s->proxy->keepalive) {
+            if (s->proxy->pending) {
+                s->proxy->pending--;
+            }
+
+            if (s->buffer->pos == s->buffer->last) {
+                s->proxy->data = 1;
+                s->proxy->data_state = 0;
+
+            } else {
+                s->proxy->keepalive = 0;
+            }
+        }
+
+        /* fall through */
+
     case ngx_smtp_xclient:
         s->connection->read->handler = ngx_mail_proxy_handler;
         s->connection->write->handler = ngx_mail_proxy_handler;
         rev->handler = ngx_mail_proxy_handler;
         c->write->handler = ngx_mail_proxy_handler;
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+        ngx_mail_proxy_zerocopy(s);
+#endif
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+        if (ngx_mail_proxy_io_uring(s) != NGX_OK) {
+            ngx_mail_proxy_internal_server_error(s);
+            return;
+        }
+#endif
+
         pcf = ngx_mail_get_module_srv_conf(s, ngx_mail_proxy_module);
         ngx_add_timer(s->connection->read, pcf->timeout);
         ngx_del_timer(c->read);
 
         c->log->action = NULL;
-        ngx_log_error(NGX_LOG_INFO, c->log, 0, "client logged in");
+
+        /* a session on a reused upstream has logged in already */
+
+        if (s->phase != NGX_MAIL_PHASE_PROXY) {
+            ngx_log_error(NGX_LOG_INFO, c->log, 0, "client logged in");
+        }
+
+        s->phase = NGX_MAIL_PHASE_PROXY;
+        ngx_mail_status_update_session(s);
 
         if (s->buffer->pos == s->buffer->last) {
             ngx_mail_proxy_handler(s->connection->write);
@@ -1104,6 +1284,11 @@ ngx_mail_proxy_handler(ngx_event_t *ev)
 
         size = b->end - b->last;
 
+        if (s->proxy->data_end && src == s->connection) {
+            /* the message is complete, hold the next command */
+            size = 0;
+        }
+
         if (size && src->read->ready) {
             c->log->action = recv_action;
 
@@ -1114,6 +1299,10 @@ ngx_mail_proxy_handler(ngx_event_t *ev)
             }
 
             if (n > 0) {
+                if (s->proxy->data && src == s->connection) {
+                    ngx_mail_proxy_smtp_data(s, b->last, n);
+                }
+
                 do_write = 1;
                 b->last += n;
 
@@ -1145,6 +1334,17 @@ ngx_mail_proxy_handler(ngx_event_t *ev)
         return;
     }
 
+    if (s->proxy->data_end && s->buffer->pos == s->buffer->last) {
+
+        if (s->proxy->buffer->pos == s->proxy->buffer->last) {
+            ngx_mail_proxy_smtp_data_done(s);
+            return;
+        }
+
+        s->proxy->data_end = 0;
+        s->proxy->keepalive = 0;
+    }
+
     if (ngx_handle_write_event(dst->write, 0) != NGX_OK) {
         ngx_mail_proxy_close_session(s);
         return;
@@ -1172,17 +1372,587 @@ ngx_mail_proxy_handler(ngx_event_t *ev)
 }
 
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
 static void
-ngx_mail_proxy_upstream_error(ngx_mail_session_t *s)
+ngx_mail_proxy_zerocopy(ngx_mail_session_t *s)
+{
+    ngx_uint_t              i;
+    ngx_connection_t       *c;
+    ngx_mail_proxy_ctx_t   *p;
+    ngx_mail_proxy_conf_t  *pcf;
+
+    pcf = ngx_mail_get_module_srv_conf(s, ngx_mail_proxy_module);
+
+    if (pcf->zerocopy == 0) {
+        return;
+    }
+
+    p = s->proxy;
+
+    for (i = 0; i < 2; i++) {
+        c = i ? p->upstream.connection : s->connection;
+
+        if (c->send != ngx_send
+#if (NGX_SSL)
+            || c->ssl
+#endif
+            )
+        {
+            continue;
+        }
+
+        if (p->zerocopy[i] == NULL) {
+            p->zerocopy[i] = ngx_palloc(s->connection->pool,
+                                        sizeof(ngx_linux_zerocopy_t));
+            if (p->zerocopy[i] == NULL) {
+                return;
+            }
+        }
+
+        if (ngx_linux_zerocopy_init(c, p->zerocopy[i], pcf->zerocopy)
+            != NGX_OK)
+        {
+            continue;
+        }
+
+        c->send = ngx_mail_proxy_zerocopy_send;
+    }
+}
+
+
+static ssize_t
+ngx_mail_proxy_zerocopy_send(ngx_connection_t *c, u_char *buf, size_t size)
+{
+    ngx_mail_session_t  *s;
+
+    s = c->data;
+
+    return ngx_linux_zerocopy_send(c,
+                                   s->proxy->zerocopy[c != s->connection],
+                                   buf, size);
+}
+
+#endif
+
+
+#if (NGX_HAVE_IO_URING_MULTISHOT)
+
+static ngx_int_t
+ngx_mail_proxy_io_uring(ngx_mail_session_t *s)
+{
+    ngx_uint_t         i;
+    ngx_connection_t  *c;
+
+    /* both sides of the relay receive data with io_uring requests */
+
+    for (i = 0; i < 2; i++) {
+        c = i ? s->proxy->upstream.connection : s->connection;
+
+        if (ngx_io_uring_recv_init(c) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_mail_proxy_smtp_get(ngx_mail_session_t *s, ngx_addr_t *peer)
+{
+    ngx_queue_t               *q;
+    ngx_connection_t          *c;
+    ngx_mail_proxy_ctx_t      *p;
+    ngx_mail_proxy_conf_t     *pcf;
+    ngx_mail_proxy_cache_t    *item;
+    ngx_mail_core_srv_conf_t  *cscf;
+
+    pcf = ngx_mail_get_module_srv_conf(s, ngx_mail_proxy_module);
+
+    for (q = ngx_queue_head(&pcf->cache);
+         q != ngx_queue_sentinel(&pcf->cache);
+         q = ngx_queue_next(q))
+    {
+        item = ngx_queue_data(q, ngx_mail_proxy_cache_t, queue);
+
+        if (!item->ready
+            || ngx_memn2cmp((u_char *) &item->sockaddr,
+                            (u_char *) peer->sockaddr,
+                            item->socklen, peer->socklen) != 0
+            || item->login.len != s->login.len
+            || item->passwd.len != s->passwd.len
+            || ngx_strncmp(item->login.data, s->login.data,
+                           s->login.len) != 0
+            || ngx_strncmp(item->passwd.data, s->passwd.data,
+                           s->passwd.len) != 0)
+        {
+            continue;
+        }
+
+        goto found;
+    }
+
+    return NGX_DECLINED;
+
+found:
+
+    ngx_queue_remove(q);
+    ngx_queue_insert_head(&pcf->free, q);
+
+    ngx_free(item->login.data);
+
+    c = item->connection;
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail proxy reuse connection: %d", c->fd);
+
+    p = s->proxy;
+
+    p->upstream.sockaddr = peer->sockaddr;
+    p->upstream.socklen = peer->socklen;
+    p->upstream.name = &peer->name;
+    p->upstream.log = s->connection->log;
+    p->upstream.log_error = NGX_ERROR_ERR;
+    p->upstream.connection = c;
+
+    c->idle = 0;
+    c->data = s;
+    c->log = s->connection->log;
+    c->read->log = c->log;
+    c->write->log = c->log;
+    c->pool->log = c->log;
+
+    c->read->handler = ngx_mail_proxy_smtp_handler;
+    c->write->handler = ngx_mail_proxy_dummy_handler;
+
+    /* count the traffic of this session only */
+    c->sent = 0;
+
+    s->phase = NGX_MAIL_PHASE_PROXY;
+    ngx_mail_status_update_session(s);
+
+    c->log->action = NULL;
+    ngx_log_error(NGX_LOG_INFO, c->log, 0, "client logged in");
+
+    s->mail_state = ngx_smtp_to;
+
+    cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
+
+    ngx_add_timer(c->read, cscf->timeout);
+
+    s->connection->read->handler = cscf->protocol->auth_state;
+
+    ngx_str_set(&s->out, smtp_auth_ok);
+    ngx_mail_send(s->connection->write);
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_mail_proxy_smtp_keepalive(ngx_mail_session_t *s)
+{
+    u_char                  *key;
+    size_t                   len;
+    ngx_uint_t               n;
+    ngx_queue_t             *q;
+    ngx_connection_t        *c;
+    ngx_mail_proxy_ctx_t    *p;
+    ngx_mail_proxy_conf_t   *pcf;
+    ngx_mail_proxy_cache_t  *item;
+
+    p = s->proxy;
+
+    if (p == NULL || !p->keepalive || p->upstream.connection == NULL) {
+        return NGX_DECLINED;
+    }
+
+    /*
+     * QUIT must have arrived on its own, with nothing left
+     * to relay in either direction
+     */
+
+    if (p->pending
+        || p->buffer->pos != p->buffer->last
+        || s->buffer->pos != s->buffer->last
+        || (ssize_t) s->buffer_cmd.len <= 0)
+    {
+        return NGX_DECLINED;
+    }
+
+    n = 0;
+
+    for (key = s->buffer_cmd.data;
+         key < s->buffer_cmd.data + s->buffer_cmd.len;
+         key++)
+    {
+        if (*key == LF) {
+            n++;
+        }
+    }
+
+    if (n != 1) {
+        return NGX_DECLINED;
+    }
+
+    c = p->upstream.connection;
+
+    if (ngx_terminate || ngx_exiting
+        || c->read->eof || c->read->error || c->write->error)
+    {
+        return NGX_DECLINED;
+    }
+
+    len = s->login.len + s->passwd.len;
+
+    key = ngx_alloc(len, ngx_cycle->log);
+    if (key == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail proxy keep connection: %d", c->fd);
+
+    /* nothing is in flight with the buffers empty */
+
+    c->send = ngx_send;
+
+    s->connection->log->action = "sending RSET to upstream";
+
+    if (c->send(c, (u_char *) "RSET" CRLF, sizeof("RSET" CRLF) - 1)
+        != (ssize_t) sizeof("RSET" CRLF) - 1)
+    {
+        ngx_free(key);
+        ngx_mail_proxy_close_upstream(s);
+        return NGX_OK;
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_free(key);
+        ngx_mail_proxy_close_upstream(s);
+        return NGX_OK;
+    }
+
+    pcf = ngx_mail_get_module_srv_conf(s, ngx_mail_proxy_module);
+
+    if (ngx_queue_empty(&pcf->free)) {
+
+        q = ngx_queue_last(&pcf->cache);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_mail_proxy_cache_t, queue);
+
+        ngx_mail_proxy_close_peer(item->connection, 1);
+        ngx_free(item->login.data);
+
+    } else {
+        q = ngx_queue_head(&pcf->free);
+        ngx_queue_remove(q);
+
+        item = ngx_queue_data(q, ngx_mail_proxy_cache_t, queue);
+    }
+
+    ngx_queue_insert_head(&pcf->cache, q);
+
+    item->connection = c;
+
+    item->socklen = p->upstream.socklen;
+    ngx_memcpy(&item->sockaddr, p->upstream.sockaddr, p->upstream.socklen);
+
+    item->login.len = s->login.len;
+    item->login.data = key;
+    ngx_memcpy(key, s->login.data, s->login.len);
+
+    item->passwd.len = s->passwd.len;
+    item->passwd.data = key + s->login.len;
+    ngx_memcpy(item->passwd.data, s->passwd.data, s->passwd.len);
+
+    item->offset = 0;
+    item->ready = 0;
+
+    p->upstream.connection = NULL;
+
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
+    if (c->write->timer_set) {
+        ngx_del_timer(c->write);
+    }
+
+    ngx_add_timer(c->read, pcf->keepalive_timeout);
+
+    c->read->handler = ngx_mail_proxy_keepalive_handler;
+    c->write->handler = ngx_mail_proxy_keepalive_dummy_handler;
+
+    c->data = item;
+    c->idle = 1;
+    c->log = ngx_cycle->log;
+    c->read->log = ngx_cycle->log;
+    c->write->log = ngx_cycle->log;
+    c->pool->log = ngx_cycle->log;
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_mail_proxy_smtp_replies(ngx_buf_t *b)
+{
+    u_char      *p, *line;
+    ngx_uint_t   n;
+
+    n = 0;
+    line = b->pos;
+
+    for (p = b->pos; p < b->last; p++) {
+
+        if (*p != LF) {
+            continue;
+        }
+
+        if (p - line < 4 || line[3] != '-') {
+            n++;
+        }
+
+        line = p + 1;
+    }
+
+    return n;
+}
+
+
+static void
+ngx_mail_proxy_smtp_data(ngx_mail_session_t *s, u_char *pos, size_t size)
+{
+    u_char                 ch, *p, *last;
+    ngx_uint_t             state;
+    ngx_mail_proxy_ctx_t  *ctx;
+    enum {
+        sw_start = 0,
+        sw_text,
+        sw_cr,
+        sw_dot,
+        sw_dot_cr
+    };
+
+    ctx = s->proxy;
+    state = ctx->data_state;
+    last = pos + size;
+
+    for (p = pos; p < last; p++) {
+        ch = *p;
+
+        switch (state) {
+
+        case sw_start:
+            state = (ch == '.') ? sw_dot : sw_text;
+            break;
+
+        case sw_text:
+            if (ch == CR) {
+                state = sw_cr;
+            }
+            break;
+
+        case sw_cr:
+            if (ch == LF) {
+                state = sw_start;
+
+            } else if (ch != CR) {
+                state = sw_text;
+            }
+            break;
+
+        case sw_dot:
+            state = (ch == CR) ? sw_dot_cr : sw_text;
+            break;
+
+        case sw_dot_cr:
+            if (ch == LF) {
+                goto done;
+            }
+
+            state = (ch == CR) ? sw_cr : sw_text;
+            break;
+        }
+    }
+
+    ctx->data_state = state;
+
+    return;
+
+done:
+
+    ctx->data = 0;
+
+    if (p + 1 == last) {
+        ctx->data_end = 1;
+        return;
+    }
+
+    /* pipelined commands follow the message, keep proxying as is */
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail proxy smtp data pipelined");
+
+    ctx->keepalive = 0;
+}
+
+
+static void
+ngx_mail_proxy_smtp_data_done(ngx_mail_session_t *s)
+{
+    ngx_connection_t          *c;
+    ngx_mail_core_srv_conf_t  *cscf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                   "mail proxy smtp data done");
+
+    c = s->proxy->upstream.connection;
+
+    s->proxy->data_end = 0;
+    s->proxy->pending++;
+
+    s->mail_state = ngx_smtp_to;
+
+    cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
+
+    s->connection->read->handler = cscf->protocol->auth_state;
+    s->connection->write->handler = ngx_mail_send;
+    c->read->handler = ngx_mail_proxy_smtp_handler;
+    c->write->handler = ngx_mail_proxy_dummy_handler;
+
+    if (s->connection->read->timer_set) {
+        ngx_del_timer(s->connection->read);
+    }
+
+    ngx_add_timer(c->read, cscf->timeout);
+
+    s->buffer->pos = s->buffer->start;
+    s->buffer->last = s->buffer->start;
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        ngx_mail_proxy_close_session(s);
+        return;
+    }
+
+    if (s->connection->read->ready) {
+        ngx_post_event(s->connection->read, &ngx_posted_events);
+        return;
+    }
+
+    if (ngx_handle_read_event(s->connection->read, 0) != NGX_OK) {
+        ngx_mail_proxy_close_session(s);
+    }
+}
+
+
+static void
+ngx_mail_proxy_keepalive_handler(ngx_event_t *ev)
 {
-    if (s->proxy->upstream.connection) {
-        ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
-                       "close mail proxy connection: %d",
-                       s->proxy->upstream.connection->fd);
+    u_char                   buf[256], *p;
+    ssize_t                  n;
+    ngx_connection_t        *c;
+    ngx_mail_proxy_cache_t  *item;
+
+    c = ev->data;
+    item = c->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, ev->log, 0,
+                   "mail proxy keepalive handler");
 
-        ngx_close_connection(s->proxy->upstream.connection);
+    if (c->close || ev->timedout) {
+        goto close;
     }
 
+    for ( ;; ) {
+        n = c->recv(c, buf, sizeof(buf));
+
+        if (n == NGX_AGAIN) {
+            break;
+        }
+
+        if (n == NGX_ERROR || n == 0) {
+            goto close;
+        }
+
+        for (p = buf; p < buf + n; p++) {
+
+            if (item->offset == 0) {
+                item->code = *p;
+                item->sep = ' ';
+
+            } else if (item->offset == 3) {
+                item->sep = *p;
+            }
+
+            item->offset++;
+
+            if (*p != LF) {
+                continue;
+            }
+
+            item->offset = 0;
+
+            if (item->sep == '-') {
+                continue;
+            }
+
+            /* anything but a single positive reply to RSET */
+
+            if (item->ready || item->code != '2') {
+                goto close;
+            }
+
+            item->ready = 1;
+        }
+    }
+
+    if (ngx_handle_read_event(c->read, 0) != NGX_OK) {
+        goto close;
+    }
+
+    return;
+
+close:
+
+    ngx_mail_proxy_keepalive_close(item);
+}
+
+
+static void
+ngx_mail_proxy_keepalive_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_MAIL, ev->log, 0,
+                   "mail proxy keepalive dummy handler");
+}
+
+
+static void
+ngx_mail_proxy_keepalive_close(ngx_mail_proxy_cache_t *item)
+{
+    ngx_queue_remove(&item->queue);
+    ngx_queue_insert_head(&item->conf->free, &item->queue);
+
+    ngx_free(item->login.data);
+
+    ngx_mail_proxy_close_peer(item->connection, 1);
+}
+
+
+static void
+ngx_mail_proxy_upstream_error(ngx_mail_session_t *s)
+{
+    ngx_mail_proxy_close_upstream(s);
+
     if (s->out.len == 0) {
         ngx_mail_session_internal_server_error(s);
         return;
@@ -1196,13 +1966,7 @@ ngx_mail_proxy_upstream_error(ngx_mail_session_t *s)
 static void
 ngx_mail_proxy_internal_server_error(ngx_mail_session_t *s)
 {
-    if (s->proxy->upstream.connection) {
-        ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
-                       "close mail proxy connection: %d",
-                       s->proxy->upstream.connection->fd);
-
-        ngx_close_connection(s->proxy->upstream.connection);
-    }
+    ngx_mail_proxy_close_upstream(s);
 
     ngx_mail_session_internal_server_error(s);
 }
@@ -1211,18 +1975,83 @@ ngx_mail_proxy_internal_server_error(ngx_mail_session_t *s)
 static void
 ngx_mail_proxy_close_session(ngx_mail_session_t *s)
 {
-    if (s->proxy->upstream.connection) {
-        ngx_log_debug1(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
-                       "close mail proxy connection: %d",
-                       s->proxy->upstream.connection->fd);
-
-        ngx_close_connection(s->proxy->upstream.connection);
+#if (NGX_HAVE_MSG_ZEROCOPY && NGX_DEBUG)
+    ngx_uint_t             i;
+    ngx_linux_zerocopy_t  *zc;
+
+    for (i = 0; s->proxy && i < 2; i++) {
+        zc = s->proxy->zerocopy[i];
+
+        if (zc && zc->zerocopied) {
+            ngx_log_debug3(NGX_LOG_DEBUG_MAIL, s->connection->log, 0,
+                           "mail proxy %s zerocopy sends: %ui, copied: %ui",
+                           i ? "upstream" : "client",
+                           zc->zerocopied, zc->copied);
+        }
     }
+#endif
+
+    ngx_mail_proxy_close_upstream(s);
 
     ngx_mail_close_connection(s->connection);
 }
 
 
+static void
+ngx_mail_proxy_close_peer(ngx_connection_t *c, ngx_uint_t own_pool)
+{
+    ngx_pool_t  *pool;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_MAIL, c->log, 0,
+                   "close mail proxy connection: %d", c->fd);
+
+    pool = c->pool;
+
+#if (NGX_MAIL_SSL)
+
+    if (c->ssl) {
+        c->ssl->no_wait_shutdown = 1;
+        c->ssl->no_send_shutdown = 1;
+
+        (void) ngx_ssl_shutdown(c);
+    }
+
+#endif
+
+    ngx_close_connection(c);
+
+    if (own_pool) {
+        ngx_destroy_pool(pool);
+    }
+}
+
+
+static void
+ngx_mail_proxy_close_upstream(ngx_mail_session_t *s)
+{
+    ngx_connection_t  *c;
+
+    c = s->proxy->upstream.connection;
+
+    if (c == NULL) {
+        return;
+    }
+
+    s->proxy->upstream.connection = NULL;
+
+    ngx_mail_proxy_close_peer(c, c->pool != s->connection->pool);
+}
+
+
+static void
+ngx_mail_proxy_cleanup(void *data)
+{
+    ngx_mail_session_t *s = data;
+
+    ngx_mail_proxy_close_upstream(s);
+}
+
+
 static void *
 ngx_mail_proxy_create_conf(ngx_conf_t *cf)
 {
@@ -1237,7 +2066,10 @@ ngx_mail_proxy_create_conf(ngx_conf_t *cf)
     pcf->pass_error_message = NGX_CONF_UNSET;
     pcf->xclient = NGX_CONF_UNSET;
     pcf->buffer_size = NGX_CONF_UNSET_SIZE;
+    pcf->zerocopy = NGX_CONF_UNSET_SIZE;
     pcf->timeout = NGX_CONF_UNSET_MSEC;
+    pcf->keepalive = NGX_CONF_UNSET_UINT;
+    pcf->keepalive_timeout = NGX_CONF_UNSET_MSEC;
 
     return pcf;
 }
@@ -1249,12 +2081,49 @@ ngx_mail_proxy_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_mail_proxy_conf_t *prev = parent;
     ngx_mail_proxy_conf_t *conf = child;
 
+    ngx_uint_t               i;
+    ngx_mail_proxy_cache_t  *items;
+
     ngx_conf_merge_value(conf->enable, prev->enable, 0);
     ngx_conf_merge_value(conf->pass_error_message, prev->pass_error_message, 0);
     ngx_conf_merge_value(conf->xclient, prev->xclient, 1);
     ngx_conf_merge_size_value(conf->buffer_size, prev->buffer_size,
                               (size_t) ngx_pagesize);
+    ngx_conf_merge_size_value(conf->zerocopy, prev->zerocopy, 0);
     ngx_conf_merge_msec_value(conf->timeout, prev->timeout, 24 * 60 * 60000);
 
+#if !(NGX_HAVE_MSG_ZEROCOPY)
+
+    if (conf->zerocopy) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "\"proxy_zerocopy\" is not supported "
+                           "on this platform, ignored");
+        conf->zerocopy = 0;
+    }
+
+#endif
+
+    ngx_conf_merge_uint_value(conf->keepalive, prev->keepalive, 0);
+    ngx_conf_merge_msec_value(conf->keepalive_timeout,
+                              prev->keepalive_timeout, 10000);
+
+    ngx_queue_init(&conf->cache);
+    ngx_queue_init(&conf->free);
+
+    if (conf->keepalive == 0) {
+        return NGX_CONF_OK;
+    }
+
+    items = ngx_pcalloc(cf->pool,
+                        sizeof(ngx_mail_proxy_cache_t) * conf->keepalive);
+    if (items == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    for (i = 0; i < conf->keepalive; i++) {
+        items[i].conf = conf;
+        ngx_queue_insert_head(&conf->free, &items[i].queue);
+    }
+
     return NGX_CONF_OK;
 }
@@ -88,6 +88,8 @@ ngx_mail_smtp_init_session(ngx_mail_session_t *s, ngx_connection_t *c)
     ctx->data = s;
     ctx->timeout = cscf->resolver_timeout;
 
+    s->resolver_ctx = ctx;
+
     if (ngx_resolve_addr(ctx) != NGX_OK) {
         ngx_mail_close_connection(c);
     }
@@ -103,6 +105,8 @@ ngx_mail_smtp_resolve_addr_handler(ngx_resolver_ctx_t *ctx)
     s = ctx->data;
     c = s->connection;
 
+    s->resolver_ctx = NULL;
+
     if (ctx->state) {
         ngx_log_error(NGX_LOG_ERR, c->log, 0,
                       "%V could not be resolved (%i: %s)",
@@ -169,6 +173,8 @@ ngx_mail_smtp_resolve_name(ngx_event_t *rev)
     ctx->data = s;
     ctx->timeout = cscf->resolver_timeout;
 
+    s->resolver_ctx = ctx;
+
     if (ngx_resolve_name(ctx) != NGX_OK) {
         ngx_mail_close_connection(c);
     }
@@ -185,6 +191,8 @@ ngx_mail_smtp_resolve_name_handler(ngx_resolver_ctx_t *ctx)
     s = ctx->data;
     c = s->connection;
 
+    s->resolver_ctx = NULL;
+
     if (ctx->state) {
         ngx_log_error(NGX_LOG_ERR, c->log, 0,
                       "\"%V\" could not be resolved (%i: %s)",
@@ -387,6 +395,7 @@ ngx_mail_smtp_create_buffer(ngx_mail_session_t *s, ngx_connection_t *c)
 void
 ngx_mail_smtp_auth_state(ngx_event_t *rev)
 {
+    u_char              *p;
     ngx_int_t            rc;
     ngx_connection_t    *c;
     ngx_mail_session_t  *s;
@@ -505,7 +514,13 @@ ngx_mail_smtp_auth_state(ngx_event_t *rev)
 
 	if((rc==NGX_OK||rc==NGX_DONE) && s->client_state == ngx_smtp_auth_password)
 	{
-		rc = NGX_DECLINED;
+		/* QUIT is answered locally if the upstream connection is kept */
+
+		if (s->command != NGX_SMTP_QUIT
+		    || ngx_mail_proxy_smtp_keepalive(s) != NGX_OK)
+		{
+			rc = NGX_DECLINED;
+		}
 	}
 
     switch (rc) {
@@ -516,6 +531,16 @@ ngx_mail_smtp_auth_state(ngx_event_t *rev)
 			ngx_mail_session_internal_server_error(s);
       		return;
     	}
+		if (s->proxy->keepalive) {
+			for (p = s->buffer_cmd.data;
+			     p < s->buffer_cmd.data + s->buffer_cmd.len;
+			     p++)
+			{
+				if (*p == LF) {
+					s->proxy->pending++;
+				}
+			}
+		}
 		s->args.nelts = 0;
         if (s->buffer->pos == s->buffer->last) {
             s->buffer->pos = s->buffer->start;
@@ -61,6 +61,13 @@ static ngx_conf_deprecated_t  ngx_mail_ssl_deprecated = {
 };
 
 
+static ngx_conf_post_t  ngx_mail_ssl_certificate_post =
+    { ngx_ssl_preload_certificate };
+
+static ngx_conf_post_t  ngx_mail_ssl_certificate_key_post =
+    { ngx_ssl_preload_certificate_key };
+
+
 static ngx_command_t  ngx_mail_ssl_commands[] = {
 
     { ngx_string("ssl"),
@@ -89,14 +96,14 @@ static ngx_command_t  ngx_mail_ssl_commands[] = {
       ngx_conf_set_str_array_slot,
       NGX_MAIL_SRV_CONF_OFFSET,
       offsetof(ngx_mail_ssl_conf_t, certificates),
-      NULL },
+      &ngx_mail_ssl_certificate_post },
 
     { ngx_string("ssl_certificate_key"),
       NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_str_array_slot,
       NGX_MAIL_SRV_CONF_OFFSET,
       offsetof(ngx_mail_ssl_conf_t, certificate_keys),
-      NULL },
+      &ngx_mail_ssl_certificate_key_post },
 
     { ngx_string("ssl_password_file"),
       NGX_MAIL_MAIN_CONF|NGX_MAIL_SRV_CONF|NGX_CONF_TAKE1,
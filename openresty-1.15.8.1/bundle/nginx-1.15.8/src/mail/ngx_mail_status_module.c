@@ -0,0 +1,994 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <ngx_event_stat.h>
+#include <ngx_mail.h>
+#include <ngx_mail_status_module.h>
+
+
+#define NGX_MAIL_STATUS_INTERVAL  1000
+
+
+static void ngx_mail_status_cleanup_session(void *data);
+static void ngx_mail_status_copy_session(ngx_mail_session_t *s,
+    ngx_mail_status_session_t *st);
+static void ngx_mail_status_handler(ngx_event_t *ev);
+static void ngx_mail_status_refresh(ngx_mail_status_main_conf_t *smcf);
+static void ngx_mail_status_collect(ngx_mail_core_main_conf_t *cmcf);
+static void ngx_mail_status_log(ngx_log_t *log,
+    ngx_mail_core_main_conf_t *cmcf);
+static void ngx_mail_status_publish(ngx_mail_status_main_conf_t *smcf,
+    ngx_uint_t nservers);
+static ngx_int_t ngx_mail_status_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_mail_status_init_session_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void *ngx_mail_status_create_main_conf(ngx_conf_t *cf);
+static char *ngx_mail_status_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_mail_status_session_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_shm_zone_t *ngx_mail_status_add_zone(ngx_conf_t *cf,
+    ngx_str_t *value, void *tag);
+static ngx_int_t ngx_mail_status_init_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_mail_status_commands[] = {
+
+    { ngx_string("status_zone"),
+      NGX_MAIL_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_mail_status_zone,
+      NGX_MAIL_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("session_zone"),
+      NGX_MAIL_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_mail_status_session_zone,
+      NGX_MAIL_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_mail_module_t  ngx_mail_status_module_ctx = {
+    NULL,                                  /* protocol */
+
+    ngx_mail_status_create_main_conf,      /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL                                   /* merge server configuration */
+};
+
+
+ngx_module_t  ngx_mail_status_module = {
+    NGX_MODULE_V1,
+    &ngx_mail_status_module_ctx,           /* module context */
+    ngx_mail_status_commands,              /* module directives */
+    NGX_MAIL_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_mail_status_init_process,          /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_str_t  ngx_mail_status_phases[] = {
+    ngx_string("auth"),
+    ngx_string("proxy"),
+    ngx_string("sleep")
+};
+
+
+static ngx_str_t  ngx_mail_status_protocols[] = {
+    ngx_string("pop3"),
+    ngx_string("imap"),
+    ngx_string("smtp")
+};
+
+
+/* the per worker state */
+
+static ngx_queue_t              ngx_mail_status_sessions;
+static ngx_mail_status_stat_t  *ngx_mail_status_stats;
+static sig_atomic_t             ngx_mail_status_dump;
+static ngx_event_t              ngx_mail_status_event;
+static ngx_connection_t         ngx_mail_status_dumb;
+
+
+ngx_int_t
+ngx_mail_status_init_session(ngx_mail_session_t *s)
+{
+    ngx_connection_t             *c;
+    ngx_pool_cleanup_t           *cln;
+    ngx_mail_status_session_t    *st;
+    ngx_mail_status_main_conf_t  *smcf;
+
+    c = s->connection;
+
+    cln = ngx_pool_cleanup_add(c->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_mail_status_cleanup_session;
+    cln->data = s;
+
+    ngx_queue_insert_tail(&ngx_mail_status_sessions, &s->queue);
+
+    smcf = ngx_mail_get_module_main_conf(s, ngx_mail_status_module);
+
+    if (smcf->session_zone == NULL) {
+        return NGX_OK;
+    }
+
+    /* the entry may come from the worker slab cache, outside the lock */
+
+    st = ngx_slab_calloc(smcf->sshpool, sizeof(ngx_mail_status_session_t));
+    if (st == NULL) {
+        /* the session is not listed */
+        return NGX_OK;
+    }
+
+    st->id = c->number;
+    st->pid = ngx_pid;
+    st->start = ngx_time();
+
+    st->client_len = ngx_min(c->addr_text.len, NGX_SOCKADDR_STRLEN);
+    ngx_memcpy(st->client, c->addr_text.data, st->client_len);
+
+    ngx_shmtx_lock(&smcf->sshpool->mutex);
+
+    ngx_queue_insert_tail(&smcf->ssh->sessions, &st->queue);
+    smcf->ssh->count++;
+
+    ngx_shmtx_unlock(&smcf->sshpool->mutex);
+
+    s->status = st;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_mail_status_cleanup_session(void *data)
+{
+    ngx_mail_session_t  *s = data;
+
+    ngx_mail_status_main_conf_t  *smcf;
+
+    ngx_queue_remove(&s->queue);
+
+    if (s->status == NULL) {
+        return;
+    }
+
+    smcf = ngx_mail_get_module_main_conf(s, ngx_mail_status_module);
+
+    ngx_shmtx_lock(&smcf->sshpool->mutex);
+
+    ngx_queue_remove(&s->status->queue);
+    smcf->ssh->count--;
+
+    ngx_shmtx_unlock(&smcf->sshpool->mutex);
+
+    ngx_slab_free(smcf->sshpool, s->status);
+
+    s->status = NULL;
+}
+
+
+void
+ngx_mail_status_update_session(ngx_mail_session_t *s)
+{
+    ngx_mail_status_main_conf_t  *smcf;
+
+    if (s->status == NULL) {
+        return;
+    }
+
+    smcf = ngx_mail_get_module_main_conf(s, ngx_mail_status_module);
+
+    ngx_shmtx_lock(&smcf->sshpool->mutex);
+
+    ngx_mail_status_copy_session(s, s->status);
+
+    ngx_shmtx_unlock(&smcf->sshpool->mutex);
+}
+
+
+static void
+ngx_mail_status_copy_session(ngx_mail_session_t *s,
+    ngx_mail_status_session_t *st)
+{
+    ngx_peer_connection_t  *peer;
+
+    st->protocol = s->protocol;
+    st->phase = s->phase;
+    st->client_sent = s->connection->sent;
+
+    if (s->login.len) {
+        st->login_len = s->login.len;
+        st->login_hash = ngx_crc32_long(s->login.data, s->login.len);
+        ngx_memcpy(st->login, s->login.data,
+                   ngx_min(s->login.len, NGX_MAIL_STATUS_LOGIN_LEN));
+    }
+
+    if (s->proxy == NULL) {
+        return;
+    }
+
+    peer = &s->proxy->upstream;
+
+    if (peer->name) {
+        st->backend_len = ngx_min(peer->name->len, NGX_SOCKADDR_STRLEN);
+        ngx_memcpy(st->backend, peer->name->data, st->backend_len);
+    }
+
+    if (peer->connection) {
+        st->upstream_sent = peer->connection->sent;
+    }
+}
+
+
+static void
+ngx_mail_status_handler(ngx_event_t *ev)
+{
+    ngx_mail_conf_ctx_t          *ctx;
+    ngx_mail_core_main_conf_t    *cmcf;
+    ngx_mail_status_main_conf_t  *smcf;
+
+    ctx = (ngx_mail_conf_ctx_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                               ngx_mail_module);
+
+    cmcf = ctx->main_conf[ngx_mail_core_module.ctx_index];
+    smcf = ctx->main_conf[ngx_mail_status_module.ctx_index];
+
+    if (smcf->session_zone) {
+        ngx_mail_status_refresh(smcf);
+    }
+
+    if (smcf->shm_zone || ngx_mail_status_dump != ngx_dump) {
+
+        ngx_mail_status_collect(cmcf);
+
+        if (ngx_mail_status_dump != ngx_dump) {
+            ngx_mail_status_dump = ngx_dump;
+            ngx_mail_status_log(ev->log, cmcf);
+        }
+
+        /* the old workers leave their slots to the new ones */
+
+        if (smcf->shm_zone && !ngx_exiting) {
+            ngx_mail_status_publish(smcf, cmcf->servers.nelts);
+        }
+    }
+
+    ngx_add_timer(ev, NGX_MAIL_STATUS_INTERVAL);
+}
+
+
+static void
+ngx_mail_status_refresh(ngx_mail_status_main_conf_t *smcf)
+{
+    ngx_uint_t                  kill;
+    ngx_queue_t                *q, *next;
+    ngx_mail_session_t         *s;
+    ngx_mail_status_session_t  *st;
+
+    kill = 0;
+
+    ngx_shmtx_lock(&smcf->sshpool->mutex);
+
+    for (q = ngx_queue_head(&ngx_mail_status_sessions);
+         q != ngx_queue_sentinel(&ngx_mail_status_sessions);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_mail_session_t, queue);
+
+        st = s->status;
+
+        if (st == NULL) {
+            continue;
+        }
+
+        /* a pending auth or resolver request still refers to the session */
+
+        if (st->kill
+            && s->resolver_ctx == NULL
+            && !ngx_mail_auth_http_pending(s))
+        {
+            ngx_queue_remove(&st->queue);
+            smcf->ssh->count--;
+
+            ngx_slab_free_locked(smcf->sshpool, st);
+
+            s->status = NULL;
+            s->killed = 1;
+            kill = 1;
+
+            continue;
+        }
+
+        ngx_mail_status_copy_session(s, st);
+    }
+
+    ngx_shmtx_unlock(&smcf->sshpool->mutex);
+
+    if (!kill) {
+        return;
+    }
+
+    for (q = ngx_queue_head(&ngx_mail_status_sessions);
+         q != ngx_queue_sentinel(&ngx_mail_status_sessions);
+         q = next)
+    {
+        next = ngx_queue_next(q);
+
+        s = ngx_queue_data(q, ngx_mail_session_t, queue);
+
+        if (!s->killed) {
+            continue;
+        }
+
+        s->killed = 0;
+
+        s->connection->log->action = NULL;
+        ngx_log_error(NGX_LOG_INFO, s->connection->log, 0,
+                      "session terminated by request");
+
+        ngx_mail_close_connection(s->connection);
+    }
+}
+
+
+static void
+ngx_mail_status_collect(ngx_mail_core_main_conf_t *cmcf)
+{
+    ngx_queue_t               *q;
+    ngx_mail_session_t        *s;
+    ngx_mail_status_stat_t    *st;
+    ngx_mail_core_srv_conf_t  *cscf;
+
+    ngx_memzero(ngx_mail_status_stats, cmcf->servers.nelts * NGX_MAIL_PHASES
+                                       * sizeof(ngx_mail_status_stat_t));
+
+    for (q = ngx_queue_head(&ngx_mail_status_sessions);
+         q != ngx_queue_sentinel(&ngx_mail_status_sessions);
+         q = ngx_queue_next(q))
+    {
+        s = ngx_queue_data(q, ngx_mail_session_t, queue);
+
+        cscf = ngx_mail_get_module_srv_conf(s, ngx_mail_core_module);
+
+        st = &ngx_mail_status_stats[cscf->index * NGX_MAIL_PHASES + s->phase];
+
+        st->sessions++;
+
+        /* the protocol and proxy buffers are allocated from c->pool */
+
+        ngx_pool_stat(s->connection->pool, &st->pool);
+        ngx_mail_auth_http_pool_stat(s, &st->pool);
+    }
+}
+
+
+static void
+ngx_mail_status_log(ngx_log_t *log, ngx_mail_core_main_conf_t *cmcf)
+{
+    size_t                     size;
+    ngx_uint_t                 i, n, sessions;
+    ngx_pool_cache_stat_t      pc;
+    ngx_mail_status_stat_t    *st;
+    ngx_mail_core_srv_conf_t  **cscfp;
+
+    cscfp = cmcf->servers.elts;
+
+    size = 0;
+    sessions = 0;
+
+    for (i = 0; i < cmcf->servers.nelts; i++) {
+        for (n = 0; n < NGX_MAIL_PHASES; n++) {
+
+            st = &ngx_mail_status_stats[i * NGX_MAIL_PHASES + n];
+
+            if (st->sessions == 0) {
+                continue;
+            }
+
+            sessions += st->sessions;
+            size += st->pool.size + st->pool.large_size;
+
+            ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                          "mail server \"%V\" in %s:%ui, %V: "
+                          "%ui sessions, %ui blocks of %uz bytes, "
+                          "%uz used, %ui large of %uz bytes",
+                          &cscfp[i]->server_name, cscfp[i]->file_name,
+                          cscfp[i]->line, &ngx_mail_status_phases[n],
+                          st->sessions, st->pool.blocks, st->pool.size,
+                          st->pool.used, st->pool.large,
+                          st->pool.large_size);
+        }
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "mail sessions: %ui, pool memory: %uz bytes",
+                  sessions, size);
+
+    ngx_pool_cache_stat(&pc);
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "pool cache: %ui hits, %ui misses, %ui full, "
+                  "%ui blocks of %uz bytes",
+                  pc.hits, pc.misses, pc.full, pc.blocks, pc.size);
+}
+
+
+static void
+ngx_mail_status_publish(ngx_mail_status_main_conf_t *smcf,
+    ngx_uint_t nservers)
+{
+    size_t                     size;
+    ngx_mail_status_worker_t  *w;
+
+    size = sizeof(ngx_mail_status_worker_t)
+           + (nservers * NGX_MAIL_PHASES - 1) * sizeof(ngx_mail_status_stat_t);
+
+    ngx_shmtx_lock(&smcf->shpool->mutex);
+
+    w = smcf->sh->workers[ngx_worker];
+
+    if (w && w->nservers != nservers) {
+        ngx_slab_free_locked(smcf->shpool, w);
+        w = NULL;
+    }
+
+    if (w == NULL) {
+        w = ngx_slab_alloc_locked(smcf->shpool, size);
+
+        smcf->sh->workers[ngx_worker] = w;
+
+        if (w == NULL) {
+            ngx_shmtx_unlock(&smcf->shpool->mutex);
+            return;
+        }
+
+        w->nservers = nservers;
+    }
+
+    w->pid = ngx_pid;
+    w->updated = ngx_time();
+
+    ngx_memcpy(w->stat, ngx_mail_status_stats,
+               nservers * NGX_MAIL_PHASES * sizeof(ngx_mail_status_stat_t));
+
+    ngx_shmtx_unlock(&smcf->shpool->mutex);
+}
+
+
+ngx_int_t
+ngx_mail_status_report(ngx_pool_t *pool, ngx_buf_t **bp)
+{
+    size_t                        size, len;
+    ngx_buf_t                    *b;
+    ngx_uint_t                    i, j, n, sessions;
+    ngx_core_conf_t              *ccf;
+    ngx_mail_conf_ctx_t          *ctx;
+    ngx_mail_status_stat_t       *st;
+    ngx_mail_status_worker_t     *w;
+    ngx_mail_core_srv_conf_t    **cscfp;
+    ngx_mail_core_main_conf_t    *cmcf;
+    ngx_mail_status_main_conf_t  *smcf;
+
+    ctx = (ngx_mail_conf_ctx_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                               ngx_mail_module);
+    if (ctx == NULL) {
+        return NGX_DECLINED;
+    }
+
+    smcf = ctx->main_conf[ngx_mail_status_module.ctx_index];
+
+    if (smcf->shm_zone == NULL) {
+        return NGX_DECLINED;
+    }
+
+    cmcf = ctx->main_conf[ngx_mail_core_module.ctx_index];
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                           ngx_core_module);
+
+    cscfp = cmcf->servers.elts;
+
+    len = 0;
+
+    for (i = 0; i < cmcf->servers.nelts; i++) {
+        len += sizeof("server \"\" : proxy sessions  blocks  size  used "
+                      " large  large_size \n") - 1
+               + cscfp[i]->server_name.len + ngx_strlen(cscfp[i]->file_name)
+               + 3 * NGX_INT_T_LEN + 4 * NGX_SIZE_T_LEN;
+    }
+
+    /* the core statistics follow the mail ones */
+
+    size = sizeof("Active mail sessions:  \n") + NGX_INT_T_LEN
+           + ccf->worker_processes
+             * (sizeof("mail worker  pid  updated \n") - 1
+                + 2 * NGX_INT_T_LEN + NGX_TIME_T_LEN
+                + NGX_MAIL_PHASES * len)
+           + ngx_event_stat_len((ngx_cycle_t *) ngx_cycle);
+
+    b = ngx_create_temp_buf(pool, size);
+    if (b == NULL) {
+        return NGX_ERROR;
+    }
+
+    sessions = 0;
+
+    ngx_shmtx_lock(&smcf->shpool->mutex);
+
+    for (i = 0; i < (ngx_uint_t) ccf->worker_processes; i++) {
+
+        w = smcf->sh->workers[i];
+
+        if (w == NULL || w->nservers != cmcf->servers.nelts) {
+            continue;
+        }
+
+        for (j = 0; j < w->nservers * NGX_MAIL_PHASES; j++) {
+            sessions += w->stat[j].sessions;
+        }
+    }
+
+    b->last = ngx_sprintf(b->last, "Active mail sessions: %ui \n", sessions);
+
+    for (i = 0; i < (ngx_uint_t) ccf->worker_processes; i++) {
+
+        w = smcf->sh->workers[i];
+
+        if (w == NULL || w->nservers != cmcf->servers.nelts) {
+            continue;
+        }
+
+        b->last = ngx_sprintf(b->last, "mail worker %ui pid %P updated %T\n",
+                              i, w->pid, w->updated);
+
+        for (j = 0; j < w->nservers; j++) {
+            for (n = 0; n < NGX_MAIL_PHASES; n++) {
+
+                st = &w->stat[j * NGX_MAIL_PHASES + n];
+
+                b->last = ngx_sprintf(b->last,
+                                      "server \"%V\" %s:%ui %V sessions %ui "
+                                      "blocks %ui size %uz used %uz "
+                                      "large %ui large_size %uz\n",
+                                      &cscfp[j]->server_name,
+                                      cscfp[j]->file_name, cscfp[j]->line,
+                                      &ngx_mail_status_phases[n],
+                                      st->sessions, st->pool.blocks,
+                                      st->pool.size, st->pool.used,
+                                      st->pool.large, st->pool.large_size);
+            }
+        }
+    }
+
+    ngx_shmtx_unlock(&smcf->shpool->mutex);
+
+    b->last = ngx_event_stat_print(b->last, (ngx_cycle_t *) ngx_cycle);
+
+    *bp = b;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_mail_status_list_sessions(ngx_pool_t *pool, ngx_buf_t **bp)
+{
+    size_t                        size;
+    ngx_buf_t                    *b;
+    ngx_queue_t                  *q;
+    ngx_mail_conf_ctx_t          *ctx;
+    ngx_mail_status_session_t    *st;
+    ngx_mail_status_main_conf_t  *smcf;
+
+    ctx = (ngx_mail_conf_ctx_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                               ngx_mail_module);
+    if (ctx == NULL) {
+        return NGX_DECLINED;
+    }
+
+    smcf = ctx->main_conf[ngx_mail_status_module.ctx_index];
+
+    if (smcf->session_zone == NULL) {
+        return NGX_DECLINED;
+    }
+
+    ngx_shmtx_lock(&smcf->sshpool->mutex);
+
+    /* logins are escaped, so they can be passed back to kill */
+
+    size = sizeof("Mail sessions: \n") + NGX_INT_T_LEN
+           + smcf->ssh->count
+             * (sizeof("id  pid  start  protocol pop3 state proxy client  "
+                       "login \"\"... backend  to_client  to_upstream \n") - 1
+                + NGX_ATOMIC_T_LEN + NGX_INT_T_LEN + NGX_TIME_T_LEN
+                + 2 * NGX_SOCKADDR_STRLEN + 3 * NGX_MAIL_STATUS_LOGIN_LEN
+                + 2 * NGX_OFF_T_LEN);
+
+    b = ngx_create_temp_buf(pool, size);
+    if (b == NULL) {
+        ngx_shmtx_unlock(&smcf->sshpool->mutex);
+        return NGX_ERROR;
+    }
+
+    b->last = ngx_sprintf(b->last, "Mail sessions: %ui\n", smcf->ssh->count);
+
+    for (q = ngx_queue_head(&smcf->ssh->sessions);
+         q != ngx_queue_sentinel(&smcf->ssh->sessions);
+         q = ngx_queue_next(q))
+    {
+        st = ngx_queue_data(q, ngx_mail_status_session_t, queue);
+
+        b->last = ngx_sprintf(b->last,
+                              "id %uA pid %P start %T protocol %V state %V "
+                              "client %*s login \"",
+                              st->id, st->pid, st->start,
+                              &ngx_mail_status_protocols[st->protocol],
+                              &ngx_mail_status_phases[st->phase],
+                              st->client_len, st->client);
+
+        b->last = (u_char *) ngx_escape_uri(b->last, st->login,
+                                            ngx_min(st->login_len,
+                                                    NGX_MAIL_STATUS_LOGIN_LEN),
+                                            NGX_ESCAPE_MAIL_AUTH);
+
+        /* a long login is shown truncated, it is killed by its full form */
+
+        if (st->login_len > NGX_MAIL_STATUS_LOGIN_LEN) {
+            b->last = ngx_cpymem(b->last, "\"...", sizeof("\"...") - 1);
+
+        } else {
+            *b->last++ = '"';
+        }
+
+        b->last = ngx_sprintf(b->last,
+                              " backend %*s to_client %O to_upstream %O\n",
+                              st->backend_len, st->backend,
+                              st->client_sent, st->upstream_sent);
+    }
+
+    ngx_shmtx_unlock(&smcf->sshpool->mutex);
+
+    *bp = b;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_mail_status_kill(ngx_atomic_uint_t id, ngx_str_t *login, ngx_uint_t *n)
+{
+    uint32_t                      hash;
+    ngx_queue_t                  *q;
+    ngx_mail_conf_ctx_t          *ctx;
+    ngx_mail_status_session_t    *st;
+    ngx_mail_status_main_conf_t  *smcf;
+
+    ctx = (ngx_mail_conf_ctx_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                               ngx_mail_module);
+    if (ctx == NULL) {
+        return NGX_DECLINED;
+    }
+
+    smcf = ctx->main_conf[ngx_mail_status_module.ctx_index];
+
+    if (smcf->session_zone == NULL) {
+        return NGX_DECLINED;
+    }
+
+    *n = 0;
+
+    hash = login ? ngx_crc32_long(login->data, login->len) : 0;
+
+    ngx_shmtx_lock(&smcf->sshpool->mutex);
+
+    for (q = ngx_queue_head(&smcf->ssh->sessions);
+         q != ngx_queue_sentinel(&smcf->ssh->sessions);
+         q = ngx_queue_next(q))
+    {
+        st = ngx_queue_data(q, ngx_mail_status_session_t, queue);
+
+        if (login) {
+            if (login->len != st->login_len
+                || hash != st->login_hash
+                || ngx_strncmp(login->data, st->login,
+                               ngx_min(st->login_len,
+                                       NGX_MAIL_STATUS_LOGIN_LEN))
+                   != 0)
+            {
+                continue;
+            }
+
+        } else if (st->id != id) {
+            continue;
+        }
+
+        /* the owning worker closes the session on its next pass */
+
+        st->kill = 1;
+        (*n)++;
+    }
+
+    ngx_shmtx_unlock(&smcf->sshpool->mutex);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_mail_status_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_mail_status_main_conf_t  *osmcf = data;
+
+    size_t                        len;
+    ngx_mail_status_main_conf_t  *smcf;
+
+    smcf = shm_zone->data;
+
+    if (osmcf) {
+        smcf->sh = osmcf->sh;
+        smcf->shpool = osmcf->shpool;
+
+        return NGX_OK;
+    }
+
+    smcf->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        smcf->sh = smcf->shpool->data;
+
+        return NGX_OK;
+    }
+
+    smcf->sh = ngx_slab_calloc(smcf->shpool, sizeof(ngx_mail_status_shctx_t));
+    if (smcf->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    smcf->shpool->data = smcf->sh;
+
+    len = sizeof(" in mail status zone \"\"") + shm_zone->shm.name.len;
+
+    smcf->shpool->log_ctx = ngx_slab_alloc(smcf->shpool, len);
+    if (smcf->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(smcf->shpool->log_ctx, " in mail status zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_mail_status_init_session_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_mail_status_main_conf_t  *osmcf = data;
+
+    size_t                        len;
+    ngx_mail_status_main_conf_t  *smcf;
+
+    smcf = shm_zone->data;
+
+    if (osmcf) {
+        smcf->ssh = osmcf->ssh;
+        smcf->sshpool = osmcf->sshpool;
+
+        return NGX_OK;
+    }
+
+    smcf->sshpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        smcf->ssh = smcf->sshpool->data;
+
+        return NGX_OK;
+    }
+
+    smcf->ssh = ngx_slab_alloc(smcf->sshpool,
+                               sizeof(ngx_mail_status_session_shctx_t));
+    if (smcf->ssh == NULL) {
+        return NGX_ERROR;
+    }
+
+    smcf->sshpool->data = smcf->ssh;
+
+    ngx_queue_init(&smcf->ssh->sessions);
+    smcf->ssh->count = 0;
+
+    len = sizeof(" in mail session zone \"\"") + shm_zone->shm.name.len;
+
+    smcf->sshpool->log_ctx = ngx_slab_alloc(smcf->sshpool, len);
+    if (smcf->sshpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(smcf->sshpool->log_ctx, " in mail session zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_mail_status_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_mail_status_main_conf_t  *smcf;
+
+    smcf = ngx_pcalloc(cf->pool, sizeof(ngx_mail_status_main_conf_t));
+    if (smcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     smcf->shm_zone = NULL;
+     *     smcf->sh = NULL;
+     *     smcf->shpool = NULL;
+     *     smcf->session_zone = NULL;
+     *     smcf->ssh = NULL;
+     *     smcf->sshpool = NULL;
+     */
+
+    return smcf;
+}
+
+
+static char *
+ngx_mail_status_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_mail_status_main_conf_t *smcf = conf;
+
+    ngx_str_t  *value;
+
+    if (smcf->shm_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    smcf->shm_zone = ngx_mail_status_add_zone(cf, &value[1],
+                                              &ngx_mail_status_module);
+    if (smcf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    smcf->shm_zone->init = ngx_mail_status_init_zone;
+    smcf->shm_zone->data = smcf;
+
+    ngx_event_stat_enable(cf);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_mail_status_session_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_mail_status_main_conf_t *smcf = conf;
+
+    ngx_str_t  *value;
+
+    if (smcf->session_zone) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    smcf->session_zone = ngx_mail_status_add_zone(cf, &value[1],
+                                                  &ngx_mail_status_sessions);
+    if (smcf->session_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    smcf->session_zone->init = ngx_mail_status_init_session_zone;
+    smcf->session_zone->data = smcf;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_shm_zone_t *
+ngx_mail_status_add_zone(ngx_conf_t *cf, ngx_str_t *value, void *tag)
+{
+    u_char     *p;
+    ssize_t     size;
+    ngx_str_t   name, s;
+
+    p = (u_char *) ngx_strchr(value->data, ':');
+
+    if (p == NULL) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", value);
+        return NULL;
+    }
+
+    name.data = value->data;
+    name.len = p - name.data;
+
+    s.data = p + 1;
+    s.len = value->data + value->len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (size == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid zone size \"%V\"", value);
+        return NULL;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", value);
+        return NULL;
+    }
+
+    return ngx_shared_memory_add(cf, &name, size, tag);
+}
+
+
+static ngx_int_t
+ngx_mail_status_init_process(ngx_cycle_t *cycle)
+{
+    ngx_mail_conf_ctx_t        *ctx;
+    ngx_mail_core_main_conf_t  *cmcf;
+
+    ngx_queue_init(&ngx_mail_status_sessions);
+
+    ctx = (ngx_mail_conf_ctx_t *) ngx_get_conf(cycle->conf_ctx,
+                                               ngx_mail_module);
+    if (ctx == NULL) {
+        return NGX_OK;
+    }
+
+    cmcf = ctx->main_conf[ngx_mail_core_module.ctx_index];
+
+    if (cmcf->servers.nelts == 0) {
+        return NGX_OK;
+    }
+
+    ngx_mail_status_stats = ngx_pcalloc(cycle->pool,
+                                        cmcf->servers.nelts * NGX_MAIL_PHASES
+                                        * sizeof(ngx_mail_status_stat_t));
+    if (ngx_mail_status_stats == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_mail_status_dump = ngx_dump;
+
+    ngx_mail_status_event.handler = ngx_mail_status_handler;
+    ngx_mail_status_event.data = &ngx_mail_status_dumb;
+    ngx_mail_status_event.log = cycle->log;
+    ngx_mail_status_event.cancelable = 1;
+
+    ngx_mail_status_dumb.fd = (ngx_socket_t) -1;
+
+    ngx_add_timer(&ngx_mail_status_event, NGX_MAIL_STATUS_INTERVAL);
+
+    return NGX_OK;
+}
@@ -0,0 +1,97 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#ifndef _NGX_MAIL_STATUS_H_INCLUDED_
+#define _NGX_MAIL_STATUS_H_INCLUDED_
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_mail.h>
+
+
+typedef struct {
+    ngx_uint_t                  sessions;
+    ngx_pool_stat_t             pool;
+} ngx_mail_status_stat_t;
+
+
+typedef struct {
+    ngx_pid_t                   pid;
+    time_t                      updated;
+    ngx_uint_t                  nservers;
+
+    /* nservers * NGX_MAIL_PHASES entries */
+    ngx_mail_status_stat_t      stat[1];
+} ngx_mail_status_worker_t;
+
+
+typedef struct {
+    ngx_mail_status_worker_t   *workers[NGX_MAX_PROCESSES];
+} ngx_mail_status_shctx_t;
+
+
+#define NGX_MAIL_STATUS_LOGIN_LEN  64
+
+
+struct ngx_mail_status_session_s {
+    ngx_queue_t                 queue;
+
+    ngx_atomic_uint_t           id;
+    ngx_pid_t                   pid;
+    time_t                      start;
+
+    ngx_uint_t                  protocol;
+    ngx_uint_t                  phase;
+    ngx_uint_t                  kill;
+
+    off_t                       client_sent;
+    off_t                       upstream_sent;
+
+    size_t                      client_len;
+    u_char                      client[NGX_SOCKADDR_STRLEN];
+
+    size_t                      backend_len;
+    u_char                      backend[NGX_SOCKADDR_STRLEN];
+
+    /*
+     * only the first NGX_MAIL_STATUS_LOGIN_LEN bytes are kept,
+     * the full length and hash identify long logins
+     */
+    size_t                      login_len;
+    uint32_t                    login_hash;
+    u_char                      login[NGX_MAIL_STATUS_LOGIN_LEN];
+};
+
+
+typedef struct {
+    ngx_queue_t                 sessions;
+    ngx_uint_t                  count;
+} ngx_mail_status_session_shctx_t;
+
+
+typedef struct {
+    ngx_shm_zone_t             *shm_zone;
+    ngx_mail_status_shctx_t    *sh;
+    ngx_slab_pool_t            *shpool;
+
+    ngx_shm_zone_t             *session_zone;
+    ngx_mail_status_session_shctx_t  *ssh;
+    ngx_slab_pool_t            *sshpool;
+} ngx_mail_status_main_conf_t;
+
+
+ngx_int_t ngx_mail_status_report(ngx_pool_t *pool, ngx_buf_t **bp);
+ngx_int_t ngx_mail_status_list_sessions(ngx_pool_t *pool, ngx_buf_t **bp);
+ngx_int_t ngx_mail_status_kill(ngx_atomic_uint_t id, ngx_str_t *login,
+    ngx_uint_t *n);
+
+
+extern ngx_module_t  ngx_mail_status_module;
+
+
+#endif /* _NGX_MAIL_STATUS_H_INCLUDED_ */
@@ -135,6 +135,9 @@ ngx_thread_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
 
     task->handler = ngx_thread_read_handler;
 
+    /* a client waits for the data, unlike for temporary file writes */
+    task->priority = NGX_THREAD_TASK_HIGH;
+
     ctx->write = 0;
 
     ctx->fd = file->fd;
@@ -518,6 +521,7 @@ ngx_thread_write_chain_to_file(ngx_file_t *file, ngx_chain_t *cl, off_t offset,
     }
 
     task->handler = ngx_thread_write_chain_to_file_handler;
+    task->priority = NGX_THREAD_TASK_NORMAL;
 
     ctx->write = 1;
 
@@ -13,4 +13,49 @@ ngx_chain_t *ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in,
     off_t limit);
 
 
+#if (NGX_HAVE_MSG_ZEROCOPY)
+
+#define NGX_LINUX_ZEROCOPY_SEGMENTS  64
+
+
+typedef struct {
+    size_t                          len;
+    uint32_t                        id;
+    unsigned                        zerocopy:1;
+    unsigned                        done:1;
+} ngx_linux_zerocopy_segment_t;
+
+
+/*
+ * the bytes of a connection sent with MSG_ZEROCOPY are reported as sent
+ * only after the kernel has released them, so the caller keeps its buffer
+ * until then and passes the same data again with the following calls
+ */
+
+typedef struct {
+    size_t                          threshold;
+
+    /* the bytes in the segments, from the start of the caller's data */
+    size_t                          sent;
+
+    /* the notification id of the next MSG_ZEROCOPY send */
+    uint32_t                        id;
+
+    ngx_uint_t                      head;
+    ngx_uint_t                      nsegments;
+    ngx_linux_zerocopy_segment_t    segments[NGX_LINUX_ZEROCOPY_SEGMENTS];
+
+    ngx_uint_t                      zerocopied;
+    ngx_uint_t                      copied;
+} ngx_linux_zerocopy_t;
+
+
+ngx_int_t ngx_linux_zerocopy_init(ngx_connection_t *c,
+    ngx_linux_zerocopy_t *zc, size_t threshold);
+ssize_t ngx_linux_zerocopy_send(ngx_connection_t *c, ngx_linux_zerocopy_t *zc,
+    u_char *buf, size_t size);
+
+#endif
+
+
 #endif /* _NGX_LINUX_H_INCLUDED_ */
@@ -89,6 +89,11 @@ extern ssize_t sendfile(int s, int fd, int32_t *offset, size_t size);
 #endif
 
 
+#if (NGX_HAVE_IO_URING)
+#include <linux/io_uring.h>
+#endif
+
+
 #if (NGX_HAVE_SYS_EVENTFD_H)
 #include <sys/eventfd.h>
 #endif
@@ -104,6 +109,31 @@ typedef struct iocb  ngx_aiocb_t;
 #endif
 
 
+#if (NGX_HAVE_FUTEX)
+#include <linux/futex.h>
+#endif
+
+
+#if (NGX_HAVE_UDP_SEGMENT)
+#include <netinet/udp.h>        /* UDP_SEGMENT */
+#endif
+
+
+#if (NGX_HAVE_MSG_ZEROCOPY)
+#include <linux/errqueue.h>     /* SO_EE_ORIGIN_ZEROCOPY */
+#endif
+
+
+#if (NGX_HAVE_REUSEPORT_CBPF)
+#include <linux/filter.h>       /* SKF_AD_CPU */
+#endif
+
+
+#if (NGX_HAVE_NUMA)
+#include <linux/mempolicy.h>    /* MPOL_PREFERRED */
+#endif
+
+
 #define NGX_LISTEN_BACKLOG        511
 
 
@@ -0,0 +1,323 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+
+
+#define NGX_NUMA_SYSFS  "/sys/devices/system/node/"
+
+
+static ngx_uint_t ngx_numa_node(ngx_numa_t *numa, ngx_cpuset_t *cpu_affinity);
+static ngx_int_t ngx_numa_read_list(char *name, ngx_cpuset_t *set,
+    ngx_log_t *log);
+
+
+ngx_int_t
+ngx_numa_init(ngx_pool_t *pool, ngx_log_t *log, ngx_numa_t **numa)
+{
+    char          name[NGX_MAX_PATH];
+    ngx_int_t     rc;
+    ngx_uint_t    i, n;
+    ngx_numa_t   *nm;
+    ngx_cpuset_t  nodes;
+
+    *numa = NULL;
+
+    rc = ngx_numa_read_list(NGX_NUMA_SYSFS "online", &nodes, log);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    if (rc == NGX_DECLINED || CPU_COUNT(&nodes) < 2) {
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "single NUMA node, \"worker_numa\" ignored");
+        return NGX_OK;
+    }
+
+    nm = ngx_pcalloc(pool, sizeof(ngx_numa_t));
+    if (nm == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < NGX_NUMA_MAX_NODES; i++) {
+
+        if (!CPU_ISSET(i, &nodes)) {
+            continue;
+        }
+
+        n = nm->nnodes;
+
+        ngx_sprintf((u_char *) name, NGX_NUMA_SYSFS "node%ui/cpulist%Z", i);
+
+        rc = ngx_numa_read_list(name, &nm->cpus[n], log);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        /* memory-only nodes cannot run workers */
+
+        if (rc == NGX_DECLINED || CPU_COUNT(&nm->cpus[n]) == 0) {
+            continue;
+        }
+
+        ngx_log_error(NGX_LOG_INFO, log, 0,
+                      "NUMA node %ui: %d cpus", i, CPU_COUNT(&nm->cpus[n]));
+
+        nm->node[n] = i;
+        nm->mask |= (uint64_t) 1 << i;
+        nm->nnodes++;
+    }
+
+    if (nm->nnodes < 2) {
+        ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                      "single NUMA node with cpus, \"worker_numa\" ignored");
+        return NGX_OK;
+    }
+
+    *numa = nm;
+
+    return NGX_OK;
+}
+
+
+void
+ngx_numa_set_worker(ngx_numa_t *numa, ngx_cpuset_t *cpu_affinity,
+    ngx_log_t *log)
+{
+    uint64_t    mask;
+    ngx_uint_t  n;
+
+    n = ngx_numa_node(numa, cpu_affinity);
+
+    if (n == numa->nnodes) {
+        return;
+    }
+
+    /*
+     * the policy only affects pages touched after this point,
+     * so connections, events and pools of the worker are allocated
+     * on its own node
+     */
+
+    mask = (uint64_t) 1 << numa->node[n];
+
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &mask,
+                NGX_NUMA_MAX_NODES + 1)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "set_mempolicy(%ui) failed", numa->node[n]);
+        return;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "set_mempolicy(): using NUMA node #%ui", numa->node[n]);
+}
+
+
+void
+ngx_numa_interleave(ngx_shm_t *shm, size_t size)
+{
+    if (shm->interleave == 0) {
+        return;
+    }
+
+    /* shared zones are accessed by all workers, spread them evenly */
+
+    if (syscall(SYS_mbind, shm->addr, size, MPOL_INTERLEAVE,
+                &shm->interleave, NGX_NUMA_MAX_NODES + 1, 0)
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
+                      "mbind(\"%V\", %uz) failed", &shm->name, size);
+    }
+}
+
+
+ngx_uint_t
+ngx_numa_stat(ngx_cycle_t *cycle, ngx_numa_stat_t *st)
+{
+    size_t            pages;
+    ngx_uint_t        i, n, k, nodes;
+    ngx_numa_t       *numa;
+    ngx_cpuset_t     *cpu_affinity;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_list_part_t  *part;
+    ngx_core_conf_t  *ccf;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    numa = ccf->numa;
+
+    if (numa == NULL) {
+        return 0;
+    }
+
+    for (n = 0; n < numa->nnodes; n++) {
+        st[n].node = numa->node[n];
+        st[n].cpus = CPU_COUNT(&numa->cpus[n]);
+        st[n].workers = 0;
+        st[n].shared = 0;
+    }
+
+    for (i = 0; i < (ngx_uint_t) ccf->worker_processes; i++) {
+        cpu_affinity = ngx_get_cycle_cpu_affinity(cycle, i);
+
+        if (cpu_affinity == NULL) {
+            continue;
+        }
+
+        n = ngx_numa_node(numa, cpu_affinity);
+
+        if (n < numa->nnodes) {
+            st[n].workers++;
+        }
+    }
+
+    /* the interleaved zone pages are spread evenly over the nodes */
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].shm.interleave == 0) {
+            continue;
+        }
+
+        nodes = 0;
+
+        for (n = 0; n < numa->nnodes; n++) {
+            if (shm_zone[i].shm.interleave & ((uint64_t) 1 << st[n].node)) {
+                nodes++;
+            }
+        }
+
+        if (nodes == 0) {
+            continue;
+        }
+
+        pages = shm_zone[i].shm.size / ngx_pagesize;
+
+        for (n = 0, k = 0; n < numa->nnodes; n++) {
+            if (shm_zone[i].shm.interleave & ((uint64_t) 1 << st[n].node)) {
+                st[n].shared += (pages / nodes + (k < pages % nodes ? 1 : 0))
+                                * ngx_pagesize;
+                k++;
+            }
+        }
+    }
+
+    return numa->nnodes;
+}
+
+
+static ngx_uint_t
+ngx_numa_node(ngx_numa_t *numa, ngx_cpuset_t *cpu_affinity)
+{
+    ngx_uint_t  i, n;
+
+    /* the node of the first cpu in the mask */
+
+    for (i = 0; i < CPU_SETSIZE; i++) {
+        if (CPU_ISSET(i, cpu_affinity)) {
+            break;
+        }
+    }
+
+    for (n = 0; n < numa->nnodes; n++) {
+        if (i < CPU_SETSIZE && CPU_ISSET(i, &numa->cpus[n])) {
+            break;
+        }
+    }
+
+    return n;
+}
+
+
+static ngx_int_t
+ngx_numa_read_list(char *name, ngx_cpuset_t *set, ngx_log_t *log)
+{
+    u_char     *p, *last;
+    ssize_t     n;
+    ngx_fd_t    fd;
+    ngx_uint_t  i, from, to;
+    u_char      buf[1024];
+
+    CPU_ZERO(set);
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_NOTICE, log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", name);
+        return NGX_DECLINED;
+    }
+
+    n = ngx_read_fd(fd, buf, sizeof(buf));
+
+    if (n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_read_fd_n " \"%s\" failed", name);
+    }
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name);
+    }
+
+    if (n == -1) {
+        return NGX_ERROR;
+    }
+
+    /* "0-3,8-11\n" */
+
+    p = buf;
+    last = buf + n;
+
+    while (p < last && *p != LF) {
+
+        for (from = 0; p < last && *p >= '0' && *p <= '9'; p++) {
+            from = from * 10 + (*p - '0');
+        }
+
+        to = from;
+
+        if (p < last && *p == '-') {
+            for (to = 0, p++; p < last && *p >= '0' && *p <= '9'; p++) {
+                to = to * 10 + (*p - '0');
+            }
+        }
+
+        if ((p < last && *p != ',' && *p != LF) || to >= CPU_SETSIZE) {
+            ngx_log_error(NGX_LOG_EMERG, log, 0,
+                          "invalid list in \"%s\"", name);
+            return NGX_ERROR;
+        }
+
+        for (i = from; i <= to; i++) {
+            CPU_SET(i, set);
+        }
+
+        if (p < last && *p == ',') {
+            p++;
+        }
+    }
+
+    return NGX_OK;
+}
@@ -331,6 +331,7 @@ ngx_linux_sendfile_thread(ngx_connection_t *c, ngx_buf_t *file, size_t size)
         }
 
         task->handler = ngx_linux_sendfile_thread_handler;
+        task->priority = NGX_THREAD_TASK_HIGH;
 
         c->sendfile_task = task;
     }
@@ -0,0 +1,277 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+static void ngx_linux_zerocopy_complete(ngx_connection_t *c,
+    ngx_linux_zerocopy_t *zc);
+static size_t ngx_linux_zerocopy_done(ngx_linux_zerocopy_t *zc);
+
+
+ngx_int_t
+ngx_linux_zerocopy_init(ngx_connection_t *c, ngx_linux_zerocopy_t *zc,
+    size_t threshold)
+{
+    int  one;
+
+    one = 1;
+
+    if (setsockopt(c->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(int)) == -1) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, c->log, ngx_socket_errno,
+                       "setsockopt(SO_ZEROCOPY) failed");
+        return NGX_DECLINED;
+    }
+
+    ngx_memzero(zc, sizeof(ngx_linux_zerocopy_t));
+
+    zc->threshold = threshold;
+
+    return NGX_OK;
+}
+
+
+ssize_t
+ngx_linux_zerocopy_send(ngx_connection_t *c, ngx_linux_zerocopy_t *zc,
+    u_char *buf, size_t size)
+{
+    int                            flags;
+    size_t                         len, done;
+    ssize_t                        n;
+    ngx_err_t                      err;
+    ngx_event_t                   *wev;
+    ngx_linux_zerocopy_segment_t  *seg;
+
+    if (zc->nsegments == 0 && size < zc->threshold) {
+        return ngx_unix_send(c, buf, size);
+    }
+
+    wev = c->write;
+    done = 0;
+
+    if (zc->nsegments) {
+        ngx_linux_zerocopy_complete(c, zc);
+        done = ngx_linux_zerocopy_done(zc);
+    }
+
+    /*
+     * the rest of the data is sent even if some was reported as done,
+     * otherwise the caller may wait for an event which never comes
+     */
+
+    if (done + zc->sent >= size
+        || zc->nsegments == NGX_LINUX_ZEROCOPY_SEGMENTS)
+    {
+        goto done;
+    }
+
+    len = size - done - zc->sent;
+    flags = (len >= zc->threshold) ? MSG_ZEROCOPY : 0;
+
+    for ( ;; ) {
+        n = send(c->fd, buf + done + zc->sent, len, flags);
+
+        ngx_log_debug5(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "send: fd:%d %z of %uz zerocopy:%d in flight:%uz",
+                       c->fd, n, len, flags != 0, zc->sent);
+
+        if (n > 0) {
+            break;
+        }
+
+        err = ngx_socket_errno;
+
+        if (n == 0) {
+            ngx_log_error(NGX_LOG_ALERT, c->log, err, "send() returned zero");
+            wev->ready = 0;
+            goto done;
+        }
+
+        if (err == NGX_EINTR) {
+            continue;
+        }
+
+        if (err == NGX_EAGAIN) {
+            wev->ready = 0;
+            goto done;
+        }
+
+        if (err == NGX_ENOBUFS && flags) {
+
+            /* the notifications exceed the socket option memory limit */
+
+            flags = 0;
+            continue;
+        }
+
+        wev->error = 1;
+        (void) ngx_connection_error(c, err, "send() failed");
+        return NGX_ERROR;
+    }
+
+    c->sent += n;
+
+    if ((size_t) n < len) {
+        wev->ready = 0;
+    }
+
+    seg = &zc->segments[(zc->head + zc->nsegments)
+                        % NGX_LINUX_ZEROCOPY_SEGMENTS];
+
+    seg->len = n;
+    seg->zerocopy = flags ? 1 : 0;
+    seg->done = flags ? 0 : 1;
+
+    if (flags) {
+        seg->id = zc->id++;
+        zc->zerocopied++;
+    }
+
+    zc->nsegments++;
+    zc->sent += n;
+
+    done += ngx_linux_zerocopy_done(zc);
+
+done:
+
+    if (done) {
+        return done;
+    }
+
+    /* the completions are reported with EPOLLERR */
+
+    wev->ready = 0;
+    return NGX_AGAIN;
+}
+
+
+static void
+ngx_linux_zerocopy_complete(ngx_connection_t *c, ngx_linux_zerocopy_t *zc)
+{
+    uint32_t                       lo, hi;
+    ssize_t                        n;
+    ngx_err_t                      err;
+    ngx_uint_t                     i;
+    struct msghdr                  msg;
+    struct cmsghdr                *cmsg;
+    struct sock_extended_err      *serr;
+    ngx_linux_zerocopy_segment_t  *seg;
+
+    union {
+        struct cmsghdr             cm;
+        u_char                     buf[CMSG_SPACE(
+                                           sizeof(struct sock_extended_err)
+                                           + sizeof(struct sockaddr_in6))];
+    } control;
+
+    for ( ;; ) {
+        ngx_memzero(&msg, sizeof(struct msghdr));
+
+        msg.msg_control = &control;
+        msg.msg_controllen = sizeof(control);
+
+        n = recvmsg(c->fd, &msg, MSG_ERRQUEUE);
+
+        if (n == -1) {
+            err = ngx_socket_errno;
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            if (err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, c->log, err,
+                              "recvmsg(MSG_ERRQUEUE) failed");
+            }
+
+            return;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&msg);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR(&msg, cmsg))
+        {
+            if (!(cmsg->cmsg_level == IPPROTO_IP
+                  && cmsg->cmsg_type == IP_RECVERR)
+                && !(cmsg->cmsg_level == IPPROTO_IPV6
+                     && cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                continue;
+            }
+
+            serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY
+                || serr->ee_errno != 0)
+            {
+                continue;
+            }
+
+            /* the ids from ee_info to ee_data are complete */
+
+            lo = serr->ee_info;
+            hi = serr->ee_data;
+
+            ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                           "zerocopy complete: fd:%d %uD-%uD",
+                           c->fd, lo, hi);
+
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                zc->copied += (uint32_t) (hi - lo) + 1;
+
+                /*
+                 * the kernel had to copy the data anyway, e.g., on loopback,
+                 * so waiting for the completions only slows the sender down
+                 */
+
+                zc->threshold = NGX_MAX_SIZE_T_VALUE;
+            }
+
+            for (i = 0; i < zc->nsegments; i++) {
+                seg = &zc->segments[(zc->head + i)
+                                    % NGX_LINUX_ZEROCOPY_SEGMENTS];
+
+                if (seg->zerocopy
+                    && (uint32_t) (seg->id - lo) <= (uint32_t) (hi - lo))
+                {
+                    seg->done = 1;
+                }
+            }
+        }
+    }
+}
+
+
+/* the completed segments at the start are reported as sent */
+
+static size_t
+ngx_linux_zerocopy_done(ngx_linux_zerocopy_t *zc)
+{
+    size_t                         done;
+    ngx_linux_zerocopy_segment_t  *seg;
+
+    done = 0;
+
+    while (zc->nsegments) {
+        seg = &zc->segments[zc->head];
+
+        if (!seg->done) {
+            break;
+        }
+
+        done += seg->len;
+
+        zc->head = (zc->head + 1) % NGX_LINUX_ZEROCOPY_SEGMENTS;
+        zc->nsegments--;
+    }
+
+    zc->sent -= done;
+
+    return done;
+}
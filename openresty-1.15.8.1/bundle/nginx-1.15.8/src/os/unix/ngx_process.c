@@ -431,8 +431,12 @@ ngx_signal_handler(int signo, siginfo_t *siginfo, void *ucontext)
             action = ", reopening logs";
             break;
 
-        case ngx_signal_value(NGX_RECONFIGURE_SIGNAL):
         case ngx_signal_value(NGX_CHANGEBIN_SIGNAL):
+            ngx_dump++;
+            action = ", dumping statistics";
+            break;
+
+        case ngx_signal_value(NGX_RECONFIGURE_SIGNAL):
         case SIGIO:
             action = ", ignoring";
             break;
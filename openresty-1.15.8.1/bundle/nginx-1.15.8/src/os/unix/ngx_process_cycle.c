@@ -48,6 +48,13 @@ sig_atomic_t  ngx_reopen;
 
 sig_atomic_t  ngx_change_binary;
 ngx_pid_t     ngx_new_binary;
+
+/*
+ * incremented on each NGX_CHANGEBIN_SIGNAL received by a worker process;
+ * modules that keep statistics compare it with the last seen value
+ */
+
+sig_atomic_t  ngx_dump;
 ngx_uint_t    ngx_inherited;
 ngx_uint_t    ngx_daemonized;
 
@@ -383,11 +390,29 @@ ngx_single_process_cycle(ngx_cycle_t *cycle)
 static void
 ngx_start_worker_processes(ngx_cycle_t *cycle, ngx_int_t n, ngx_int_t type)
 {
-    ngx_int_t      i;
-    ngx_channel_t  ch;
+    ngx_int_t         i;
+    ngx_channel_t     ch;
+#if (NGX_HAVE_NUMA)
+    ngx_uint_t        k, nnodes;
+    ngx_numa_stat_t   numa[NGX_NUMA_MAX_NODES];
+#endif
 
     ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0, "start worker processes");
 
+#if (NGX_HAVE_NUMA)
+
+    nnodes = ngx_numa_stat(cycle, numa);
+
+    for (k = 0; k < nnodes; k++) {
+        ngx_log_error(NGX_LOG_NOTICE, cycle->log, 0,
+                      "NUMA node %ui: %ui cpus, %ui workers, "
+                      "%uz bytes of shared zones",
+                      numa[k].node, numa[k].cpus, numa[k].workers,
+                      numa[k].shared);
+    }
+
+#endif
+
     ngx_memzero(&ch, sizeof(ngx_channel_t));
 
     ch.command = NGX_CMD_OPEN_CHANNEL;
@@ -891,6 +916,10 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
         }
     }
 
+    /* the pools created from now on use the pool cache */
+
+    ngx_pool_cache_max = ccf->pool_cache;
+
     /*
      * privileged agent process has the same permission as master process
      */
@@ -953,6 +982,12 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
 
         if (cpu_affinity) {
             ngx_setaffinity(cpu_affinity, cycle->log);
+
+#if (NGX_HAVE_NUMA)
+            if (ccf->numa) {
+                ngx_numa_set_worker(ccf->numa, cpu_affinity, cycle->log);
+            }
+#endif
         }
     }
 
@@ -1047,6 +1082,8 @@ static void
 ngx_worker_process_exit(ngx_cycle_t *cycle)
 {
     ngx_uint_t         i;
+    ngx_list_part_t   *part;
+    ngx_shm_zone_t    *shm_zone;
     ngx_connection_t  *c;
 
     for (i = 0; cycle->modules[i]; i++) {
@@ -1055,6 +1092,25 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
         }
     }
 
+    /* return chunks cached by this worker to the shared zones */
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        ngx_slab_cache_flush((ngx_slab_pool_t *) shm_zone[i].shm.addr);
+    }
+
     if (ngx_exiting) {
         c = cycle->connections;
         for (i = 0; i < cycle->connection_n; i++) {
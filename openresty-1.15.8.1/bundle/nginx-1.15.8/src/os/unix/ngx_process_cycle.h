@@ -57,6 +57,7 @@ extern sig_atomic_t    ngx_noaccept;
 extern sig_atomic_t    ngx_reconfigure;
 extern sig_atomic_t    ngx_reopen;
 extern sig_atomic_t    ngx_change_binary;
+extern sig_atomic_t    ngx_dump;
 
 
 #endif /* _NGX_PROCESS_CYCLE_H_INCLUDED_ */
@@ -25,6 +25,34 @@ typedef cpuset_t  ngx_cpuset_t;
 
 void ngx_setaffinity(ngx_cpuset_t *cpu_affinity, ngx_log_t *log);
 
+#if (NGX_HAVE_NUMA)
+
+#define NGX_NUMA_MAX_NODES  64
+
+typedef struct {
+    ngx_uint_t    nnodes;
+    uint64_t      mask;
+    ngx_uint_t    node[NGX_NUMA_MAX_NODES];
+    ngx_cpuset_t  cpus[NGX_NUMA_MAX_NODES];
+} ngx_numa_t;
+
+
+typedef struct {
+    ngx_uint_t    node;
+    ngx_uint_t    cpus;
+    ngx_uint_t    workers;
+    size_t        shared;
+} ngx_numa_stat_t;
+
+
+ngx_int_t ngx_numa_init(ngx_pool_t *pool, ngx_log_t *log, ngx_numa_t **numa);
+void ngx_numa_set_worker(ngx_numa_t *numa, ngx_cpuset_t *cpu_affinity,
+    ngx_log_t *log);
+void ngx_numa_interleave(ngx_shm_t *shm, size_t size);
+ngx_uint_t ngx_numa_stat(ngx_cycle_t *cycle, ngx_numa_stat_t *st);
+
+#endif
+
 #else
 
 #define ngx_setaffinity(cpu_affinity, log)
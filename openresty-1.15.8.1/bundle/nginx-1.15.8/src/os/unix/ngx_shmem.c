@@ -11,9 +11,60 @@
 
 #if (NGX_HAVE_MAP_ANON)
 
+#if (NGX_LINUX && defined MAP_HUGETLB)
+static size_t ngx_shm_hugepage_size(ngx_log_t *log);
+#endif
+
+
 ngx_int_t
 ngx_shm_alloc(ngx_shm_t *shm)
 {
+#if (NGX_LINUX && defined MAP_HUGETLB)
+    size_t      size;
+    ngx_uint_t  level;
+
+    shm->hugetlb = 0;
+
+    /*
+     * "on" tries huge pages from the hugetlb pool for any zone,
+     * "auto" only for zones of at least one huge page; both fall back
+     * to regular pages, advised to be transparent huge pages, so the
+     * slab allocator sees the same ngx_pagesize layout either way
+     */
+
+    if (shm->hugepages != NGX_SHM_HUGEPAGES_OFF) {
+
+        size = ngx_shm_hugepage_size(shm->log);
+
+        if (shm->hugepages == NGX_SHM_HUGEPAGES_ON || shm->size >= size) {
+
+            shm->addr = (u_char *) mmap(NULL, ngx_align(shm->size, size),
+                                        PROT_READ|PROT_WRITE,
+                                        MAP_ANON|MAP_SHARED|MAP_HUGETLB,
+                                        -1, 0);
+
+            if (shm->addr != MAP_FAILED) {
+                shm->hugetlb = 1;
+
+#if (NGX_HAVE_NUMA)
+                ngx_numa_interleave(shm, ngx_align(shm->size, size));
+#endif
+
+                return NGX_OK;
+            }
+
+            level = (shm->hugepages == NGX_SHM_HUGEPAGES_ON) ? NGX_LOG_WARN
+                                                             : NGX_LOG_INFO;
+
+            ngx_log_error(level, shm->log, ngx_errno,
+                          "mmap(MAP_HUGETLB, %uz) failed for zone \"%V\", "
+                          "using regular pages",
+                          ngx_align(shm->size, size), &shm->name);
+        }
+    }
+
+#endif
+
     shm->addr = (u_char *) mmap(NULL, shm->size,
                                 PROT_READ|PROT_WRITE,
                                 MAP_ANON|MAP_SHARED, -1, 0);
@@ -24,6 +75,22 @@ ngx_shm_alloc(ngx_shm_t *shm)
         return NGX_ERROR;
     }
 
+#if (NGX_HAVE_NUMA)
+    ngx_numa_interleave(shm, shm->size);
+#endif
+
+#if (NGX_LINUX && defined MADV_HUGEPAGE)
+
+    if (shm->hugepages != NGX_SHM_HUGEPAGES_OFF
+        && madvise(shm->addr, shm->size, MADV_HUGEPAGE) == -1)
+    {
+        ngx_log_error(NGX_LOG_INFO, shm->log, ngx_errno,
+                      "madvise(MADV_HUGEPAGE) failed for zone \"%V\"",
+                      &shm->name);
+    }
+
+#endif
+
     return NGX_OK;
 }
 
@@ -31,12 +98,89 @@ ngx_shm_alloc(ngx_shm_t *shm)
 void
 ngx_shm_free(ngx_shm_t *shm)
 {
-    if (munmap((void *) shm->addr, shm->size) == -1) {
+    size_t  size;
+
+    size = shm->size;
+
+#if (NGX_LINUX && defined MAP_HUGETLB)
+
+    /* hugetlb mappings are unmapped in whole huge pages */
+
+    if (shm->hugetlb) {
+        size = ngx_align(size, ngx_shm_hugepage_size(shm->log));
+    }
+
+#endif
+
+    if (munmap((void *) shm->addr, size) == -1) {
         ngx_log_error(NGX_LOG_ALERT, shm->log, ngx_errno,
-                      "munmap(%p, %uz) failed", shm->addr, shm->size);
+                      "munmap(%p, %uz) failed", shm->addr, size);
+    }
+}
+
+
+#if (NGX_LINUX && defined MAP_HUGETLB)
+
+static size_t
+ngx_shm_hugepage_size(ngx_log_t *log)
+{
+    u_char           *p, *last;
+    ssize_t           n;
+    ngx_fd_t          fd;
+    ngx_int_t         kb;
+    u_char            buf[4096];
+
+    static size_t     size;
+
+    if (size) {
+        return size;
+    }
+
+    /* the default huge page size used by MAP_HUGETLB */
+
+    size = 2 * 1024 * 1024;
+
+    fd = ngx_open_file("/proc/meminfo", NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_INFO, log, ngx_errno,
+                      ngx_open_file_n " \"/proc/meminfo\" failed");
+        return size;
     }
+
+    n = ngx_read_fd(fd, buf, sizeof(buf) - 1);
+
+    if (ngx_close_file(fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"/proc/meminfo\" failed");
+    }
+
+    if (n <= 0) {
+        return size;
+    }
+
+    buf[n] = '\0';
+
+    p = (u_char *) ngx_strstr(buf, "Hugepagesize:");
+    if (p == NULL) {
+        return size;
+    }
+
+    for (p += sizeof("Hugepagesize:") - 1; *p == ' '; p++) { /* void */ }
+
+    for (last = p; *last >= '0' && *last <= '9'; last++) { /* void */ }
+
+    kb = ngx_atoi(p, last - p);
+
+    if (kb > 0) {
+        size = (size_t) kb * 1024;
+    }
+
+    return size;
 }
 
+#endif
+
 #elif (NGX_HAVE_MAP_DEVZERO)
 
 ngx_int_t
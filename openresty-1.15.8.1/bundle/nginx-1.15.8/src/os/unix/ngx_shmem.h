@@ -13,12 +13,20 @@
 #include <ngx_core.h>
 
 
+#define NGX_SHM_HUGEPAGES_OFF   0
+#define NGX_SHM_HUGEPAGES_ON    1
+#define NGX_SHM_HUGEPAGES_AUTO  2
+
+
 typedef struct {
     u_char      *addr;
     size_t       size;
     ngx_str_t    name;
     ngx_log_t   *log;
     ngx_uint_t   exists;   /* unsigned  exists:1;  */
+    ngx_uint_t   hugepages;
+    ngx_uint_t   hugetlb;  /* unsigned  hugetlb:1;  */
+    uint64_t     interleave;  /* NUMA nodes */
 } ngx_shm_t;
 
 
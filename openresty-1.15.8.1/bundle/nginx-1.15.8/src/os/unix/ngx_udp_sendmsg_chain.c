@@ -10,19 +10,40 @@
 #include <ngx_event.h>
 
 
+#if (NGX_HAVE_SENDMMSG)
+#define NGX_UDP_SEND_BATCH  32
+#else
+#define NGX_UDP_SEND_BATCH  1
+#endif
+
+
 static ngx_chain_t *ngx_udp_output_chain_to_iovec(ngx_iovec_t *vec,
     ngx_chain_t *in, ngx_log_t *log);
-static ssize_t ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec);
+static ngx_int_t ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec,
+    ngx_uint_t nvec);
+#if (NGX_HAVE_SENDMMSG && NGX_HAVE_UDP_SEGMENT)
+static size_t ngx_sendmsg_segment(ngx_connection_t *c, ngx_iovec_t *vec,
+    ngx_uint_t nvec);
+
+
+/* 65535 less the IPv4 and UDP headers */
+#define NGX_UDP_SEGMENT_MAX  65507
+
+
+/* -1: not yet known, 0: UDP_SEGMENT is not available, 1: available */
+static ngx_int_t  ngx_udp_segment = -1;
+#endif
 
 
 ngx_chain_t *
 ngx_udp_unix_sendmsg_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 {
-    ssize_t        n;
-    off_t          send;
-    ngx_chain_t   *cl;
+    off_t          send, size;
+    ngx_int_t      rc;
+    ngx_uint_t     i, nvec, niovs;
+    ngx_chain_t   *cl, *next;
     ngx_event_t   *wev;
-    ngx_iovec_t    vec;
+    ngx_iovec_t    vec[NGX_UDP_SEND_BATCH];
     struct iovec   iovs[NGX_IOVS_PREALLOCATE];
 
     wev = c->write;
@@ -50,58 +71,93 @@ ngx_udp_unix_sendmsg_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 
     send = 0;
 
-    vec.iovs = iovs;
-    vec.nalloc = NGX_IOVS_PREALLOCATE;
-
     for ( ;; ) {
 
-        /* create the iovec and coalesce the neighbouring bufs */
+        /*
+         * create the iovecs of the datagrams to send in one go,
+         * they share the iovs array
+         */
 
-        cl = ngx_udp_output_chain_to_iovec(&vec, in, c->log);
+        cl = in;
+        size = 0;
+        niovs = 0;
 
-        if (cl == NGX_CHAIN_ERROR) {
-            return NGX_CHAIN_ERROR;
-        }
+        for (nvec = 0; nvec < NGX_UDP_SEND_BATCH; nvec++) {
 
-        if (cl && cl->buf->in_file) {
-            ngx_log_error(NGX_LOG_ALERT, c->log, 0,
-                          "file buf in sendmsg "
-                          "t:%d r:%d f:%d %p %p-%p %p %O-%O",
-                          cl->buf->temporary,
-                          cl->buf->recycled,
-                          cl->buf->in_file,
-                          cl->buf->start,
-                          cl->buf->pos,
-                          cl->buf->last,
-                          cl->buf->file,
-                          cl->buf->file_pos,
-                          cl->buf->file_last);
+            if (niovs == NGX_IOVS_PREALLOCATE || send + size >= limit) {
+                break;
+            }
 
-            ngx_debug_point();
+            vec[nvec].iovs = &iovs[niovs];
+            vec[nvec].nalloc = NGX_IOVS_PREALLOCATE - niovs;
 
-            return NGX_CHAIN_ERROR;
+            /* create the iovec and coalesce the neighbouring bufs */
+
+            next = ngx_udp_output_chain_to_iovec(&vec[nvec], cl, c->log);
+
+            if (next == NGX_CHAIN_ERROR) {
+                return NGX_CHAIN_ERROR;
+            }
+
+            if (next && next->buf->in_file) {
+                ngx_log_error(NGX_LOG_ALERT, c->log, 0,
+                              "file buf in sendmsg "
+                              "t:%d r:%d f:%d %p %p-%p %p %O-%O",
+                              next->buf->temporary,
+                              next->buf->recycled,
+                              next->buf->in_file,
+                              next->buf->start,
+                              next->buf->pos,
+                              next->buf->last,
+                              next->buf->file,
+                              next->buf->file_pos,
+                              next->buf->file_last);
+
+                ngx_debug_point();
+
+                return NGX_CHAIN_ERROR;
+            }
+
+            if (next == cl) {
+                break;
+            }
+
+            niovs += vec[nvec].count;
+            size += vec[nvec].size;
+
+            cl = next;
+
+            if (cl == NULL) {
+                nvec++;
+                break;
+            }
         }
 
-        if (cl == in) {
+        if (nvec == 0) {
             return in;
         }
 
-        send += vec.size;
+        rc = ngx_sendmsg(c, vec, nvec);
 
-        n = ngx_sendmsg(c, &vec);
-
-        if (n == NGX_ERROR) {
+        if (rc == NGX_ERROR) {
             return NGX_CHAIN_ERROR;
         }
 
-        if (n == NGX_AGAIN) {
+        if (rc == NGX_AGAIN) {
             wev->ready = 0;
             return in;
         }
 
-        c->sent += n;
+        /* the number of datagrams sent */
+
+        for (size = 0, i = 0; i < (ngx_uint_t) rc; i++) {
+            size += vec[i].size;
+        }
 
-        in = ngx_chain_update_sent(in, n);
+        send += size;
+        c->sent += size;
+
+        in = ngx_chain_update_sent(in, size);
 
         if (send >= limit || in == NULL) {
             return in;
@@ -166,6 +222,12 @@ ngx_udp_output_chain_to_iovec(ngx_iovec_t *vec, ngx_chain_t *in, ngx_log_t *log)
 
         } else {
             if (n == vec->nalloc) {
+
+                if (vec->nalloc < NGX_IOVS_PREALLOCATE) {
+                    /* does not fit into a batch, will be sent separately */
+                    return cl;
+                }
+
                 ngx_log_error(NGX_LOG_ALERT, log, 0,
                               "too many parts in a datagram");
                 return NGX_CHAIN_ERROR;
@@ -196,12 +258,22 @@ ngx_udp_output_chain_to_iovec(ngx_iovec_t *vec, ngx_chain_t *in, ngx_log_t *log)
 }
 
 
-static ssize_t
-ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec)
+static ngx_int_t
+ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec, ngx_uint_t nvec)
 {
-    ssize_t        n;
-    ngx_err_t      err;
-    struct msghdr  msg;
+    ssize_t          n;
+    ngx_err_t        err;
+    struct msghdr    msg;
+
+#if (NGX_HAVE_SENDMMSG)
+    size_t           segment;
+    ngx_uint_t       i;
+    struct mmsghdr   mmsg[NGX_UDP_SEND_BATCH];
+#endif
+
+#if (NGX_HAVE_SENDMMSG && NGX_HAVE_UDP_SEGMENT)
+    u_char           msg_segment[CMSG_SPACE(sizeof(uint16_t))];
+#endif
 
 #if (NGX_HAVE_MSGHDR_MSG_CONTROL)
 
@@ -303,12 +375,72 @@ ngx_sendmsg(ngx_connection_t *c, ngx_iovec_t *vec)
 
 #endif
 
+#if (NGX_HAVE_SENDMMSG)
+
+    segment = 0;
+
+#if (NGX_HAVE_UDP_SEGMENT)
+
+    if (nvec > 1 && msg.msg_control == NULL) {
+        segment = ngx_sendmsg_segment(c, vec, nvec);
+    }
+
+    if (segment) {
+        struct cmsghdr  *cmsg;
+
+        /* the iovecs of a batch are contiguous */
+
+        for (i = 1; i < nvec; i++) {
+            msg.msg_iovlen += vec[i].count;
+        }
+
+        msg.msg_control = &msg_segment;
+        msg.msg_controllen = sizeof(msg_segment);
+
+        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+        *(uint16_t *) CMSG_DATA(cmsg) = (uint16_t) segment;
+    }
+
+#endif
+
+#endif
+
 eintr:
 
-    n = sendmsg(c->fd, &msg, 0);
+#if (NGX_HAVE_SENDMMSG)
+
+    if (nvec > 1 && segment == 0) {
+
+        for (i = 0; i < nvec; i++) {
+            mmsg[i].msg_hdr = msg;
+            mmsg[i].msg_hdr.msg_iov = vec[i].iovs;
+            mmsg[i].msg_hdr.msg_iovlen = vec[i].count;
+            mmsg[i].msg_len = 0;
+        }
+
+        n = sendmmsg(c->fd, mmsg, nvec, 0);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "sendmmsg: %z of %ui", n, nvec);
+
+    } else
+
+#endif
+    {
+        n = sendmsg(c->fd, &msg, 0);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                       "sendmsg: %z of %uz, %ui datagrams",
+                       n, vec->size, nvec);
 
-    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
-                   "sendmsg: %z of %uz", n, vec->size);
+        if (n != -1) {
+            n = nvec;
+        }
+    }
 
     if (n == -1) {
         err = ngx_errno;
@@ -325,6 +457,30 @@ eintr:
             goto eintr;
 
         default:
+
+#if (NGX_HAVE_SENDMMSG && NGX_HAVE_UDP_SEGMENT)
+
+            if (segment && (err == NGX_EIO || err == NGX_EINVAL)) {
+
+                /*
+                 * EIO: the device cannot offload checksums,
+                 * EINVAL: the segments do not fit into the path MTU
+                 */
+
+                ngx_log_debug1(NGX_LOG_DEBUG_EVENT, c->log, err,
+                               "sendmsg(UDP_SEGMENT) failed, "
+                               "sending %ui datagrams", nvec);
+
+                if (err == NGX_EIO) {
+                    ngx_udp_segment = 0;
+                }
+
+                segment = 0;
+                goto eintr;
+            }
+
+#endif
+
             c->write->error = 1;
             ngx_connection_error(c, err, "sendmsg() failed");
             return NGX_ERROR;
@@ -333,3 +489,68 @@ eintr:
 
     return n;
 }
+
+
+#if (NGX_HAVE_SENDMMSG && NGX_HAVE_UDP_SEGMENT)
+
+static size_t
+ngx_sendmsg_segment(ngx_connection_t *c, ngx_iovec_t *vec, ngx_uint_t nvec)
+{
+    int         value;
+    size_t      size, total;
+    ngx_uint_t  i;
+
+    /*
+     * the datagrams of a batch are sent as one buffer with UDP segmentation
+     * offload if all of them are of the same size, except for the last one
+     * which may be shorter
+     */
+
+    if (ngx_udp_segment == 0) {
+        return 0;
+    }
+
+    size = vec[0].size;
+    total = size;
+
+    for (i = 1; i < nvec; i++) {
+
+        if (vec[i].size == 0
+            || vec[i].size > size
+            || (vec[i].size < size && i != nvec - 1))
+        {
+            return 0;
+        }
+
+        total += vec[i].size;
+    }
+
+    if (size == 0 || total > NGX_UDP_SEGMENT_MAX) {
+        return 0;
+    }
+
+    if (ngx_udp_segment == -1) {
+
+        /* older kernels silently ignore the control message */
+
+        value = 0;
+
+        if (setsockopt(c->fd, IPPROTO_UDP, UDP_SEGMENT,
+                       (const void *) &value, sizeof(int))
+            == -1)
+        {
+            ngx_log_error(NGX_LOG_INFO, c->log, ngx_socket_errno,
+                          "setsockopt(UDP_SEGMENT) failed, "
+                          "UDP segmentation offload is not used");
+
+            ngx_udp_segment = 0;
+            return 0;
+        }
+
+        ngx_udp_segment = 1;
+    }
+
+    return size;
+}
+
+#endif
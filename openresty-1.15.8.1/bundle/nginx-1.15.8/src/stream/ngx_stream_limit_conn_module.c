@@ -159,7 +159,7 @@ ngx_stream_limit_conn_handler(ngx_stream_session_t *s)
             continue;
         }
 
-        hash = ngx_crc32_short(key.data, key.len);
+        hash = ngx_crc32c(key.data, key.len);
 
         shpool = (ngx_slab_pool_t *) limits[i].shm_zone->shm.addr;
 
@@ -26,8 +26,20 @@ typedef struct {
 
     ngx_stream_variable_value_t  *default_value;
     ngx_conf_t                   *cf;
+
+    ngx_hash_t                    binary_hash;
+    ngx_str_t                     include_name;
+    off_t                         include_size;
+    time_t                        include_mtime;
+    ngx_uint_t                    includes;
+    ngx_uint_t                    entries;
+
     unsigned                      hostnames:1;
     unsigned                      no_cacheable:1;
+    unsigned                      complex_values:1;
+    unsigned                      outside_entries:1;
+    unsigned                      allow_binary_include:1;
+    unsigned                      binary_include:1;
 } ngx_stream_map_conf_ctx_t;
 
 
@@ -39,12 +51,38 @@ typedef struct {
 } ngx_stream_map_ctx_t;
 
 
+typedef struct {
+    ngx_stream_variable_value_t  *value;
+    uintptr_t                     offset;
+} ngx_stream_map_binary_value_t;
+
+
+typedef struct {
+    ngx_stream_map_binary_value_t  *elts;
+    ngx_uint_t                      nelts;
+} ngx_stream_map_binary_values_t;
+
+
 static int ngx_libc_cdecl ngx_stream_map_cmp_dns_wildcards(const void *one,
     const void *two);
 static void *ngx_stream_map_create_conf(ngx_conf_t *cf);
 static char *ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_stream_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf);
+static char *ngx_stream_map_include(ngx_conf_t *cf, ngx_command_t *dummy,
+    void *conf, ngx_stream_map_conf_ctx_t *ctx, ngx_str_t *name);
+static ngx_int_t ngx_stream_map_include_binary_base(ngx_conf_t *cf,
+    ngx_stream_map_conf_ctx_t *ctx, ngx_str_t *name);
+static char *ngx_stream_map_drop_binary_base(ngx_conf_t *cf,
+    ngx_stream_map_conf_ctx_t *ctx);
+static void ngx_stream_map_create_binary_base(ngx_stream_map_conf_ctx_t *ctx,
+    ngx_hash_t *hash);
+static int ngx_libc_cdecl ngx_stream_map_cmp_values(const void *one,
+    const void *two);
+static uintptr_t ngx_stream_map_value_offset(void *value, void *data);
+#if (NGX_PCRE)
+static ngx_int_t ngx_stream_map_regex_set(ngx_conf_t *cf, ngx_stream_map_t *map);
+#endif
 
 
 static ngx_command_t  ngx_stream_map_commands[] = {
@@ -102,6 +140,30 @@ ngx_module_t  ngx_stream_map_module = {
 };
 
 
+typedef struct {
+    u_char    MAPBIN[6];
+    u_char    version;
+    u_char    ptr_size;
+    uint32_t  endianness;
+    uint32_t  crc32;
+    uint32_t  flags;
+    uint32_t  reserved;
+    int64_t   source_size;
+    int64_t   source_mtime;
+    uint64_t  default_value;
+} ngx_stream_map_header_t;
+
+
+#define NGX_STREAM_MAP_BINARY_HOSTNAMES  0x01
+#define NGX_STREAM_MAP_BINARY_VOLATILE   0x02
+
+
+static ngx_stream_map_header_t  ngx_stream_map_header = {
+    { 'M', 'A', 'P', 'B', 'I', 'N' }, 0, sizeof(void *), 0x12345678,
+    0, 0, 0, 0, 0, 0
+};
+
+
 static ngx_int_t
 ngx_stream_map_variable(ngx_stream_session_t *s, ngx_stream_variable_value_t *v,
     uintptr_t data)
@@ -264,8 +326,15 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ctx.default_value = NULL;
     ctx.cf = &save;
+    ngx_str_null(&ctx.include_name);
+    ctx.includes = 0;
+    ctx.entries = 0;
     ctx.hostnames = 0;
     ctx.no_cacheable = 0;
+    ctx.complex_values = 0;
+    ctx.outside_entries = 0;
+    ctx.allow_binary_include = 1;
+    ctx.binary_include = 0;
 
     save = *cf;
     cf->pool = pool;
@@ -297,7 +366,10 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     hash.name = "map_hash";
     hash.pool = cf->pool;
 
-    if (ctx.keys.keys.nelts) {
+    if (ctx.binary_include) {
+        map->map.hash.hash = ctx.binary_hash;
+
+    } else if (ctx.keys.keys.nelts) {
         hash.hash = &map->map.hash.hash;
         hash.temp_pool = NULL;
 
@@ -307,6 +379,21 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             ngx_destroy_pool(pool);
             return NGX_CONF_ERROR;
         }
+
+        if (ctx.allow_binary_include
+            && !ctx.outside_entries
+            && !ctx.complex_values
+            && ctx.entries > 10000
+            && ctx.includes == 1
+            && ctx.keys.dns_wc_head.nelts == 0
+            && ctx.keys.dns_wc_tail.nelts == 0
+#if (NGX_PCRE)
+            && ctx.regexes.nelts == 0
+#endif
+            )
+        {
+            ngx_stream_map_create_binary_base(&ctx, &map->map.hash.hash);
+        }
     }
 
     if (ctx.keys.dns_wc_head.nelts) {
@@ -354,6 +441,11 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     if (ctx.regexes.nelts) {
         map->map.regex = ctx.regexes.elts;
         map->map.nregex = ctx.regexes.nelts;
+
+        if (ngx_stream_map_regex_set(cf, &map->map) != NGX_OK) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
     }
 
 #endif
@@ -364,6 +456,33 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 }
 
 
+#if (NGX_PCRE)
+
+static ngx_int_t
+ngx_stream_map_regex_set(ngx_conf_t *cf, ngx_stream_map_t *map)
+{
+    ngx_str_t   *patterns;
+    ngx_uint_t   i;
+
+    if (map->nregex < 2) {
+        return NGX_OK;
+    }
+
+    patterns = ngx_palloc(cf->temp_pool, map->nregex * sizeof(ngx_str_t));
+    if (patterns == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < map->nregex; i++) {
+        patterns[i] = map->regex[i].regex->name;
+    }
+
+    return ngx_regex_set_create(cf, &map->regex_set, patterns, map->nregex);
+}
+
+#endif
+
+
 static int ngx_libc_cdecl
 ngx_stream_map_cmp_dns_wildcards(const void *one, const void *two)
 {
@@ -413,10 +532,21 @@ ngx_stream_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (ctx->binary_include) {
+        if (ngx_stream_map_drop_binary_base(cf, ctx) != NGX_CONF_OK) {
+            return NGX_CONF_ERROR;
+        }
+
+        value = cf->args->elts;
+    }
+
     if (ngx_strcmp(value[0].data, "include") == 0) {
-        return ngx_conf_include(cf, dummy, conf);
+        return ngx_stream_map_include(cf, dummy, conf, ctx, &value[1]);
     }
 
+    ctx->entries++;
+    ctx->outside_entries = 1;
+
     key = 0;
 
     for (i = 0; i < value[1].len; i++) {
@@ -492,6 +622,8 @@ ngx_stream_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
         var->data = (u_char *) cvp;
         var->valid = 0;
 
+        ctx->complex_values = 1;
+
     } else {
         var->len = v.len;
         var->data = v.data;
@@ -586,3 +718,460 @@ found:
 
     return NGX_CONF_ERROR;
 }
+
+
+static char *
+ngx_stream_map_include(ngx_conf_t *cf, ngx_command_t *dummy, void *conf,
+    ngx_stream_map_conf_ctx_t *ctx, ngx_str_t *name)
+{
+    char             *rv;
+    ngx_str_t         file;
+    ngx_file_info_t   fi;
+
+    if (ctx->outside_entries || ctx->includes) {
+        ctx->allow_binary_include = 0;
+    }
+
+    if (!ctx->allow_binary_include
+        || strpbrk((char *) name->data, "*?[") != NULL)
+    {
+        ctx->allow_binary_include = 0;
+        ctx->includes++;
+
+        return ngx_conf_include(cf, dummy, conf);
+    }
+
+    file.len = name->len + 4;
+    file.data = ngx_pnalloc(cf->temp_pool, name->len + 5);
+    if (file.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_sprintf(file.data, "%V.bin%Z", name);
+
+    if (ngx_conf_full_name(cf->cycle, &file, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, cf->log, 0, "include %s", file.data);
+
+    switch (ngx_stream_map_include_binary_base(cf, ctx, &file)) {
+    case NGX_OK:
+        return NGX_CONF_OK;
+    case NGX_ERROR:
+        return NGX_CONF_ERROR;
+    default:
+        break;
+    }
+
+    file.len -= 4;
+    file.data[file.len] = '\0';
+
+    ctx->include_name = file;
+
+    if (ngx_file_info(file.data, &fi) == NGX_FILE_ERROR) {
+        ctx->allow_binary_include = 0;
+
+    } else {
+        ctx->include_size = ngx_file_size(&fi);
+        ctx->include_mtime = ngx_file_mtime(&fi);
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, cf->log, 0, "include %s", file.data);
+
+    rv = ngx_conf_parse(cf, &file);
+
+    ctx->includes++;
+    ctx->outside_entries = 0;
+
+    return rv;
+}
+
+
+static ngx_int_t
+ngx_stream_map_include_binary_base(ngx_conf_t *cf,
+    ngx_stream_map_conf_ctx_t *ctx, ngx_str_t *name)
+{
+    u_char                       *base, *p, *last, ch;
+    size_t                        size, len;
+    ssize_t                       n;
+    uint32_t                      crc32;
+    ngx_err_t                     err;
+    ngx_int_t                     rc;
+    ngx_file_t                    file;
+    ngx_file_info_t               fi;
+    ngx_stream_map_header_t      *header;
+    ngx_stream_variable_value_t  *vv;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+    file.name = *name;
+    file.log = cf->log;
+
+    file.fd = ngx_open_file(name->data, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+        if (err != NGX_ENOENT) {
+            ngx_conf_log_error(NGX_LOG_CRIT, cf, err,
+                               ngx_open_file_n " \"%s\" failed", name->data);
+        }
+        return NGX_DECLINED;
+    }
+
+    base = NULL;
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
+                           ngx_fd_info_n " \"%s\" failed", name->data);
+        goto failed;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    len = sizeof(ngx_stream_map_header_t) + sizeof(ngx_stream_variable_value_t);
+
+    if (size < len) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "incompatible binary map base \"%s\"", name->data);
+        goto failed;
+    }
+
+    ch = name->data[name->len - 4];
+    name->data[name->len - 4] = '\0';
+
+    if (ngx_file_info(name->data, &fi) == NGX_FILE_ERROR) {
+        err = ngx_errno;
+        name->data[name->len - 4] = ch;
+
+        ngx_conf_log_error(NGX_LOG_CRIT, cf, err,
+                           ngx_file_info_n " \"%*s\" failed",
+                           name->len - 4, name->data);
+        goto failed;
+    }
+
+    name->data[name->len - 4] = ch;
+
+    base = ngx_palloc(ctx->keys.pool, size);
+    if (base == NULL) {
+        goto failed;
+    }
+
+    n = ngx_read_file(&file, base, size, 0);
+
+    if (n == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_CRIT, cf, ngx_errno,
+                           ngx_read_file_n " \"%s\" failed", name->data);
+        goto failed;
+    }
+
+    if ((size_t) n != size) {
+        ngx_conf_log_error(NGX_LOG_CRIT, cf, 0,
+            ngx_read_file_n " \"%s\" returned only %z bytes instead of %z",
+            name->data, n, size);
+        goto failed;
+    }
+
+    header = (ngx_stream_map_header_t *) base;
+
+    if (ngx_memcmp(&ngx_stream_map_header, header, 12) != 0) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "incompatible binary map base \"%s\"", name->data);
+        goto failed;
+    }
+
+    if (header->source_size != (int64_t) ngx_file_size(&fi)
+        || header->source_mtime != (int64_t) ngx_file_mtime(&fi))
+    {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "stale binary map base \"%s\"", name->data);
+        goto failed;
+    }
+
+    crc32 = ngx_crc32_long(base + sizeof(ngx_stream_map_header_t),
+                           size - sizeof(ngx_stream_map_header_t));
+
+    if (crc32 != header->crc32) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "CRC32 mismatch in binary map base \"%s\"",
+                           name->data);
+        goto failed;
+    }
+
+    p = base + sizeof(ngx_stream_map_header_t);
+    last = base + size;
+
+    for ( ;; ) {
+        if ((size_t) (last - p) < sizeof(ngx_stream_variable_value_t)) {
+            goto invalid;
+        }
+
+        vv = (ngx_stream_variable_value_t *) p;
+
+        if (vv->data == NULL) {
+            break;
+        }
+
+        len = ngx_align(sizeof(ngx_stream_variable_value_t) + vv->len,
+                        sizeof(void *));
+
+        if ((size_t) (last - p) < len
+            || (uintptr_t) vv->data
+               != (uintptr_t) (p - base) + sizeof(ngx_stream_variable_value_t))
+        {
+            goto invalid;
+        }
+
+        vv->data = base + (uintptr_t) vv->data;
+        p += len;
+    }
+
+    p += sizeof(ngx_stream_variable_value_t);
+
+    if (header->default_value >= (uint64_t) (p - base)) {
+        goto invalid;
+    }
+
+    if (ngx_hash_import(&ctx->binary_hash, base, p, last) != last) {
+        goto invalid;
+    }
+
+    ctx->include_name.len = name->len - 4;
+    ctx->include_name.data = ngx_pnalloc(cf->temp_pool, name->len - 3);
+    if (ctx->include_name.data == NULL) {
+        rc = NGX_ERROR;
+        goto done;
+    }
+
+    ngx_cpystrn(ctx->include_name.data, name->data, name->len - 3);
+
+    if (header->default_value) {
+        ctx->default_value = (ngx_stream_variable_value_t *)
+                                 (base + header->default_value);
+    }
+
+    if (header->flags & NGX_STREAM_MAP_BINARY_HOSTNAMES) {
+        ctx->hostnames = 1;
+    }
+
+    if (header->flags & NGX_STREAM_MAP_BINARY_VOLATILE) {
+        ctx->no_cacheable = 1;
+    }
+
+    ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                       "using binary map base \"%s\"", name->data);
+
+    ctx->includes++;
+    ctx->binary_include = 1;
+    rc = NGX_OK;
+
+    goto done;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                       "invalid binary map base \"%s\"", name->data);
+
+failed:
+
+    if (base) {
+        ngx_pfree(ctx->keys.pool, base);
+    }
+
+    rc = NGX_DECLINED;
+
+done:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, cf->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", name->data);
+    }
+
+    return rc;
+}
+
+
+static char *
+ngx_stream_map_drop_binary_base(ngx_conf_t *cf, ngx_stream_map_conf_ctx_t *ctx)
+{
+    char       *rv;
+    ngx_str_t  *value, args[2];
+
+    ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                       "binary map base of \"%V\" cannot be mixed "
+                       "with usual entries, using the source file",
+                       &ctx->include_name);
+
+    value = cf->args->elts;
+
+    args[0] = value[0];
+    args[1] = value[1];
+
+    ctx->binary_include = 0;
+    ctx->allow_binary_include = 0;
+    ctx->default_value = NULL;
+
+    rv = ngx_conf_parse(cf, &ctx->include_name);
+
+    ctx->outside_entries = 0;
+
+    value = cf->args->elts;
+
+    value[0] = args[0];
+    value[1] = args[1];
+    cf->args->nelts = 2;
+
+    return rv;
+}
+
+
+static void
+ngx_stream_map_create_binary_base(ngx_stream_map_conf_ctx_t *ctx,
+    ngx_hash_t *hash)
+{
+    u_char                          *p;
+    size_t                           size;
+    ngx_uint_t                       i, j, n;
+    ngx_file_mapping_t               fm;
+    ngx_stream_map_header_t         *header;
+    ngx_stream_variable_value_t     *vv, **vp;
+    ngx_stream_map_binary_value_t   *bv;
+    ngx_stream_map_binary_values_t   values;
+
+    n = 0;
+    size = sizeof(ngx_stream_map_header_t)
+           + sizeof(ngx_stream_variable_value_t);
+
+    for (i = 0; i < ctx->keys.hsize; i++) {
+        vp = ctx->values_hash[i].elts;
+
+        for (j = 0; vp && j < ctx->values_hash[i].nelts; j++) {
+            size += ngx_align(sizeof(ngx_stream_variable_value_t) + vp[j]->len,
+                              sizeof(void *));
+            n++;
+        }
+    }
+
+    size += ngx_hash_export_size(hash);
+
+    bv = ngx_palloc(ctx->keys.temp_pool,
+                    n * sizeof(ngx_stream_map_binary_value_t));
+    if (bv == NULL) {
+        return;
+    }
+
+    fm.name = ngx_pnalloc(ctx->keys.temp_pool, ctx->include_name.len + 5);
+    if (fm.name == NULL) {
+        return;
+    }
+
+    ngx_sprintf(fm.name, "%V.bin%Z", &ctx->include_name);
+
+    fm.size = size;
+    fm.log = ctx->cf->log;
+
+    ngx_log_error(NGX_LOG_NOTICE, fm.log, 0,
+                  "creating binary map base \"%s\"", fm.name);
+
+    if (ngx_create_file_mapping(&fm) != NGX_OK) {
+        return;
+    }
+
+    p = ngx_cpymem(fm.addr, &ngx_stream_map_header,
+                   sizeof(ngx_stream_map_header_t));
+
+    n = 0;
+
+    for (i = 0; i < ctx->keys.hsize; i++) {
+        vp = ctx->values_hash[i].elts;
+
+        for (j = 0; vp && j < ctx->values_hash[i].nelts; j++) {
+            bv[n].value = vp[j];
+            bv[n].offset = p - (u_char *) fm.addr;
+            n++;
+
+            vv = (ngx_stream_variable_value_t *) p;
+            *vv = *vp[j];
+            p += sizeof(ngx_stream_variable_value_t);
+            vv->data = (u_char *) (p - (u_char *) fm.addr);
+
+            p = ngx_cpymem(p, vp[j]->data, vp[j]->len);
+            p = ngx_align_ptr(p, sizeof(void *));
+        }
+    }
+
+    /* the file is zero-filled, so the terminating value is in place */
+
+    p += sizeof(ngx_stream_variable_value_t);
+
+    values.elts = bv;
+    values.nelts = n;
+
+    ngx_qsort(bv, n, sizeof(ngx_stream_map_binary_value_t),
+              ngx_stream_map_cmp_values);
+
+    (void) ngx_hash_export(hash, fm.addr, p, ngx_stream_map_value_offset,
+                           &values);
+
+    header = fm.addr;
+
+    header->flags = (ctx->hostnames ? NGX_STREAM_MAP_BINARY_HOSTNAMES : 0)
+                    | (ctx->no_cacheable ? NGX_STREAM_MAP_BINARY_VOLATILE : 0);
+    header->source_size = ctx->include_size;
+    header->source_mtime = ctx->include_mtime;
+
+    if (ctx->default_value) {
+        header->default_value = ngx_stream_map_value_offset(ctx->default_value,
+                                                          &values);
+    }
+
+    header->crc32 = ngx_crc32_long((u_char *) fm.addr
+                                       + sizeof(ngx_stream_map_header_t),
+                                   fm.size - sizeof(ngx_stream_map_header_t));
+
+    ngx_close_file_mapping(&fm);
+}
+
+
+static int ngx_libc_cdecl
+ngx_stream_map_cmp_values(const void *one, const void *two)
+{
+    ngx_stream_map_binary_value_t  *first, *second;
+
+    first = (ngx_stream_map_binary_value_t *) one;
+    second = (ngx_stream_map_binary_value_t *) two;
+
+    if ((uintptr_t) first->value < (uintptr_t) second->value) {
+        return -1;
+    }
+
+    return (uintptr_t) first->value > (uintptr_t) second->value;
+}
+
+
+static uintptr_t
+ngx_stream_map_value_offset(void *value, void *data)
+{
+    ngx_stream_map_binary_values_t  *values = data;
+
+    ngx_uint_t  lo, hi, mid;
+
+    lo = 0;
+    hi = values->nelts;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+
+        if (values->elts[mid].value == value) {
+            return values->elts[mid].offset;
+        }
+
+        if ((uintptr_t) values->elts[mid].value < (uintptr_t) value) {
+            lo = mid + 1;
+
+        } else {
+            hi = mid;
+        }
+    }
+
+    return 0;
+}
@@ -59,6 +59,13 @@ static ngx_conf_enum_t  ngx_stream_ssl_verify[] = {
 };
 
 
+static ngx_conf_post_t  ngx_stream_ssl_certificate_post =
+    { ngx_ssl_preload_certificate };
+
+static ngx_conf_post_t  ngx_stream_ssl_certificate_key_post =
+    { ngx_ssl_preload_certificate_key };
+
+
 static ngx_command_t  ngx_stream_ssl_commands[] = {
 
     { ngx_string("ssl_handshake_timeout"),
@@ -73,14 +80,14 @@ static ngx_command_t  ngx_stream_ssl_commands[] = {
       ngx_conf_set_str_array_slot,
       NGX_STREAM_SRV_CONF_OFFSET,
       offsetof(ngx_stream_ssl_conf_t, certificates),
-      NULL },
+      &ngx_stream_ssl_certificate_post },
 
     { ngx_string("ssl_certificate_key"),
       NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_str_array_slot,
       NGX_STREAM_SRV_CONF_OFFSET,
       offsetof(ngx_stream_ssl_conf_t, certificate_keys),
-      NULL },
+      &ngx_stream_ssl_certificate_key_post },
 
     { ngx_string("ssl_password_file"),
       NGX_STREAM_MAIN_CONF|NGX_STREAM_SRV_CONF|NGX_CONF_TAKE1,
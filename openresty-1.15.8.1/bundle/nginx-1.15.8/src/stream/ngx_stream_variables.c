@@ -916,12 +916,18 @@ ngx_stream_map_find(ngx_stream_session_t *s, ngx_stream_map_t *map,
     if (len && map->nregex) {
         ngx_int_t                n;
         ngx_uint_t               i;
+        ngx_regex_set_t         *set;
         ngx_stream_map_regex_t  *reg;
 
         reg = map->regex;
+        set = map->regex_set;
 
-        for (i = 0; i < map->nregex; i++) {
+        /* only the regexes whose literals are found are executed */
 
+        for (i = set ? ngx_regex_set_scan(set, match) : 0;
+             i < map->nregex;
+             i = set ? ngx_regex_set_next(set, i + 1) : i + 1)
+        {
             n = ngx_stream_regex_exec(s, reg[i].regex, match);
 
             if (n == NGX_OK) {
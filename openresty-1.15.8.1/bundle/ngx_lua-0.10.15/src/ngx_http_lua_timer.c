@@ -787,7 +787,11 @@ ngx_http_lua_abort_pending_timers(ngx_event_t *ev)
     ngx_int_t                    i, n;
     ngx_event_t                **events;
     ngx_connection_t            *c, *saved_c = NULL;
+#if (NGX_TIMER_WHEEL)
+    ngx_rbtree_node_t           *cur;
+#else
     ngx_rbtree_node_t           *cur, *prev, *next, *sentinel, *temp;
+#endif
     ngx_http_lua_timer_ctx_t    *tctx;
     ngx_http_lua_main_conf_t    *lmcf;
 
@@ -828,6 +832,35 @@ ngx_http_lua_abort_pending_timers(ngx_event_t *ev)
 
     /* expire pending timers immediately */
 
+#if (NGX_TIMER_WHEEL)
+
+    events = ngx_pcalloc(ngx_cycle->pool,
+                         lmcf->pending_timers * sizeof(ngx_event_t));
+    if (events == NULL) {
+        return;
+    }
+
+    n = 0;
+
+    for (cur = ngx_event_timer_next(NULL);
+         cur && n < lmcf->pending_timers;
+         cur = ngx_event_timer_next(cur))
+    {
+        ev = (ngx_event_t *) ((char *) cur - offsetof(ngx_event_t, timer));
+
+        if (ev->handler == ngx_http_lua_timer_handler) {
+            events[n++] = ev;
+        }
+    }
+
+    if (n < lmcf->pending_timers) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
+                      "lua pending timer counter got out of sync: %i",
+                      lmcf->pending_timers);
+    }
+
+#else
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     cur = ngx_event_timer_rbtree.root;
@@ -905,6 +938,8 @@ ngx_http_lua_abort_pending_timers(ngx_event_t *ev)
     /* restore the old tree root's parent */
     ngx_event_timer_rbtree.root->parent = temp;
 
+#endif
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                    "lua found %i pending timers to be aborted prematurely",
                    n);
@@ -912,7 +947,7 @@ ngx_http_lua_abort_pending_timers(ngx_event_t *ev)
     for (i = 0; i < n; i++) {
         ev = events[i];
 
-        ngx_rbtree_delete(&ngx_event_timer_rbtree, &ev->timer);
+        ngx_event_timer_delete(&ev->timer);
 
 #if (NGX_DEBUG)
         ev->timer.left = NULL;
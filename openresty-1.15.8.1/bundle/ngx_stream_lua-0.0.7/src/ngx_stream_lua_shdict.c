@@ -521,7 +521,7 @@ ngx_stream_lua_shdict_get_helper(lua_State *L, int get_stale)
         return 2;
     }
 
-    hash = ngx_crc32_short(key.data, key.len);
+    hash = ngx_crc32c(key.data, key.len);
 
 #if (NGX_DEBUG)
     ngx_log_debug2(NGX_LOG_DEBUG_STREAM, ctx->log, 0,
@@ -997,7 +997,7 @@ ngx_stream_lua_shdict_set_helper(lua_State *L, int flags)
         return 2;
     }
 
-    hash = ngx_crc32_short(key.data, key.len);
+    hash = ngx_crc32c(key.data, key.len);
 
     value_type = lua_type(L, 3);
 
@@ -1337,7 +1337,7 @@ ngx_stream_lua_shdict_incr(lua_State *L)
         return 2;
     }
 
-    hash = ngx_crc32_short(key.data, key.len);
+    hash = ngx_crc32c(key.data, key.len);
 
     value = luaL_checknumber(L, 3);
 
@@ -1546,7 +1546,7 @@ ngx_stream_lua_shared_dict_get(ngx_shm_zone_t *zone, u_char *key_data,
         return NGX_ERROR;
     }
 
-    hash = ngx_crc32_short(key_data, key_len);
+    hash = ngx_crc32c(key_data, key_len);
 
     ctx = zone->data;
 
@@ -1704,7 +1704,7 @@ ngx_stream_lua_shdict_push_helper(lua_State *L, int flags)
         return 2;
     }
 
-    hash = ngx_crc32_short(key.data, key.len);
+    hash = ngx_crc32c(key.data, key.len);
 
     value_type = lua_type(L, 3);
 
@@ -1998,7 +1998,7 @@ ngx_stream_lua_shdict_pop_helper(lua_State *L, int flags)
         return 2;
     }
 
-    hash = ngx_crc32_short(key.data, key.len);
+    hash = ngx_crc32c(key.data, key.len);
 
     ngx_shmtx_lock(&ctx->shpool->mutex);
 
@@ -2167,7 +2167,7 @@ ngx_stream_lua_shdict_llen(lua_State *L)
         return 2;
     }
 
-    hash = ngx_crc32_short(key.data, key.len);
+    hash = ngx_crc32c(key.data, key.len);
 
     ngx_shmtx_lock(&ctx->shpool->mutex);
 
@@ -2281,7 +2281,7 @@ ngx_stream_lua_ffi_shdict_store(ngx_shm_zone_t *zone, int op, u_char *key,
 
     *forcible = 0;
 
-    hash = ngx_crc32_short(key, key_len);
+    hash = ngx_crc32c(key, key_len);
 
     switch (value_type) {
 
@@ -2542,7 +2542,7 @@ ngx_stream_lua_ffi_shdict_get(ngx_shm_zone_t *zone, u_char *key,
     ctx = zone->data;
     name = ctx->name;
 
-    hash = ngx_crc32_short(key, key_len);
+    hash = ngx_crc32c(key, key_len);
 
 #if (NGX_DEBUG)
     ngx_log_debug3(NGX_LOG_DEBUG_STREAM, ctx->log, 0,
@@ -2688,7 +2688,7 @@ ngx_stream_lua_ffi_shdict_incr(ngx_shm_zone_t *zone, u_char *key,
 
     *forcible = 0;
 
-    hash = ngx_crc32_short(key, key_len);
+    hash = ngx_crc32c(key, key_len);
 
     dd("looking up key %.*s in shared dict %.*s", (int) key_len, key,
        (int) ctx->name.len, ctx->name.data);
@@ -2959,7 +2959,7 @@ ngx_stream_lua_ffi_shdict_get_ttl(ngx_shm_zone_t *zone, u_char *key,
     ngx_stream_lua_shdict_node_t        *sd;
 
     ctx = zone->data;
-    hash = ngx_crc32_short(key, key_len);
+    hash = ngx_crc32c(key, key_len);
 
     ngx_shmtx_lock(&ctx->shpool->mutex);
 
@@ -3004,7 +3004,7 @@ ngx_stream_lua_ffi_shdict_set_expire(ngx_shm_zone_t *zone, u_char *key,
     }
 
     ctx = zone->data;
-    hash = ngx_crc32_short(key, key_len);
+    hash = ngx_crc32c(key, key_len);
 
     ngx_shmtx_lock(&ctx->shpool->mutex);
 